@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <p24fxxxx.h>
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Aes.h"
+
+#ifdef USE_AES
+//AES-128 in CTR mode over the image packed 3 bytes per instruction, the
+//phantom bytes left out. Counter block n is the nonce followed by n as a
+//64-bit big endian number, and encrypts to the keystream for packed bytes
+//16n to 16n+15, so a row's keystream depends on its address alone. Only
+//the forward cipher is needed, and AesPrefetch makes the next row's
+//keystream while WriteMem waits for this one.
+
+#ifdef USE_STATS
+extern BL_STATS stats;                                                              //Keystream blocks and their cycles are counted for RD_STATS
+#endif
+
+//FIPS-197 S-box, read through PSV
+static const BYTE aesSbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+
+static const WORD aesKey[AES_BLOCK_SIZE/2] = AES_KEY;                               //Low byte first, 0x0100 is key bytes 00 01
+static BYTE aesRoundKeys[(AES_ROUNDS + 1)*AES_BLOCK_SIZE];                          //Key schedule, made once by AesInit
+static BYTE aesNonce[AES_NONCE_SIZE];
+static BYTE aesStream[AES_ROW_BLOCKS*AES_BLOCK_SIZE];                               //Keystream of the row at aesStreamAddr
+static DWORD aesStreamAddr;
+static BYTE aesStreamBlocks;                                                        //Blocks of it made so far
+
+#define AES_XTIME(x)	((BYTE)(((x) << 1) ^ ((x) >> 7)*0x1B))	//Times 2 in GF(2^8), no branch
+
+/********************************************************************
+* Function: 	void AesInit(void)
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Nonce all zeros, no keystream made.
+*
+* Overview: 	Expands AES_KEY into the 11 round keys, so a block
+*				costs no key schedule.
+*
+* Note:		 	Called before anything can reach WriteMem, which runs
+*				AesPrefetch.
+********************************************************************/
+void AesInit(void)
+{
+	BYTE *rk = aesRoundKeys;
+	BYTE t0, t1, t2, t3;
+	BYTE rcon;
+	WORD i;
+
+	for(i = 0; i < AES_BLOCK_SIZE/2; i++) {
+		rk[2*i] = (BYTE)aesKey[i];
+		rk[2*i+1] = (BYTE)(aesKey[i] >> 8);
+	}
+
+	rcon = 0x01;
+	for(i = AES_BLOCK_SIZE; i < sizeof(aesRoundKeys); i += 4) {
+		t0 = rk[i-4];
+		t1 = rk[i-3];
+		t2 = rk[i-2];
+		t3 = rk[i-1];
+		if(i % AES_BLOCK_SIZE == 0) {                                               //RotWord, SubWord and Rcon for the first word of a round key
+			BYTE t = t0;
+
+			t0 = aesSbox[t1] ^ rcon;
+			t1 = aesSbox[t2];
+			t2 = aesSbox[t3];
+			t3 = aesSbox[t];
+			rcon = AES_XTIME(rcon);
+		}
+		rk[i] = rk[i-AES_BLOCK_SIZE] ^ t0;
+		rk[i+1] = rk[i-AES_BLOCK_SIZE+1] ^ t1;
+		rk[i+2] = rk[i-AES_BLOCK_SIZE+2] ^ t2;
+		rk[i+3] = rk[i-AES_BLOCK_SIZE+3] ^ t3;
+	}
+
+	for(i = 0; i < AES_NONCE_SIZE; i++) {
+		aesNonce[i] = 0;
+	}
+	aesStreamBlocks = 0;
+}
+
+/********************************************************************
+* Function: 	void AesSetNonce(BYTE * nonce)
+*
+* Precondition: None.
+*
+* Input: 		nonce - AES_NONCE_SIZE bytes, as SET_NONCE sent them
+*
+* Output:		None.
+*
+* Side Effects:	Keystream made for the old nonce is dropped.
+*
+* Overview: 	Sets the high half of the counter blocks.
+*
+* Note:		 	None.
+********************************************************************/
+void AesSetNonce(BYTE * nonce)
+{
+	BYTE i;
+
+	for(i = 0; i < AES_NONCE_SIZE; i++) {
+		aesNonce[i] = nonce[i];
+	}
+	aesStreamBlocks = 0;
+}
+
+/********************************************************************
+* Function: 	void AesEncrypt(BYTE * block)
+*
+* Precondition: AesInit called.
+*
+* Input: 		block - AES_BLOCK_SIZE bytes
+*
+* Output:		None.
+*
+* Side Effects:	block is replaced by its ciphertext.
+*
+* Overview: 	The AES-128 cipher, FIPS-197, a byte at a time.
+*				SubBytes and ShiftRows are one pass of table reads,
+*				MixColumns and AddRoundKey one pass per column, with
+*				the doubling done by AES_XTIME.
+*
+* Note:		 	No table or branch depends on the data but the S-box.
+********************************************************************/
+void AesEncrypt(BYTE * block)
+{
+	BYTE s[AES_BLOCK_SIZE];
+	BYTE *rk = aesRoundKeys;
+	BYTE a0, a1, a2, a3, t;
+	BYTE round;
+	BYTE c;
+
+	for(c = 0; c < AES_BLOCK_SIZE; c++) {
+		block[c] ^= rk[c];
+	}
+
+	for(round = 1; round <= AES_ROUNDS; round++) {
+		rk += AES_BLOCK_SIZE;
+		s[0] = aesSbox[block[0]];                                                   //Bytes are column by column, row r moves r columns left
+		s[1] = aesSbox[block[5]];
+		s[2] = aesSbox[block[10]];
+		s[3] = aesSbox[block[15]];
+		s[4] = aesSbox[block[4]];
+		s[5] = aesSbox[block[9]];
+		s[6] = aesSbox[block[14]];
+		s[7] = aesSbox[block[3]];
+		s[8] = aesSbox[block[8]];
+		s[9] = aesSbox[block[13]];
+		s[10] = aesSbox[block[2]];
+		s[11] = aesSbox[block[7]];
+		s[12] = aesSbox[block[12]];
+		s[13] = aesSbox[block[1]];
+		s[14] = aesSbox[block[6]];
+		s[15] = aesSbox[block[11]];
+
+		if(round == AES_ROUNDS) {                                                   //The last round has no MixColumns
+			for(c = 0; c < AES_BLOCK_SIZE; c++) {
+				block[c] = s[c] ^ rk[c];
+			}
+			break;
+		}
+
+		for(c = 0; c < AES_BLOCK_SIZE; c += 4) {
+			a0 = s[c];
+			a1 = s[c+1];
+			a2 = s[c+2];
+			a3 = s[c+3];
+			t = a0 ^ a1 ^ a2 ^ a3;
+			block[c] = a0 ^ t ^ AES_XTIME(a0 ^ a1) ^ rk[c];                         //2*a0 + 3*a1 + a2 + a3
+			block[c+1] = a1 ^ t ^ AES_XTIME(a1 ^ a2) ^ rk[c+1];
+			block[c+2] = a2 ^ t ^ AES_XTIME(a2 ^ a3) ^ rk[c+2];
+			block[c+3] = a3 ^ t ^ AES_XTIME(a3 ^ a0) ^ rk[c+3];
+		}
+	}
+}
+
+/********************************************************************
+* Function: 	static void AesStreamBlock(void)
+*
+* Precondition: AesInit called, fewer than AES_ROW_BLOCKS made.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	One more block of aesStream.
+*
+* Overview: 	Encrypts the next counter block of the row at
+*				aesStreamAddr. Its number is the block's place in the
+*				packed image, 3 bytes per instruction from address 0.
+*
+* Note:		 	None.
+********************************************************************/
+static void AesStreamBlock(void)
+{
+	BYTE *block = &aesStream[aesStreamBlocks*AES_BLOCK_SIZE];
+	DWORD_VAL counter;
+	BYTE i;
+	#ifdef USE_STATS
+	DWORD start = StatsClock();
+	#endif
+
+	counter.Val = aesStreamAddr/(PM_ROW_SIZE/2)*AES_ROW_BLOCKS + aesStreamBlocks;
+	for(i = 0; i < AES_NONCE_SIZE; i++) {
+		block[i] = aesNonce[i];
+	}
+	block[8] = 0;                                                                   //Flash ends well short of 2^32 blocks
+	block[9] = 0;
+	block[10] = 0;
+	block[11] = 0;
+	block[12] = counter.v[3];
+	block[13] = counter.v[2];
+	block[14] = counter.v[1];
+	block[15] = counter.v[0];
+	AesEncrypt(block);
+	aesStreamBlocks++;
+
+	#ifdef USE_STATS
+	stats.aesBlocks++;
+	stats.aesCycles += StatsClock() - start;
+	#endif
+}
+
+/********************************************************************
+* Function: 	void AesCtrRow(BYTE * row, DWORD rowAddr)
+*
+* Precondition: AesInit called, the nonce set.
+*
+* Input: 		row - the row, 4 bytes per instruction
+*				rowAddr - address of its first instruction
+*
+* Output:		None.
+*
+* Side Effects:	Starts the keystream of the next row.
+*
+* Overview: 	Decrypts a row in place, encrypting is the same. The
+*				keystream is taken from what AesPrefetch made while
+*				the row before was written, only the blocks it did
+*				not get to are made here.
+*
+* Note:		 	The phantom bytes are left as they are.
+********************************************************************/
+void AesCtrRow(BYTE * row, DWORD rowAddr)
+{
+	BYTE *key;
+	WORD i;
+	#ifdef USE_STATS
+	DWORD start = StatsClock();
+	#endif
+
+	if(rowAddr != aesStreamAddr) {                                                  //First row, or not the one after the last
+		aesStreamAddr = rowAddr;
+		aesStreamBlocks = 0;
+	}
+	while(aesStreamBlocks < AES_ROW_BLOCKS) {
+		AesStreamBlock();
+	}
+
+	key = aesStream;
+	for(i = 0; i < PM_ROW_SIZE; i += PM_INSTR_SIZE) {
+		row[i] ^= key[0];
+		row[i+1] ^= key[1];
+		row[i+2] ^= key[2];
+		key += 3;
+	}
+
+	aesStreamAddr = rowAddr + PM_ROW_SIZE/2;                                        //Rows mostly come in address order
+	aesStreamBlocks = 0;
+
+	#ifdef USE_STATS
+	stats.aesWait += StatsClock() - start;
+	#endif
+}
+
+/********************************************************************
+* Function: 	void AesPrefetch(void)
+*
+* Precondition: AesInit called.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	One more block of the next row's keystream, if it
+*				is not all made yet.
+*
+* Overview: 	Work for the time an NVM operation leaves the CPU
+*				waiting, see PrefetchWriteMem. A block at a time,
+*				so the wait ends at most one block late.
+*
+* Note:		 	On a part that stalls the CPU for the whole row
+*				write this never runs and AesCtrRow does it all.
+********************************************************************/
+void AesPrefetch(void)
+{
+	if(aesStreamBlocks < AES_ROW_BLOCKS) {
+		AesStreamBlock();
+	}
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BOOTCONFIG_H
+#define BOOTCONFIG_H
+
+//Macros only: p24FJ256GB206.gld includes this file too, so the linker
+//script's program region ends where BOOT_ADDR_HI does for the same
+//switches. Sizes behind each BOOT_ADDR_HI are in README.md, Code size.
+
+//Bootloader feature configuration
+#define USE_BOOT_PROTECT                //Use BL block protection
+#define USE_RUNAWAY_PROTECT             //Provide runaway code protection using program flow
+//#define USE_CONFIGWORD_PROTECT	//Protect last page from writes/erases
+//#define USE_VECTOR_PROTECT            //Use Reset and IVT protection
+//#define USE_HI_SPEED_BRG              //Use BRGH=1, UART high speed mode
+//#define USE_WORKAROUNDS               //UART workarounds for device errata
+//#define USE_AUTOBAUD                    //Use hardware autobaud feature
+//#define USE_AES                       //AES-128 CTR: WritePM decrypts every row, SET_NONCE starts each image, see Aes.c
+//#define USE_SIGN                      //ECDSA P-256 image signature, VERIFY_OK commits only a signed image, see Sign.c
+//#define USE_RESET_SAVE                //Restores the reset vector without using USE_BOOT_PROTECT
+#define USE_UART_ISR                    //Use interrupt driven UART with RX/TX ring buffers
+#define USE_WINDOW                      //Sliding window transfers with sequence numbers, needs USE_UART_ISR
+//#define USE_LARGE_PACKETS             //Multi-page packets with a 16-bit length, enabled per SESSION
+#define USE_VERIFY_RANGE                //VERIFY_OK commits the timeout only after a matching VERIFY_RANGE
+//#define USE_LZ                        //WT_FLASH_LZ, rows from an LZ compressed stream
+#define USE_BLANK_CHECK                 //ER_FLASH skips blank pages and reports erased/skipped counts
+//#define USE_BAUD_SWITCH               //SET_BAUD moves to a faster rate, confirmed by a round trip
+//#define USE_FRAME_CRC                 //CRC-16 or CRC-32 instead of the checksum, enabled per SESSION
+//#define USE_COBS                      //COBS framing, at most 1 byte in 254 instead of DLE stuffing, enabled per SESSION
+//#define USE_STREAM                    //RD_STREAM, a flash range sent back as a run of CRC checked frames
+//#define USE_AUTO_ERASE                //WT_FLASH erases each page the first time a session writes to it, enabled per SESSION
+//#define USE_BATCH                     //BATCH, erases, rows, range checks and VERIFY_OK run from one frame
+//#define USE_DUAL_SLOT                 //A/B application slots, a new image goes live only once verified
+//#define USE_FAST_BOOT                 //Run a verified application at once, skipping the entry delay
+//#define USE_MULTIDROP                 //RS-485 bus: node address in every frame, broadcast frames go unanswered
+//#define USE_JOURNAL                   //Progress journal in flash, an update cut short resumes where it stopped
+//#define USE_STATS                     //RD_STATS performance counters, Timer2/3 clocks the waits
+//#define USE_USB_CDC                   //Talk USB CDC instead of the UART, needs the MLA USB device stack
+
+#define BOOT_ADDR_LOW 		0x400	//start of BL protection area
+#if defined(USE_SIGN) && defined(USE_AES)
+	#define BOOT_ADDR_HI  	0x33FF	//end of BL protection area, the application from 0x3400
+#elif defined(USE_SIGN)
+	#define BOOT_ADDR_HI  	0x2FFF	//end of BL protection area, the application from 0x3000
+#elif defined(USE_AES)
+	#define BOOT_ADDR_HI  	0x27FF	//end of BL protection area, the application from 0x2800
+#elif (defined(USE_LARGE_PACKETS) || defined(USE_LZ) || defined(USE_BAUD_SWITCH) || defined(USE_FRAME_CRC) || \
+	   defined(USE_COBS) || defined(USE_STREAM) || defined(USE_AUTO_ERASE) || defined(USE_BATCH) || \
+	   defined(USE_DUAL_SLOT) || defined(USE_FAST_BOOT) || defined(USE_MULTIDROP) || defined(USE_JOURNAL) || \
+	   defined(USE_STATS))
+	#define BOOT_ADDR_HI  	0x23FF	//end of BL protection area, the application from 0x2400
+#else
+	#define BOOT_ADDR_HI  	0x13FF	//end of BL protection area, the application from 0x1400 as before
+#endif
+
+#endif /*BOOTCONFIG_H*/
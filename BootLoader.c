@@ -49,6 +49,21 @@
 #include <GenericTypeDefs.h>
 #include "BootLoader.h"
 #include "Memory.h"
+#include "Uart.h"
+#include "Transport.h"
+#include "Crc.h"
+#include "Lz.h"
+#include "Aes.h"
+#include "Sha256.h"
+#include "Sign.h"
+
+#ifdef USE_STATS                                                                    //Every NVM operation is timed, see StatsWriteMem
+#define WriteMem(cmd)		StatsWriteMem(cmd)
+#define Erase(hi, lo, cmd)	StatsErase(hi, lo, cmd)
+#endif
+#if ((defined(USE_AES) || defined(USE_SIGN)) && !defined(USE_STATS))                //A write makes keystream or hashes while it waits, see PrefetchWriteMem
+#define WriteMem(cmd)		PrefetchWriteMem(cmd)
+#endif
 
 //Globals ********************************
 WORD responseBytes;                                                                 //Number of bytes in command response
@@ -64,7 +79,138 @@ volatile WORD keyTest1 = 0x0000;
 volatile WORD keyTest2 = 0xAAAA;
 #endif
 
-BYTE buffer[MAX_PACKET_SIZE+1];                                                     //Transmit/Recieve Buffer
+BYTE buffer[MAX_PACKET_SIZE+MAX_CHECK_SIZE];                                        //Transmit/Recieve Buffer
+BYTE rxBlock[TRANSPORT_BLOCK_SIZE];                                                 //Bytes taken from the transport, not yet parsed
+WORD rxBlockPos;
+WORD rxBlockLen;
+BYTE txBlock[TRANSPORT_BLOCK_SIZE];                                                 //Response bytes not yet handed to the transport
+WORD txBlockLen;
+
+#ifdef USE_WINDOW                                                                   //Sliding window state
+BYTE windowSize = 1;                                                                //Frames the host may have in flight, 1 = AN851 stop-and-wait
+BYTE rxSeq;                                                                         //Sequence number expected next
+BYTE txSeq;                                                                         //Sequence number of the frame being answered
+BYTE nakSent;                                                                       //NAK already sent for rxSeq
+BYTE duplicate;                                                                     //Frame was handled before, its ack was lost
+#endif
+
+#ifdef USE_VERIFY_RANGE
+BYTE verifyState = VERIFY_NONE;                                                     //Gates VERIFY_OK
+BYTE unverifiedRows[(VERIFY_ROWS + 7)/8];                                           //A bit for each row written and not yet covered by a matching range
+#endif
+
+#if (defined(USE_LZ) || defined(USE_BATCH))
+WORD packetLength;                                                                  //Bytes in buffer, sequence number and checksum included
+#endif
+
+#ifdef USE_BATCH
+BYTE batchResult[BATCH_MAX_OPS*BATCH_RESULT_SIZE];                                  //Sub-command results, buffer still holds the ones to come
+#endif
+
+#ifdef USE_LZ
+BYTE lzRow[PM_ROW_SIZE];                                                            //A WT_FLASH_LZ row decoded for WritePM
+#endif
+
+const PM_REGION protectRegions[] = {                                                //Flash WritePM leaves alone, see RowProtected
+	#ifdef USE_VECTOR_PROTECT
+	{0, VECTOR_SECTION},                                                            //Reset vector and IVTs
+	#endif
+	#ifdef USE_BOOT_PROTECT
+	{BOOT_ADDR_LOW, BOOT_ADDR_HI + 1},                                              //Bootloader
+	#endif
+	#ifdef USE_JOURNAL
+	{JOURNAL_ADDR, JOURNAL_ADDR + PM_PAGE_SIZE/2},                                  //The journal is the bootloader's own
+	#endif
+	#ifdef USE_CONFIGWORD_PROTECT
+	{CONFIG_START & 0xFFFC00, 0x1000000},                                           //Last page
+	#endif
+	{0, 0}                                                                          //End of the table
+};
+
+//BOOT_ADDR_HI + 1 as a symbol: the linker script checks that its program
+//region, which holds this code, ends where the protection does
+#define BOOT_STR(x)		#x
+#define BOOT_XSTR(x)	BOOT_STR(x)
+__asm__(".global __BOOT_END\n\t.equ __BOOT_END, " BOOT_XSTR(BOOT_ADDR_HI) " + 1");
+
+//WritePM rows: an instruction of a row held 4 bytes each, low byte first
+#define IN_ROW(addr, rowAddr)		((DWORD)(addr) - (rowAddr) < PM_ROW_SIZE/2)	//Unsigned, so also false below the row
+#define ROW_INSTR(row, rowAddr, addr)	((row) + ((DWORD)(addr) - (rowAddr)) * 2)
+#define ROW_GET(p, d)		((d).v[0] = (p)[0], (d).v[1] = (p)[1], (d).v[2] = (p)[2], (d).v[3] = (p)[3])
+#define ROW_SET(p, d)		((p)[0] = (d).v[0], (p)[1] = (d).v[1], (p)[2] = (d).v[2], (p)[3] = (d).v[3])
+#if (defined(USE_FAST_BOOT) && !defined(USE_DUAL_SLOT))
+#define FIXUP_END			(APP_HEADER_ADDR + 2*APP_HEADER_WORDS)	//Rows from here on need no RowFixup
+#else
+#define FIXUP_END			0x200	//Reset vector, USER_PROG_RESET, DELAY_TIME_ADDR and the AIVT
+#endif
+
+#ifdef USE_BAUD_SWITCH
+const DWORD baudRates[BAUD_SWITCH_COUNT] = {BAUD_SWITCH_1, BAUD_SWITCH_2, BAUD_SWITCH_3, BAUD_SWITCH_4};
+const WORD baudRegs[BAUD_SWITCH_COUNT] = {BAUD_REG(BAUD_SWITCH_1, 4), BAUD_REG(BAUD_SWITCH_2, 4),
+										  BAUD_REG(BAUD_SWITCH_3, 4), BAUD_REG(BAUD_SWITCH_4, 4)};
+const BYTE baudConfirm[] = BAUD_CONFIRM_BYTES;
+BYTE baudPending;                                                                   //Table index + 1 of an accepted SET_BAUD
+#endif
+
+#ifdef USE_LARGE_PACKETS
+BYTE largePackets;                                                                  //Frames carry a 16-bit length
+#endif
+#if (defined(USE_LARGE_PACKETS) || defined(USE_COBS))
+BYTE lengthHi;                                                                      //High byte of the length of the current frame, 0 without large packets
+#endif
+
+#ifdef USE_FRAME_CRC
+BYTE crcBytes;                                                                      //CRC size agreed by SESSION, 0 for the checksum
+BYTE checkBytes;                                                                    //Checksum or CRC bytes at the end of the frame in buffer
+#define CHECK_BYTES		checkBytes
+#else
+#define CHECK_BYTES		1
+#endif
+
+#ifdef USE_COBS
+BYTE cobsFraming;                                                                   //COBS frames accepted, agreed by SESSION
+BYTE cobsFrame;                                                                     //Frame being answered was COBS, the reply goes the same way
+BYTE cobsOpen;                                                                      //STX that ended the last frame received opens the next
+BYTE cobsSent;                                                                      //Last byte sent was the STX that ended a COBS frame
+#endif
+
+#ifdef USE_DUAL_SLOT
+BYTE activeSlot = SLOT_NONE;                                                        //Slot the vector page points at
+BYTE targetSlot;                                                                    //Slot WritePM and ErasePM may change
+DWORD_VAL slotEnd;                                                                  //Matching VERIFY_RANGE from the target base, 0 if none
+DWORD_VAL slotCrc;
+#define IN_TARGET(addr)		((DWORD)(addr) - SLOT_BASE(targetSlot) < SLOT_SIZE)	//Unsigned, so also false below the base
+#define OTHER_PAGE(page)	((page) == SLOT_RECORD_ADDR ? SLOT_RECORD_ADDR + PM_PAGE_SIZE/2 : SLOT_RECORD_ADDR)
+#endif
+
+#ifdef USE_FAST_BOOT
+DWORD bootMagic BL_PERSISTENT;                                                      //BOOT_MAGIC from the application: stay in the bootloader
+#ifndef USE_DUAL_SLOT
+DWORD_VAL headerStart;                                                              //Span of the matching VERIFY_RANGEs, headerEnd 0 if none
+DWORD_VAL headerEnd;
+#endif
+#endif
+
+#ifdef USE_MULTIDROP
+BYTE nodeAddr;                                                                      //This node, NODE_ADDRESS or the address straps
+BYTE frameAddr;                                                                     //Address byte of the frame in buffer
+#endif
+
+#ifdef USE_JOURNAL
+WORD journalNext;                                                                   //Word the next entry goes to, 0 with no journal open
+#endif
+
+#ifdef USE_AUTO_ERASE
+BYTE autoErase;                                                                     //WT_FLASH erases pages first, agreed by SESSION
+#endif
+#ifdef USE_ERASED_PAGES
+BYTE erasedPages[(AUTO_ERASE_PAGES + 7)/8];                                         //A bit for each page erased since the SESSION or SIGNATURE
+#endif
+
+#ifdef USE_STATS
+BL_STATS stats;                                                                     //Performance counters, read with RD_STATS
+BYTE statsClock;                                                                    //Timer2/3 is free running for the counters
+#endif
 
 /********************************************************************
 * Function: 	void BootLoader()
@@ -85,6 +231,10 @@ void BootLoader(void)
 {
 	DWORD_VAL delay;
 
+	#ifdef USE_AES
+	AesInit();                                                                      //Key schedule, before anything calls WriteMem
+	#endif
+
 	sourceAddr.Val = DELAY_TIME_ADDR;                                               //Setup bootloader entry delay, Bootloader timer address
 	delay.Val = ReadLatch(sourceAddr.word.HW, sourceAddr.word.LW);                  //Read BL timeout
 
@@ -94,8 +244,24 @@ void BootLoader(void)
 	if(userReset.Val == 0xFFFFFF) {                                                 //Prevent bootloader lockout - if no user reset vector, reset to BL start
 		userReset.Val = BOOT_ADDR_LOW;
 	}
+	userTimeout.Val = DEFAULT_DELAY;                                                //Unless the update sends DELAY_TIME_ADDR
+	#ifdef USE_DUAL_SLOT
+	delay.Val = SlotBoot();                                                         //The slot record has both instead
+	if(activeSlot != SLOT_NONE) {
+		userTimeout.Val = delay.Val;                                                //Kept by an update that does not send DELAY_TIME_ADDR
+	}
+	#endif
 	userResetRead = 0;
-    delay.Val = 2;                                                                  //Set to 2 Seconds as default
+
+	#ifdef USE_FAST_BOOT
+	if(!BootRequested() && AppValid()) {                                            //Verified image and nobody asking for the bootloader
+		ResetDevice(userReset.Val);                                                 //No delay, the UART was never set up
+	}
+	#endif
+
+	#ifdef USE_JOURNAL
+	JournalInit();                                                                  //Pick up the journal of an update cut short
+	#endif
 
 	if(delay.v[0] == 0) {                                                           //If timeout is zero, check reset state.
                                                                                     //If device is returning from reset, BL is disabled call user code
@@ -121,27 +287,15 @@ void BootLoader(void)
 		T2CONbits.TON=1;                                                            //Enable timer
 	}
 
-	#ifdef DEV_HAS_PPS                                                              //If using a part with PPS, map the UART I/O
-		ioMap();
-	#endif
-
-	#ifdef UTX_ANA                                                                  //Configure UART pins to be digital I/O.
-		UTX_ANA = 1;
+	#ifdef USE_MULTIDROP
+	#ifdef NODE_ADDRESS_PINS
+	nodeAddr = NODE_ADDRESS_PINS();
+	#else
+	nodeAddr = NODE_ADDRESS;
 	#endif
-	#ifdef URX_ANA
-		URX_ANA = 1;
 	#endif
 
-    UxMODEbits.UARTEN = 1;                                                          //SETUP UART COMMS: No parity, one stop bit, autobaud, polled, Enable uart
-    #ifdef USE_AUTOBAUD
-	    UxMODEbits.ABAUD = 1;                                                       //Use autobaud
-    #else
-        UxBRG = BAUDRATEREG;
-    #endif
-	#ifdef USE_HI_SPEED_BRG
-		UxMODEbits.BRGH = 1;                                                        //Use high speed mode
-	#endif
-	UxSTA = 0x0400;                                                                 //Enable TX
+	TransportInit();                                                                //UART, USB CDC or host link, see Transport.h
 
         /// test
         //PutResponse(1);
@@ -159,7 +313,16 @@ void BootLoader(void)
 			writeKey2 += 42;
 		#endif
 		HandleCommand();                                                            //Handle the command
+		#ifdef USE_MULTIDROP
+		if(frameAddr != NODE_BROADCAST)                                             //Broadcasts are never answered, they would collide
+		#endif
 		PutResponse(responseBytes);                                                 //Respond to sent command
+		#ifdef USE_BAUD_SWITCH
+		if(baudPending) {                                                           //Only now, the reply went out at the old rate
+			SwitchBaud(baudPending - 1);
+			baudPending = 0;
+		}
+		#endif
 	}
 }
 
@@ -184,44 +347,129 @@ void GetCommand()
 	BYTE RXByte;
 	BYTE checksum;
 	WORD dataCount;
+	WORD rxErrors;
+	#ifdef USE_LARGE_PACKETS
+	BYTE hiPending;
+	#endif
+	#ifdef USE_MULTIDROP
+	BYTE addrPending;
+	#endif
+	#ifdef USE_STATS
+	WORD escapes = 0;                                                               //Counted here, added to stats once per frame
+	#endif
 
 	while(1){
 
+		#ifdef USE_COBS
+		if(cobsOpen) {
+			cobsOpen = 0;
+			RXByte = STX;                                                           //No STX of its own after a COBS frame
+		} else
+		#endif
 		#ifndef USE_AUTOBAUD
         GetChar(&RXByte);                                                           //Get first STX
         if(RXByte == STX){
         #else
         AutoBaud();                                                                 //Get first STX and calculate baud rate
-		RXByte = UxRXREG;                                                           //Dummy read
         #endif
 
+		#ifndef USE_MULTIDROP                                                       //On a bus only a frame for this node does, see FrameCheck
+		#ifdef USE_STATS
+		if(!statsClock) {
+			StatsStartClock();                                                      //Data received, Timer2/3 now only clocks the counters
+		}
+		#else
 		T2CONbits.TON = 0;                                                          //Disable timer - data received
+		#endif
+		#endif
 
 		GetChar(&RXByte);                                                           //Read second byte
+		#ifdef USE_COBS
+		cobsFrame = 0;
+		if(RXByte != STX && cobsFraming) {                                          //STX then a code byte, a COBS frame
+			if(GetCobsFrame(RXByte)) return;
+			continue;
+		}
+		#endif
 		if(RXByte == STX){                                                          //2 STX, beginning of data
 
 			checksum = 0;                                                           //Reset checksum
 			dataCount = 0;                                                          //Reset datacount
+			rxErrors = TransportErrors();                                           //Note receive errors seen so far
+			#ifdef USE_LARGE_PACKETS
+			hiPending = largePackets;
+			lengthHi = 0;
+			#endif
+			#ifdef USE_MULTIDROP
+			addrPending = 1;
+			#endif
+			#ifdef USE_FRAME_CRC
+			if(crcBytes) FrameCrcStart(crcBytes);
+			#endif
 
-			while(dataCount <= MAX_PACKET_SIZE+1){                                  //Maximum num bytes to receive
+			while(dataCount <= MAX_PACKET_SIZE+MAX_CHECK_SIZE){                     //Maximum num bytes to receive
 				GetChar(&RXByte);
 				switch(RXByte){
 					case STX:                                                       //Start over if STX
+						#ifdef USE_COBS
+						if(cobsFraming) {                                           //Might have been a COBS frame, the STX opens the next
+							cobsOpen = 1;
+							dataCount = 0xFFFF;
+							break;
+						}
+						#endif
 						checksum = 0;
 						dataCount = 0;
+						rxErrors = TransportErrors();
+						#ifdef USE_LARGE_PACKETS
+						hiPending = largePackets;
+						lengthHi = 0;
+						#endif
+						#ifdef USE_MULTIDROP
+						addrPending = 1;
+						#endif
+						#ifdef USE_FRAME_CRC
+						if(crcBytes) FrameCrcStart(crcBytes);
+						#endif
 						break;
 
 					case ETX:                                                       //End of packet if ETX
-						checksum = ~checksum +1;                                    //Test checksum
-						Nop();
-						if(checksum == 0) return;                                   //Return if OK
+						#ifdef USE_STATS
+						stats.rxEscapes += escapes;
+						escapes = 0;
+						#endif
+						if(FrameCheck(checksum, dataCount, rxErrors) == 0) return;  //Return if OK
 						dataCount = 0xFFFF;                                         //Otherwise restart
 						break;
 
 					case DLE:                                                       //If DLE, treat next as data
 						GetChar(&RXByte);
+						#ifdef USE_STATS
+						escapes++;
+						#endif
 					default:                                                        //Get data, put in buffer
 						checksum += RXByte;
+						#ifdef USE_FRAME_CRC
+						if(crcBytes) FrameCrcPut(RXByte);
+						#endif
+						#ifdef USE_MULTIDROP
+						if(addrPending) {
+							frameAddr = RXByte;                                     //Checked with the rest, buffer stays AN851 shaped
+							addrPending = 0;
+							break;
+						}
+						#endif
+						#ifdef USE_LARGE_PACKETS
+						if(dataCount == 2 && hiPending && buffer[0] != SESSION) {
+							lengthHi = RXByte;                                      //Keep the header in buffer AN851 shaped
+							hiPending = 0;
+							break;
+						}
+						#endif
+						if(dataCount >= MAX_PACKET_SIZE+MAX_CHECK_SIZE) {           //Too long, drop it
+							dataCount = 0xFFFF;
+							break;
+						}
 						buffer[dataCount++] = RXByte;
 						break;
 
@@ -235,6 +483,78 @@ void GetCommand()
 	}                                                                               //End while(1)
 }                                                                                   //End GetCommand()
 
+/********************************************************************
+* Function: 	BYTE FrameCheck(BYTE checksum, WORD dataCount,
+*							WORD rxErrors)
+*
+* Precondition: A whole frame is in buffer.
+*
+* Input: 		checksum - sum of every byte of the frame
+*				dataCount - bytes in buffer, checksum or CRC included
+*				rxErrors - TransportErrors() at the start of the frame
+*
+* Output:		0 if the frame is good, otherwise not 0.
+*
+* Side Effects:	May send a NAK, sets packetLength.
+*
+* Overview: 	The end of frame checks of GetCommand and
+*				GetCobsFrame: checksum or CRC, receive errors and,
+*				in a window, the sequence number.
+*
+* Note:		 	None.
+********************************************************************/
+BYTE FrameCheck(BYTE checksum, WORD dataCount, WORD rxErrors)
+{
+	checksum = ~checksum +1;                                                        //Test checksum
+	Nop();
+	#ifdef USE_FRAME_CRC
+	checkBytes = 1;
+	if(crcBytes && buffer[0] != SESSION) {                                          //SESSION keeps the checksum
+		checksum = (FrameCrcResult() != 0);                                         //CRC of a frame with its CRC is 0
+		checkBytes = crcBytes;
+	}
+	#endif
+	#ifdef USE_STATS
+	if(checksum != 0) stats.badChecksums++;
+	#endif
+	if(rxErrors != TransportErrors()) checksum = 1;                                 //Drop packets that lost bytes to an overrun
+	#ifdef USE_MULTIDROP
+	if(checksum == 0 && frameAddr != nodeAddr && frameAddr != NODE_BROADCAST) {
+		return 1;                                                                   //Another node's frame or a reply, not ours to check
+	}
+	if(checksum == 0) {
+		#ifdef USE_STATS
+		if(!statsClock) {
+			StatsStartClock();
+		}
+		#else
+		T2CONbits.TON = 0;                                                          //Addressed to this node, stay in the bootloader
+		#endif
+	}
+	#endif
+	#ifdef USE_WINDOW
+	#ifdef USE_MULTIDROP
+	if(checksum == 0 && frameAddr == NODE_BROADCAST) {
+		duplicate = 0;                                                              //Outside the sequence, every node runs it once
+	} else
+	#endif
+	if(checksum == 0 && windowSize > 1 && buffer[0] != SESSION) {
+		if(dataCount < 3+CHECK_BYTES || !CheckSequence(buffer[dataCount-1-CHECK_BYTES])) { //Sequence number precedes the checksum
+			checksum = 1;
+		}
+	}
+	#ifndef USE_MULTIDROP                                                           //A damaged frame may not have been ours, the host times out
+	else if(checksum != 0 && windowSize > 1 && !nakSent) {
+		PutNak();                                                                   //Ask the host to go back to rxSeq
+	}
+	#endif
+	#endif
+	#if (defined(USE_LZ) || defined(USE_BATCH))
+	packetLength = dataCount;
+	#endif
+	return checksum;
+}
+
 /********************************************************************
 * Function: 	void HandleCommand()
 *
@@ -253,19 +573,28 @@ void GetCommand()
 void HandleCommand()
 {
 	BYTE Command;
-	BYTE length;
+	WORD length;
 
 	#if (defined(DEV_HAS_EEPROM) || defined(DEV_HAS_CONFIG_BITS))                   //Variables used in EE and CONFIG read/writes
 		WORD i=0;
 		WORD_VAL temp;
 		WORD bytesRead = 0;
 	#endif
+	#ifdef USE_AUTO_ERASE
+		WORD page;
+	#endif
 
 	Command = buffer[0];                                                            //Get command from buffer
 	length = buffer[1];                                                             //Get data length from buffer
+	#ifdef USE_STATS
+	stats.commands++;
+	#endif
+	#ifdef USE_LARGE_PACKETS
+	length |= (WORD)lengthHi << 8;
+	#endif
 
 	if(length == 0x00) {                                                            //RESET Command
-        UxMODEbits.UARTEN = 0;                                                      //Disable UART
+		TransportClose();                                                           //Finish sending and release the link
 		ResetDevice(userReset.Val);
 	}
 
@@ -279,6 +608,26 @@ void HandleCommand()
 	writeKey2 =  writeKey2 << 1;
 	#endif
 
+	#ifdef USE_WINDOW
+	if(duplicate && (Command == WT_FLASH || Command == ER_FLASH || Command == WT_EEDATA ||
+					 Command == WT_CONFIG || Command == VERIFY_OK || Command == WT_FLASH_LZ || Command == BATCH)) {
+		responseBytes = 1;                                                          //Already done, only repeat the ack
+		return;
+	}
+	#endif
+
+	#ifdef USE_VERIFY_RANGE
+	if(Command == WT_FLASH || Command == ER_FLASH || Command == WT_EEDATA || Command == WT_CONFIG ||
+	   Command == WT_FLASH_LZ) {
+		verifyState = VERIFY_NONE;                                                  //Flash changed, earlier checks no longer count
+		#ifdef USE_DUAL_SLOT
+		slotEnd.Val = 0;
+		#elif defined(USE_FAST_BOOT)
+		headerEnd.Val = 0;
+		#endif
+	}
+	#endif
+
 	//Handle Commands
 	switch(Command)
 	{
@@ -288,26 +637,260 @@ void HandleCommand()
 			responseBytes = 4;                                                      //Set length of reply
 			break;
 		case RD_FLASH:                                                              //Read flash memory
+			if((DWORD)length*PM_INSTR_SIZE > MAX_DATA_SIZE) {                       //Reply would not fit, send the bare command
+				responseBytes = 1;
+				break;
+			}
+			#ifdef USE_AES
+			responseBytes = 1;                                                      //The plain image would go straight back out
+			break;
+			#endif
 			ReadPM(length, sourceAddr);
 				responseBytes = length*PM_INSTR_SIZE + 5;                           //Set length of reply
 			break;
 		case WT_FLASH:                                                              //Write flash memory
+			if((DWORD)length*PM_ROW_SIZE > MAX_DATA_SIZE) {                         //More rows than a packet holds, ignore
+				responseBytes = 1;
+				break;
+			}
+			#ifdef USE_AUTO_ERASE
+			AutoErasePM(length, sourceAddr);                                        //Pages this session has not erased yet
+			#endif
+
 			#ifdef USE_RUNAWAY_PROTECT
 				writeKey1 -= length;                                                //Modify keys to ensure proper program flow
 				writeKey2 += Command;
 			#endif
 
+			#ifdef USE_JOURNAL
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - length;                //Setup program flow protection test keys
+				keyTest2 = (0x557F << 1) + WT_FLASH;
+			#endif
+			JournalAdd(JOURNAL_WRITE, sourceAddr, length);
+			#endif
+
 			WritePM(length, sourceAddr);
 			responseBytes = 1;                                                      //Set length of reply
  			break;
+		#ifdef USE_LZ
+		case WT_FLASH_LZ:                                                           //Write rows from a compressed stream
+		{
+			DWORD n;
+			WORD streamBytes = packetLength - 5 - CHECK_BYTES;                      //Less command, length, address and checksum
+
+			#ifdef USE_WINDOW
+			if(windowSize > 1) {
+				streamBytes--;                                                      //and the sequence number
+			}
+			#endif
+
+			buffer[1] = LZ_BAD_STREAM;
+			responseBytes = 2;
+			if(length > LZ_MAX_ROWS || streamBytes > MAX_DATA_SIZE) {
+				break;
+			}
+
+			LzInit(&buffer[5], streamBytes);                                        //Dry run, a bad stream must not reach flash
+			for(n = (DWORD)length*(PM_ROW_SIZE/PM_INSTR_SIZE)*3; n; n--) {
+				asm("clrwdt");
+				LzGetByte();
+			}
+			if(!LzDone()) {
+				break;
+			}
+
+			#ifdef USE_AUTO_ERASE
+			AutoErasePM(length, sourceAddr);                                        //Keeps buffer, the stream is decoded again below
+			#endif
+
+			#ifdef USE_RUNAWAY_PROTECT
+				writeKey1 -= length;                                                //Same program flow as WT_FLASH
+				writeKey2 += WT_FLASH;
+			#endif
+
+			#ifdef USE_JOURNAL
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - length;                //Setup program flow protection test keys
+				keyTest2 = (0x557F << 1) + WT_FLASH;
+			#endif
+			JournalAdd(JOURNAL_WRITE, sourceAddr, length);
+			#endif
+
+			LzInit(&buffer[5], streamBytes);
+			WritePM(length, sourceAddr);
+			buffer[1] = LZ_OK;
+			break;
+		}
+		#endif
+		#ifdef USE_AES
+		case SET_NONCE:                                                             //Counter blocks of the rows that follow
+			if(length != AES_NONCE_SIZE) {
+				responseBytes = 1;                                                  //Not a nonce, send the bare command
+				break;
+			}
+			AesSetNonce(&buffer[5]);
+			responseBytes = 5;
+			break;
+		#endif
+		#ifdef USE_SIGN
+		case SIGNATURE:                                                             //Signature of the rows that follow
+			if(length != SIGN_SIZE) {
+				responseBytes = 1;                                                  //Not a signature, send the bare command
+				break;
+			}
+			SignBegin(&buffer[5]);
+			responseBytes = 5;
+			break;
+		#endif
+		#ifdef USE_BAUD_SWITCH
+		case SET_BAUD:                                                              //Switch after the reply, see SwitchBaud
+		{
+			DWORD_VAL rate;
+			BYTE i;
+
+			rate.v[0] = buffer[5];
+			rate.v[1] = buffer[6];
+			rate.v[2] = buffer[7];
+			rate.v[3] = buffer[8];
+
+			buffer[5] = BAUD_UNSUPPORTED;
+			for(i = 0; i < BAUD_SWITCH_COUNT; i++) {
+				if(baudRates[i] == rate.Val) {
+					buffer[5] = BAUD_SWITCHING;
+					baudPending = i + 1;
+				}
+			}
+			responseBytes = 6;
+			break;
+		}
+		#endif
+		#ifdef USE_DUAL_SLOT
+		case RD_SLOT:                                                               //Where the next image goes
+		{
+			DWORD_VAL base;
+
+			base.Val = SLOT_BASE(targetSlot);
+			buffer[5] = activeSlot;
+			buffer[6] = targetSlot;
+			buffer[7] = base.v[0];
+			buffer[8] = base.v[1];
+			buffer[9] = base.v[2];
+			buffer[10] = (BYTE)SLOT_SIZE;
+			buffer[11] = (BYTE)(SLOT_SIZE >> 8);
+			buffer[12] = (BYTE)(SLOT_SIZE >> 16);
+			responseBytes = 13;
+			break;
+		}
+		#endif
+		#ifdef USE_STATS
+		case RD_STATS:                                                              //Counters since reset or the last clear
+			StatsReply(buffer[5]);
+			responseBytes = 10 + 4*STATS_COUNT;
+			break;
+		#endif
+		case RD_CRC_MAP:                                                            //CRC32 of length pages
+			if((DWORD)length*4 > MAX_DATA_SIZE) {                                   //Reply would not fit, send the bare command
+				responseBytes = 1;
+				break;
+			}
+			CrcMapPM(length, sourceAddr);
+			responseBytes = length*4 + 5;
+			break;
+		case VERIFY_RANGE:                                                          //CRC32 of [sourceAddr, end)
+		{
+			DWORD_VAL endAddr;
+			DWORD_VAL crc;
+			#ifdef USE_VERIFY_RANGE
+			BYTE match;
+			WORD row;
+			#endif
+
+			endAddr.v[0] = buffer[5];
+			endAddr.v[1] = buffer[6];
+			endAddr.v[2] = buffer[7];
+			endAddr.v[3] = 0;
+			if(endAddr.Val <= sourceAddr.Val) {                                     //Empty or inverted, it checks nothing
+				#ifdef USE_VERIFY_RANGE
+				verifyState = VERIFY_FAILED;                                        //Its CRC of 0 must not pass for a match
+				#endif
+				responseBytes = 1;                                                  //Bare command, no digest
+				break;
+			}
+			crc.Val = CrcPM((endAddr.Val - sourceAddr.Val + 1)/2, sourceAddr);
+
+			#ifdef USE_VERIFY_RANGE
+			match = crc.v[0] == buffer[8] && crc.v[1] == buffer[9] &&
+					crc.v[2] == buffer[10] && crc.v[3] == buffer[11];
+			if(!match) {
+				verifyState = VERIFY_FAILED;
+			} else {
+				for(row = ROW_NUM(sourceAddr.Val + PM_ROW_SIZE/2 - 1); row < ROW_NUM(endAddr.Val) && row < VERIFY_ROWS; row++) {
+					unverifiedRows[row/8] &= ~(1 << (row % 8));                     //Only rows the range covers whole
+				}
+				for(row = 0; row < sizeof(unverifiedRows) && unverifiedRows[row] == 0; row++);
+				if(verifyState == VERIFY_NONE && row == sizeof(unverifiedRows)) {
+					verifyState = VERIFY_MATCH;                                     //No row written since the erase is left unchecked
+				}
+				#ifdef USE_JOURNAL                                                  //Whole rows from the start of one
+				if((sourceAddr.Val & (PM_ROW_SIZE/2 - 1)) == 0 && endAddr.Val > sourceAddr.Val) {
+					#ifdef USE_RUNAWAY_PROTECT
+						keyTest1 = 0x0009 | (WORD)sourceAddr.Val;                   //Setup program flow protection test keys
+						keyTest2 = 0x557F << 1;
+					#endif
+					JournalAdd(JOURNAL_VERIFY, sourceAddr, JOURNAL_ROW(endAddr.Val - sourceAddr.Val));
+				}
+				#endif
+			}
+			#endif
+
+			#ifdef USE_DUAL_SLOT
+			if(match && sourceAddr.Val == SLOT_BASE(targetSlot) &&
+			   endAddr.Val <= sourceAddr.Val + SLOT_SIZE) {
+				slotEnd.Val = endAddr.Val;                                          //The range SlotCommit records and SlotBoot checks
+				slotCrc.Val = crc.Val;
+			}
+			#elif defined(USE_FAST_BOOT)
+			if(match && sourceAddr.Val >= VECTOR_SECTION) {                         //Page 0 is the bootloader's to rewrite, leave it out
+				if(headerEnd.Val == 0 || sourceAddr.Val < headerStart.Val) {
+					headerStart.Val = sourceAddr.Val;
+				}
+				if(endAddr.Val > headerEnd.Val) {
+					headerEnd.Val = endAddr.Val;                                    //WriteHeader covers the whole span, gaps included
+				}
+			}
+			#endif
+
+			buffer[5] = crc.v[0];                                                   //Reply with the digest only
+			buffer[6] = crc.v[1];
+			buffer[7] = crc.v[2];
+			buffer[8] = crc.v[3];
+			responseBytes = 9;
+			break;
+		}
 		case ER_FLASH:                                                              //Erase flash memory
 			#ifdef USE_RUNAWAY_PROTECT
 				writeKey1 += length;                                                //Modify keys to ensure proper program flow
 				writeKey2 -= Command;
 			#endif
 
+			#ifdef USE_JOURNAL
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = (0x0009 | (WORD)sourceAddr.Val) + length;                //Setup program flow protection test keys
+				keyTest2 = (0x557F << 1) - ER_FLASH;
+			#endif
+			JournalAdd(JOURNAL_ERASE, sourceAddr, length*(PM_PAGE_SIZE/PM_ROW_SIZE));
+			#endif
+
+			#ifdef USE_SIGN
+			SignErase();                                                            //Rows already hashed may go
+			#endif
 			ErasePM(length, sourceAddr);
+			#ifdef USE_BLANK_CHECK
+			responseBytes = 9;                                                      //Erased and skipped page counts
+			#else
 			responseBytes = 1;                                                      //Set length of reply
+			#endif
 			break;
 
 		#ifdef DEV_HAS_EEPROM
@@ -394,9 +977,203 @@ void HandleCommand()
 				writeKey2 += Command;
 			#endif
 
-			WriteTimeout();
+			#ifdef USE_SIGN
+			if(!SignValid()) {                                                      //The ranges match, but not a signed image
+				verifyState = VERIFY_FAILED;
+			}
+			#endif
+
+			#ifdef USE_DUAL_SLOT
+			if(verifyState == VERIFY_MATCH && slotEnd.Val != 0) {                   //The target slot holds a checked image, switch to it
+				#ifdef USE_RUNAWAY_PROTECT
+					keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - 1;                 //Setup program flow protection test keys
+					keyTest2 = (0x557F << 1) + VERIFY_OK;
+				#endif
+				SlotCommit();
+			}
+			#else
+			#ifdef USE_VERIFY_RANGE
+			if(verifyState == VERIFY_MATCH)                                         //Only once the device has checked the image
+			#endif
+			{
+				WriteTimeout();
+				#ifdef USE_FAST_BOOT
+				if(headerEnd.Val != 0) {
+					#ifdef USE_RUNAWAY_PROTECT
+						keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - 1;             //Setup program flow protection test keys
+						keyTest2 = (0x557F << 1) + VERIFY_OK;
+					#endif
+					WriteHeader();
+				}
+				#endif
+				#ifdef USE_JOURNAL
+				#ifdef USE_RUNAWAY_PROTECT
+					keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - 1;                 //Setup program flow protection test keys
+					keyTest2 = (0x557F << 1) + VERIFY_OK;
+				#endif
+				JournalClose();                                                     //Update complete, nothing left to resume
+				#endif
+			}
+			#endif
 			responseBytes = 1;                                                      //Set length of reply
 			break;
+		#ifdef USE_JOURNAL
+		case JOURNAL:                                                               //Entries from number sourceAddr on
+			if(13 + (DWORD)length*3 > MAX_DATA_SIZE) {                              //Reply would not fit, send the bare command
+				responseBytes = 1;
+				break;
+			}
+			#ifdef USE_RUNAWAY_PROTECT
+				writeKey1 -= 1;                                                     //Modify keys to ensure proper program flow
+				writeKey2 += Command;
+			#endif
+
+			if((buffer[5] & JOURNAL_BEGIN)
+			#ifdef USE_WINDOW
+			   && !duplicate                                                        //Begun already, only the reply was lost
+			#endif
+			   ) {
+				DWORD_VAL tag;
+
+				tag.v[0] = buffer[6];
+				tag.v[1] = buffer[7];
+				tag.v[2] = buffer[8];
+				tag.v[3] = buffer[9];
+				#ifdef USE_RUNAWAY_PROTECT
+					keyTest1 = (0x0009 | (WORD)sourceAddr.Val) - 1;                 //Setup program flow protection test keys
+					keyTest2 = (0x557F << 1) + JOURNAL;
+				#endif
+				JournalBegin(tag);
+			}
+			responseBytes = 13 + 3*JournalReply(sourceAddr.word.LW, length);
+			break;
+		#endif
+		#ifdef USE_STREAM
+		case RD_STREAM:                                                             //Frames from sourceAddr up to the end address
+			#ifdef USE_AES
+			responseBytes = 1;                                                      //No plain text back, as RD_FLASH
+			break;
+			#endif
+			{
+				DWORD_VAL end;
+
+				end.v[0] = buffer[5];
+				end.v[1] = buffer[6];
+				end.v[2] = buffer[7];
+				end.v[3] = 0;
+				if(!crcBytes || length < 4 || length > MAX_DATA_SIZE || end.Val <= sourceAddr.Val
+				#ifdef USE_MULTIDROP
+				   || frameAddr == NODE_BROADCAST                                   //Every node would answer at once
+				#endif
+				   ) {
+					responseBytes = 1;                                              //No frame CRC agreed or no room for a literal, send the bare command
+					break;
+				}
+				responseBytes = StreamPM(length, sourceAddr, end.Val);
+			}
+			break;
+		#endif
+		#ifdef USE_BATCH
+		case BATCH:                                                                 //length sub-commands, one result each
+			if(length > BATCH_MAX_OPS) {                                            //Results would not fit, send the bare command
+				responseBytes = 1;
+				break;
+			}
+			responseBytes = BatchPM(length);
+			break;
+		#endif
+		#ifdef USE_SESSION
+		case SESSION:                                                               //Negotiate window and packet size
+			#ifdef USE_LARGE_PACKETS
+			largePackets = buffer[6] & SESSION_LARGE;
+			#endif
+
+			#ifdef USE_COBS
+			cobsFraming = buffer[6] & SESSION_COBS;
+			#endif
+
+			#ifdef USE_AUTO_ERASE
+			autoErase = buffer[6] & SESSION_AUTO_ERASE;
+			#ifdef USE_JOURNAL
+			if(journalNext >= 2) {                                                  //An update cut short: its pages hold rows
+				autoErase = 0;                                                      //the host will not send again
+			}
+			#endif
+			for(page = 0; page < sizeof(erasedPages); page++) {
+				erasedPages[page] = 0;                                              //Nothing erased by this session yet
+			}
+			#ifdef USE_SIGN
+			SignErase();                                                            //Auto erase may now take out rows already hashed
+			#endif
+			#endif
+
+			#ifdef USE_FRAME_CRC
+			crcBytes = 0;                                                           //From the next frame on, this reply keeps the checksum
+			if(buffer[6] & SESSION_CRC32) {
+				crcBytes = 4;
+			} else if(buffer[6] & SESSION_CRC16) {
+				crcBytes = 2;
+			}
+			#endif
+
+			#ifdef USE_WINDOW
+			windowSize = buffer[5];
+			#ifdef USE_LARGE_PACKETS
+			if(largePackets && windowSize > MAX_LARGE_WINDOW_SIZE) {
+				windowSize = MAX_LARGE_WINDOW_SIZE;
+			}
+			#endif
+			if(windowSize > MAX_WINDOW_SIZE) {
+				windowSize = MAX_WINDOW_SIZE;
+			}
+			if(windowSize == 0) {
+				windowSize = 1;
+			}
+			rxSeq = 0;                                                              //Sequencing restarts with every session
+			nakSent = 0;
+			duplicate = 0;
+			buffer[5] = windowSize;
+			#else
+			buffer[5] = 1;
+			#endif
+
+			#ifdef USE_LARGE_PACKETS
+			if(largePackets) {
+				buffer[6] = SESSION_LARGE;
+				buffer[7] = (BYTE)MAX_DATA_SIZE;                                    //Data bytes per packet
+				buffer[8] = (BYTE)(MAX_DATA_SIZE >> 8);
+			} else
+			#endif
+			{
+				buffer[6] = 0;
+				buffer[7] = 0x00;
+				buffer[8] = 0x01;
+			}
+			#ifdef USE_FRAME_CRC
+			if(crcBytes == 4) {
+				buffer[6] |= SESSION_CRC32;
+			} else if(crcBytes == 2) {
+				buffer[6] |= SESSION_CRC16;
+			}
+			#endif
+			#ifdef USE_COBS
+			buffer[6] |= cobsFraming;
+			#endif
+			#ifdef USE_AUTO_ERASE
+			buffer[6] |= autoErase;
+			#endif
+			#ifdef USE_BATCH
+			buffer[6] |= SESSION_BATCH;                                             //Always on, only reported
+			#endif
+			#ifdef USE_AES
+			buffer[6] |= SESSION_AES;
+			#endif
+			#ifdef USE_SIGN
+			buffer[6] |= SESSION_SIGN;
+			#endif
+			responseBytes = 9;
+			break;
+		#endif
 		default:
 			break;
 	}                                                                               //End switch(Command)
@@ -423,59 +1200,198 @@ void PutResponse(WORD responseLen)
 	WORD i;
 	BYTE data;
 	BYTE checksum;
+	#ifdef USE_STATS
+	WORD escapes = 0;                                                               //Counted here, added to stats once per frame
+	#endif
+	#ifdef USE_FRAME_CRC
+	BYTE crcSize = (buffer[0] != SESSION) ? crcBytes : 0;                           //SESSION replies keep the checksum
+	DWORD_VAL crc;
+	#endif
 
-	UxSTAbits.UTXEN = 1;                                                            //Make sure TX is enabled
+	#ifdef USE_WINDOW
+	if(windowSize > 1 && buffer[0] != SESSION) {
+		buffer[responseLen++] = txSeq;                                              //Acknowledge by sequence number
+	}
+	#endif
+	#ifdef USE_MULTIDROP
+	TransportDriver(TRUE);                                                          //Take the bus, the master is listening
+	#endif
+	#ifdef USE_FRAME_CRC
+	if(crcSize) {                                                                   //Own pass, keeps the stuffing loop as tight as without
+		FrameCrcStart(crcSize);
+		#ifdef USE_MULTIDROP
+		FrameCrcPut(nodeAddr | NODE_REPLY);
+		#endif
+		for(i = 0; i < responseLen; i++) {
+			#ifdef USE_LARGE_PACKETS
+			if(i == 2 && largePackets) FrameCrcPut(lengthHi);
+			#endif
+			FrameCrcPut(buffer[i]);
+		}
+		crc.Val = FrameCrcResult();
+	}
+	#endif
 
-	PutChar(STX);                                                                   //Put 2 STX characters
-	PutChar(STX);
+	#ifdef USE_COBS
+	if(cobsFrame) {                                                                 //Trailer into buffer, PutCobs sends it with the rest
+		BYTE hi = 0;
 
-	checksum = 0;
-	for(i = 0; i < responseLen; i++){
-		asm("clrwdt");                                                              //Looping code so clear WDT
-		data = buffer[i];                                                           //Get data from response buffer
+		#ifdef USE_LARGE_PACKETS
+		hi = (largePackets && buffer[0] != SESSION && responseLen > 2);             //As the loop below puts it
+		#endif
+		#ifdef USE_FRAME_CRC
+		if(crcSize) {
+			for(i = crcSize; i-- > 0;) {
+				buffer[responseLen++] = crc.v[i];                                   //High byte first
+			}
+		} else
+		#endif
+		{
+			checksum = 0;
+			for(i = 0; i < responseLen; i++) {
+				checksum += buffer[i];
+			}
+			if(hi) checksum += lengthHi;
+			buffer[responseLen++] = ~checksum + 1;
+		}
+		PutCobs(responseLen, hi);
+		PutFlush();
+		return;
+	}
+	#endif
+
+	PutChar(STX);                                                                   //Put 2 STX characters
+	PutChar(STX);
+
+	checksum = 0;
+	#ifdef USE_MULTIDROP
+	checksum = nodeAddr | NODE_REPLY;                                               //Never a control character, no DLE
+	PutChar(checksum);
+	#ifdef USE_STATS
+	stats.txBytes++;
+	#endif
+	#endif
+	for(i = 0; i < responseLen; i++){
+		asm("clrwdt");                                                              //Looping code so clear WDT
+		#ifdef USE_LARGE_PACKETS
+		if(i == 2 && largePackets && buffer[0] != SESSION) {                        //Put the high length byte after the low one
+			checksum += lengthHi;
+			if(lengthHi == STX || lengthHi == ETX || lengthHi == DLE){
+				PutChar(DLE);
+				#ifdef USE_STATS
+				escapes++;
+				#endif
+			}
+			PutChar(lengthHi);
+			#ifdef USE_STATS
+			stats.txBytes++;                                                        //Not in responseLen
+			#endif
+		}
+		#endif
+		data = buffer[i];                                                           //Get data from response buffer
 		checksum += data;                                                           //Accumulate checksum
 		if(data == STX || data == ETX || data == DLE){                         		//If control character, stuff DLE
 			PutChar(DLE);
+			#ifdef USE_STATS
+			escapes++;
+			#endif
 		}
 		PutChar(data);                                                              //Send data
 	}
 
-	checksum = ~checksum + 1;                                                       //Keep track of checksum
-	if(checksum == STX || checksum == ETX || checksum == DLE){                      //If control character, stuff DLE
-		PutChar(DLE);
+	#ifdef USE_FRAME_CRC
+	if(crcSize) {
+		for(i = crcSize; i-- > 0;) {
+			data = crc.v[i];                                                        //High byte first
+			if(data == STX || data == ETX || data == DLE){
+				PutChar(DLE);
+				#ifdef USE_STATS
+				escapes++;
+				#endif
+			}
+			PutChar(data);
+		}
+	} else
+	#endif
+	{
+		checksum = ~checksum + 1;                                                   //Keep track of checksum
+		if(checksum == STX || checksum == ETX || checksum == DLE){                  //If control character, stuff DLE
+			PutChar(DLE);
+			#ifdef USE_STATS
+			escapes++;
+			#endif
+		}
+		PutChar(checksum);                                                          //Put checksum
 	}
+	#ifdef USE_STATS
+	stats.txEscapes += escapes;
+	stats.txBytes += responseLen + escapes + 4;                                     //Two STX, checksum and ETX
+	#ifdef USE_FRAME_CRC
+	if(crcSize) stats.txBytes += crcSize - 1;
+	#endif
+	#endif
 
-	PutChar(checksum);                                                              //Put checksum
 	PutChar(ETX);                                                                   //Put End of text
-	while(!UxSTAbits.TRMT);                                                         //Wait for transmit to finish
+	#ifdef USE_COBS
+	cobsSent = 0;
+	#endif
+	PutFlush();                                                                     //Hand the rest of the frame to the transport
+	#ifdef USE_MULTIDROP
+	TransportDriver(FALSE);                                                         //Release the bus once the last stop bit is out
+	#endif
 }
 
 /********************************************************************
 * Function: 	void PutChar(BYTE Char)
 *
-* Precondition: UART Setup
+* Precondition: Transport initialised
 *
 * Input: 		Char - Character to transmit
 *
 * Output: 		None
 *
-* Side Effects:	Puts character into destination pointed to by ptrChar.
+* Side Effects:	None.
 *
-* Overview: 	Transmits a character on UART2.
-*	 			Waits for an empty spot in TXREG FIFO.
+* Overview: 	Adds a character to txBlock and hands the block to
+*				the transport once it is full.
 *
-* Note:		 	None
+* Note:		 	PutFlush sends what is left at the end of a frame.
 ********************************************************************/
 void PutChar(BYTE txChar)
 {
-	while(UxSTAbits.UTXBF);                                                         //Wait for FIFO space
-	UxTXREG = txChar;                                                               //Put character onto UART FIFO to transmit
+	txBlock[txBlockLen++] = txChar;
+	if(txBlockLen == TRANSPORT_BLOCK_SIZE) {
+		PutFlush();
+	}
+}
+
+/********************************************************************
+* Function: 	void PutFlush()
+*
+* Precondition: Transport initialised
+*
+* Input: 		None.
+*
+* Output: 		None
+*
+* Side Effects:	Empties txBlock.
+*
+* Overview: 	Hands the characters queued by PutChar to the transport.
+*
+* Note:		 	The transport may still be sending them on return.
+********************************************************************/
+void PutFlush(void)
+{
+	if(txBlockLen != 0) {
+		TransportWrite(txBlock, txBlockLen);
+		txBlockLen = 0;
+	}
 }
 
 /********************************************************************
 * Function:        void GetChar(BYTE * ptrChar)
 *
-* PreCondition:    UART Setup
+* PreCondition:    Transport initialised
 *
 * Input:		ptrChar - pointer to character received
 *
@@ -484,32 +1400,157 @@ void PutChar(BYTE txChar)
 * Side Effects:	Puts character into destination pointed to by ptrChar.
 *				Clear WDT
 *
-* Overview:		Receives a character from UART2.
+* Overview:		Receives a character, waiting for the transport if
+*				rxBlock is empty. Jumps to the user code once the
+*				bootloader entry timeout expires.
 *
-* Note:			None
+* Note:			With USE_STATS the wait is added to stats.rxWait.
 ********************************************************************/
 void GetChar(BYTE * ptrChar)
 {
-	BYTE dummy;
-	while(1)
+	#ifdef USE_STATS
+	DWORD waitStart;
+
+	if(PollChar(ptrChar)) {
+		return;                                                                     //Nothing to wait for, nothing to time
+	}
+	waitStart = StatsClock();
+	#endif
+
+	while(!PollChar(ptrChar))
 	{
 		asm("clrwdt");                                                              //Looping code, so clear WDT
-		if((UxSTA & 0x000E) != 0x0000) {                                            //Check for receive errors
-			dummy = UxRXREG;                                                        //Dummy read to clear FERR/PERR
-			UxSTAbits.OERR = 0;                                                     //Clear OERR to keep receiving
-		}
-		if(UxSTAbits.URXDA == 1) {                                                  //Get the data
-			* ptrChar = UxRXREG;                                                    //Get data from UART RX FIFO
-			break;
-		}
 
         #ifndef USE_AUTOBAUD
 		if(IFS0bits.T3IF == 1) {                                                    //If timer expired, jump to user code
+			#ifdef USE_STATS
+			if(statsClock) {
+				IFS0bits.T3IF = 0;                                                  //Only the counters' clock wrapping
+				continue;
+			}
+			#endif
+			TransportClose();
 			ResetDevice(userReset.Val);
 		}
         #endif
 	}                                                                               //End while(1)
+
+	#ifdef USE_STATS
+	stats.rxWait += StatsClock() - waitStart;
+	#endif
+}
+
+/********************************************************************
+* Function: 	BOOL PollChar(BYTE * ptrChar)
+*
+* Precondition: Transport initialised
+*
+* Input: 		ptrChar - pointer to receive buffer
+*
+* Output:		TRUE if a character was read.
+*
+* Side Effects:	Refills rxBlock from the transport when it is empty.
+*
+* Overview: 	GetChar without the wait and the bootloader timeout.
+*
+* Note:		 	None.
+********************************************************************/
+BOOL PollChar(BYTE * ptrChar)
+{
+	if(rxBlockPos == rxBlockLen) {
+		rxBlockLen = TransportRead(rxBlock, TRANSPORT_BLOCK_SIZE);
+		rxBlockPos = 0;
+		if(rxBlockLen == 0) {
+			return FALSE;
+		}
+		#ifdef USE_STATS
+		stats.rxBytes += rxBlockLen;
+		#endif
+	}
+	*ptrChar = rxBlock[rxBlockPos++];
+	return TRUE;
+}
+
+#ifdef USE_BAUD_SWITCH
+/********************************************************************
+* Function: 	void SwitchBaud(BYTE index)
+*
+* Precondition: SET_BAUD reply queued
+*
+* Input: 		index - entry of the BAUD_SWITCH table
+*
+* Output:		None.
+*
+* Side Effects:	UxBRG/BRGH changed, Timer1 used.
+*
+* Overview: 	Lets the reply go out at the old rate, switches, then
+*				waits BAUD_CONFIRM_MS for the BAUD_CONFIRM_BYTES from the
+*				host. If they arrive intact they are echoed at the new
+*				rate, otherwise the old rate is restored. The host does
+*				the same when the echo does not come back.
+*
+* Note:		 	Timer2/3 is the bootloader entry timeout, Timer1 is free.
+********************************************************************/
+void SwitchBaud(BYTE index)
+{
+	WORD oldBrg = UxBRG;
+	BYTE oldBrgh = UxMODEbits.BRGH;
+	BYTE matched = 0;
+	BYTE rxChar;
+
+	TransportFlush();                                                               //Reply goes out at the old rate
+	while(PollChar(&rxChar));                                                       //Anything received meanwhile is noise
+	#ifdef USE_COBS
+	cobsOpen = 0;                                                                   //Both ends start afresh at the new rate
+	cobsSent = 0;
+	#endif
+
+	UxMODEbits.BRGH = 1;
+	UxBRG = baudRegs[index];
+
+	T1CONbits.TON = 0;
+	T1CONbits.TCKPS = 3;                                                            //1:256
+	TMR1 = 0;
+	PR1 = BAUD_CONFIRM_TICKS;
+	IFS0bits.T1IF = 0;
+	T1CONbits.TON = 1;
+
+	while(matched < sizeof(baudConfirm) && !IFS0bits.T1IF) {
+		asm("clrwdt");
+		if(PollChar(&rxChar)) {
+			if(rxChar != baudConfirm[matched]) {                                    //Garbled, the rates do not match
+				break;
+			}
+			matched++;
+		}
+	}
+	T1CONbits.TON = 0;
+
+	#ifdef USE_MULTIDROP
+	if(matched == sizeof(baudConfirm) && frameAddr == NODE_BROADCAST) {
+		return;                                                                     //Every node switched, none echoes
+	}
+	#endif
+	if(matched == sizeof(baudConfirm)) {
+		#ifdef USE_MULTIDROP
+		TransportDriver(TRUE);
+		#endif
+		for(matched = 0; matched < sizeof(baudConfirm); matched++) {
+			PutChar(baudConfirm[matched]);                                          //Echo, the host commits on seeing it
+		}
+		PutFlush();
+		#ifdef USE_MULTIDROP
+		TransportDriver(FALSE);
+		#endif
+		#ifdef USE_STATS
+		stats.txBytes += sizeof(baudConfirm);
+		#endif
+	} else {
+		UxBRG = oldBrg;                                                             //Fall back
+		UxMODEbits.BRGH = oldBrgh;
+	}
 }
+#endif
 
 /********************************************************************
 * Function:     void ReadPM(WORD length, DWORD_VAL sourceAddr)
@@ -543,6 +1584,194 @@ void ReadPM(WORD length, DWORD_VAL sourceAddr)
 	}                                                                               //End while(bytesRead < length*PM_INSTR_SIZE)
 }
 
+/********************************************************************
+* Function:     void CrcMapPM(WORD length, DWORD_VAL sourceAddr)
+*
+* PreCondition: None
+*
+* Input:		length		- number of pages
+*				sourceAddr 	- address in the first page
+*
+* Output:		None
+*
+* Side Effects:	Puts one CRC32 per page into buffer, LSB first.
+*
+* Overview:		Computes the CRC32 of each page over the same 4 bytes
+*				per instruction that RD_FLASH returns, so a host can
+*				find the pages that differ from its image.
+*
+* Note:			Page 0 and the bootloader pages never match a host
+*				image, the bootloader rewrites the reset vector, the
+*				user reset/delay words and its AIVT slots.
+********************************************************************/
+void CrcMapPM(WORD length, DWORD_VAL sourceAddr)
+{
+	WORD page;
+	DWORD_VAL crc;
+
+	sourceAddr.Val &= ~((DWORD)PM_PAGE_SIZE/2 - 1);                                 //Start of the first page
+
+	for(page = 0; page < length; page++) {
+		crc.Val = CrcPM(PM_PAGE_SIZE/PM_INSTR_SIZE, sourceAddr);
+		sourceAddr.Val += PM_PAGE_SIZE/2;
+
+		buffer[page*4+5] = crc.v[0];
+		buffer[page*4+6] = crc.v[1];
+		buffer[page*4+7] = crc.v[2];
+		buffer[page*4+8] = crc.v[3];
+	}
+}
+
+/********************************************************************
+* Function:     DWORD CrcPM(DWORD length, DWORD_VAL sourceAddr)
+*
+* PreCondition: None
+*
+* Input:		length		- number of instructions
+*				sourceAddr 	- address of the first instruction
+*
+* Output:		CRC32 of the instructions.
+*
+* Side Effects:	None
+*
+* Overview:		Reads flash with ReadLatch and runs the 4 bytes per
+*				instruction that ReadPM returns, phantom byte included,
+*				through the CRC.
+*
+* Note:			Clears the watchdog, a whole device takes about half a
+*				second.
+********************************************************************/
+DWORD CrcPM(DWORD length, DWORD_VAL sourceAddr)
+{
+	DWORD_VAL temp;
+	DWORD crc = CRC32_INIT;
+
+	while(length--) {
+		asm("clrwdt");
+		temp.Val = ReadLatch(sourceAddr.word.HW, sourceAddr.word.LW);
+		crc = Crc32Update(crc, temp.v, PM_INSTR_SIZE);
+		sourceAddr.Val += 2;
+	}
+	return ~crc;
+}
+
+#ifdef USE_STREAM
+/********************************************************************
+* Function:     WORD StreamPM(WORD room, DWORD_VAL sourceAddr, DWORD end)
+*
+* PreCondition: A frame CRC agreed by SESSION.
+*
+* Input:		room		- data bytes per frame, as the host asked
+*				sourceAddr 	- address of the first instruction
+*				end			- address past the last instruction
+*
+* Output:		Length of the last frame, left in buffer for the
+*				main loop to send.
+*
+* Side Effects:	Sends every frame but the last with PutResponse.
+*
+* Overview:		Streams the range without a request per frame. Each
+*				frame is an RD_STREAM reply carrying its own start
+*				address, the low bits of its instruction count in the
+*				length and the instructions coded by StreamFrame.
+*
+* Note:			Paced only by TransportWrite waiting for room. A frame
+*				lost on the way shows up at the host as a gap in the
+*				addresses; it asks for that range again.
+********************************************************************/
+WORD StreamPM(WORD room, DWORD_VAL sourceAddr, DWORD end)
+{
+	WORD length;
+
+	while(1) {
+		buffer[0] = RD_STREAM;
+		buffer[2] = sourceAddr.v[0];                                                //Where this frame starts
+		buffer[3] = sourceAddr.v[1];
+		buffer[4] = sourceAddr.v[2];
+		length = StreamFrame(&sourceAddr, end, room);
+		if(sourceAddr.Val >= end) {
+			return length;
+		}
+		PutResponse(length);
+	}
+}
+
+/********************************************************************
+* Function:     WORD StreamFrame(DWORD_VAL *sourceAddr, DWORD end, WORD room)
+*
+* PreCondition: None
+*
+* Input:		sourceAddr 	- address of the first instruction, moved on
+*							  past the last one coded
+*				end			- address past the last instruction
+*				room		- data bytes the frame may hold, at least 4
+*
+* Output:		Length of the reply in buffer.
+*
+* Side Effects:	Sets the length in buffer[1] (and lengthHi) to the
+*				number of instructions coded.
+*
+* Overview:		Codes instructions from buffer[5] on as tokens. A token
+*				with STREAM_BLANK set stands for up to STREAM_MAX_RUN
+*				erased instructions on its own, any other is followed
+*				by token + 1 instructions of 3 bytes each, the phantom
+*				byte left out.
+*
+* Note:			An erased page is 4 bytes where RD_FLASH takes 2048.
+*				Without large packets a frame covers at most 255
+*				instructions, so the length byte can count them.
+********************************************************************/
+WORD StreamFrame(DWORD_VAL *sourceAddr, DWORD end, WORD room)
+{
+	DWORD_VAL temp;
+	WORD limit = 5 + room;
+	WORD i = 5;
+	WORD count = 0;
+	WORD maxCount = 0xFF;
+	WORD token;
+	BYTE n;
+
+	#ifdef USE_LARGE_PACKETS
+	if(largePackets) maxCount = 0xFFFF;
+	#endif
+
+	while(sourceAddr->Val < end && i + 4 <= limit && count < maxCount) {            //Room for a token and one instruction
+		asm("clrwdt");
+		temp.Val = ReadLatch(sourceAddr->word.HW, sourceAddr->word.LW);
+		token = i++;
+		n = 0;
+		if(temp.Val == 0xFFFFFF) {
+			do {                                                                    //Erased run, the token alone
+				n++;
+				sourceAddr->Val += 2;
+			} while(n < STREAM_MAX_RUN && sourceAddr->Val < end && count + n < maxCount &&
+					ReadLatch(sourceAddr->word.HW, sourceAddr->word.LW) == 0xFFFFFF);
+			buffer[token] = STREAM_BLANK | (n - 1);
+		} else {
+			do {                                                                    //Literal run up to the next erased instruction
+				buffer[i++] = temp.v[0];
+				buffer[i++] = temp.v[1];
+				buffer[i++] = temp.v[2];
+				n++;
+				sourceAddr->Val += 2;
+				if(n == STREAM_MAX_RUN || sourceAddr->Val >= end || count + n >= maxCount || i + 3 > limit) {
+					break;
+				}
+				temp.Val = ReadLatch(sourceAddr->word.HW, sourceAddr->word.LW);
+			} while(temp.Val != 0xFFFFFF);
+			buffer[token] = n - 1;
+		}
+		count += n;
+	}
+
+	buffer[1] = (BYTE)count;
+	#ifdef USE_LARGE_PACKETS
+	lengthHi = (BYTE)(count >> 8);
+	#endif
+	return i;
+}
+#endif
+
 /********************************************************************
 * Function:     void WritePM(WORD length, DWORD_VAL sourceAddr)
 *
@@ -553,121 +1782,78 @@ void ReadPM(WORD length, DWORD_VAL sourceAddr)
 *
 * Output:		None.
 *
-* Side Effects:	None.
+* Side Effects:	Rows in buffer that hold special addresses are changed
+*				in place by RowFixup. With USE_AES every row is
+*				decrypted in place first.
 *
 * Overview:		Writes number of rows indicated from buffer into
-*				flash memory
-*
-* Note:			None
+*				flash memory, a row at a time: AesCtrRow with USE_AES,
+*				SignRow with USE_SIGN, its hashing done mostly while
+*				the row is written, RowFixup for the few rows that
+*				need it, one
+*				RowProtected check, then WriteRowLatch and the row
+*				write.
+*
+* Note:			For WT_FLASH_LZ the rows come from the stream set up
+*				with LzInit, 3 bytes per instruction, phantom byte 0,
+*				decoded into lzRow first.
 ********************************************************************/
 void WritePM(WORD length, DWORD_VAL sourceAddr)
 {
 	WORD bytesWritten;
-	DWORD_VAL data;
+	BYTE *row;
+	#ifdef USE_LZ
+	WORD i;
+	#endif
 	#ifdef USE_RUNAWAY_PROTECT
 	WORD temp = (WORD)sourceAddr.Val;
 	#endif
 
-	bytesWritten = 0;                                                               //First 5 buffer locations are cmd,len,addr
+	bytesWritten = 0;
 
 	while((bytesWritten) < length*PM_ROW_SIZE) {                                    //Write length rows to flash
 		asm("clrwdt");
-		data.v[0] = buffer[bytesWritten+5];                                         //Get data to write from buffer
-		data.v[1] = buffer[bytesWritten+6];
-		data.v[2] = buffer[bytesWritten+7];
-		data.v[3] = buffer[bytesWritten+8];
-		bytesWritten+=PM_INSTR_SIZE;                                                //4 bytes per instruction: low word, high byte, phantom byte
-
-		#ifndef DEV_HAS_CONFIG_BITS                                                 //Flash configuration word handling
-			if(sourceAddr.Val == CONFIG_END) {                                      //Mask of bit 15 of CW1 to ensure it is programmed as 0 as noted in PIC24FJ datasheets
-				data.Val &= 0x007FFF;
-			}
-		#endif
-
-		#ifdef USE_BOOT_PROTECT                                                     //Protect the bootloader & reset vector
-			if(sourceAddr.Val == 0x0) {                                             //Protect BL reset & get user reset
-				userReset.Val = data.Val & 0xFFFF;                                  //Get user app reset vector lo word
-				data.Val = 0x040000 + (0xFFFF & BOOT_ADDR_LOW);                     //program low word of BL reset
-				userResetRead = 1;
-			}
-			if(sourceAddr.Val == 0x2) {
-				userReset.Val += (DWORD)(data.Val & 0x00FF)<<16;                    //Get user app reset vector hi byte
-				data.Val = ((DWORD)(BOOT_ADDR_LOW & 0xFF0000))>>16;                 //Program high byte of BL reset
-				userResetRead = 1;
-			}
-		#else
-			if(sourceAddr.Val == 0x0) {                                             //Get user app reset vector lo word
-				userReset.Val = data.Val & 0xFFFF;
-				userResetRead = 1;
-			}
-			if(sourceAddr.Val == 0x2) {                                             //Get user app reset vector	hi byte
-				userReset.Val |= ((DWORD)(data.Val & 0x00FF))<<16;
-				userResetRead = 1;
+		#ifdef USE_LZ
+		if(buffer[0] == WT_FLASH_LZ) {
+			for(i = 0; i < PM_ROW_SIZE; i += PM_INSTR_SIZE) {                       //Decode the next row
+				lzRow[i] = LzGetByte();
+				lzRow[i+1] = LzGetByte();
+				lzRow[i+2] = LzGetByte();
+				lzRow[i+3] = 0;
 			}
+			row = lzRow;
+		} else
 		#endif
+		row = &buffer[bytesWritten+5];                                              //First 5 buffer locations are cmd,len,addr
+		bytesWritten += PM_ROW_SIZE;
 
-		if(sourceAddr.Val == USER_PROG_RESET) {                                     //Put information from reset vector in user reset vector location
-			if(userResetRead){                                                      //Has reset vector been grabbed from location 0x0?
-				data.Val = userReset.Val;                                           //If yes, use that reset vector
-			}else{
-				userReset.Val = data.Val;                                           //If no, use the user's indicated reset vector
-			}
-		}
-		if(sourceAddr.Val == DELAY_TIME_ADDR) {                                     //If address is delay timer location, store data and write empty word
-			userTimeout.Val = data.Val;
-			data.Val = 0xFFFFFF;
-		}
-
-		#ifdef USE_BOOT_PROTECT                                                     //Do not erase bootloader & reset vector
-			if(sourceAddr.Val < BOOT_ADDR_LOW || sourceAddr.Val > BOOT_ADDR_HI) {
-		#endif
-
-		#ifdef USE_CONFIGWORD_PROTECT                                               //Do not erase last page
-			if(sourceAddr.Val < (CONFIG_START & 0xFFFC00)) {
-		#endif
-
-		#ifdef USE_VECTOR_PROTECT                                                   //Do not erase first page
-			//if(sourceAddr.Val >= PM_PAGE_SIZE/2) {
-			if(sourceAddr.Val >= VECTOR_SECTION) {
-		#endif
-
-   		WriteLatch(sourceAddr.word.HW, sourceAddr.word.LW,data.word.HW, data.word.LW);//write data into latches
-
-		#ifdef USE_VECTOR_PROTECT
-			}                                                                       //End vectors protect
+		#ifdef USE_AES
+		AesCtrRow(row, sourceAddr.Val);                                             //RowFixup and the latches see the plain row
 		#endif
-
-		#ifdef USE_CONFIGWORD_PROTECT
-			}                                                                       //End config protect
+		#ifdef USE_SIGN
+		SignRow(row, sourceAddr.Val);                                               //Hashed as sent, mostly while it is written
 		#endif
 
-		#ifdef USE_BOOT_PROTECT
-			}                                                                       //End bootloader protect
+		if(sourceAddr.Val < FIXUP_END
+		#ifndef DEV_HAS_CONFIG_BITS
+		   || sourceAddr.Val + PM_ROW_SIZE/2 > CONFIG_END
 		#endif
+		   ) {
+			#ifdef USE_SIGN
+			SignFlush();                                                            //Before RowFixup changes it
+			#endif
+			RowFixup(row, sourceAddr.Val);                                          //Reset vector, AIVT, delay and config word rows only
+		}
 
 		#ifdef USE_RUNAWAY_PROTECT
-			writeKey1 += 4;                                                         //Modify keys to ensure proper program flow
-			writeKey2 -= 4;
+			writeKey1 += PM_ROW_SIZE;                                               //Modify keys to ensure proper program flow, 4 per instruction
+			writeKey2 -= PM_ROW_SIZE;
+			keyTest1 =  (0x0009 | temp) - length + bytesWritten - 5;                //Setup program flow protection test keys
+			keyTest2 =  (((0x557F << 1) + WT_FLASH) - bytesWritten) + 6;
 		#endif
 
-		if((bytesWritten % PM_ROW_SIZE) == 0) {                                     //Write to flash memory if complete row is finished
-			#ifdef USE_RUNAWAY_PROTECT
-				keyTest1 =  (0x0009 | temp) - length + bytesWritten - 5;            //Setup program flow protection test keys
-				keyTest2 =  (((0x557F << 1) + WT_FLASH) - bytesWritten) + 6;
-			#endif
-
-			#ifdef USE_BOOT_PROTECT                                                 //Protect the bootloader & reset vector
-				if((sourceAddr.Val < BOOT_ADDR_LOW || sourceAddr.Val > BOOT_ADDR_HI)) {
-			#endif
-
-			#ifdef USE_CONFIGWORD_PROTECT                                           //Do not erase last page
-				if(sourceAddr.Val < (CONFIG_START & 0xFFFC00)) {
-			#endif
-
-			#ifdef USE_VECTOR_PROTECT                                               //Do not erase first page
-				if(sourceAddr.Val >= VECTOR_SECTION) {
-			#endif
-
+		if(!RowProtected(sourceAddr.Val)) {
+			WriteRowLatch(sourceAddr.word.HW, sourceAddr.word.LW, row, PM_ROW_SIZE/PM_INSTR_SIZE);
 			WriteMem(PM_ROW_WRITE);                                                 //Execute write sequence
 
 			#ifdef USE_RUNAWAY_PROTECT
@@ -675,54 +1861,213 @@ void WritePM(WORD length, DWORD_VAL sourceAddr)
 				writeKey2 -= 6;
 			#endif
 
-			#ifdef USE_VECTOR_PROTECT
-				}                                                                   //End vectors protect
-			#endif
-
-			#ifdef USE_CONFIGWORD_PROTECT
-				}                                                                   //End config protect
-			#endif
-
-			#ifdef USE_BOOT_PROTECT
-				}                                                                   //End boot protect
+			#ifdef USE_VERIFY_RANGE                                                 //VERIFY_OK waits for a range over it, page 0 aside
+			if(sourceAddr.Val >= VECTOR_SECTION && ROW_NUM(sourceAddr.Val) < VERIFY_ROWS) {
+				unverifiedRows[ROW_NUM(sourceAddr.Val)/8] |= 1 << (ROW_NUM(sourceAddr.Val) % 8);
+			}
 			#endif
 		}
+		#ifdef USE_SIGN
+		SignFlush();                                                                //What the write left, buffer or lzRow is reused next
+		#endif
 
-		sourceAddr.Val = sourceAddr.Val + 2;                                        //Increment addr by 2
-	}                                                                               //End while((bytesWritten-5) < length*PM_ROW_SIZE)
+		sourceAddr.Val += PM_ROW_SIZE/2;                                            //Next row
+	}
 }
 
 /********************************************************************
-* Function:     void ErasePM(WORD length, DWORD_VAL sourceAddr)
+* Function:     void RowFixup(BYTE *row, DWORD rowAddr)
 *
-* PreCondition:
+* PreCondition: None
 *
-* Input:		length		- number of pages to erase
-*				sourceAddr 	- page aligned address to erase
+* Input:		row			- the row, 4 bytes per instruction
+*				rowAddr		- address of its first instruction
 *
 * Output:		None.
 *
-* Side Effects:	None.
+* Side Effects:	May set userReset, userResetRead and userTimeout.
 *
-* Overview:		Erases number of pages from flash memory
+* Overview:		Applies the per address rules WritePM has always had
+*				to the instructions of this row they name: the
+*				bootloader's reset vector in place of the image's,
+*				the image's one kept for USER_PROG_RESET, the delay
+*				taken out, the header and the AIVT UART handlers
+*				kept, bit 15 of the config word cleared.
 *
-* Note:			None
+* Note:			Called for rows below FIXUP_END and the config word
+*				row only, so the checks cost nothing elsewhere.
 ********************************************************************/
-void ErasePM(WORD length, DWORD_VAL sourceAddr)
+void RowFixup(BYTE *row, DWORD rowAddr)
 {
-	WORD i=0;
-	#ifdef USE_RUNAWAY_PROTECT
-	WORD temp = (WORD)sourceAddr.Val;
+	DWORD_VAL data;
+	BYTE *p;
+	#if (defined(USE_FAST_BOOT) && !defined(USE_DUAL_SLOT))
+	DWORD addr;
 	#endif
 
-	while(i<length) {
-		i++;
-		#ifdef USE_RUNAWAY_PROTECT
-			writeKey1++;                                                            //Modify keys to ensure proper program flow
-			writeKey2--;
-		#endif
+	#ifndef DEV_HAS_CONFIG_BITS                                                     //Flash configuration word handling
+	if(IN_ROW(CONFIG_END, rowAddr)) {                                               //Mask of bit 15 of CW1 to ensure it is programmed as 0 as noted in PIC24FJ datasheets
+		p = ROW_INSTR(row, rowAddr, CONFIG_END);
+		ROW_GET(p, data);
+		data.Val &= 0x007FFF;
+		ROW_SET(p, data);
+	}
+	#endif
 
-		#ifdef USE_BOOT_PROTECT                                                     //If protection enabled, protect BL and reset vector
+	#ifndef USE_DUAL_SLOT                                                           //The slot record decides userReset, see SlotBoot
+	if(IN_ROW(0x0, rowAddr)) {
+		p = ROW_INSTR(row, rowAddr, 0x0);
+		ROW_GET(p, data);
+		userReset.Val = data.Val & 0xFFFF;                                          //Get user app reset vector lo word
+		#ifdef USE_BOOT_PROTECT                                                     //Protect the bootloader & reset vector
+		data.Val = 0x040000 + (0xFFFF & BOOT_ADDR_LOW);                             //program low word of BL reset
+		ROW_SET(p, data);
+		#endif
+		userResetRead = 1;
+	}
+	if(IN_ROW(0x2, rowAddr)) {
+		p = ROW_INSTR(row, rowAddr, 0x2);
+		ROW_GET(p, data);
+		#ifdef USE_BOOT_PROTECT
+		userReset.Val += (DWORD)(data.Val & 0x00FF)<<16;                            //Get user app reset vector hi byte
+		data.Val = ((DWORD)(BOOT_ADDR_LOW & 0xFF0000))>>16;                         //Program high byte of BL reset
+		ROW_SET(p, data);
+		#else
+		userReset.Val |= ((DWORD)(data.Val & 0x00FF))<<16;                          //Get user app reset vector	hi byte
+		#endif
+		userResetRead = 1;
+	}
+
+	if(IN_ROW(USER_PROG_RESET, rowAddr)) {                                          //Put information from reset vector in user reset vector location
+		p = ROW_INSTR(row, rowAddr, USER_PROG_RESET);
+		if(userResetRead){                                                          //Has reset vector been grabbed from location 0x0?
+			ROW_SET(p, userReset);                                                  //If yes, use that reset vector
+		}else{
+			ROW_GET(p, userReset);                                                  //If no, use the user's indicated reset vector
+		}
+	}
+	#endif
+
+	data.Val = 0xFFFFFF;
+	if(IN_ROW(DELAY_TIME_ADDR, rowAddr)) {                                          //If address is delay timer location, store data and write empty word
+		p = ROW_INSTR(row, rowAddr, DELAY_TIME_ADDR);
+		if((p[0] & p[1] & p[2]) != 0xFF) {                                          //Blank, as in an image without one, keeps the delay
+			ROW_GET(p, userTimeout);
+		}
+		ROW_SET(p, data);
+	}
+	#if (defined(USE_FAST_BOOT) && !defined(USE_DUAL_SLOT))
+	for(addr = APP_HEADER_ADDR; addr < APP_HEADER_ADDR + 2*APP_HEADER_WORDS; addr += 2) {
+		if(IN_ROW(addr, rowAddr)) {                                                 //Header stays blank until VERIFY_OK writes it
+			ROW_SET(ROW_INSTR(row, rowAddr, addr), data);
+		}
+	}
+	#endif
+
+	#ifdef USE_UART_ISR                                                             //Keep the bootloader UART handlers in the AIVT
+	if(IN_ROW(UxRX_AIVT_ADDR, rowAddr)) {
+		data.Val = __builtin_tbladdress(UxRXInterrupt);
+		ROW_SET(ROW_INSTR(row, rowAddr, UxRX_AIVT_ADDR), data);
+	}
+	if(IN_ROW(UxTX_AIVT_ADDR, rowAddr)) {
+		data.Val = __builtin_tbladdress(UxTXInterrupt);
+		ROW_SET(ROW_INSTR(row, rowAddr, UxTX_AIVT_ADDR), data);
+	}
+	#endif
+}
+
+/********************************************************************
+* Function:     BOOL RowProtected(DWORD rowAddr)
+*
+* PreCondition: None
+*
+* Input:		rowAddr		- address of the first instruction of a row
+*
+* Output:		TRUE if WritePM must leave the row alone.
+*
+* Side Effects:	None.
+*
+* Overview:		Walks protectRegions, plus the slot that is not the
+*				target with USE_DUAL_SLOT. A row that overlaps a
+*				region at all is protected.
+*
+* Note:			None
+********************************************************************/
+BOOL RowProtected(DWORD rowAddr)
+{
+	const PM_REGION *region;
+
+	#ifdef USE_DUAL_SLOT                                                            //Only the target slot, the active one stays intact
+	if(!IN_TARGET(rowAddr)) {
+		return TRUE;
+	}
+	#endif
+
+	for(region = protectRegions; region->end; region++) {
+		if(rowAddr < region->end && rowAddr + PM_ROW_SIZE/2 > region->start) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/********************************************************************
+* Function:     void ErasePM(WORD length, DWORD_VAL sourceAddr)
+*
+* PreCondition:
+*
+* Input:		length		- number of pages to erase
+*				sourceAddr 	- page aligned address to erase
+*
+* Output:		None.
+*
+* Side Effects:	With USE_BLANK_CHECK puts the erased and skipped page
+*				counts into buffer, LSB first.
+*
+* Overview:		Erases number of pages from flash memory, with
+*				USE_BLANK_CHECK only those that are not blank already.
+*
+* Note:			None
+********************************************************************/
+void ErasePM(WORD length, DWORD_VAL sourceAddr)
+{
+	WORD i=0;
+	#ifdef USE_RUNAWAY_PROTECT
+	WORD temp = (WORD)sourceAddr.Val;
+	#endif
+	#ifdef USE_VERIFY_RANGE
+	WORD row;
+	#endif
+	#ifdef USE_BLANK_CHECK
+	WORD_VAL erased;
+	WORD_VAL skipped;
+
+	erased.Val = 0;
+	skipped.Val = 0;
+	#endif
+
+	while(i<length) {
+		i++;
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1++;                                                            //Modify keys to ensure proper program flow
+			writeKey2--;
+		#endif
+
+		#ifdef USE_ERASED_PAGES                                                     //WT_FLASH need not erase it again, protected or not
+			if(PAGE_NUM(sourceAddr.Val) < AUTO_ERASE_PAGES) {
+				erasedPages[PAGE_NUM(sourceAddr.Val)/8] |= 1 << (PAGE_NUM(sourceAddr.Val) % 8);
+			}
+		#endif
+
+		#ifdef USE_DUAL_SLOT                                                        //Page 0 and the active slot are never erased
+			if(IN_TARGET(sourceAddr.Val)) {
+		#endif
+
+		#ifdef USE_JOURNAL                                                          //Nor the journal, it outlives the update
+			if(sourceAddr.Val - JOURNAL_ADDR >= PM_PAGE_SIZE/2) {
+		#endif
+
+		#ifdef USE_BOOT_PROTECT                                                     //If protection enabled, protect BL and reset vector
 			if(sourceAddr.Val < BOOT_ADDR_LOW || sourceAddr.Val > BOOT_ADDR_HI) {   //Do not erase bootloader
 		#endif
 
@@ -739,6 +2084,29 @@ void ErasePM(WORD length, DWORD_VAL sourceAddr)
 			keyTest2 = (0x557F << 1) - ER_FLASH - i + 3;
 		#endif
 
+		#ifdef USE_UART_ISR
+			if(sourceAddr.Val < PM_PAGE_SIZE/2) {                                   //AIVT is blank until replaceBLVectors, hold off
+				SRbits.IPL = 7;                                                     //the UART interrupts, PollErase drains the FIFO
+			}
+		#endif
+
+		#ifdef USE_BLANK_CHECK                                                      //Page 0 always holds the BL reset, never blank
+		if(sourceAddr.Val >= PM_PAGE_SIZE/2 &&
+		   IsBlank(sourceAddr.word.HW, sourceAddr.word.LW, PM_PAGE_SIZE/PM_INSTR_SIZE)) {
+			skipped.Val++;                                                          //Nothing programmed, spare the NVM stall and the wear
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = 0x0000;                                                  //Keys as Erase would leave them
+				keyTest2 = 0xAAAA;
+			#endif
+		} else {
+			erased.Val++;
+		#endif
+
+		#ifdef USE_UART_ISR
+		if(sourceAddr.Val < PM_PAGE_SIZE/2) {
+			PollErase(sourceAddr.word.HW, sourceAddr.word.LW, PM_PAGE_ERASE);       //The tens of ms without interrupts
+		} else
+		#endif
 		Erase(sourceAddr.word.HW, sourceAddr.word.LW, PM_PAGE_ERASE);              	//Perform erase
 
 		#ifdef USE_RUNAWAY_PROTECT
@@ -746,6 +2114,28 @@ void ErasePM(WORD length, DWORD_VAL sourceAddr)
 			writeKey2 -= 3;
 		#endif
 
+		#ifdef USE_BLANK_CHECK
+		}
+		#endif
+
+		#ifdef USE_VERIFY_RANGE                                                     //Blank now, none of its rows is left to check
+			for(row = ROW_NUM(sourceAddr.Val); row < ROW_NUM(sourceAddr.Val + PM_PAGE_SIZE/2) && row < VERIFY_ROWS; row++) {
+				unverifiedRows[row/8] &= ~(1 << (row % 8));
+			}
+		#endif
+
+		#ifdef USE_UART_ISR
+			if(sourceAddr.Val < PM_PAGE_SIZE/2) {                                   //Put the bootloader UART vectors back into the AIVT
+				#ifdef USE_RUNAWAY_PROTECT
+					keyTest1 = (0x0009 | temp) + length + i;                        //Setup program flow protection test keys
+					keyTest2 = (0x557F << 1) - ER_FLASH - i;
+				#endif
+
+				replaceBLVectors();
+				SRbits.IPL = 0;
+			}
+		#endif
+
 		#ifdef USE_VECTOR_PROTECT
 			}                                                                       //End vectors protect
 		#elif  defined(USE_BOOT_PROTECT) || defined(USE_RESET_SAVE)
@@ -770,10 +2160,253 @@ void ErasePM(WORD length, DWORD_VAL sourceAddr)
 			}                                                                       //End bootloader protect
 		#endif
 
+		#ifdef USE_JOURNAL
+			}                                                                       //End journal protect
+		#endif
+
+		#ifdef USE_DUAL_SLOT
+			}                                                                       //End slot protect
+		#endif
+
 		sourceAddr.Val += PM_PAGE_SIZE/2;                                           //Increment by a page
 
 	}                                                                               //End while(i<length)
+
+	#ifdef USE_BLANK_CHECK
+	buffer[5] = erased.v[0];                                                        //Protected pages count as neither
+	buffer[6] = erased.v[1];
+	buffer[7] = skipped.v[0];
+	buffer[8] = skipped.v[1];
+	#endif
+}
+
+#ifdef USE_AUTO_ERASE
+/********************************************************************
+* Function:     void AutoErasePM(WORD length, DWORD_VAL sourceAddr)
+*
+* PreCondition: Keys as HandleCommand leaves them for a WT_FLASH.
+*
+* Input:		length		- number of rows about to be written
+*				sourceAddr 	- row aligned address of the first
+*
+* Output:		None.
+*
+* Side Effects:	Marks the pages in erasedPages.
+*
+* Overview:		With SESSION_AUTO_ERASE agreed, erases each page the
+*				rows reach that this session has not erased yet, as
+*				an ER_FLASH of that one page would: journal entry,
+*				protection, blank check and the bootloader reset
+*				vector put back into page 0.
+*
+* Note:			The host then sends only rows. A page it leaves out
+*				of the image keeps what it held.
+********************************************************************/
+void AutoErasePM(WORD length, DWORD_VAL sourceAddr)
+{
+	DWORD_VAL page;
+	DWORD end = sourceAddr.Val + (DWORD)length*(PM_ROW_SIZE/2);
+	WORD n;
+	#ifdef USE_RUNAWAY_PROTECT
+	WORD key1 = writeKey1;
+	WORD key2 = writeKey2;
+	#endif
+	#ifdef USE_BLANK_CHECK
+	BYTE saved[4];
+	#endif
+
+	if(!autoErase) {
+		return;
+	}
+
+	for(page.Val = sourceAddr.Val & ~(DWORD)(PM_PAGE_SIZE/2 - 1); page.Val < end; page.Val += PM_PAGE_SIZE/2) {
+		n = PAGE_NUM(page.Val);
+		if(n >= AUTO_ERASE_PAGES || (erasedPages[n/8] & (1 << (n % 8)))) {
+			continue;
+		}
+
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 = key1 - (0x0009 | (WORD)sourceAddr.Val) + (0x0009 | (WORD)page.Val) + 1;
+			writeKey2 = key2 - ER_FLASH; //Keys as an ER_FLASH of this one page has them
+		#endif
+
+		#ifdef USE_JOURNAL
+		#ifdef USE_RUNAWAY_PROTECT
+			keyTest1 = (0x0009 | (WORD)page.Val) + 1;                               //Setup program flow protection test keys
+			keyTest2 = (0x557F << 1) - ER_FLASH;
+		#endif
+		JournalAdd(JOURNAL_ERASE, page, PM_PAGE_SIZE/PM_ROW_SIZE);
+		#endif
+
+		#ifdef USE_BLANK_CHECK
+		for(n = 0; n < 4; n++) {                                                    //ErasePM puts its counts over the first row
+			saved[n] = buffer[5 + n];
+		}
+		#endif
+
+		ErasePM(1, page);                                                           //Marks the page
+
+		#ifdef USE_BLANK_CHECK
+		for(n = 0; n < 4; n++) {
+			buffer[5 + n] = saved[n];
+		}
+		#endif
+	}
+
+	#ifdef USE_RUNAWAY_PROTECT
+		writeKey1 = key1;                                                           //Back to the WT_FLASH program flow
+		writeKey2 = key2;
+	#endif
+}
+#endif
+
+#ifdef USE_BATCH
+/********************************************************************
+* Function:     WORD BatchPM(WORD count)
+*
+* PreCondition: A BATCH frame in buffer, packetLength set.
+*
+* Input:		count		- sub-commands in the frame
+*
+* Output:		Reply length: the BATCH header, then BATCH_RESULT_SIZE
+*				bytes for each sub-command, its status and what its
+*				own reply would have carried: the erased and skipped
+*				page counts of an ER_FLASH with USE_BLANK_CHECK, the
+*				device's CRC for a VERIFY_RANGE, zeros otherwise.
+*
+* Side Effects:	buffer, sourceAddr and the keys are overwritten.
+*
+* Overview:		Each sub-command is a command, a 16-bit length and a
+*				24-bit address, then its data: length rows for
+*				WT_FLASH, end address and CRC for VERIFY_RANGE,
+*				nothing for ER_FLASH and VERIFY_OK. Its data is moved
+*				down to buffer[5] and its header put in front, so
+*				HandleCommand runs it as the frame it would otherwise
+*				have come in. The first that fails stops the batch,
+*				the rest are BATCH_SKIPPED.
+*
+* Note:			The data only moves down, never over a sub-command
+*				still to come. A repeated BATCH is only acked, see
+*				HandleCommand; its VERIFY_RANGE tells the host what
+*				the statuses would have.
+********************************************************************/
+WORD BatchPM(WORD count)
+{
+	DWORD dataBytes;
+	WORD pos = 5;
+	WORD end = packetLength - CHECK_BYTES;                                          //Less the checksum
+	WORD length;
+	WORD i;
+	WORD k;
+	BYTE cmd;
+	BYTE status = BATCH_OK;
+	BYTE expect[4];
+	BYTE addr[3];
+	BYTE *result = batchResult;
+
+	#ifdef USE_WINDOW
+	if(windowSize > 1) {
+		end--;                                                                      //and the sequence number
+	}
+	#endif
+	addr[0] = buffer[2];
+	addr[1] = buffer[3];
+	addr[2] = buffer[4];
+
+	for(i = 0; i < count; i++, result += BATCH_RESULT_SIZE) {
+		asm("clrwdt");
+		for(k = 1; k < BATCH_RESULT_SIZE; k++) {
+			result[k] = 0;
+		}
+		if(status != BATCH_OK) {
+			result[0] = BATCH_SKIPPED;
+			continue;
+		}
+
+		status = BATCH_BAD;
+		result[0] = status;
+		if(pos + BATCH_HEADER_SIZE > end) {
+			continue;
+		}
+		cmd = buffer[pos];
+		length = buffer[pos+1] | (WORD)buffer[pos+2] << 8;
+		dataBytes = (cmd == WT_FLASH) ? (DWORD)length*PM_ROW_SIZE : (cmd == VERIFY_RANGE) ? 7 : 0;
+		if((cmd != WT_FLASH && cmd != ER_FLASH && cmd != VERIFY_RANGE && cmd != VERIFY_OK) ||
+		   length == 0 || pos + BATCH_HEADER_SIZE + dataBytes > end
+		   #ifndef USE_LARGE_PACKETS
+		   || buffer[pos+2] != 0
+		   #endif
+		   ) {
+			continue;                                                               //Length 0 would be RESET
+		}
+
+		buffer[0] = cmd;                                                            //The frame HandleCommand expects
+		buffer[1] = buffer[pos+1];
+		#ifdef USE_LARGE_PACKETS
+		lengthHi = buffer[pos+2];
+		#endif
+		buffer[2] = buffer[pos+3];
+		buffer[3] = buffer[pos+4];
+		buffer[4] = buffer[pos+5];
+		pos += BATCH_HEADER_SIZE;
+		for(k = 0; k < (WORD)dataBytes; k++) {
+			buffer[5 + k] = buffer[pos + k];
+		}
+		pos += (WORD)dataBytes;
+		for(k = 0; k < 4; k++) {
+			expect[k] = buffer[8 + k];                                              //VERIFY_RANGE CRC, its reply goes over it
+		}
+
+		status = BATCH_OK;
+		#ifdef USE_VERIFY_RANGE
+		if(cmd == VERIFY_OK && (verifyState != VERIFY_MATCH                         //As VERIFY_OK will find it, a commit clears it
+		   #ifdef USE_DUAL_SLOT
+		   || slotEnd.Val == 0
+		   #endif
+		   #ifdef USE_SIGN
+		   || !SignValid()
+		   #endif
+		   )) {
+			status = BATCH_NOT_VERIFIED;
+		}
+		#endif
+
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 = 0xFFFF;                                                     //Keys as the main loop hands them on
+			writeKey2 = 0x5555;
+			writeKey1 += 10;
+			writeKey2 += 42;
+		#endif
+		HandleCommand();
+
+		if(cmd == VERIFY_RANGE && responseBytes != 9) {
+			status = BATCH_BAD;                                                     //Empty or inverted range, no digest
+		} else if(cmd == VERIFY_RANGE && (buffer[5] != expect[0] || buffer[6] != expect[1] ||
+										  buffer[7] != expect[2] || buffer[8] != expect[3])) {
+			status = BATCH_MISMATCH;
+		}
+		if((cmd == VERIFY_RANGE || cmd == ER_FLASH) && responseBytes == 9) {
+			for(k = 1; k < BATCH_RESULT_SIZE; k++) {
+				result[k] = buffer[4 + k];                                          //Before the next sub-command moves over it
+			}
+		}
+		result[0] = status;
+	}
+
+	buffer[0] = BATCH;
+	buffer[1] = (BYTE)count;
+	#ifdef USE_LARGE_PACKETS
+	lengthHi = (BYTE)(count >> 8);
+	#endif
+	buffer[2] = addr[0];
+	buffer[3] = addr[1];
+	buffer[4] = addr[2];
+	for(i = 0; i < count*BATCH_RESULT_SIZE; i++) {
+		buffer[5 + i] = batchResult[i];
+	}
+	return 5 + count*BATCH_RESULT_SIZE;
 }
+#endif
 
 /********************************************************************
 * Function:     void WriteTimeout()
@@ -841,78 +2474,6 @@ void WriteTimeout()
 
 }
 
-/*********************************************************************
-* Function:     void AutoBaud()
-*
-* PreCondition: UART Setup
-*
-* Input:		None.
-*
-* Output:		None.
-*
-* Side Effects:	Resets WDT.
-*
-* Overview:		Sets autobaud mode and waits for completion.
-*
-* Note:			Contains code to handle UART errata issues for
-				PIC24FJ128 family parts, A2 and A3 revs.
-********************************************************************/
-void AutoBaud()
-{
-	BYTE dummy;
-	UxMODEbits.ABAUD = 1;                                                           //Set autobaud mode
-
-	while(UxMODEbits.ABAUD)	{                                                       //Wait for sync character 0x55
-		asm("clrwdt");                                                              //looping code so clear WDT
-		if(IFS0bits.T3IF == 1) {                                                    //if timer expired, jump to user code
-			ResetDevice(userReset.Val);
-		}
-		if(UxSTAbits.OERR) UxSTAbits.OERR = 0;
-		if(UxSTAbits.URXDA) dummy = UxRXREG;
-	}
-
-	#ifdef USE_WORKAROUNDS                                                          //Workarounds for autobaud errata in some silicon revisions
-		if(UxBRG == 0xD) UxBRG--;                                                   //Workaround for autobaud innaccuracy
-		if(UxBRG == 0x1A) UxBRG--;
-		if(UxBRG == 0x09) UxBRG--;
-
-		#ifdef USE_HI_SPEED_BRG                                                     //Workarounds for ABAUD incompatability w/ BRGH = 1
-			UxBRG = (UxBRG+1)*4 -1;
-			if(UxBRG == 0x13) UxBRG=0x11;
-			if(UxBRG == 0x1B) UxBRG=0x19;
-			if(UxBRG == 0x08) UxBRG=0x22;
-
-			if (UxBRG & 0x0001)	UxBRG++;                                            //Workaround for Odd BRG recieve error when BRGH = 1
-		#endif
-	#endif
-
-}
-
-#ifdef DEV_HAS_PPS
-/*********************************************************************
-* Function:     void ioMap()
-*
-* PreCondition: None.
-*
-* Input:		None.
-*
-* Output:		None.
-*
-* Side Effects:	Locks IOLOCK bit.
-*
-* Overview:		Maps UART IO for communications on PPS devices.
-*
-* Note:			None.
-********************************************************************/
-void ioMap()
-{
-	__builtin_write_OSCCONL(OSCCON & 0xFFBF);                                       //Clear the IOLOCK bit
-	PPS_URX_REG = PPS_URX_PIN;                                                      //UxRX = RP19
-	PPS_UTX_PIN = UxTX_IO;                                                          //RP25 = UxTX
-	__builtin_write_OSCCONL(OSCCON | 0x0040);                                       //Lock the IOLOCK bit so that the IO is not accedentally changed.
-}
-#endif
-
 #if defined(USE_BOOT_PROTECT) || defined(USE_RESET_SAVE)
 /*********************************************************************
 * Function:     void replaceBLReset(DWORD_VAL sourceAddr)
@@ -986,3 +2547,1245 @@ void replaceBLReset(DWORD_VAL sourceAddr)
 
 }
 #endif
+
+#ifdef USE_UART_ISR
+/*********************************************************************
+* Function:     void replaceBLVectors()
+*
+* PreCondition: Page containing the AIVT has just been erased.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Writes the bootloader UART RX/TX handler addresses back
+*				into their AIVT slots
+*
+* Note:			None.
+********************************************************************/
+void replaceBLVectors()
+{
+	DWORD_VAL data;
+	#ifndef DEV_HAS_WORD_WRITE
+		DWORD_VAL address;
+		WORD i;
+	#endif
+	#ifdef USE_RUNAWAY_PROTECT
+		WORD tempkey1;
+		WORD tempkey2;
+
+		tempkey1 = keyTest1;
+		tempkey2 = keyTest2;
+	#endif
+
+	#ifdef DEV_HAS_WORD_WRITE                                                       //Write both vectors with word writes
+		data.Val = __builtin_tbladdress(UxRXInterrupt);
+		WriteLatch(0, UxRX_AIVT_ADDR, data.word.HW, data.word.LW);
+
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 += 5;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 6;
+		#endif
+		WriteMem(PM_WORD_WRITE);
+
+		data.Val = __builtin_tbladdress(UxTXInterrupt);
+		WriteLatch(0, UxTX_AIVT_ADDR, data.word.HW, data.word.LW);
+
+		#ifdef USE_RUNAWAY_PROTECT
+			keyTest1 = tempkey1;
+			keyTest2 = tempkey2;
+			writeKey1 += 5;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 6;
+		#endif
+		WriteMem(PM_WORD_WRITE);
+
+	#else                                                                           //Otherwise rewrite the AIVT row, other words stay erased
+		address.Val = UxRX_AIVT_ADDR & ~((DWORD)PM_ROW_SIZE/2 - 1);
+		for(i = 0; i < PM_ROW_SIZE/2; i += 2) {
+			data.Val = 0xFFFFFF;
+			if(address.Val + i == UxRX_AIVT_ADDR) {
+				data.Val = __builtin_tbladdress(UxRXInterrupt);
+			}
+			if(address.Val + i == UxTX_AIVT_ADDR) {
+				data.Val = __builtin_tbladdress(UxTXInterrupt);
+			}
+			WriteLatch(address.word.HW, address.word.LW + i, data.word.HW, data.word.LW);
+		}
+
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 += 5;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 6;
+		#endif
+		WriteMem(PM_ROW_WRITE);
+	#endif
+}
+#endif
+
+#ifdef USE_DUAL_SLOT
+/*********************************************************************
+* Function:     BYTE SlotBoot(void)
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		Entry delay committed with the slot, 0xFF if neither
+*				slot is valid.
+*
+* Side Effects:	Sets userReset, activeSlot and targetSlot. May
+*				rewrite the vector page.
+*
+* Overview:		Picks the slot of the newest record and checks its
+*				image against the recorded CRC. If that fails the newest
+*				record of the other slot is tried. The vector page is
+*				made to point at the slot chosen, with neither the
+*				bootloader stays in charge.
+*
+* Note:			A full slot takes about a quarter of a second to check.
+********************************************************************/
+BYTE SlotBoot(void)
+{
+	DWORD_VAL entry;
+	DWORD_VAL commit;
+	BYTE slot = 0;
+	BYTE pass;
+
+	entry.Val = SlotFind(SLOT_ANY);                                                 //Newest switch-over
+	if(entry.Val != 0) {
+		slot = (BYTE)ReadLatch(entry.word.HW, entry.word.LW + 6);
+	}
+
+	for(pass = 0; pass < 2; pass++) {
+		entry.Val = SlotFind(slot);
+		if(entry.Val != 0 && SlotCheck(entry.Val)) {
+			activeSlot = slot;
+			targetSlot = slot ^ 1;
+			userReset.Val = SLOT_VECTOR_ADDR;                                       //ResetDevice() only reaches 16 bits, the goto there reaches the slot
+
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = 0xFFFF;                                                  //Setup program flow protection test keys
+				keyTest2 = 0x5555;
+			#endif
+			SlotVectors(slot);                                                      //Also repairs a switch-over cut short
+			#ifdef USE_RUNAWAY_PROTECT
+				keyTest1 = 0x0000;
+				keyTest2 = 0xAAAA;
+			#endif
+
+			commit.Val = ReadLatch(entry.word.HW, entry.word.LW + 6);
+			return commit.v[1];
+		}
+		slot ^= 1;                                                                  //Fall back to the other slot
+	}
+
+	activeSlot = SLOT_NONE;
+	targetSlot = 0;
+	userReset.Val = BOOT_ADDR_LOW;                                                  //Nothing to run, stay in the bootloader
+	return 0xFF;
+}
+
+/*********************************************************************
+* Function:     WORD SlotCount(DWORD page)
+*
+* PreCondition: None.
+*
+* Input:		page - first address of a record page
+*
+* Output:		Records in use, committed or not.
+*
+* Side Effects:	None.
+*
+* Overview:		Records are appended, the first blank one ends the page.
+*
+* Note:			None.
+********************************************************************/
+WORD SlotCount(DWORD page)
+{
+	DWORD_VAL entry;
+	WORD n;
+
+	entry.Val = page;
+	for(n = 0; n < SLOT_ENTRIES; n++) {
+		if(IsBlank(entry.word.HW, entry.word.LW, SLOT_ENTRY_SIZE/2)) {
+			break;
+		}
+		entry.Val += SLOT_ENTRY_SIZE;
+	}
+	return n;
+}
+
+/*********************************************************************
+* Function:     DWORD SlotPage(void)
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		First address of the record page in use.
+*
+* Side Effects:	None.
+*
+* Overview:		The second page is in use once it has a record and the
+*				first is blank or full, otherwise the first is. A full
+*				page stays until the other one takes the next record.
+*
+* Note:			None.
+********************************************************************/
+DWORD SlotPage(void)
+{
+	WORD first = SlotCount(SLOT_RECORD_ADDR);
+
+	if(SlotCount(SLOT_RECORD_ADDR + PM_PAGE_SIZE/2) != 0 && (first == 0 || first == SLOT_ENTRIES)) {
+		return SLOT_RECORD_ADDR + PM_PAGE_SIZE/2;
+	}
+	return SLOT_RECORD_ADDR;
+}
+
+/*********************************************************************
+* Function:     DWORD SlotFind(BYTE slot)
+*
+* PreCondition: None.
+*
+* Input:		slot - 0 for A, 1 for B or SLOT_ANY
+*
+* Output:		Address of the newest committed record for slot, 0 if
+*				there is none.
+*
+* Side Effects:	None.
+*
+* Overview:		Searches the page in use from its last record back,
+*				then the other page. Records whose commit word was
+*				never written are skipped.
+*
+* Note:			None.
+********************************************************************/
+DWORD SlotFind(BYTE slot)
+{
+	DWORD_VAL page;
+	DWORD_VAL entry;
+	DWORD_VAL commit;
+	WORD n;
+	BYTE pass;
+
+	page.Val = SlotPage();
+	for(pass = 0; pass < 2; pass++) {
+		n = SlotCount(page.Val);
+		while(n-- > 0) {
+			entry.Val = page.Val + (DWORD)n*SLOT_ENTRY_SIZE;
+			commit.Val = ReadLatch(entry.word.HW, entry.word.LW + 6);
+			if(commit.v[2] == SLOT_MAGIC && commit.v[0] < 2 && (slot == SLOT_ANY || commit.v[0] == slot)) {
+				return entry.Val;
+			}
+		}
+		page.Val = OTHER_PAGE(page.Val);                                            //Then the older page
+	}
+	return 0;
+}
+
+/*********************************************************************
+* Function:     BOOL SlotCheck(DWORD record)
+*
+* PreCondition: record is committed, see SlotFind
+*
+* Input:		record - address of a slot record
+*
+* Output:		TRUE if the slot still holds the image it recorded.
+*
+* Side Effects:	None.
+*
+* Overview:		Runs CrcPM over the range VERIFY_RANGE checked before
+*				the switch-over and compares it with the recorded CRC.
+*
+* Note:			None.
+********************************************************************/
+BOOL SlotCheck(DWORD record)
+{
+	DWORD_VAL entry;
+	DWORD_VAL base;
+	DWORD_VAL end;
+	DWORD_VAL crc;
+
+	entry.Val = record;
+	end.Val = ReadLatch(entry.word.HW, entry.word.LW);
+	crc.word.LW = (WORD)ReadLatch(entry.word.HW, entry.word.LW + 2);
+	crc.word.HW = (WORD)ReadLatch(entry.word.HW, entry.word.LW + 4);
+	base.Val = SLOT_BASE((BYTE)ReadLatch(entry.word.HW, entry.word.LW + 6));
+
+	if(end.Val <= base.Val || end.Val > base.Val + SLOT_SIZE) {
+		return FALSE;
+	}
+	return CrcPM((end.Val - base.Val + 1)/2, base) == crc.Val;
+}
+
+/*********************************************************************
+* Function:     void SlotCommit(void)
+*
+* PreCondition: VERIFY_RANGE matched from the target slot base,
+*				program flow protection keys set up by the caller.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	Target slot becomes the active one, userReset follows.
+*
+* Overview:		Appends a record of the verified range with word
+*				writes. The commit word goes last, until it is written
+*				the old slot boots, from then on the new one. Then
+*				points the vector page at the new slot.
+*
+* Note:			A full page moves the records to the other page, which
+*				is erased first. The full page is still in use until
+*				the new record is committed.
+********************************************************************/
+void SlotCommit(void)
+{
+	DWORD_VAL entry;
+	WORD n;
+	#ifdef USE_RUNAWAY_PROTECT
+		WORD tempkey1 = keyTest1;
+		WORD tempkey2 = keyTest2;
+	#endif
+
+	entry.Val = SlotPage();
+	n = SlotCount(entry.Val);
+	if(n == SLOT_ENTRIES) {
+		entry.Val = OTHER_PAGE(entry.Val);
+		n = 0;
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 -= 7;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 3;
+		#endif
+		Erase(entry.word.HW, entry.word.LW, PM_PAGE_ERASE);
+		#ifdef USE_RUNAWAY_PROTECT
+			keyTest1 = tempkey1;
+			keyTest2 = tempkey2;
+		#endif
+	}
+	entry.Val += (DWORD)n*SLOT_ENTRY_SIZE;
+
+	WriteWordPM(entry, slotEnd.Val);
+	entry.Val += 2;
+	WriteWordPM(entry, slotCrc.word.LW);
+	entry.Val += 2;
+	WriteWordPM(entry, slotCrc.word.HW);
+	entry.Val += 2;
+	WriteWordPM(entry, ((DWORD)SLOT_MAGIC << 16) | ((WORD)userTimeout.v[0] << 8) | targetSlot);//Commit
+
+	SlotVectors(targetSlot);
+	#ifdef USE_RUNAWAY_PROTECT
+		keyTest1 = 0x0000;
+		keyTest2 = 0xAAAA;
+	#endif
+
+	activeSlot = targetSlot;
+	targetSlot ^= 1;
+	userReset.Val = SLOT_VECTOR_ADDR;
+	slotEnd.Val = 0;
+}
+
+/*********************************************************************
+* Function:     void SlotVectors(BYTE slot)
+*
+* PreCondition: Program flow protection keys set up by the caller.
+*
+* Input:		slot - 0 for A, 1 for B
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Rewrites the vector page, one goto per entry of the
+*				slot's own .application_ivt, unless it already points
+*				there. The IVT in page 0 never changes.
+*
+* Note:			Leaves the keys set up if nothing was written.
+********************************************************************/
+void SlotVectors(BYTE slot)
+{
+	DWORD_VAL addr;
+	DWORD_VAL data;
+	DWORD target;
+	WORD i;
+	#ifdef USE_RUNAWAY_PROTECT
+		WORD tempkey1 = keyTest1;
+		WORD tempkey2 = keyTest2;
+	#endif
+
+	addr.Val = SLOT_VECTOR_ADDR;
+	for(i = 0; i < SLOT_VECTORS; i++, addr.Val += 4) {
+		target = SLOT_BASE(slot) + 4*(DWORD)i;
+		if(ReadLatch(addr.word.HW, addr.word.LW) != (0x040000 | (target & 0xFFFF)) ||
+		   ReadLatch(addr.word.HW, addr.word.LW + 2) != target >> 16) {
+			break;
+		}
+	}
+	if(i == SLOT_VECTORS) {
+		return;
+	}
+
+	addr.Val = SLOT_VECTOR_ADDR;
+	#ifdef USE_RUNAWAY_PROTECT
+		writeKey1 -= 7;                                                             //Modify keys to ensure proper program flow
+		writeKey2 -= 3;
+	#endif
+	Erase(addr.word.HW, addr.word.LW, PM_PAGE_ERASE);
+
+	while(addr.Val < SLOT_VECTOR_ADDR + 4*SLOT_VECTORS) {                           //Rows of gotos, blank after the last
+		for(i = 0; i < PM_ROW_SIZE/PM_INSTR_SIZE; i++, addr.Val += 2) {
+			target = SLOT_BASE(slot) + (addr.Val - SLOT_VECTOR_ADDR)/4*4;
+			if(addr.Val >= SLOT_VECTOR_ADDR + 4*SLOT_VECTORS) {
+				data.Val = 0xFFFFFF;
+			} else if((addr.Val & 2) == 0) {
+				data.Val = 0x040000 | (target & 0xFFFF);                            //goto low word
+			} else {
+				data.Val = target >> 16;                                            //and high byte
+			}
+			WriteLatch(addr.word.HW, addr.word.LW, data.word.HW, data.word.LW);
+		}
+
+		#ifdef USE_RUNAWAY_PROTECT
+			keyTest1 = tempkey1;
+			keyTest2 = tempkey2;
+			writeKey1 += 5;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 6;
+		#endif
+		WriteMem(PM_ROW_WRITE);
+	}
+}
+#endif
+
+#ifdef USE_FAST_BOOT
+/*********************************************************************
+* Function:     BOOL BootRequested(void)
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		TRUE if the bootloader is asked for.
+*
+* Side Effects:	Clears bootMagic. Watching for a break uses the UART
+*				and Timer2/3 for BOOT_BREAK_US.
+*
+* Overview:		Entry conditions that keep the bootloader in charge
+*				over a valid application: BOOT_MAGIC left in RAM by the
+*				application before a software reset, the BOOT_PIN_ACTIVE
+*				strap, or a break held on RX through the reset.
+*
+* Note:			The magic is cleared whatever the outcome, so the
+*				next reset boots the application again.
+********************************************************************/
+BOOL BootRequested(void)
+{
+	if(bootMagic == BOOT_MAGIC) {
+		bootMagic = 0;
+		return TRUE;
+	}
+
+	#ifdef BOOT_PIN_ACTIVE
+	if(BOOT_PIN_ACTIVE()) {
+		return TRUE;
+	}
+	#endif
+
+	#if (BOOT_BREAK_US > 0)
+	if(TransportBreak((DWORD)(FCY/1000000) * BOOT_BREAK_US)) {
+		return TRUE;
+	}
+	#endif
+	return FALSE;
+}
+
+/*********************************************************************
+* Function:     BOOL AppValid(void)
+*
+* PreCondition: SlotBoot called with USE_DUAL_SLOT.
+*
+* Input:		None.
+*
+* Output:		TRUE if the application may run without the delay.
+*
+* Side Effects:	None.
+*
+* Overview:		With USE_DUAL_SLOT the slot record is the header and
+*				SlotBoot has checked it. Otherwise the header in page 0
+*				must carry APP_VALID and, with FAST_BOOT_CRC, the
+*				range it names must still match its CRC.
+*
+* Note:			The check runs at about the speed of VERIFY_RANGE.
+********************************************************************/
+BOOL AppValid(void)
+{
+	#ifdef USE_DUAL_SLOT
+	return activeSlot != SLOT_NONE;
+	#else
+	DWORD_VAL addr;
+	DWORD_VAL start;
+	DWORD_VAL end;
+	DWORD_VAL crc;
+
+	addr.Val = APP_HEADER_ADDR;
+	if(ReadLatch(addr.word.HW, addr.word.LW + 8) != APP_VALID || userReset.Val == BOOT_ADDR_LOW) {
+		return FALSE;
+	}
+
+	#ifdef FAST_BOOT_CRC
+	start.Val = ReadLatch(addr.word.HW, addr.word.LW);
+	end.Val = ReadLatch(addr.word.HW, addr.word.LW + 2);
+	crc.word.LW = (WORD)ReadLatch(addr.word.HW, addr.word.LW + 4);
+	crc.word.HW = (WORD)ReadLatch(addr.word.HW, addr.word.LW + 6);
+	if(end.Val <= start.Val || CrcPM((end.Val - start.Val + 1)/2, start) != crc.Val) {
+		return FALSE;
+	}
+	#endif
+	return TRUE;
+	#endif
+}
+
+#ifndef USE_DUAL_SLOT
+/*********************************************************************
+* Function:     void WriteHeader(void)
+*
+* PreCondition: Program flow protection keys set up by the caller,
+*				headerEnd non-zero.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Writes the application header for the span of the
+*				matching VERIFY_RANGEs, APP_VALID last. The CRC is
+*				taken again over the whole span, gaps included, so
+*				AppValid can check it in one pass.
+*
+* Note:			The header words are only written when blank, which
+*				they are once page 0 has been erased and rewritten.
+*				With USE_DUAL_SLOT the slot record takes its place.
+********************************************************************/
+void WriteHeader(void)
+{
+	DWORD_VAL addr;
+	DWORD_VAL crc;
+
+	addr.Val = APP_HEADER_ADDR;
+	if(!IsBlank(addr.word.HW, addr.word.LW, APP_HEADER_WORDS)) {
+		return;                                                                     //Page 0 was left alone, keep what is there
+	}
+	crc.Val = CrcPM((headerEnd.Val - headerStart.Val + 1)/2, headerStart);
+
+	WriteWordPM(addr, headerStart.Val);
+	addr.Val += 2;
+	WriteWordPM(addr, headerEnd.Val);
+	addr.Val += 2;
+	WriteWordPM(addr, crc.word.LW);
+	addr.Val += 2;
+	WriteWordPM(addr, crc.word.HW);
+	addr.Val += 2;
+	WriteWordPM(addr, APP_VALID);
+	headerEnd.Val = 0;
+}
+#endif
+#endif
+
+#ifdef USE_JOURNAL
+/*********************************************************************
+* Function:     void JournalInit(void)
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	journalNext set.
+*
+* Overview:		Finds the first blank word after the tag, where the
+*				next entry goes. Without a tag no journal is open and
+*				nothing is recorded until JOURNAL_BEGIN.
+*
+* Note:			None.
+********************************************************************/
+void JournalInit(void)
+{
+	DWORD_VAL addr;
+
+	addr.Val = JOURNAL_ADDR;
+	journalNext = 0;
+	if((ReadLatch(addr.word.HW, addr.word.LW) & 0xFF0000) != JOURNAL_TAG_WORD(0, 0) ||
+	   (ReadLatch(addr.word.HW, addr.word.LW + 2) & 0xFF0000) != JOURNAL_TAG_WORD(1, 0)) {
+		return;
+	}
+	for(journalNext = 2; journalNext < JOURNAL_WORDS; journalNext++) {
+		if(IsBlank(addr.word.HW, addr.word.LW + 2*journalNext, 1)) {
+			break;
+		}
+	}
+}
+
+/*********************************************************************
+* Function:     void JournalBegin(DWORD_VAL tag)
+*
+* PreCondition: Program flow protection keys set up by the caller.
+*
+* Input:		tag - the host's name for the image, kept with the journal
+*
+* Output:		None.
+*
+* Side Effects:	Entries of an earlier update are lost.
+*
+* Overview:		Erases the journal page unless it is blank already
+*				and writes the tag, from then on every erase and write
+*				is recorded.
+*
+* Note:			None.
+********************************************************************/
+void JournalBegin(DWORD_VAL tag)
+{
+	DWORD_VAL addr;
+	#ifdef USE_RUNAWAY_PROTECT
+		WORD tempkey1 = keyTest1;
+		WORD tempkey2 = keyTest2;
+	#endif
+
+	addr.Val = JOURNAL_ADDR;
+	if(!IsBlank(addr.word.HW, addr.word.LW, JOURNAL_WORDS)) {
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 -= 7;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 3;
+		#endif
+		Erase(addr.word.HW, addr.word.LW, PM_PAGE_ERASE);
+		#ifdef USE_RUNAWAY_PROTECT
+			keyTest1 = tempkey1;
+			keyTest2 = tempkey2;
+		#endif
+	}
+
+	WriteWordPM(addr, JOURNAL_TAG_WORD(0, tag.word.LW));
+	addr.Val += 2;
+	WriteWordPM(addr, JOURNAL_TAG_WORD(1, tag.word.HW));
+	journalNext = 2;
+
+	#ifdef USE_RUNAWAY_PROTECT
+		keyTest1 = 0x0000;
+		keyTest2 = 0xAAAA;
+	#endif
+}
+
+/*********************************************************************
+* Function:     void JournalAdd(BYTE type, DWORD_VAL addr, WORD rows)
+*
+* PreCondition: Program flow protection keys set up by the caller.
+*
+* Input:		type - JOURNAL_ERASE, JOURNAL_WRITE or JOURNAL_VERIFY
+*				addr - first address of the range
+*				rows - rows in the range
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Appends one entry with a word write, 45us against the
+*				2ms of a row. Called before the erase or write, so an
+*				operation cut short by a reset is always the last
+*				entry; every earlier one has finished.
+*
+* Note:			With no journal open, or a full one, nothing is
+*				written. A full journal misses later operations and
+*				JournalReply lets the host see that it is full.
+********************************************************************/
+void JournalAdd(BYTE type, DWORD_VAL addr, WORD rows)
+{
+	DWORD_VAL entry;
+
+	if(journalNext < 2 || journalNext >= JOURNAL_WORDS || JOURNAL_ROW(addr.Val) > JOURNAL_MAX_ROWS) {
+		return;
+	}
+	if(rows > JOURNAL_MAX_ROWS) {
+		rows = JOURNAL_MAX_ROWS;                                                    //Still reaches past the end of flash
+	}
+
+	entry.Val = JOURNAL_ADDR + 2*journalNext;
+	WriteWordPM(entry, JOURNAL_ENTRY(type, JOURNAL_ROW(addr.Val), rows));
+	journalNext++;
+
+	#ifdef USE_RUNAWAY_PROTECT
+		keyTest1 = 0x0000;
+		keyTest2 = 0xAAAA;
+	#endif
+}
+
+/*********************************************************************
+* Function:     void JournalClose(void)
+*
+* PreCondition: Program flow protection keys set up by the caller.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Erases the journal once VERIFY_OK has committed the
+*				image, there is nothing left to resume.
+*
+* Note:			None.
+********************************************************************/
+void JournalClose(void)
+{
+	DWORD_VAL addr;
+
+	addr.Val = JOURNAL_ADDR;
+	if(!IsBlank(addr.word.HW, addr.word.LW, JOURNAL_WORDS)) {
+		#ifdef USE_RUNAWAY_PROTECT
+			writeKey1 -= 7;                                                         //Modify keys to ensure proper program flow
+			writeKey2 -= 3;
+		#endif
+		Erase(addr.word.HW, addr.word.LW, PM_PAGE_ERASE);
+	}
+	journalNext = 0;
+
+	#ifdef USE_RUNAWAY_PROTECT
+		keyTest1 = 0x0000;
+		keyTest2 = 0xAAAA;
+	#endif
+}
+
+/*********************************************************************
+* Function:     WORD JournalReply(WORD first, WORD length)
+*
+* PreCondition: None.
+*
+* Input:		first	- number of the first entry to send
+*				length	- most entries to send
+*
+* Output:		Entries put into the reply.
+*
+* Side Effects:	None.
+*
+* Overview:		Fills buffer from buffer[5]: the number of entries and
+*				the most the page holds, 0 with no journal open, 16 bits
+*				each, the tag, then 3 bytes per entry, all LSB first.
+*
+* Note:			The tag is not counted as an entry.
+********************************************************************/
+WORD JournalReply(WORD first, WORD length)
+{
+	DWORD_VAL addr;
+	DWORD_VAL word;
+	WORD count = journalNext ? journalNext - 2 : 0;
+	WORD n;
+
+	addr.Val = JOURNAL_ADDR;
+	buffer[5] = (BYTE)count;
+	buffer[6] = (BYTE)(count >> 8);
+	buffer[7] = journalNext ? (BYTE)(JOURNAL_WORDS - 2) : 0;
+	buffer[8] = journalNext ? (BYTE)((JOURNAL_WORDS - 2) >> 8) : 0;
+	word.Val = ReadLatch(addr.word.HW, addr.word.LW);
+	buffer[9] = word.v[0];
+	buffer[10] = word.v[1];
+	word.Val = ReadLatch(addr.word.HW, addr.word.LW + 2);
+	buffer[11] = word.v[0];
+	buffer[12] = word.v[1];
+
+	for(n = 0; n < length && first + n < count; n++) {
+		word.Val = ReadLatch(addr.word.HW, addr.word.LW + 2*(2 + first + n));
+		buffer[13 + 3*n] = word.v[0];
+		buffer[14 + 3*n] = word.v[1];
+		buffer[15 + 3*n] = word.v[2];
+	}
+	return n;
+}
+#endif
+
+#if (defined(USE_DUAL_SLOT) || defined(USE_FAST_BOOT) || defined(USE_JOURNAL))
+/*********************************************************************
+* Function:     void WriteWordPM(DWORD_VAL addr, DWORD data)
+*
+* PreCondition: Word is blank, program flow protection keys set up by
+*				the caller.
+*
+* Input:		addr - address of the word
+*				data - value to write
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		One word write, as replaceBLReset does them.
+*
+* Note:			Leaves the keys set up for the caller's next write.
+********************************************************************/
+void WriteWordPM(DWORD_VAL addr, DWORD data)
+{
+	DWORD_VAL temp;
+	#ifdef USE_RUNAWAY_PROTECT
+		WORD tempkey1 = keyTest1;
+		WORD tempkey2 = keyTest2;
+	#endif
+
+	temp.Val = data;
+	WriteLatch(addr.word.HW, addr.word.LW, temp.word.HW, temp.word.LW);
+
+	#ifdef USE_RUNAWAY_PROTECT
+		writeKey1 += 5;                                                             //Modify keys to ensure proper program flow
+		writeKey2 -= 6;
+	#endif
+	WriteMem(PM_WORD_WRITE);
+
+	#ifdef USE_RUNAWAY_PROTECT
+		keyTest1 = tempkey1;
+		keyTest2 = tempkey2;
+	#endif
+}
+#endif
+
+#ifdef USE_WINDOW
+/*********************************************************************
+* Function:     BYTE CheckSequence(BYTE seq)
+*
+* PreCondition: Frame with a valid checksum received in windowed mode.
+*
+* Input:		seq - sequence number carried by the frame
+*
+* Output:		TRUE if the frame should be answered.
+*
+* Side Effects:	Updates rxSeq, txSeq and duplicate. May send a NAK.
+*
+* Overview:		Accepts the next frame in sequence. Frames from the last
+*				window are duplicates whose ack was lost; they are
+*				answered again without being executed. A frame from
+*				ahead of rxSeq means one was lost, the host is sent a
+*				single NAK and later frames are dropped until it
+*				goes back.
+*
+* Note:			None.
+********************************************************************/
+BYTE CheckSequence(BYTE seq)
+{
+	BYTE diff;
+
+	diff = seq - rxSeq;
+	txSeq = seq;
+
+	if(diff == 0) {                                                                 //Next in sequence
+		rxSeq++;
+		nakSent = 0;
+		duplicate = 0;
+		return TRUE;
+	}
+
+	if(diff >= (BYTE)(0 - windowSize)) {                                            //Behind rxSeq, already handled
+		duplicate = 1;
+		return TRUE;
+	}
+
+	if(!nakSent) {                                                                  //Gap, a frame was lost
+		PutNak();
+	}
+	return FALSE;
+}
+
+/*********************************************************************
+* Function:     void PutNak()
+*
+* PreCondition: Windowed mode, received frame is being dropped.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	Overwrites buffer.
+*
+* Overview:		Tells the host to resend everything from rxSeq.
+*
+* Note:			Only one NAK is sent per lost frame, the host timeout
+*				covers a lost NAK.
+********************************************************************/
+void PutNak()
+{
+	txSeq = rxSeq;
+	nakSent = 1;
+	buffer[0] = SEQ_NAK;
+	PutResponse(1);
+}
+#endif
+
+#ifdef USE_COBS
+/*********************************************************************
+* Function:     BOOL GetCobsFrame(BYTE code)
+*
+* PreCondition: STX and the first code byte received, cobsFraming set.
+*
+* Input:		code - the byte after STX
+*
+* Output:		TRUE if a good frame is in buffer.
+*
+* Side Effects:	Sets cobsFrame, so the reply is COBS encoded too.
+*
+* Overview:		COBS with STX as the value it removes: the frame is
+*				STX, blocks, STX. A block is a code byte (XOR STX, so
+*				never STX itself) holding one more than the number of
+*				data bytes after it; every block but the last and
+*				those of 254 bytes stands for an STX after its data.
+*				The payload, checksum or CRC is otherwise what an
+*				STX STX frame carries, decoded as it arrives.
+*
+* Note:			An STX ends the frame wherever it falls and also
+*				opens the next one, so back to back frames share it
+*				and STX STX is only ever the start of a DLE frame.
+*				A frame cut off in a block is dropped like a bad
+*				checksum, the one after it is still received.
+********************************************************************/
+BOOL GetCobsFrame(BYTE RXByte)
+{
+	BYTE checksum = 0;
+	WORD dataCount = 0;
+	WORD rxErrors = TransportErrors();
+	BYTE left = 0;                                                                  //Data bytes still to come in this block
+	BYTE implied = 0;                                                               //STX due when the next block starts
+	BYTE tooLong = 0;
+	BYTE data;
+	#ifdef USE_LARGE_PACKETS
+	BYTE hiPending = largePackets;
+	lengthHi = 0;
+	#endif
+
+	cobsFrame = 1;
+	#ifdef USE_FRAME_CRC
+	if(crcBytes) FrameCrcStart(crcBytes);
+	#endif
+
+	while(RXByte != STX) {                                                          //STX ends the frame
+		if(left == 0) {                                                             //Code byte
+			data = STX;
+			left = (RXByte ^ STX) - 1;
+			if(!implied) {
+				implied = (left != 254);
+				GetChar(&RXByte);
+				continue;
+			}
+			implied = (left != 254);
+		} else {
+			data = RXByte;
+			left--;
+		}
+
+		checksum += data;
+		#ifdef USE_FRAME_CRC
+		if(crcBytes) FrameCrcPut(data);
+		#endif
+		#ifdef USE_LARGE_PACKETS
+		if(dataCount == 2 && hiPending && buffer[0] != SESSION) {
+			lengthHi = data;                                                        //Keep the header in buffer AN851 shaped
+			hiPending = 0;
+		} else
+		#endif
+		if(dataCount < MAX_PACKET_SIZE+MAX_CHECK_SIZE) {
+			buffer[dataCount++] = data;
+		} else {
+			tooLong = 1;
+		}
+		GetChar(&RXByte);
+	}
+
+	cobsOpen = 1;
+	if(left != 0 || tooLong || dataCount == 0) {
+		checksum = 1;                                                               //Cut off or too long, fails FrameCheck
+	}
+	return FrameCheck(checksum, dataCount, rxErrors) == 0;
+}
+
+/*********************************************************************
+* Function:     void PutCobs(WORD length, BYTE hi)
+*
+* PreCondition: Response and its checksum or CRC in buffer.
+*
+* Input:		length - bytes in buffer, trailer included
+*				hi - send lengthHi after buffer[1]
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:		Sends buffer as a COBS frame, see GetCobsFrame. Each
+*				block is found by scanning ahead for the next STX,
+*				at most 254 bytes.
+*
+* Note:			One code byte per 254 data bytes or STX, the only
+*				overhead but the STX at either end. The opening one
+*				is left out after a COBS reply, which ended in it.
+********************************************************************/
+#define COBS_AT(k)	((hi && (k) >= 2) ? ((k) == 2 ? lengthHi : buffer[(k)-1]) : buffer[k])
+
+void PutCobs(WORD length, BYTE hi)
+{
+	WORD k = 0;
+	WORD j;
+	WORD end = length + hi;
+	BYTE code;
+	#ifdef USE_STATS
+	WORD codes = 0;
+	WORD implied = 0;
+	#endif
+
+	if(!cobsSent) PutChar(STX);                                                     //Else the STX that ended the last one
+	while(1) {
+		asm("clrwdt");
+		for(j = k; j < end && j - k < 254 && COBS_AT(j) != STX; j++);
+		code = (BYTE)(j - k + 1);
+		PutChar(code ^ STX);
+		#ifdef USE_STATS
+		codes++;
+		#endif
+		for(; k < j; k++) {
+			PutChar(COBS_AT(k));
+		}
+		if(k == end) break;
+		if(code != 0xFF) {
+			k++;                                                                    //The STX the block stands for
+			#ifdef USE_STATS
+			implied++;
+			#endif
+		}
+	}
+	PutChar(STX);
+	#ifdef USE_STATS
+	stats.txEscapes += codes;                                                       //Code bytes are COBS's escapes
+	stats.txBytes += end - implied + codes + 2 - cobsSent;
+	#endif
+	cobsSent = 1;
+}
+#endif
+
+#ifdef USE_STATS
+/*********************************************************************
+* Function:     DWORD StatsClock()
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		Timer2/3 count in instruction cycles.
+*
+* Side Effects:	None.
+*
+* Overview:		Reads the 32-bit timer, TMR2 first so TMR3HLD holds
+*				the matching high word.
+*
+* Note:			Differences are only meaningful once StatsStartClock
+*				has run, before that the timer may be stopped.
+********************************************************************/
+DWORD StatsClock(void)
+{
+	DWORD_VAL now;
+
+	now.word.LW = TMR2;
+	now.word.HW = TMR3HLD;
+	return now.Val;
+}
+
+/*********************************************************************
+* Function:     void StatsStartClock()
+*
+* PreCondition: First STX received.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	Ends the bootloader entry timeout.
+*
+* Overview:		Lets Timer2/3 run over its full 32-bit range instead of
+*				stopping it, so the counters have a clock. The count
+*				carries on from where it is, a wait in progress
+*				stays correct.
+*
+* Note:			The timer wraps every 2^32 cycles, GetChar clears the
+*				T3IF this raises instead of leaving for the user code.
+********************************************************************/
+void StatsStartClock(void)
+{
+	PR3 = 0xFFFF;
+	PR2 = 0xFFFF;
+	IFS0bits.T3IF = 0;
+	T2CONbits.TON = 1;                                                              //Already on unless in always-BL mode
+	statsClock = 1;
+}
+
+/*********************************************************************
+* Function:     void StatsReply(BYTE options)
+*
+* PreCondition: RD_STATS command in buffer.
+*
+* Input:		options - STATS_CLEAR to zero the counters
+*
+* Output:		None.
+*
+* Side Effects:	Overwrites buffer from index 5.
+*
+* Overview:		Puts the counter count, FCY and then each BL_STATS
+*				counter in buffer, all little endian.
+*
+* Note:			A repeated frame does not clear again, so counts
+*				between the lost reply and its repeat are kept.
+********************************************************************/
+void StatsReply(BYTE options)
+{
+	DWORD * counter = (DWORD *)&stats;
+	BYTE * out = &buffer[5];
+	DWORD_VAL value;
+	BYTE i;
+
+	*out++ = STATS_COUNT;
+	value.Val = FCY;
+	for(i = 0; i <= STATS_COUNT; i++) {
+		*out++ = value.v[0];
+		*out++ = value.v[1];
+		*out++ = value.v[2];
+		*out++ = value.v[3];
+		if(i < STATS_COUNT) {
+			value.Val = counter[i];
+		}
+	}
+
+	#ifdef USE_WINDOW
+	if(duplicate) {
+		return;
+	}
+	#endif
+	if(options & STATS_CLEAR) {
+		for(i = 0; i < STATS_COUNT; i++) {
+			counter[i] = 0;
+		}
+	}
+}
+
+/*********************************************************************
+* Function:     void StatsWriteMem(WORD cmd)
+*
+* PreCondition: As WriteMem.
+*
+* Input:		cmd - NVMCON operation, as WriteMem
+*
+* Output:		None.
+*
+* Side Effects:	As WriteMem.
+*
+* Overview:		WriteMem, with the stall added to stats.nvmWait.
+*
+* Note:			BootLoader.c calls this for every WriteMem.
+********************************************************************/
+void StatsWriteMem(WORD cmd)
+{
+	DWORD start = StatsClock();
+
+	#if (defined(USE_AES) || defined(USE_SIGN))
+	PrefetchWriteMem(cmd);
+	#else
+	(WriteMem)(cmd);                                                                //The function, not the macro
+	#endif
+	stats.nvmWait += StatsClock() - start;
+	stats.nvmOps++;
+}
+
+/*********************************************************************
+* Function:     void StatsErase(WORD page, WORD addrLo, WORD cmd)
+*
+* PreCondition: As Erase.
+*
+* Input:		page, addrLo, cmd - as Erase
+*
+* Output:		None.
+*
+* Side Effects:	As Erase.
+*
+* Overview:		Erase, with the stall added to stats.nvmWait.
+*
+* Note:			BootLoader.c calls this for every Erase.
+********************************************************************/
+void StatsErase(WORD page, WORD addrLo, WORD cmd)
+{
+	DWORD start = StatsClock();
+
+	(Erase)(page, addrLo, cmd);
+	stats.nvmWait += StatsClock() - start;
+	stats.nvmOps++;
+}
+#endif
+
+#if (defined(USE_AES) || defined(USE_SIGN))
+/*********************************************************************
+* Function:     void PrefetchWriteMem(WORD cmd)
+*
+* PreCondition: As WriteMem.
+*
+* Input:		cmd - NVMCON operation, as WriteMem
+*
+* Output:		None.
+*
+* Side Effects:	As WriteMem, and more of the next row's keystream and
+*				of this row's hash.
+*
+* Overview:		WriteMem, with AesPrefetch and SignPrefetch run while
+*				the operation keeps WR set. Rows mostly come in
+*				address order, so WritePM finds the keystream of the
+*				next one made, and the row being written is mostly
+*				hashed by the time the write ends.
+*
+* Note:			BootLoader.c calls this for every WriteMem, through
+*				StatsWriteMem with USE_STATS.
+********************************************************************/
+void PrefetchWriteMem(WORD cmd)
+{
+	WriteMemStart(cmd);
+	while(NVMCONbits.WR == 1) {
+		#ifdef USE_AES
+		AesPrefetch();
+		#endif
+		#ifdef USE_SIGN
+		SignPrefetch();
+		#endif
+	}
+}
+#endif
+
+#ifdef USE_UART_ISR
+/*********************************************************************
+* Function:     void PollErase(WORD page, WORD addrLo, WORD cmd)
+*
+* PreCondition: As Erase, the UART interrupts held off with IPL.
+*
+* Input:		page, addrLo, cmd - as Erase
+*
+* Output:		None.
+*
+* Side Effects:	As Erase, and the receive ring filled.
+*
+* Overview:		Erase, with UartPollRx emptying the RX FIFO while the
+*				operation keeps WR set. Page 0 holds the AIVT, so its
+*				erase cannot take the RX interrupt, and a 4 byte FIFO
+*				alone overruns in well under a millisecond.
+*
+* Note:			Counted in stats as StatsErase counts Erase.
+********************************************************************/
+void PollErase(WORD page, WORD addrLo, WORD cmd)
+{
+	#ifdef USE_STATS
+	DWORD start = StatsClock();
+	#endif
+
+	EraseStart(page, addrLo, cmd);
+	while(NVMCONbits.WR == 1) {
+		UartPollRx();
+	}
+	#ifdef USE_STATS
+	stats.nvmWait += StatsClock() - start;
+	stats.nvmOps++;
+	#endif
+}
+#endif
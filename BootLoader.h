@@ -63,18 +63,10 @@
 //#define DEV_HAS_CONFIG_BITS             //Device has Configuration Bits
 //#define DEV_HAS_EEPROM          	//Device has internal data EEPROM
 #define DEV_HAS_USB			//Device is a USB capable device with a 96MHz PLL
+#define DEV_HAS_CRC			//Device has the 32-bit programmable CRC generator
 
 
-//Bootloader feature configuration
-#define USE_BOOT_PROTECT                //Use BL block protection
-#define USE_RUNAWAY_PROTECT             //Provide runaway code protection using program flow
-//#define USE_CONFIGWORD_PROTECT	//Protect last page from writes/erases
-//#define USE_VECTOR_PROTECT            //Use Reset and IVT protection
-//#define USE_HI_SPEED_BRG              //Use BRGH=1, UART high speed mode
-//#define USE_WORKAROUNDS               //UART workarounds for device errata
-//#define USE_AUTOBAUD                    //Use hardware autobaud feature
-//#define USE_AES                       //Use encryption
-//#define USE_RESET_SAVE                //Restores the reset vector without using USE_BOOT_PROTECT
+#include "BootConfig.h"                 //Feature switches and BOOT_ADDR_LOW/HI, shared with the linker script
 
 //Bootloader Operation Configuration
 #define MAJOR_VERSION		0x01	//Bootloader FW version
@@ -88,25 +80,154 @@
     #define BAUDRATE            9600
 #endif
 
-#define MAX_PACKET_SIZE		261	//Max packet size
+#ifdef USE_BAUD_SWITCH
+	#define BAUD_SWITCH_1		115200	//Rates SET_BAUD accepts, all with BRGH=1
+	#define BAUD_SWITCH_2		250000
+	#define BAUD_SWITCH_3		500000
+	#define BAUD_SWITCH_4		1000000
+	#define BAUD_CONFIRM_MS		500	//Time the host has to confirm a new rate, max 1048
+#endif
+
+#ifndef USE_LARGE_PACKETS
+	#define MAX_DATA_SIZE		256	//Max data bytes per packet, one row
+#else
+	#define LARGE_PACKET_PAGES	4	//Flash pages per large packet
+	#define MAX_DATA_SIZE		(LARGE_PACKET_PAGES*PM_PAGE_SIZE)	//Max data bytes per packet
+#endif
+
+#ifndef USE_WINDOW
+	#define MAX_PACKET_SIZE		(MAX_DATA_SIZE+5)	//Max packet size
+#else
+	#define MAX_PACKET_SIZE		(MAX_DATA_SIZE+6)	//Max packet size, includes the sequence number
+#endif
+
+#ifndef USE_FRAME_CRC
+	#define MAX_CHECK_SIZE		1	//Bytes after the packet, the checksum
+#else
+	#define MAX_CHECK_SIZE		4	//Room for a CRC-32
+#endif
+
+#define TRANSPORT_BLOCK_SIZE	64	//Bytes moved per TransportRead/TransportWrite, one USB FS packet
+
+#ifdef USE_UART_ISR
+	#ifndef USE_LARGE_PACKETS
+	#define UART_RX_BUF_SIZE	1024	//UART receive ring buffer size in bytes, power of 2
+	#else
+	#define UART_RX_BUF_SIZE	16384	//Room for two large packets in flight
+	#endif
+	#define UART_TX_BUF_SIZE	512	//UART transmit ring buffer size in bytes, power of 2
+	#define UART_INT_PRIORITY	4	//UART RX/TX interrupt priority level
+#endif
+
+#ifdef USE_LZ
+	#define LZ_WINDOW_SIZE		1024	//Decoder history in bytes, power of 2
+	#define LZ_MAX_ROWS			(0xFFFF/PM_ROW_SIZE)	//Rows per WT_FLASH_LZ, WritePM counts bytes in a WORD
+#endif
+
+#ifdef USE_WINDOW
+	#define MAX_WINDOW_SIZE		(UART_RX_BUF_SIZE/(256+6+8) + 1)	//Frames in flight, all but one wait in the RX ring
+	#define MAX_LARGE_WINDOW_SIZE	(UART_RX_BUF_SIZE/(MAX_PACKET_SIZE+9) + 1)	//Same for large packets
+#endif
+
+#if defined(USE_MULTIDROP) && defined(USE_COBS)
+	#undef USE_COBS				//A COBS frame shares its STX with the one before, a bus has more than one talker
+#endif
+
+#if defined(USE_WINDOW) || defined(USE_LARGE_PACKETS) || defined(USE_FRAME_CRC) || defined(USE_COBS)
+	#define USE_SESSION				//SESSION command negotiates the options above
+#endif
+
+#ifdef USE_BATCH
+	#define BATCH_MAX_OPS		32	//Sub-commands per BATCH frame, BATCH_RESULT_SIZE bytes each in the reply
+#endif
+
+#if defined(USE_AUTO_ERASE) || defined(USE_SIGN)
+	#define USE_ERASED_PAGES		//ErasePM marks each page in erasedPages, auto erase and SignValid read it
+	#define AUTO_ERASE_PAGES	(CONFIG_END/(PM_PAGE_SIZE/2) + 1)	//Pages the erased page bitmap covers, the config page last
+	#define PAGE_NUM(addr)		((WORD)((DWORD)(addr)/(PM_PAGE_SIZE/2)))
+#endif
+
+#ifdef USE_STATS                                                                    //Performance counters, RD_STATS sends them in this order
+	typedef struct {
+		DWORD rxBytes;                                                              //Bytes taken from the transport
+		DWORD txBytes;                                                              //Bytes handed to the transport
+		DWORD rxEscapes;                                                            //DLE stuffing in received frames
+		DWORD txEscapes;                                                            //DLE stuffing in sent frames
+		DWORD badChecksums;                                                         //Frames GetCommand dropped for their checksum
+		DWORD rxWait;                                                               //Instruction cycles GetChar waited for a byte
+		DWORD nvmWait;                                                              //Instruction cycles in WriteMem and Erase
+		DWORD nvmOps;                                                               //WriteMem and Erase calls
+		DWORD overruns;                                                             //UART OERR events
+		DWORD framingErrors;                                                        //Characters received with FERR or PERR
+		DWORD ringOverflows;                                                        //Characters lost to a full receive ring
+		DWORD commands;                                                             //Frames handled, duplicates included
+		#ifdef USE_AES
+		DWORD aesBlocks;                                                            //Keystream blocks made
+		DWORD aesCycles;                                                            //Instruction cycles they took
+		DWORD aesWait;                                                              //Instruction cycles WritePM spent in AesCtrRow, what no row write hid
+		#endif
+		#ifdef USE_SIGN
+		DWORD signWait;                                                             //Instruction cycles WritePM spent hashing, what no row write hid
+		DWORD signCycles;                                                           //Instruction cycles of the signature check at VERIFY_OK
+		#endif
+	} BL_STATS;
+	#define STATS_COUNT		(sizeof(BL_STATS)/sizeof(DWORD))
+#endif
 
 //USER_PROG_RESET should be the location of a pointer to the start of user code, 
 //not the location of the first instruction of the user application.
 #define USER_PROG_RESET         0x100	//User app reset vector location
 #define DELAY_TIME_ADDR 	0x102	//BL entry delay location, 0x102
+#define DEFAULT_DELAY 		2	//BL entry delay in seconds VERIFY_OK commits when an update sends none
+
+#ifdef USE_DUAL_SLOT                                                                //Layout after the bootloader, see README.md
+	#define SLOT_VECTOR_ADDR	(BOOT_ADDR_HI+1)	//Goto table the IVT points at (__APP_IVT_BASE), forwards to the active slot
+	#define SLOT_VECTORS		(0x110/4)	//Goto entries in it, reset first, as .application_ivt
+	#define SLOT_RECORD_ADDR	(SLOT_VECTOR_ADDR+PM_PAGE_SIZE/2)	//Two pages of slot records, filled in turn
+	#define SLOT_A_BASE			(SLOT_RECORD_ADDR+PM_PAGE_SIZE)	//Each slot starts with the image's own .application_ivt
+	#define SLOT_SIZE			((((CONFIG_START & 0xFFFC00) - SLOT_A_BASE)/2) & 0xFFFC00)	//Whole pages, 79 by default, slot B ends by the config page
+	#define SLOT_B_BASE			(SLOT_A_BASE+SLOT_SIZE)
+	#define SLOT_BASE(slot)		((slot) ? SLOT_B_BASE : SLOT_A_BASE)
+#endif
 
-#define BOOT_ADDR_LOW 		0x400	//start of BL protection area
-#ifndef USE_AES
-	#define BOOT_ADDR_HI  	0x9FF	//end of BL protection area
-#else
- 	#define BOOT_ADDR_HI  	0x13FF	//end of BL protection area ** USE 0x13FF for AES support
+#ifdef USE_FAST_BOOT                                                                //Entry conditions that keep the bootloader over a valid application
+	#define APP_HEADER_ADDR		0x200	//Application header, page 0 between the AIVT and the bootloader
+	#define BOOT_MAGIC_ADDR		0x800	//RAM the application writes BOOT_MAGIC to before a software reset
+	#define BOOT_MAGIC			0x424F4F54	//"BOOT"
+	#define BOOT_BREAK_US		2500	//Watch RX this long for a break, over two characters at BAUDRATE; 0 to skip
+	//#define BOOT_PIN_ACTIVE()	(PORTDbits.RD7 == 0)	//Strap to stay in the bootloader, a digital input with its pull-up
+	#define FAST_BOOT_CRC				//Check the image CRC at every boot, else the valid flag alone decides
 #endif
 
-//If using encryption, set the AES encryption key
-#ifdef USE_AES
+#ifdef USE_MULTIDROP                                                                //Node address and transceiver control, see README.md
+	#define NODE_ADDRESS		0x01	//This node, 0x00 to 0x7E
+	//#define NODE_ADDRESS_PINS()	(PORTB & 0x003F)	//Or read it from the board's slot straps at reset
+	#ifndef RS485_DE
+		#define RS485_DE		LATDbits.LATD6	//Transceiver driver enable, high while PutResponse sends
+		#define RS485_DE_TRIS	TRISDbits.TRISD6
+	#endif
+#endif
+
+#ifdef USE_JOURNAL                                                                  //Progress journal, see README.md
+	#define JOURNAL_ADDR		0x2A400	//A page of its own below the config page, never part of an image
+#endif
+
+//If using encryption, set the AES encryption key, words low byte first: this one is 000102...0F
+//A production key is better passed as -DAES_KEY={...} by the build than kept in the source
+#if (defined(USE_AES) && !defined(AES_KEY))
 	#define AES_KEY {0x0100,0x0302,0x0504,0x0706,0x0908,0x0B0A,0x0D0C,0x0F0E}
 #endif
 
+//If signing, set the public key images are checked against, x then y, big endian bytes.
+//This one is the RFC 6979 A.2.5 example key, its private key is published: a production
+//build passes its own as -DSIGN_PUBLIC_KEY={...}, an851sign --public prints it
+#if (defined(USE_SIGN) && !defined(SIGN_PUBLIC_KEY))
+	#define SIGN_PUBLIC_KEY {0x60,0xFE,0xD4,0xBA,0x25,0x5A,0x9D,0x31,0xC9,0x61,0xEB,0x74,0xC6,0x35,0x6D,0x68, \
+		0xC0,0x49,0xB8,0x92,0x3B,0x61,0xFA,0x6C,0xE6,0x69,0x62,0x2E,0x60,0xF2,0x9F,0xB6, \
+		0x79,0x03,0xFE,0x10,0x08,0xB8,0xBC,0x99,0xA4,0x1A,0xE9,0xE9,0x56,0x28,0xBC,0x64, \
+		0xF2,0xF1,0xB2,0x0C,0x2D,0x7E,0x9F,0x51,0x77,0xA3,0xC2,0x94,0xD4,0x46,0x22,0x99}
+#endif
+
 //If using RPx pins multiplexed with ANx functions, uncomment these lines to configure AD1PCFG
 //#define UTX_ANA		AD1PCFGbits.PCFG2
 //#define URX_ANA		AD1PCFGbits.PCFG4
@@ -158,6 +279,12 @@
 //Vector section is either 0 to 0x200 or 0 to end of first page, whichever is larger
 #define VECTOR_SECTION      ((0x200>(PM_PAGE_SIZE/2))?0x200:(PM_PAGE_SIZE/2)) 
 
+//A span of flash WritePM leaves alone, see protectRegions
+typedef struct {
+	DWORD start;
+	DWORD end;                                                                      //Past the last address, 0 ends the table
+} PM_REGION;
+
 #ifdef DEV_HAS_CONFIG_BITS
 	#define CM_ROW_SIZE 		1	//configuration row size in bytes
 #endif
@@ -186,6 +313,7 @@
 #elif   defined(__PIC24F16KA102__)
 	#define CONFIG_START 		0xF80000	
         #define CONFIG_END              0xF80010
+	#define PM_END			0x2BFE	//Last user flash address, the config bits are apart
 
 #else
     #warning "No config location defined... using default config locations"
@@ -194,6 +322,15 @@
 
 #endif
 
+#ifndef PM_END
+	#define PM_END			CONFIG_END	//The flash config words end user flash
+#endif
+
+#ifdef USE_VERIFY_RANGE
+	#define VERIFY_ROWS			(PM_END/(PM_ROW_SIZE/2) + 1)	//Rows the unverified row bitmap covers
+	#define ROW_NUM(addr)		((WORD)((DWORD)(addr)/(PM_ROW_SIZE/2)))
+#endif
+
 
 //Self-write NVMCON opcodes	
 #if defined(__PIC24F__)     //PIC24F "J" type devices
@@ -221,6 +358,11 @@
 //**********************************************************************************
 
 //UART Baud Rate Calculation *******************************************************
+#define BAUD_REG(rate, div)			((FCY + ((div)/2*(rate)))/(div)/(rate)-1)
+#define BAUD_ACT(rate, div)			(FCY/(div)/(BAUD_REG(rate, div)+1))
+#define BAUD_ERR(rate, div)			((BAUD_ACT(rate, div) > (rate)) ? BAUD_ACT(rate, div)-(rate) : (rate)-BAUD_ACT(rate, div))
+#define BAUD_ERR_PERCENT(rate, div)	((BAUD_ERR(rate, div)*100+(rate)/2)/(rate))
+
 #ifndef USE_AUTOBAUD
 
 #ifdef USE_HI_SPEED_BRG
@@ -230,11 +372,11 @@
 #endif
 
 
-#define BAUDRATEREG         ((FCY + (BRG_DIV/2*BAUDRATE))/BRG_DIV/BAUDRATE-1)
-#define BAUD_ACTUAL         (FCY/BRG_DIV/(BAUDRATEREG+1))
+#define BAUDRATEREG         BAUD_REG(BAUDRATE, BRG_DIV)
+#define BAUD_ACTUAL         BAUD_ACT(BAUDRATE, BRG_DIV)
 
-#define BAUD_ERROR          ((BAUD_ACTUAL > BAUDRATE) ? BAUD_ACTUAL-BAUDRATE : BAUDRATE-BAUD_ACTUAL)
-#define BAUD_ERROR_PRECENT  ((BAUD_ERROR*100+BAUDRATE/2)/BAUDRATE)
+#define BAUD_ERROR          BAUD_ERR(BAUDRATE, BRG_DIV)
+#define BAUD_ERROR_PRECENT  BAUD_ERR_PERCENT(BAUDRATE, BRG_DIV)
 
 #if (BAUD_ERROR_PRECENT > 3)
     #error "UART frequency error is worse than 3%"
@@ -242,6 +384,23 @@
     #warning "UART frequency error is worse than 2%"
 #endif
 
+#endif
+
+#ifdef USE_BAUD_SWITCH                                                              //Same checks for every SET_BAUD rate
+#define BAUD_SWITCH_COUNT	4
+#define BAUD_CONFIRM_TICKS	(FCY/256*BAUD_CONFIRM_MS/1000)	//Timer1 at 1:256
+
+#if (BAUD_ERR_PERCENT(BAUD_SWITCH_1, 4) > 3 || BAUD_ERR_PERCENT(BAUD_SWITCH_2, 4) > 3 || \
+	 BAUD_ERR_PERCENT(BAUD_SWITCH_3, 4) > 3 || BAUD_ERR_PERCENT(BAUD_SWITCH_4, 4) > 3)
+    #error "A BAUD_SWITCH rate has a UART frequency error worse than 3%"
+#elif (BAUD_ERR_PERCENT(BAUD_SWITCH_1, 4) > 2 || BAUD_ERR_PERCENT(BAUD_SWITCH_2, 4) > 2 || \
+	   BAUD_ERR_PERCENT(BAUD_SWITCH_3, 4) > 2 || BAUD_ERR_PERCENT(BAUD_SWITCH_4, 4) > 2)
+    #warning "A BAUD_SWITCH rate has a UART frequency error worse than 2%"
+#endif
+
+#if (BAUD_CONFIRM_TICKS > 0xFFFF)
+	#error "BAUD_CONFIRM_MS does not fit Timer1"
+#endif
 #endif
 //**********************************************************************************
 
@@ -256,6 +415,87 @@
 #define RD_CONFIG	0x06
 #define WT_CONFIG	0x07
 #define VERIFY_OK	0x08
+#define SESSION		0x09	//Negotiate window and packet size, always AN851 framed
+#define RD_CRC_MAP	0x0A	//CRC32 of each flash page in a range
+#define VERIFY_RANGE	0x0B	//CRC32 of an address range, checked against the host's
+#define WT_FLASH_LZ	0x0C	//Write rows decoded from an LZ stream
+#define SET_BAUD	0x0D	//Switch baud rate, then confirm at the new one
+#define RD_STATS	0x0E	//Read the performance counters, see BL_STATS
+#define RD_SLOT		0x0F	//Active slot and where the next image goes, see USE_DUAL_SLOT
+#define JOURNAL		0x10	//Read the progress journal or start a new one, see USE_JOURNAL
+#define RD_STREAM	0x11	//Stream a flash range back, erased runs coded short, see USE_STREAM
+#define BATCH		0x12	//Run a list of sub-commands in order, one status each, see USE_BATCH
+#define SET_NONCE	0x13	//Nonce of the image that follows, see USE_AES
+#define SIGNATURE	0x14	//Signature of the image that follows, see USE_SIGN
+#define SEQ_NAK		0xFF	//Response only: frame lost, resend from sequence number
+
+//VERIFY_RANGE results since the last write or erase
+#define VERIFY_NONE		0	//No range checked yet, or rows written are not all covered
+#define VERIFY_MATCH	1	//Every range checked matched, together they cover every row written
+#define VERIFY_FAILED	2	//At least one range did not match
+
+//SET_BAUD reply status
+#define BAUD_SWITCHING		0x00	//Rate accepted, the device switches after this reply
+#define BAUD_UNSUPPORTED	0x01	//Rate not in the BAUD_SWITCH table
+
+//Raw bytes each way at the new rate, not framed
+#define BAUD_CONFIRM_BYTES	{0xA5, 0x5A, 0xC3, 0x3C}
+
+//RD_STATS option flags
+#define STATS_CLEAR	0x01	//Zero the counters once they are read
+
+//Slot records, 4 words each: end and CRC of the verified range, then the commit word
+#define SLOT_ENTRY_SIZE		8	//Program memory address units per record
+#define SLOT_ENTRIES		(PM_PAGE_SIZE/2/SLOT_ENTRY_SIZE)	//Records per page
+#define SLOT_MAGIC			0xA5	//Commit word: SLOT_MAGIC, entry delay, slot
+#define SLOT_NONE			0xFF	//RD_SLOT: neither slot holds a valid image
+#define SLOT_ANY			0xFE	//SlotFind: newest record of either slot
+
+//Application header at APP_HEADER_ADDR: start and end of the verified range, its CRC, then the valid flag
+#define APP_HEADER_WORDS	5	//Words from APP_HEADER_ADDR that WritePM leaves blank
+#define APP_VALID			0x00A55A	//Valid flag, written last at VERIFY_OK
+
+//Node address byte, before the command in every frame when USE_MULTIDROP is set
+#define NODE_BROADCAST		0x7F	//Every node takes the frame, none replies
+#define NODE_REPLY			0x80	//Set in the address of a reply, so no node takes it for a command
+
+//Progress journal at JOURNAL_ADDR: the tag, then one word per entry, type, first row and rows.
+//Each entry goes in before the erase or write it names, only the last may not have finished
+#define JOURNAL_ERASE		0	//Pages about to be erased, counted in rows
+#define JOURNAL_WRITE		1	//Rows about to be written
+#define JOURNAL_VERIFY		2	//Rows a VERIFY_RANGE matched
+#define JOURNAL_TAG			3	//Two words, 16 bits each of the tag JOURNAL_BEGIN gave
+#define JOURNAL_WORDS		(PM_PAGE_SIZE/PM_INSTR_SIZE)	//Entries the page holds, tag included
+#define JOURNAL_MAX_ROWS	0x7FF	//Row and rows fields are 11 bits
+#define JOURNAL_ROW(addr)	((addr)/(PM_ROW_SIZE/2))
+#define JOURNAL_ENTRY(type, row, rows)	(((DWORD)(type) << 22) | ((DWORD)(row) << 11) | (rows))
+#define JOURNAL_TAG_WORD(k, half)		(((DWORD)JOURNAL_TAG << 22) | ((DWORD)(k) << 16) | (half))	//Never blank
+
+//JOURNAL option flags
+#define JOURNAL_BEGIN		0x01	//Erase the journal and start a new one with the 4 byte tag that follows
+
+//RD_STREAM data: a token, then for a literal run 3 bytes per instruction, low byte first
+#define STREAM_BLANK		0x80	//Token flag: (token & 0x7F) + 1 erased instructions, nothing follows
+#define STREAM_MAX_RUN		0x80	//Instructions per token, a literal token holds the count less one
+
+//BATCH sub-command: command, 16-bit length, 24-bit address, then its data
+#define BATCH_HEADER_SIZE	6
+#define BATCH_RESULT_SIZE	5	//Per sub-command in the reply: status, then 4 bytes of what its own reply carries
+#define BATCH_OK			0x00	//Status per sub-command in the reply: done
+#define BATCH_BAD			0x01	//Not allowed in a batch, length 0 or its data runs past the frame
+#define BATCH_MISMATCH		0x02	//VERIFY_RANGE: the CRC differs from the one given
+#define BATCH_NOT_VERIFIED	0x03	//VERIFY_OK: no matching VERIFY_RANGE, nothing committed
+#define BATCH_SKIPPED		0x04	//Not run, an earlier sub-command failed
+
+//SESSION option flags
+#define SESSION_LARGE	0x01	//16-bit length, up to MAX_DATA_SIZE data bytes per packet
+#define SESSION_CRC16	0x02	//CRC-16/CCITT, 0x1021, after each frame instead of the checksum
+#define SESSION_CRC32	0x04	//CRC-32/MPEG-2, 0x04C11DB7, preferred if both are asked for
+#define SESSION_COBS	0x08	//Frames may be COBS encoded, see GetCobsFrame
+#define SESSION_AUTO_ERASE	0x10	//WT_FLASH erases a page before its first row, see AutoErasePM
+#define SESSION_BATCH	0x20	//Reply only: BATCH is built in, it needs no asking for
+#define SESSION_AES		0x40	//Reply only: rows are decrypted, SET_NONCE is built in
+#define SESSION_SIGN	0x80	//Reply only: VERIFY_OK needs a good SIGNATURE, see USE_SIGN
 
 //Communications Control bytes
 #define STX             0x55
@@ -296,28 +536,230 @@
 #ifdef DEV_HAS_PPS
     #define UxTX_IO UARTREG(UARTNUM,TX_IO)
 #endif
+
+#ifdef USE_UART_ISR
+    #define UARTALTISR2(a,b)    _AltU##a##b##Interrupt
+    #define UARTALTISR(a,b)     UARTALTISR2(a,b)
+
+    #define UxRXInterrupt       UARTALTISR(UARTNUM,RX)      //Handlers live in the AIVT, the IVT belongs to the application
+    #define UxTXInterrupt       UARTALTISR(UARTNUM,TX)
+
+    #ifndef BL_ISR
+        #define BL_ISR          __attribute__((interrupt, no_auto_psv))
+    #endif
+
+    //Interrupt control bits and AIVT slot address (0x104 + 2*(8 + IRQ)) for the selected UART
+    #if (UARTNUM == 1)
+        #define UxRXIF          IFS0bits.U1RXIF
+        #define UxRXIE          IEC0bits.U1RXIE
+        #define UxRXIP          IPC2bits.U1RXIP
+        #define UxTXIF          IFS0bits.U1TXIF
+        #define UxTXIE          IEC0bits.U1TXIE
+        #define UxTXIP          IPC3bits.U1TXIP
+        #define UxRX_AIVT_ADDR  0x12A
+        #define UxTX_AIVT_ADDR  0x12C
+    #elif (UARTNUM == 2)
+        #define UxRXIF          IFS1bits.U2RXIF
+        #define UxRXIE          IEC1bits.U2RXIE
+        #define UxRXIP          IPC7bits.U2RXIP
+        #define UxTXIF          IFS1bits.U2TXIF
+        #define UxTXIE          IEC1bits.U2TXIE
+        #define UxTXIP          IPC7bits.U2TXIP
+        #define UxRX_AIVT_ADDR  0x150
+        #define UxTX_AIVT_ADDR  0x152
+    #elif (UARTNUM == 3)
+        #define UxRXIF          IFS5bits.U3RXIF
+        #define UxRXIE          IEC5bits.U3RXIE
+        #define UxRXIP          IPC20bits.U3RXIP
+        #define UxTXIF          IFS5bits.U3TXIF
+        #define UxTXIE          IEC5bits.U3TXIE
+        #define UxTXIP          IPC20bits.U3TXIP
+        #define UxRX_AIVT_ADDR  0x1B8
+        #define UxTX_AIVT_ADDR  0x1BA
+    #elif (UARTNUM == 4)
+        #define UxRXIF          IFS5bits.U4RXIF
+        #define UxRXIE          IEC5bits.U4RXIE
+        #define UxRXIP          IPC22bits.U4RXIP
+        #define UxTXIF          IFS5bits.U4TXIF
+        #define UxTXIE          IEC5bits.U4TXIE
+        #define UxTXIP          IPC22bits.U4TXIP
+        #define UxRX_AIVT_ADDR  0x1C4
+        #define UxTX_AIVT_ADDR  0x1C6
+    #endif
+#endif
 //**********************************************************************************
 //Function Prototypes **************************************************************
 void BootLoader(void);
 void PutChar(BYTE);
+void PutFlush(void);
 void GetChar(BYTE *);
 void ReadPM(WORD, DWORD_VAL);
 void WritePM(WORD, DWORD_VAL);
+void RowFixup(BYTE *, DWORD);
+BOOL RowProtected(DWORD);
 void ErasePM(WORD, DWORD_VAL);
+#ifdef USE_AUTO_ERASE
+void AutoErasePM(WORD, DWORD_VAL);
+#endif
+#ifdef USE_BATCH
+WORD BatchPM(WORD);
+#endif
+void CrcMapPM(WORD, DWORD_VAL);
+DWORD CrcPM(DWORD, DWORD_VAL);
+void SwitchBaud(BYTE);
+BOOL PollChar(BYTE *);
 void WriteTimeout();
 void GetCommand();
+BYTE FrameCheck(BYTE, WORD, WORD);
 void HandleCommand();
 void PutResponse(WORD);
 void AutoBaud();
 #if defined(USE_BOOT_PROTECT) || defined(USE_RESET_SAVE)
 void replaceBLReset(DWORD_VAL);
 #endif
+#ifdef USE_UART_ISR
+void replaceBLVectors();
+#endif
+#ifdef USE_WINDOW
+BYTE CheckSequence(BYTE);
+void PutNak();
+#endif
+#ifdef USE_COBS
+BOOL GetCobsFrame(BYTE);
+void PutCobs(WORD, BYTE);
+#endif
+#ifdef USE_DUAL_SLOT
+BYTE SlotBoot(void);
+WORD SlotCount(DWORD);
+DWORD SlotPage(void);
+DWORD SlotFind(BYTE);
+BOOL SlotCheck(DWORD);
+void SlotCommit(void);
+void SlotVectors(BYTE);
+#endif
+#ifdef USE_FAST_BOOT
+BOOL BootRequested(void);
+BOOL AppValid(void);
+#ifndef USE_DUAL_SLOT
+void WriteHeader(void);
+#endif
+#endif
+#ifdef USE_JOURNAL
+void JournalInit(void);
+void JournalBegin(DWORD_VAL);
+void JournalAdd(BYTE, DWORD_VAL, WORD);
+void JournalClose(void);
+WORD JournalReply(WORD, WORD);
+#endif
+#if (defined(USE_DUAL_SLOT) || defined(USE_FAST_BOOT) || defined(USE_JOURNAL))
+void WriteWordPM(DWORD_VAL, DWORD);
+#endif
+#ifdef USE_STREAM
+WORD StreamPM(WORD, DWORD_VAL, DWORD);
+WORD StreamFrame(DWORD_VAL *, DWORD, WORD);
+#endif
+#ifdef USE_STATS
+DWORD StatsClock(void);
+void StatsStartClock(void);
+void StatsReply(BYTE);
+void StatsWriteMem(WORD);
+void StatsErase(WORD, WORD, WORD);
+#endif
+#if (defined(USE_AES) || defined(USE_SIGN))
+void PrefetchWriteMem(WORD);
+#endif
+#ifdef USE_UART_ISR
+void PollErase(WORD, WORD, WORD);
+#endif
 //**********************************************************************************
 //Configuration Check **************************************************************
 #if ((defined(DEV_HAS_WORD_WRITE) && defined(DEV_HAS_CONFIG_BITS)) || \
 	 (defined(DEV_HAS_WORD_WRITE) && defined(DEV_HAS_EEPROM)))
 	#warning "No devices support configured feature set."
 #endif
+
+#if (defined(USE_UART_ISR) && defined(USE_AUTOBAUD))
+	#error "USE_AUTOBAUD reads the UART directly and cannot be used with USE_UART_ISR"
+#endif
+
+#if (defined(USE_UART_ISR) && ((UART_RX_BUF_SIZE & (UART_RX_BUF_SIZE-1)) || (UART_TX_BUF_SIZE & (UART_TX_BUF_SIZE-1))))
+	#error "UART ring buffer sizes must be a power of 2"
+#endif
+
+#if (defined(USE_LZ) && (LZ_WINDOW_SIZE & (LZ_WINDOW_SIZE-1)))
+	#error "LZ_WINDOW_SIZE must be a power of 2"
+#endif
+
+#if (defined(USE_WINDOW) && !defined(USE_UART_ISR) && !defined(USE_USB_CDC))
+	#error "USE_WINDOW needs USE_UART_ISR to buffer frames in flight"
+#endif
+
+#if ((BOOT_ADDR_LOW | (BOOT_ADDR_HI + 1)) & (PM_ROW_SIZE/2 - 1))
+	#error "WritePM protects whole rows, BOOT_ADDR_LOW and BOOT_ADDR_HI + 1 must be row aligned"
+#endif
+
+#if (defined(USE_AES) && (PM_ROW_SIZE/PM_INSTR_SIZE*3) % 16)
+	#error "USE_AES encrypts rows in whole 16 byte blocks, 3 bytes per instruction, PM_ROW_SIZE does not fit"
+#endif
+
+#if (defined(USE_SIGN) && !defined(USE_VERIFY_RANGE))
+	#error "USE_SIGN gates the VERIFY_OK that USE_VERIFY_RANGE already gates, it needs USE_VERIFY_RANGE"
+#endif
+
+#if (defined(USE_STREAM) && !defined(USE_FRAME_CRC))
+	#error "USE_STREAM frames are only checked by a frame CRC, it needs USE_FRAME_CRC"
+#endif
+
+#if (defined(USE_DUAL_SLOT) && (!defined(USE_VERIFY_RANGE) || !defined(DEV_HAS_WORD_WRITE)))
+	#error "USE_DUAL_SLOT records the VERIFY_RANGE digest with word writes, it needs USE_VERIFY_RANGE and DEV_HAS_WORD_WRITE"
+#endif
+
+#if (defined(USE_FAST_BOOT) && !defined(USE_DUAL_SLOT) && (!defined(USE_VERIFY_RANGE) || !defined(DEV_HAS_WORD_WRITE)))
+	#error "USE_FAST_BOOT writes the header from the VERIFY_RANGE digests with word writes, it needs USE_VERIFY_RANGE and DEV_HAS_WORD_WRITE"
+#endif
+
+#if (defined(USE_FAST_BOOT) && APP_HEADER_ADDR + 2*APP_HEADER_WORDS > BOOT_ADDR_LOW)
+	#error "The application header must lie in page 0 below the bootloader"
+#endif
+
+#ifdef USE_FAST_BOOT
+	#ifndef BL_PERSISTENT
+		#define BL_PERSISTENT	__attribute__((persistent, address(BOOT_MAGIC_ADDR)))
+	#endif
+#endif
+
+#if (defined(USE_DUAL_SLOT) && (BOOT_ADDR_HI >= SLOT_VECTOR_ADDR || SLOT_B_BASE+SLOT_SIZE > (CONFIG_START & 0xFFFC00)))
+	#error "Dual slot layout overlaps the bootloader or the config page"
+#endif
+
+#if (defined(USE_JOURNAL) && (defined(USE_DUAL_SLOT) || !defined(DEV_HAS_WORD_WRITE)))
+	#error "USE_JOURNAL needs a free page and word writes, the USE_DUAL_SLOT layout leaves no page free"
+#endif
+
+#if (defined(USE_JOURNAL) && ((JOURNAL_ADDR & (PM_PAGE_SIZE/2 - 1)) || JOURNAL_ADDR + PM_PAGE_SIZE/2 > (CONFIG_START & 0xFFFC00) || \
+	 JOURNAL_ROW(CONFIG_START) > JOURNAL_MAX_ROWS))
+	#error "JOURNAL_ADDR must be a page below the config page, and every row must fit an entry"
+#endif
+
+#if (defined(USE_AUTO_ERASE) && (!defined(USE_SESSION) || defined(DEV_HAS_CONFIG_BITS)))
+	#error "USE_AUTO_ERASE is enabled per SESSION and sizes its bitmap from the flash config words, it needs USE_SESSION and no DEV_HAS_CONFIG_BITS"
+#endif
+
+#if (defined(USE_BATCH) && (BATCH_MAX_OPS > 255 || BATCH_MAX_OPS*BATCH_RESULT_SIZE + 5 > MAX_PACKET_SIZE))
+	#error "BATCH_MAX_OPS must fit the 8-bit length of a small packet, and its results a reply"
+#endif
+
+#if (defined(USE_MULTIDROP) && (defined(USE_USB_CDC) || NODE_ADDRESS >= NODE_BROADCAST))
+	#error "USE_MULTIDROP needs the UART transport and a NODE_ADDRESS below NODE_BROADCAST"
+#endif
+
+#if (defined(USE_USB_CDC) && !defined(DEV_HAS_USB))
+	#error "USE_USB_CDC needs a device with a USB module"
+#endif
+
+#if (defined(USE_USB_CDC) && (defined(USE_UART_ISR) || defined(USE_AUTOBAUD) || defined(USE_BAUD_SWITCH)))
+	#error "USE_UART_ISR, USE_AUTOBAUD and USE_BAUD_SWITCH only apply to the UART transport"
+#endif
 //**********************************************************************************
 
 #endif //ifdef CONFIG_H
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <p24fxxxx.h>
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Crc.h"
+
+//CRC-32 (IEEE 802.3, reflected 0xEDB88320) one nibble at a time, the
+//table costs 64 bytes instead of 1K for the byte wise version.
+static const DWORD crc32Table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/********************************************************************
+* Function: 	DWORD Crc32Update(DWORD crc, BYTE * data, WORD length)
+*
+* Precondition: None.
+*
+* Input: 		crc - running CRC, CRC32_INIT for the first block
+*				data - bytes to add
+*				length - number of bytes
+*
+* Output:		Updated running CRC.
+*
+* Side Effects:	None.
+*
+* Overview: 	Adds a block of bytes to a running CRC-32. The final
+*				CRC is the running value inverted, ~crc.
+*
+* Note:		 	Same polynomial and bit order as zlib crc32().
+********************************************************************/
+DWORD Crc32Update(DWORD crc, BYTE * data, WORD length)
+{
+	while(length--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ crc32Table[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32Table[crc & 0x0F];
+	}
+
+	return crc;
+}
+
+#ifdef USE_FRAME_CRC
+//Frame CRCs: CRC-16/CCITT (0x1021) and CRC-32/MPEG-2 (0x04C11DB7), MSB
+//first, all ones to start, no final inversion. A frame run through the
+//CRC with its own CRC appended, high byte first, leaves 0, so GetCommand
+//can feed every byte up to ETX and test for 0 as it does the checksum.
+#ifndef DEV_HAS_CRC
+//Nibble tables as for crc32Table. CRC-16 runs in the top half of the
+//32-bit value, so both widths share FrameCrcPut.
+static const DWORD crc16FrameTable[16] = {
+	0x00000000, 0x10210000, 0x20420000, 0x30630000,
+	0x40840000, 0x50A50000, 0x60C60000, 0x70E70000,
+	0x81080000, 0x91290000, 0xA14A0000, 0xB16B0000,
+	0xC18C0000, 0xD1AD0000, 0xE1CE0000, 0xF1EF0000
+};
+static const DWORD crc32FrameTable[16] = {
+	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9,
+	0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+	0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61,
+	0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
+};
+static const DWORD * frameCrcTable;
+static DWORD frameCrc;
+#endif
+
+/********************************************************************
+* Function: 	void FrameCrcStart(BYTE bytes)
+*
+* Precondition: None.
+*
+* Input: 		bytes - CRC width in bytes, 2 or 4
+*
+* Output:		None.
+*
+* Side Effects:	Restarts the CRC module, anything in it is lost.
+*
+* Overview: 	Sets up a frame CRC. With DEV_HAS_CRC the module
+*				takes 8-bit data MSB first and starts from all ones,
+*				otherwise the nibble tables do the same work.
+*
+* Note:		 	Called at every STX STX, one CRC is in use at a time.
+********************************************************************/
+void FrameCrcStart(BYTE bytes)
+{
+	#ifdef DEV_HAS_CRC
+	CRCCON1 = 0;                                                                    //Stop, empties the FIFO
+	CRCCON1bits.CRCEN = 1;
+	CRCCON2bits.DWIDTH = 7;                                                         //8-bit data, LENDIAN = 0 shifts it MSB first
+	CRCCON2bits.PLEN = bytes*8 - 1;
+	if(bytes == 2) {
+		CRCXORL = 0x1021;
+		CRCXORH = 0x0000;
+		CRCWDATH = 0x0000;
+	} else {
+		CRCXORL = 0x1DB7;
+		CRCXORH = 0x04C1;
+		CRCWDATH = 0xFFFF;
+	}
+	CRCWDATL = 0xFFFF;
+	CRCCON1bits.CRCGO = 1;
+	#else
+	if(bytes == 2) {
+		frameCrcTable = crc16FrameTable;
+		frameCrc = 0xFFFF0000;
+	} else {
+		frameCrcTable = crc32FrameTable;
+		frameCrc = 0xFFFFFFFF;
+	}
+	#endif
+}
+
+#ifndef DEV_HAS_CRC
+/********************************************************************
+* Function: 	void FrameCrcPut(BYTE data)
+*
+* Precondition: FrameCrcStart called.
+*
+* Input: 		data - next frame byte, unescaped
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Adds a byte to the frame CRC, software version of the
+*				DEV_HAS_CRC macro in Crc.h.
+*
+* Note:		 	None.
+********************************************************************/
+void FrameCrcPut(BYTE data)
+{
+	frameCrc = (frameCrc << 4) ^ frameCrcTable[(BYTE)(frameCrc >> 28) ^ (data >> 4)];
+	frameCrc = (frameCrc << 4) ^ frameCrcTable[((BYTE)(frameCrc >> 28) ^ data) & 0x0F];
+}
+#endif
+
+/********************************************************************
+* Function: 	DWORD FrameCrcResult()
+*
+* Precondition: FrameCrcStart called.
+*
+* Input: 		None.
+*
+* Output:		CRC of the bytes put since FrameCrcStart, 16 or 32
+*				bits.
+*
+* Side Effects:	None.
+*
+* Overview: 	Waits for the CRC module to drain its FIFO and shift
+*				the last byte, then reads the shift register.
+*
+* Note:		 	0 after a frame and its CRC means the frame is good.
+********************************************************************/
+DWORD FrameCrcResult(void)
+{
+	#ifdef DEV_HAS_CRC
+	DWORD_VAL crc;
+
+	while(!CRCCON1bits.CRCMPT);                                                     //FIFO empty...
+	asm("repeat #7");                                                               //...and 8 cycles for the last byte's shifts
+	Nop();
+	crc.word.LW = CRCWDATL;
+	crc.word.HW = CRCWDATH;
+	if(CRCCON2bits.PLEN == 15) {
+		crc.word.HW = 0;
+	}
+	return crc.Val;
+	#else
+	if(frameCrcTable == crc16FrameTable) {
+		return frameCrc >> 16;
+	}
+	return frameCrc;
+	#endif
+}
+#endif
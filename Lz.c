@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <p24fxxxx.h>
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Lz.h"
+
+#ifdef USE_LZ
+//The stream is a list of sequences, LZ4 style. Each starts with a token,
+//high nibble the literal count, low nibble the match length less 3. A
+//nibble of 15 is followed by bytes that are added to it up to and
+//including the first byte below 255. The literals follow, then the match
+//offset, 2 bytes LSB first, 1 to LZ_WINDOW_SIZE bytes back. The last
+//sequence stops after its literals.
+#define LZ_MIN_MATCH	3
+
+static BYTE lzWindow[LZ_WINDOW_SIZE];                                               //Last bytes decoded, a match copies from here
+static WORD lzPos;                                                                  //Bytes decoded, mod 64K
+static BYTE *lzSrc;
+static BYTE *lzEnd;
+static WORD lzLiterals;                                                             //Literals left in this sequence
+static WORD lzMatch;                                                                //Match bytes left in this sequence
+static WORD lzOffset;
+static BYTE lzToken;
+static BYTE lzMatchPending;                                                         //Literals done, offset not read yet
+static BYTE lzError;
+
+/********************************************************************
+* Function: 	BYTE LzNext(void)
+*
+* Precondition: LzInit called.
+*
+* Input: 		None.
+*
+* Output:		Next stream byte, 0xFF past the end.
+*
+* Side Effects:	Sets lzError when reading past the end.
+*
+* Overview: 	Reads the compressed stream.
+*
+* Note:		 	None.
+********************************************************************/
+static BYTE LzNext(void)
+{
+	if(lzSrc == lzEnd) {
+		lzError = 1;
+		return 0xFF;
+	}
+	return *lzSrc++;
+}
+
+/********************************************************************
+* Function: 	WORD LzLength(WORD length)
+*
+* Precondition: LzInit called.
+*
+* Input: 		length - count from the token nibble
+*
+* Output:		Count including the extension bytes.
+*
+* Side Effects:	None.
+*
+* Overview: 	Reads the extension bytes of a nibble that is 15.
+*
+* Note:		 	None.
+********************************************************************/
+static WORD LzLength(WORD length)
+{
+	BYTE data;
+
+	if(length == 15) {
+		do {
+			data = LzNext();
+			length += data;
+		} while(data == 255 && !lzError);
+	}
+	return length;
+}
+
+/********************************************************************
+* Function: 	void LzInit(BYTE * src, WORD length)
+*
+* Precondition: None.
+*
+* Input: 		src - compressed stream
+*				length - bytes in the stream
+*
+* Output:		None.
+*
+* Side Effects:	Decoder state and window reset.
+*
+* Overview: 	Starts decoding a stream. Every packet is a stream of
+*				its own, so a resent packet decodes the same.
+*
+* Note:		 	The window starts out as 0xFF, offsets reaching before
+*				the start of the stream copy erased flash.
+********************************************************************/
+void LzInit(BYTE * src, WORD length)
+{
+	WORD i;
+
+	for(i = 0; i < LZ_WINDOW_SIZE; i++) {
+		lzWindow[i] = 0xFF;
+	}
+	lzPos = 0;
+	lzSrc = src;
+	lzEnd = src + length;
+	lzLiterals = 0;
+	lzMatch = 0;
+	lzMatchPending = 0;
+	lzError = 0;
+}
+
+/********************************************************************
+* Function: 	BYTE LzGetByte(void)
+*
+* Precondition: LzInit called.
+*
+* Input: 		None.
+*
+* Output:		Next decoded byte.
+*
+* Side Effects:	Sets the error flag on a corrupt or short stream and
+*				returns 0xFF from then on.
+*
+* Overview: 	Decodes one byte, reading tokens, literals and match
+*				offsets as they are needed.
+*
+* Note:		 	None.
+********************************************************************/
+BYTE LzGetByte(void)
+{
+	BYTE data;
+
+	while(lzLiterals == 0 && lzMatch == 0) {
+		if(lzError) {
+			return 0xFF;
+		}
+		if(lzMatchPending) {                                                        //Offset and match length
+			lzOffset = LzNext();
+			lzOffset |= (WORD)LzNext() << 8;
+			lzMatch = LzLength(lzToken & 0x0F) + LZ_MIN_MATCH;
+			lzMatchPending = 0;
+			if(lzOffset == 0 || lzOffset > LZ_WINDOW_SIZE) {
+				lzError = 1;
+			}
+		} else {                                                                    //Next sequence
+			lzToken = LzNext();
+			lzLiterals = LzLength(lzToken >> 4);
+			lzMatchPending = 1;
+		}
+	}
+
+	if(lzLiterals) {
+		data = LzNext();
+		lzLiterals--;
+	} else {
+		data = lzWindow[(lzPos - lzOffset) & (LZ_WINDOW_SIZE-1)];
+		lzMatch--;
+	}
+	lzWindow[lzPos & (LZ_WINDOW_SIZE-1)] = data;
+	lzPos++;
+
+	return data;
+}
+
+/********************************************************************
+* Function: 	BYTE LzDone(void)
+*
+* Precondition: LzInit called.
+*
+* Input: 		None.
+*
+* Output:		TRUE if the stream ended exactly where decoding did.
+*
+* Side Effects:	None.
+*
+* Overview: 	Checks a stream after the expected number of bytes has
+*				been decoded from it.
+*
+* Note:		 	None.
+********************************************************************/
+BYTE LzDone(void)
+{
+	return !lzError && lzSrc == lzEnd && lzLiterals == 0 && lzMatch == 0;
+}
+#endif
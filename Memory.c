@@ -68,6 +68,27 @@ extern volatile WORD keyTest2;
 ; Overview: 	Write stored registers to flash memory
 ;*********************************************************************/
 void WriteMem(WORD cmd)
+{
+	WriteMemStart(cmd);
+
+	while(NVMCONbits.WR == 1);
+}
+
+/********************************************************************
+; Function: 	void WriteMemStart(WORD cmd)
+;
+; PreCondition: Appropriate data written to latches with WriteLatch
+;
+; Input:    	cmd - type of memory operation to perform
+;                               
+; Output:   	None.
+;
+; Side Effects: NVMCONbits.WR stays set until the operation is done
+;
+; Overview: 	Starts the write of stored registers to flash memory,
+;				the caller waits for it
+;*********************************************************************/
+void WriteMemStart(WORD cmd)
 {
 	NVMCON = cmd;
 
@@ -80,9 +101,6 @@ void WriteMem(WORD cmd)
 
 	__builtin_write_NVM();
 
-
-	while(NVMCONbits.WR == 1);
-
 	#ifdef USE_RUNAWAY_PROTECT
 
 		}//end if(writeKey1...
@@ -118,6 +136,39 @@ void WriteLatch(WORD page, WORD addrLo, WORD dataHi, WORD dataLo)
 	
 }	
 
+/********************************************************************
+; Function: 	void WriteRowLatch(WORD page, WORD addrLo, 
+;								   BYTE *data, WORD length)
+;
+; PreCondition: None.
+;
+; Input:    	page 	- upper byte of address
+;				addrLo 	- lower word of address
+;				data	- 4 bytes per instruction, low byte first,
+;						  the phantom byte ignored
+;				length	- number of instructions to latch
+;                               
+; Output:   	None.
+;
+; Side Effects: TBLPAG changed
+;
+; Overview: 	Stores a run of instructions in the hardware latches
+;				with TBLPAG loaded once. The run must not cross a
+;				TBLPAG boundary, a row never does. data need not be
+;				word aligned, so it is read a byte at a time.
+;*********************************************************************/
+void WriteRowLatch(WORD page, WORD addrLo, BYTE *data, WORD length)
+{
+	TBLPAG = page;
+
+	while(length--) {
+		__builtin_tblwtl(addrLo, data[0] | (WORD)data[1] << 8);
+		__builtin_tblwth(addrLo, data[2]);
+		addrLo += 2;
+		data += 4;
+	}
+}
+
 /********************************************************************
 ; Function: 	DWORD ReadLatch(WORD page, WORD addrLo)
 ;
@@ -144,6 +195,37 @@ DWORD ReadLatch(WORD page, WORD addrLo)
 	return temp.Val;
 }
 
+/********************************************************************
+; Function: 	BOOL IsBlank(WORD page, WORD addrLo, WORD length)
+;
+; PreCondition: None.
+;
+; Input:    	page 	- upper byte of address
+;				addrLo 	- lower word of address
+;				length	- number of instructions to check
+;                               
+; Output:   	TRUE if every instruction reads 0xFFFFFF
+;
+; Side Effects: TBLPAG changed
+;
+; Overview: 	Blank check, stops at the first programmed word. The
+;				range must not cross a TBLPAG boundary, a page never
+;				does.
+;*********************************************************************/
+BOOL IsBlank(WORD page, WORD addrLo, WORD length)
+{
+	TBLPAG = page;
+
+	while(length--) {
+		if(__builtin_tblrdl(addrLo) != 0xFFFF || (__builtin_tblrdh(addrLo) & 0x00FF) != 0x00FF) {
+			return FALSE;
+		}
+		addrLo += 2;
+	}
+
+	return TRUE;
+}
+
 /*********************************************************************
 ; Function: 	void ResetDevice(WORD addr);
 ;
@@ -159,7 +241,11 @@ DWORD ReadLatch(WORD page, WORD addrLo)
 ;**********************************************************************/
 void ResetDevice(WORD addr)
 {
+	#ifdef SIM_HOST
+		SimResetDevice(addr);                                                       //Host simulator, report and stop
+	#else
 	asm("goto %0" : : "r"(addr));
+	#endif
 }
 
 /********************************************************************
@@ -178,6 +264,29 @@ void ResetDevice(WORD addr)
 ; Overview: 	Erases page of flash memory at input address
 *********************************************************************/	
 void Erase(WORD page, WORD addrLo, WORD cmd)
+{
+	EraseStart(page, addrLo, cmd);
+
+	while(NVMCONbits.WR == 1);
+}
+
+/********************************************************************
+; Function: 	void EraseStart(WORD page, WORD addrLo, WORD cmd);
+;
+; PreCondition: None.
+;
+; Input:    	page 	- upper byte of address
+;				addrLo 	- lower word of address
+;				cmd		- type of memory operation to perform
+;                               
+; Output:   	None.
+;
+; Side Effects: NVMCONbits.WR stays set until the erase is done
+;
+; Overview: 	Starts the erase of the page at input address, the
+;				caller waits for it
+*********************************************************************/	
+void EraseStart(WORD page, WORD addrLo, WORD cmd)
 {
 	WORD temp;	
 
@@ -197,9 +306,6 @@ void Erase(WORD page, WORD addrLo, WORD cmd)
 
 	__builtin_write_NVM();
 
-
-	while(NVMCONbits.WR == 1);
-
 	#ifdef USE_RUNAWAY_PROTECT
 
 		}//end if(writekey1...
@@ -38,9 +38,13 @@
 #define MEMORY_H
 
 DWORD ReadLatch(WORD, WORD);
+BOOL IsBlank(WORD, WORD, WORD);
 void Erase(WORD, WORD, WORD);
+void EraseStart(WORD, WORD, WORD);
 void WriteLatch(WORD, WORD, WORD, WORD);
+void WriteRowLatch(WORD, WORD, BYTE *, WORD);
 void WriteMem(WORD);
+void WriteMemStart(WORD);
 void ResetDevice(WORD);
 
 #endif /*MEMORY_H*/
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <p24fxxxx.h>
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Sha256.h"
+
+#ifdef USE_SIGN
+//SHA-256, FIPS 180-4, for the image hash USE_SIGN keeps as rows are
+//written. The message schedule is a 16 word ring rather than all 64
+//words, which keeps the stack small on a part with little RAM.
+
+static const DWORD sha256K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define SHA256_ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+/********************************************************************
+* Function: 	static void Sha256Block(SHA256_CTX * ctx)
+*
+* Precondition: ctx->block holds a whole block.
+*
+* Input: 		ctx - hash in progress
+*
+* Output:		None.
+*
+* Side Effects:	ctx->state takes in the block.
+*
+* Overview: 	The SHA-256 compression function, 64 rounds with the
+*				schedule made 16 words ahead in place.
+*
+* Note:		 	None.
+********************************************************************/
+static void Sha256Block(SHA256_CTX * ctx)
+{
+	DWORD w[16];
+	DWORD a, b, c, d, e, f, g, h;
+	DWORD t1, t2;
+	BYTE i;
+
+	for(i = 0; i < 16; i++) {                                                       //Big endian words
+		w[i] = ((DWORD)ctx->block[4*i] << 24) | ((DWORD)ctx->block[4*i+1] << 16) |
+			   ((DWORD)ctx->block[4*i+2] << 8) | ctx->block[4*i+3];
+	}
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+	f = ctx->state[5];
+	g = ctx->state[6];
+	h = ctx->state[7];
+
+	for(i = 0; i < 64; i++) {
+		if(i >= 16) {                                                               //w[i] from w[i-16], w[i-15], w[i-7] and w[i-2]
+			t1 = w[(i+1) & 15];
+			t2 = w[(i+14) & 15];
+			w[i & 15] += (SHA256_ROR(t1, 7) ^ SHA256_ROR(t1, 18) ^ (t1 >> 3)) + w[(i+9) & 15] +
+						 (SHA256_ROR(t2, 17) ^ SHA256_ROR(t2, 19) ^ (t2 >> 10));
+		}
+		t1 = h + (SHA256_ROR(e, 6) ^ SHA256_ROR(e, 11) ^ SHA256_ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+			 sha256K[i] + w[i & 15];
+		t2 = (SHA256_ROR(a, 2) ^ SHA256_ROR(a, 13) ^ SHA256_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+	ctx->state[5] += f;
+	ctx->state[6] += g;
+	ctx->state[7] += h;
+}
+
+/********************************************************************
+* Function: 	void Sha256Init(SHA256_CTX * ctx)
+*
+* Precondition: None.
+*
+* Input: 		ctx - hash to start
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Sets the initial hash value, nothing hashed yet.
+*
+* Note:		 	None.
+********************************************************************/
+void Sha256Init(SHA256_CTX * ctx)
+{
+	ctx->state[0] = 0x6A09E667;
+	ctx->state[1] = 0xBB67AE85;
+	ctx->state[2] = 0x3C6EF372;
+	ctx->state[3] = 0xA54FF53A;
+	ctx->state[4] = 0x510E527F;
+	ctx->state[5] = 0x9B05688C;
+	ctx->state[6] = 0x1F83D9AB;
+	ctx->state[7] = 0x5BE0CD19;
+	ctx->bytes = 0;
+}
+
+/********************************************************************
+* Function: 	void Sha256Update(SHA256_CTX * ctx, BYTE * data, WORD length)
+*
+* Precondition: Sha256Init called.
+*
+* Input: 		ctx - hash in progress
+*				data - bytes to add
+*				length - how many
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Adds data to the message, compressing each block as
+*				it fills.
+*
+* Note:		 	Calls of a few bytes cost little more than one of
+*				many, WritePM hands it an instruction at a time.
+********************************************************************/
+void Sha256Update(SHA256_CTX * ctx, BYTE * data, WORD length)
+{
+	BYTE used = (BYTE)(ctx->bytes % SHA256_BLOCK_SIZE);
+
+	ctx->bytes += length;
+	while(length--) {
+		ctx->block[used++] = *data++;
+		if(used == SHA256_BLOCK_SIZE) {
+			Sha256Block(ctx);
+			used = 0;
+		}
+	}
+}
+
+/********************************************************************
+* Function: 	void Sha256Final(SHA256_CTX * ctx, BYTE * digest)
+*
+* Precondition: Sha256Init called.
+*
+* Input: 		ctx - hash in progress
+*				digest - SHA256_SIZE bytes for the result
+*
+* Output:		None.
+*
+* Side Effects:	ctx is used up, Sha256Init starts it again.
+*
+* Overview: 	Pads the message with 0x80, zeros and its length in
+*				bits, then writes the state out big endian.
+*
+* Note:		 	None.
+********************************************************************/
+void Sha256Final(SHA256_CTX * ctx, BYTE * digest)
+{
+	DWORD bits = ctx->bytes << 3;
+	BYTE used = (BYTE)(ctx->bytes % SHA256_BLOCK_SIZE);
+	BYTE i;
+
+	ctx->block[used++] = 0x80;
+	if(used > SHA256_BLOCK_SIZE - 8) {                                              //No room for the length, it goes in a block of its own
+		while(used < SHA256_BLOCK_SIZE) {
+			ctx->block[used++] = 0;
+		}
+		Sha256Block(ctx);
+		used = 0;
+	}
+	while(used < SHA256_BLOCK_SIZE - 4) {                                           //The high word of the 64-bit length is 0
+		ctx->block[used++] = 0;
+	}
+	ctx->block[60] = (BYTE)(bits >> 24);
+	ctx->block[61] = (BYTE)(bits >> 16);
+	ctx->block[62] = (BYTE)(bits >> 8);
+	ctx->block[63] = (BYTE)bits;
+	Sha256Block(ctx);
+
+	for(i = 0; i < SHA256_SIZE; i++) {
+		digest[i] = (BYTE)(ctx->state[i/4] >> (24 - 8*(i & 3)));
+	}
+}
+#endif
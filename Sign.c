@@ -0,0 +1,828 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <p24fxxxx.h>
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Sha256.h"
+#include "Sign.h"
+
+#ifdef USE_SIGN
+//ECDSA over P-256 with SHA-256 (FIPS 186-4), verify only. The message is
+//every row WritePM is given, in the order given: its 3 byte address low
+//byte first, then 3 bytes per instruction, phantom bytes left out. It is
+//hashed as the rows arrive, mostly while the row write keeps the CPU
+//waiting, so VERIFY_OK has only the curve arithmetic left to do.
+//
+//Programming only clears bits, so the hash says what was sent, not what
+//flash holds. The signature counts only if every page below the config
+//page was erased after it and before any row written to the page; rows
+//left from before, ours or anyone's, are then gone. erasedPages keeps
+//track, SignBegin clears it.
+//
+//Numbers are 16 words of 16 bits, least significant first, and field
+//arithmetic is Montgomery multiplication, one routine for both moduli.
+//Points are Jacobian, u1*G + u2*Q is one pass of doublings with Shamir's
+//trick. Nothing here is secret, so nothing needs to run in constant time.
+
+#ifdef USE_STATS
+extern BL_STATS stats;                                                              //Hashing and verify cycles are counted for RD_STATS
+#endif
+extern BYTE erasedPages[];                                                          //Pages ErasePM went over, see BootLoader.c
+
+#define EC_WORDS	16                                                              //256 bits
+
+typedef WORD EC_NUM[EC_WORDS];
+
+typedef struct {
+	EC_NUM x;
+	EC_NUM y;
+	EC_NUM z;                                                                       //0 for the point at infinity
+} EC_POINT;                                                                         //Jacobian, x/z^2 and y/z^3, Montgomery form mod p
+
+typedef struct {
+	EC_NUM m;
+	EC_NUM r2;                                                                      //2^512 mod m, takes a number into Montgomery form
+	WORD inv;                                                                       //-1/m mod 2^16
+} EC_MOD;
+
+static const EC_MOD ecP = {                                                         //Field prime, 2^256 - 2^224 + 2^192 + 2^96 - 1
+	{0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x0000, 0x0000,
+	 0x0000, 0x0000, 0x0000, 0x0000, 0x0001, 0x0000, 0xFFFF, 0xFFFF},
+	{0x0003, 0x0000, 0x0000, 0x0000, 0xFFFF, 0xFFFF, 0xFFFB, 0xFFFF,
+	 0xFFFE, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFD, 0xFFFF, 0x0004, 0x0000},
+	0x0001
+};
+
+static const EC_MOD ecN = {                                                         //Group order
+	{0x2551, 0xFC63, 0xCAC2, 0xF3B9, 0x9E84, 0xA717, 0xFAAD, 0xBCE6,
+	 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x0000, 0x0000, 0xFFFF, 0xFFFF},
+	{0xEEA2, 0xBE79, 0x4C95, 0x8324, 0x6FA6, 0x49BD, 0x799C, 0x4699,
+	 0xEC59, 0x2B6B, 0xB239, 0x2845, 0x5620, 0xF3D9, 0x2D94, 0x66E1},
+	0xBC4F
+};
+
+static const EC_NUM ecGx = {                                                        //Base point, plain form
+	0xC296, 0xD898, 0x3945, 0xF4A1, 0x33A0, 0x2DEB, 0x7D81, 0x7703,
+	0x40F2, 0x63A4, 0xE6E5, 0xF8BC, 0x4247, 0xE12C, 0xD1F2, 0x6B17
+};
+static const EC_NUM ecGy = {
+	0x51F5, 0x37BF, 0x4068, 0xCBB6, 0x5ECE, 0x6B31, 0x3357, 0x2BCE,
+	0x9E16, 0x7C0F, 0xEB4A, 0x8EE7, 0x7F9B, 0xFE1A, 0x42E2, 0x4FE3
+};
+
+static const BYTE signPublicKey[SIGN_PUBLIC_SIZE] = SIGN_PUBLIC_KEY;
+
+static BYTE signState = SIGN_NONE;
+static BYTE signature[SIGN_SIZE];
+static SHA256_CTX signHash;
+static BYTE *signRow;                                                               //Row being hashed, its next instruction
+static BYTE signRowLeft;                                                            //Instructions of it not hashed yet
+
+#ifdef SIM_BENCH
+DWORD ecMuls;
+#endif
+
+/********************************************************************
+* Function: 	static void EcLoad(WORD * a, const BYTE * bytes)
+*
+* Precondition: None.
+*
+* Input: 		a - number to set
+*				bytes - 32 bytes, big endian
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Reads a number as signatures and keys hold it.
+*
+* Note:		 	None.
+********************************************************************/
+static void EcLoad(WORD * a, const BYTE * bytes)
+{
+	BYTE i;
+
+	for(i = 0; i < EC_WORDS; i++) {
+		a[i] = ((WORD)bytes[30 - 2*i] << 8) | bytes[31 - 2*i];
+	}
+}
+
+/********************************************************************
+* Function: 	static BOOL EcIsZero(const WORD * a)
+*
+* Precondition: None.
+*
+* Input: 		a - number
+*
+* Output:		TRUE if it is 0.
+*
+* Side Effects:	None.
+*
+* Overview: 	Zero is zero in Montgomery form too.
+*
+* Note:		 	None.
+********************************************************************/
+static BOOL EcIsZero(const WORD * a)
+{
+	BYTE i;
+
+	for(i = 0; i < EC_WORDS; i++) {
+		if(a[i] != 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/********************************************************************
+* Function: 	static BOOL EcLess(const WORD * a, const WORD * b)
+*
+* Precondition: None.
+*
+* Input: 		a, b - numbers
+*
+* Output:		TRUE if a < b.
+*
+* Side Effects:	None.
+*
+* Overview: 	Compares from the most significant word down.
+*
+* Note:		 	None.
+********************************************************************/
+static BOOL EcLess(const WORD * a, const WORD * b)
+{
+	BYTE i = EC_WORDS;
+
+	while(i--) {
+		if(a[i] != b[i]) {
+			return a[i] < b[i];
+		}
+	}
+	return FALSE;
+}
+
+/********************************************************************
+* Function: 	static WORD EcAddWords(WORD * r, const WORD * a, const WORD * b)
+*
+* Precondition: None.
+*
+* Input: 		r - sum, may be a or b
+*				a, b - numbers
+*
+* Output:		Carry out, 0 or 1.
+*
+* Side Effects:	None.
+*
+* Overview: 	r = a + b mod 2^256.
+*
+* Note:		 	None.
+********************************************************************/
+static WORD EcAddWords(WORD * r, const WORD * a, const WORD * b)
+{
+	DWORD t = 0;
+	BYTE i;
+
+	for(i = 0; i < EC_WORDS; i++) {
+		t += (DWORD)a[i] + b[i];
+		r[i] = (WORD)t;
+		t >>= 16;
+	}
+	return (WORD)t;
+}
+
+/********************************************************************
+* Function: 	static WORD EcSubWords(WORD * r, const WORD * a, const WORD * b)
+*
+* Precondition: None.
+*
+* Input: 		r - difference, may be a or b
+*				a, b - numbers
+*
+* Output:		Borrow out, 0 or 1.
+*
+* Side Effects:	None.
+*
+* Overview: 	r = a - b mod 2^256.
+*
+* Note:		 	None.
+********************************************************************/
+static WORD EcSubWords(WORD * r, const WORD * a, const WORD * b)
+{
+	DWORD t = 0;
+	BYTE i;
+
+	for(i = 0; i < EC_WORDS; i++) {
+		t = (DWORD)a[i] - b[i] - t;
+		r[i] = (WORD)t;
+		t = (t >> 16) & 1;
+	}
+	return (WORD)t;
+}
+
+/********************************************************************
+* Function: 	static void EcAdd(WORD * r, const WORD * a, const WORD * b,
+*								  const EC_MOD * m)
+*
+* Precondition: a, b < m.
+*
+* Input: 		r - sum, may be a or b
+*				a, b - numbers
+*				m - modulus
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	r = a + b mod m.
+*
+* Note:		 	None.
+********************************************************************/
+static void EcAdd(WORD * r, const WORD * a, const WORD * b, const EC_MOD * m)
+{
+	if(EcAddWords(r, a, b) || !EcLess(r, m->m)) {
+		EcSubWords(r, r, m->m);
+	}
+}
+
+/********************************************************************
+* Function: 	static void EcSub(WORD * r, const WORD * a, const WORD * b,
+*								  const EC_MOD * m)
+*
+* Precondition: a, b < m.
+*
+* Input: 		r - difference, may be a or b
+*				a, b - numbers
+*				m - modulus
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	r = a - b mod m.
+*
+* Note:		 	None.
+********************************************************************/
+static void EcSub(WORD * r, const WORD * a, const WORD * b, const EC_MOD * m)
+{
+	if(EcSubWords(r, a, b)) {
+		EcAddWords(r, r, m->m);
+	}
+}
+
+/********************************************************************
+* Function: 	static void EcMul(WORD * r, const WORD * a, const WORD * b,
+*								  const EC_MOD * m)
+*
+* Precondition: b < m.
+*
+* Input: 		r - product, may be a or b
+*				a, b - numbers
+*				m - modulus
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Montgomery product r = a*b/2^256 mod m, word by word
+*				(CIOS): add a[i]*b, then the multiple of m that
+*				clears the low word, and shift down a word.
+*
+* Note:		 	Almost all of a verify's time is spent here.
+********************************************************************/
+static void EcMul(WORD * r, const WORD * a, const WORD * b, const EC_MOD * m)
+{
+	WORD t[EC_WORDS + 2];
+	DWORD c;
+	WORD q;
+	BYTE i, j;
+
+	#ifdef SIM_BENCH
+	ecMuls++;
+	#endif
+	for(j = 0; j < EC_WORDS + 2; j++) {
+		t[j] = 0;
+	}
+	for(i = 0; i < EC_WORDS; i++) {
+		c = 0;
+		for(j = 0; j < EC_WORDS; j++) {                                             //t += a[i]*b
+			c += (DWORD)a[i]*b[j] + t[j];
+			t[j] = (WORD)c;
+			c >>= 16;
+		}
+		c += t[EC_WORDS];
+		t[EC_WORDS] = (WORD)c;
+		t[EC_WORDS + 1] = (WORD)(c >> 16);
+
+		q = t[0]*m->inv;                                                            //(t + q*m)/2^16
+		c = ((DWORD)q*m->m[0] + t[0]) >> 16;
+		for(j = 1; j < EC_WORDS; j++) {
+			c += (DWORD)q*m->m[j] + t[j];
+			t[j-1] = (WORD)c;
+			c >>= 16;
+		}
+		c += t[EC_WORDS];
+		t[EC_WORDS - 1] = (WORD)c;
+		t[EC_WORDS] = t[EC_WORDS + 1] + (WORD)(c >> 16);
+	}
+	if(t[EC_WORDS] || !EcLess(t, m->m)) {                                           //Below 2m, one subtraction at most
+		EcSubWords(t, t, m->m);
+	}
+	for(j = 0; j < EC_WORDS; j++) {
+		r[j] = t[j];
+	}
+}
+
+/********************************************************************
+* Function: 	static void EcInvert(WORD * a, const EC_MOD * m)
+*
+* Precondition: a in Montgomery form, not 0; m prime.
+*
+* Input: 		a - number to invert, in place
+*				m - modulus
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	a = a^(m-2) = 1/a mod m, Fermat, by square and
+*				multiply from the top bit. Stays in Montgomery form.
+*
+* Note:		 	About 256 squares and as many multiplies as m-2
+*				has one bits.
+********************************************************************/
+static void EcInvert(WORD * a, const EC_MOD * m)
+{
+	EC_NUM e;
+	EC_NUM r;
+	WORD i = 16*EC_WORDS;
+	BYTE j;
+
+	for(j = 0; j < EC_WORDS; j++) {
+		e[j] = m->m[j];
+		r[j] = 0;
+	}
+	e[0] -= 2;                                                                      //Low word of either modulus is over 2
+	r[0] = 1;
+	EcMul(r, r, m->r2, m);                                                          //1 in Montgomery form
+	while(i--) {
+		EcMul(r, r, r, m);
+		if((e[i >> 4] >> (i & 15)) & 1) {
+			EcMul(r, r, a, m);
+		}
+	}
+	for(j = 0; j < EC_WORDS; j++) {
+		a[j] = r[j];
+	}
+}
+
+/********************************************************************
+* Function: 	static void EcDouble(EC_POINT * p)
+*
+* Precondition: None.
+*
+* Input: 		p - point, in place
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	p = 2p, the a = -3 doubling: delta = z^2,
+*				gamma = y^2, beta = x*gamma,
+*				alpha = 3(x - delta)(x + delta),
+*				x' = alpha^2 - 8 beta, z' = (y + z)^2 - gamma - delta,
+*				y' = alpha(4 beta - x') - 8 gamma^2.
+*
+* Note:		 	Infinity stays infinity, z' is 0.
+********************************************************************/
+static void EcDouble(EC_POINT * p)
+{
+	EC_NUM delta, gamma, beta, alpha, t;
+
+	EcMul(delta, p->z, p->z, &ecP);
+	EcMul(gamma, p->y, p->y, &ecP);
+	EcMul(beta, p->x, gamma, &ecP);
+	EcSub(t, p->x, delta, &ecP);
+	EcAdd(alpha, p->x, delta, &ecP);
+	EcMul(alpha, t, alpha, &ecP);
+	EcAdd(t, alpha, alpha, &ecP);
+	EcAdd(alpha, t, alpha, &ecP);
+
+	EcAdd(t, p->y, p->z, &ecP);
+	EcMul(t, t, t, &ecP);
+	EcSub(t, t, gamma, &ecP);
+	EcSub(p->z, t, delta, &ecP);
+
+	EcAdd(beta, beta, beta, &ecP);                                                  //4 beta
+	EcAdd(beta, beta, beta, &ecP);
+	EcMul(t, alpha, alpha, &ecP);
+	EcSub(t, t, beta, &ecP);
+	EcSub(p->x, t, beta, &ecP);
+
+	EcSub(t, beta, p->x, &ecP);
+	EcMul(t, alpha, t, &ecP);
+	EcMul(gamma, gamma, gamma, &ecP);                                               //8 gamma^2
+	EcAdd(gamma, gamma, gamma, &ecP);
+	EcAdd(gamma, gamma, gamma, &ecP);
+	EcAdd(gamma, gamma, gamma, &ecP);
+	EcSub(p->y, t, gamma, &ecP);
+}
+
+/********************************************************************
+* Function: 	static void EcAddPoint(EC_POINT * p, const EC_POINT * q)
+*
+* Precondition: None.
+*
+* Input: 		p - point, in place
+*				q - point to add
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	p = p + q, Jacobian both: u1 = x1 z2^2, u2 = x2 z1^2,
+*				s1 = y1 z2^3, s2 = y2 z1^3, h = u2 - u1,
+*				r = s2 - s1, x' = r^2 - h^3 - 2 u1 h^2,
+*				y' = r(u1 h^2 - x') - s1 h^3, z' = z1 z2 h.
+*
+* Note:		 	h = 0 means p = q, doubled instead, or p = -q, which
+*				gives infinity.
+********************************************************************/
+static void EcAddPoint(EC_POINT * p, const EC_POINT * q)
+{
+	EC_NUM z1z1, z2z2, u1, u2, s1, s2, h, r;
+	BYTE j;
+
+	if(EcIsZero(q->z)) {
+		return;
+	}
+	if(EcIsZero(p->z)) {
+		*p = *q;
+		return;
+	}
+	EcMul(z1z1, p->z, p->z, &ecP);
+	EcMul(z2z2, q->z, q->z, &ecP);
+	EcMul(u1, p->x, z2z2, &ecP);
+	EcMul(u2, q->x, z1z1, &ecP);
+	EcMul(s1, p->y, q->z, &ecP);
+	EcMul(s1, s1, z2z2, &ecP);
+	EcMul(s2, q->y, p->z, &ecP);
+	EcMul(s2, s2, z1z1, &ecP);
+	EcSub(h, u2, u1, &ecP);
+	EcSub(r, s2, s1, &ecP);
+	if(EcIsZero(h)) {
+		if(EcIsZero(r)) {
+			EcDouble(p);
+		} else {
+			for(j = 0; j < EC_WORDS; j++) {
+				p->z[j] = 0;
+			}
+		}
+		return;
+	}
+
+	EcMul(z1z1, p->z, q->z, &ecP);                                                  //z' = z1 z2 h
+	EcMul(p->z, z1z1, h, &ecP);
+	EcMul(z2z2, h, h, &ecP);                                                        //h^2, then u1 h^2 and h^3
+	EcMul(u1, u1, z2z2, &ecP);
+	EcMul(h, h, z2z2, &ecP);
+	EcMul(u2, r, r, &ecP);
+	EcSub(u2, u2, h, &ecP);
+	EcSub(u2, u2, u1, &ecP);
+	EcSub(p->x, u2, u1, &ecP);
+	EcSub(u1, u1, p->x, &ecP);
+	EcMul(u1, r, u1, &ecP);
+	EcMul(s1, s1, h, &ecP);
+	EcSub(p->y, u1, s1, &ecP);
+}
+
+/********************************************************************
+* Function: 	BOOL EcdsaVerify(BYTE * hash, BYTE * sig, const BYTE * key)
+*
+* Precondition: None.
+*
+* Input: 		hash - SHA256_SIZE byte message digest
+*				sig - r then s, SIGN_SIZE bytes
+*				key - public key, SIGN_PUBLIC_SIZE bytes
+*
+* Output:		TRUE if the signature is good.
+*
+* Side Effects:	None.
+*
+* Overview: 	Checks 0 < r, s < n, then finds u1*G + u2*Q with
+*				u1 = e/s and u2 = r/s mod n, and compares its x mod n
+*				with r. G, Q and G + Q are the points the doubling
+*				loop adds, two bits of u1 and u2 at a time.
+*
+* Note:		 	The key is taken to be on the curve, it is built in.
+*				Uses about 1 KB of stack.
+********************************************************************/
+BOOL EcdsaVerify(BYTE * hash, BYTE * sig, const BYTE * key)
+{
+	EC_NUM r, s, u1, u2;
+	EC_POINT g, q, gq, sum;
+	const EC_POINT *add;
+	WORD i = 16*EC_WORDS;
+	BYTE j;
+
+	EcLoad(r, sig);
+	EcLoad(s, sig + 32);
+	if(EcIsZero(r) || EcIsZero(s) || !EcLess(r, ecN.m) || !EcLess(s, ecN.m)) {
+		return FALSE;
+	}
+
+	EcMul(s, s, ecN.r2, &ecN);                                                      //1/s, Montgomery form
+	EcInvert(s, &ecN);
+	EcLoad(u1, hash);                                                               //Its own 256 bits, no truncation
+	EcMul(u1, u1, s, &ecN);                                                         //Plain form, the Montgomery factors cancel
+	EcMul(u2, r, s, &ecN);
+
+	for(j = 0; j < EC_WORDS; j++) {
+		g.z[j] = 0;
+		sum.x[j] = 0;
+		sum.y[j] = 0;
+		sum.z[j] = 0;                                                               //Infinity
+	}
+	g.z[0] = 1;
+	EcMul(g.z, g.z, ecP.r2, &ecP);
+	EcMul(g.x, ecGx, ecP.r2, &ecP);
+	EcMul(g.y, ecGy, ecP.r2, &ecP);
+	EcLoad(q.x, key);
+	EcLoad(q.y, key + 32);
+	EcMul(q.x, q.x, ecP.r2, &ecP);
+	EcMul(q.y, q.y, ecP.r2, &ecP);
+	for(j = 0; j < EC_WORDS; j++) {
+		q.z[j] = g.z[j];
+	}
+	gq = g;
+	EcAddPoint(&gq, &q);
+
+	while(i--) {                                                                    //Top bit first
+		EcDouble(&sum);
+		j = ((u1[i >> 4] >> (i & 15)) & 1) | (((u2[i >> 4] >> (i & 15)) & 1) << 1);
+		add = (j == 1) ? &g : (j == 2) ? &q : &gq;
+		if(j) {
+			EcAddPoint(&sum, add);
+		}
+	}
+	if(EcIsZero(sum.z)) {
+		return FALSE;
+	}
+
+	EcInvert(sum.z, &ecP);                                                          //x = x/z^2, then out of Montgomery form
+	EcMul(sum.y, sum.z, sum.z, &ecP);
+	EcMul(sum.x, sum.x, sum.y, &ecP);
+	for(j = 0; j < EC_WORDS; j++) {
+		sum.y[j] = 0;
+	}
+	sum.y[0] = 1;
+	EcMul(sum.x, sum.x, sum.y, &ecP);
+	if(!EcLess(sum.x, ecN.m)) {                                                     //x mod n, p < 2n
+		EcSubWords(sum.x, sum.x, ecN.m);
+	}
+	for(j = 0; j < EC_WORDS; j++) {
+		if(sum.x[j] != r[j]) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/********************************************************************
+* Function: 	void SignBegin(BYTE * sig)
+*
+* Precondition: None.
+*
+* Input: 		sig - SIGNATURE data, SIGN_SIZE bytes
+*
+* Output:		None.
+*
+* Side Effects:	Any hash in progress and any earlier result are lost.
+*				No page counts as erased any more.
+*
+* Overview: 	Keeps the signature of the image that follows and
+*				starts a new hash for its rows.
+*
+* Note:		 	With auto erase the rows erase their own pages
+*				again, the host erases the rest.
+********************************************************************/
+void SignBegin(BYTE * sig)
+{
+	BYTE i;
+
+	for(i = 0; i < SIGN_SIZE; i++) {
+		signature[i] = sig[i];
+	}
+	for(i = 0; i < (AUTO_ERASE_PAGES + 7)/8; i++) {
+		erasedPages[i] = 0;                                                         //Bits a page held before count for nothing
+	}
+	Sha256Init(&signHash);
+	signRowLeft = 0;
+	signState = SIGN_OPEN;
+}
+
+/********************************************************************
+* Function: 	void SignRow(BYTE * row, DWORD rowAddr)
+*
+* Precondition: SignFlush called since the row before.
+*
+* Input: 		row - the plain row, 4 bytes per instruction
+*				rowAddr - address of its first instruction
+*
+* Output:		None.
+*
+* Side Effects:	A row after VERIFY_OK checked the hash makes the
+*				result SIGN_BAD, the image is no longer the one
+*				checked. So does a row on a page not erased since
+*				SIGNATURE, flash would hold it ANDed with what was
+*				there.
+*
+* Overview: 	Hashes the address and leaves the row for
+*				SignPrefetch to take in while it is written.
+*
+* Note:		 	Rows with no SIGNATURE before them are not hashed.
+*				Nor can they count: the SIGNATURE that follows
+*				needs their pages erased again, see SignValid.
+********************************************************************/
+void SignRow(BYTE * row, DWORD rowAddr)
+{
+	DWORD_VAL addr;
+	WORD page = PAGE_NUM(rowAddr);
+
+	if(signState == SIGN_OPEN && (page >= AUTO_ERASE_PAGES || !(erasedPages[page/8] & (1 << (page % 8))))) {
+		signState = SIGN_BAD;                                                       //Written over what the page held
+	}
+	if(signState != SIGN_OPEN) {
+		if(signState == SIGN_GOOD) {
+			signState = SIGN_BAD;
+		}
+		return;
+	}
+	addr.Val = rowAddr;
+	Sha256Update(&signHash, addr.v, 3);
+	signRow = row;
+	signRowLeft = PM_ROW_SIZE/PM_INSTR_SIZE;
+}
+
+/********************************************************************
+* Function: 	void SignPrefetch(void)
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	One more instruction of the row hashed, if any is
+*				left.
+*
+* Overview: 	Work for the time an NVM operation leaves the CPU
+*				waiting, see PrefetchWriteMem. An instruction at a
+*				time, so the wait ends at most one block late.
+*
+* Note:		 	None.
+********************************************************************/
+void SignPrefetch(void)
+{
+	if(signRowLeft) {
+		Sha256Update(&signHash, signRow, 3);
+		signRow += PM_INSTR_SIZE;
+		signRowLeft--;
+	}
+}
+
+/********************************************************************
+* Function: 	void SignFlush(void)
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Hashes what the row write did not, before WritePM
+*				changes the row or moves on from it.
+*
+* Note:		 	None.
+********************************************************************/
+void SignFlush(void)
+{
+	#ifdef USE_STATS
+	DWORD start = StatsClock();
+	#endif
+
+	while(signRowLeft) {
+		SignPrefetch();
+	}
+
+	#ifdef USE_STATS
+	stats.signWait += StatsClock() - start;
+	#endif
+}
+
+/********************************************************************
+* Function: 	void SignErase(void)
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	The result is SIGN_BAD if rows were hashed.
+*
+* Overview: 	ER_FLASH may take out rows already hashed, the image
+*				would then not be what was signed. Erasing first is
+*				the usual order and is left alone.
+*
+* Note:		 	AutoErasePM only erases a page before its first row
+*				since SignBegin or the SESSION, which calls this.
+********************************************************************/
+void SignErase(void)
+{
+	if((signState == SIGN_OPEN && signHash.bytes != 0) || signState == SIGN_GOOD) {
+		signState = SIGN_BAD;
+	}
+}
+
+/********************************************************************
+* Function: 	BOOL SignValid(void)
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		TRUE if the rows written since SIGNATURE are the
+*				signed image and all flash holds below the config
+*				page.
+*
+* Side Effects:	The first call after the rows ends the hash and
+*				keeps the result, later calls return it.
+*
+* Overview: 	The check VERIFY_OK makes before it commits, as well
+*				as the VERIFY_RANGE match.
+*
+* Note:		 	The verify takes a few seconds at 16 MIPS, see
+*				README.md. The host allows for it in its timeout.
+*				The config page is left out, erasing it would take
+*				the configuration words; see USE_CONFIGWORD_PROTECT.
+********************************************************************/
+BOOL SignValid(void)
+{
+	BYTE digest[SHA256_SIZE];
+	WORD page;
+	#ifdef USE_STATS
+	DWORD start;
+	#endif
+
+	for(page = 0; signState == SIGN_OPEN && page < AUTO_ERASE_PAGES - 1; page++) {
+		if(!(erasedPages[page/8] & (1 << (page % 8)))) {
+			signState = SIGN_BAD;                                                   //Left holding rows from before SIGNATURE
+		}
+	}
+	if(signState == SIGN_OPEN) {
+		#ifdef USE_STATS
+		start = StatsClock();
+		#endif
+		Sha256Final(&signHash, digest);
+		signState = EcdsaVerify(digest, signature, signPublicKey) ? SIGN_GOOD : SIGN_BAD;
+		#ifdef USE_STATS
+		stats.signCycles += StatsClock() - start;
+		#endif
+	}
+	return signState == SIGN_GOOD;
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIGN_H
+#define SIGN_H
+
+#define SIGN_SIZE			64	//SIGNATURE data, r then s, 32 bytes each big endian
+#define SIGN_PUBLIC_SIZE	64	//SIGN_PUBLIC_KEY, x then y of the point, 32 bytes each big endian
+
+//Image signature state
+#define SIGN_NONE			0	//No SIGNATURE since reset
+#define SIGN_OPEN			1	//Rows are being hashed
+#define SIGN_GOOD			2	//Checked, the signature matched the rows
+#define SIGN_BAD			3	//Checked and failed, or changed after the check
+
+void SignBegin(BYTE *);
+void SignRow(BYTE *, DWORD);
+void SignPrefetch(void);
+void SignFlush(void);
+void SignErase(void);
+BOOL SignValid(void);
+BOOL EcdsaVerify(BYTE *, BYTE *, const BYTE *);
+
+#ifdef SIM_BENCH
+extern DWORD ecMuls;                                                                //Field multiplies so far, the bench turns them into cycles
+#endif
+
+#endif /*SIGN_H*/
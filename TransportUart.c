@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Memory.h"
+#include "Transport.h"
+#include "Uart.h"
+
+#ifndef USE_USB_CDC
+
+extern DWORD_VAL userReset;                                                         //AutoBaud leaves for the user code on timeout
+
+#ifdef USE_STATS
+extern BL_STATS stats;                                                              //Receive errors are counted for RD_STATS
+extern BYTE statsClock;
+#endif
+
+#ifndef USE_UART_ISR
+static WORD rxErrors;                                                               //Count of OERR/FERR/PERR events, see TransportErrors
+#endif
+
+/********************************************************************
+* Function: 	void TransportInit()
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Maps the UART pins on PPS devices.
+*
+* Overview: 	Sets up UARTNUM at BAUDRATE (or for autobaud), no
+*				parity, one stop bit, and enables the transmitter.
+*
+* Note:		 	With USE_UART_ISR the ring buffers and interrupts are
+*				started too.
+********************************************************************/
+void TransportInit(void)
+{
+	#ifdef DEV_HAS_PPS                                                              //If using a part with PPS, map the UART I/O
+		ioMap();
+	#endif
+
+	#ifdef UTX_ANA                                                                  //Configure UART pins to be digital I/O.
+		UTX_ANA = 1;
+	#endif
+	#ifdef URX_ANA
+		URX_ANA = 1;
+	#endif
+	#ifdef USE_MULTIDROP
+		RS485_DE = 0;                                                               //Listen, the bus belongs to the master
+		RS485_DE_TRIS = 0;
+	#endif
+
+    UxMODEbits.UARTEN = 1;                                                          //SETUP UART COMMS: No parity, one stop bit, autobaud, polled, Enable uart
+    #ifdef USE_AUTOBAUD
+	    UxMODEbits.ABAUD = 1;                                                       //Use autobaud
+    #else
+        UxBRG = BAUDRATEREG;
+    #endif
+	#ifdef USE_HI_SPEED_BRG
+		UxMODEbits.BRGH = 1;                                                        //Use high speed mode
+	#endif
+	UxSTA = 0x0400;                                                                 //Enable TX
+
+	#ifdef USE_UART_ISR
+		UartInit();                                                                 //Start interrupt driven RX/TX
+	#endif
+}
+
+/********************************************************************
+* Function: 	WORD TransportRead(BYTE * data, WORD length)
+*
+* Precondition: TransportInit called
+*
+* Input: 		data - where to put the characters
+*				length - room in data
+*
+* Output:		Number of characters read, 0 if none are waiting.
+*
+* Side Effects:	Clears UART receive errors.
+*
+* Overview: 	Non-blocking read of what the UART has received.
+*
+* Note:		 	A polled read stops at a receive error and counts it
+*				on the next call, after the characters before it.
+********************************************************************/
+WORD TransportRead(BYTE * data, WORD length)
+{
+	#ifdef USE_UART_ISR
+	return UartRead(data, length);
+	#else
+	WORD count = 0;
+
+	while(count < length) {
+		if((UxSTA & 0x000E) != 0x0000) {                                            //Check for receive errors
+			if(count != 0) {
+				break;
+			}
+			#ifdef USE_STATS
+			if(UxSTAbits.OERR) stats.overruns++;
+			if(UxSTA & 0x000C) stats.framingErrors++;
+			#endif
+			(void)UxRXREG;                                                          //Dummy read to clear FERR/PERR
+			UxSTAbits.OERR = 0;                                                     //Clear OERR to keep receiving
+			rxErrors++;
+		}
+		if(UxSTAbits.URXDA == 0) {
+			break;
+		}
+		data[count++] = UxRXREG;                                                    //Get data from UART RX FIFO
+	}
+	return count;
+	#endif
+}
+
+/********************************************************************
+* Function: 	void TransportWrite(BYTE * data, WORD length)
+*
+* Precondition: TransportInit called
+*
+* Input: 		data - characters to transmit
+*				length - number of characters
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Queues characters in the transmit ring, or feeds the
+*				TX FIFO directly when polled.
+*
+* Note:		 	With USE_UART_ISR it returns before the characters are
+*				on the wire. Polled it waits for TRMT, so a response
+*				is out before the next command starts.
+********************************************************************/
+void TransportWrite(BYTE * data, WORD length)
+{
+	#ifdef USE_UART_ISR
+	UartWrite(data, length);
+	#else
+	while(length--) {
+		while(UxSTAbits.UTXBF);                                                     //Wait for FIFO space
+		UxTXREG = *data++;                                                          //Put character onto UART FIFO to transmit
+	}
+	while(!UxSTAbits.TRMT);                                                         //Polled, wait for transmit to finish as before
+	#endif
+}
+
+/********************************************************************
+* Function: 	void TransportFlush()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Waits until everything written has left the transmit
+*				shift register.
+*
+* Note:		 	None.
+********************************************************************/
+void TransportFlush(void)
+{
+	#ifdef USE_UART_ISR
+	UartFlush();
+	#else
+	while(!UxSTAbits.TRMT);                                                         //Wait for transmit to finish
+	#endif
+}
+
+/********************************************************************
+* Function: 	void TransportClose()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Restores the primary IVT with USE_UART_ISR.
+*
+* Overview: 	Finishes sending and disables the UART before control
+*				is handed to the application.
+*
+* Note:		 	None.
+********************************************************************/
+void TransportClose(void)
+{
+	#ifdef USE_UART_ISR
+	UartClose();                                                                    //Finish sending and release the AIVT
+	#else
+	TransportFlush();
+	#endif
+	UxMODEbits.UARTEN = 0;                                                          //Disable UART
+}
+
+/********************************************************************
+* Function: 	WORD TransportErrors()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		Running count of receive errors.
+*
+* Side Effects:	None.
+*
+* Overview: 	GetCommand drops a frame when this changes while the
+*				frame is received.
+*
+* Note:		 	OERR, FERR, PERR and receive ring overflows.
+********************************************************************/
+WORD TransportErrors(void)
+{
+	#ifdef USE_UART_ISR
+	return uartErrors;
+	#else
+	return 0;
+	#endif
+}
+
+#ifdef USE_FAST_BOOT
+/********************************************************************
+* Function: 	BOOL TransportBreak(DWORD cycles)
+*
+* Precondition: UART and Timer2/3 not yet set up.
+*
+* Input: 		cycles - how long to watch the line, instruction cycles
+*
+* Output:		TRUE if a break arrived in that time.
+*
+* Side Effects:	Uses Timer2/3. Leaves the UART disabled.
+*
+* Overview: 	A host holding RX low through the reset shows up as
+*				NUL characters with FERR set. Anything else that
+*				arrives is dropped.
+*
+* Note:		 	Receive only and polled, the ring buffers and
+*				interrupts are not started. With USE_AUTOBAUD the
+*				BRG is left at its reset value, a break is a break at
+*				any rate.
+********************************************************************/
+BOOL TransportBreak(DWORD cycles)
+{
+	DWORD_VAL period;
+	BOOL seen = FALSE;
+	BYTE dummy;
+
+	#ifdef DEV_HAS_PPS
+		ioMap();
+	#endif
+	#ifdef URX_ANA
+		URX_ANA = 1;
+	#endif
+	#ifndef USE_AUTOBAUD
+		UxBRG = BAUDRATEREG;
+	#endif
+	#ifdef USE_HI_SPEED_BRG
+		UxMODEbits.BRGH = 1;
+	#endif
+	UxMODEbits.UARTEN = 1;
+
+	period.Val = cycles;
+	T2CONbits.TON = 0;
+	T2CONbits.T32 = 1;
+	IFS0bits.T3IF = 0;
+	PR3 = period.word.HW;
+	PR2 = period.word.LW;
+	TMR2 = 0;
+	TMR3 = 0;
+	T2CONbits.TON = 1;
+
+	while(!seen && !IFS0bits.T3IF) {
+		if(UxSTAbits.OERR) {
+			UxSTAbits.OERR = 0;
+		}
+		if(UxSTAbits.URXDA) {
+			seen = UxSTAbits.FERR;                                                  //FERR belongs to the character at the top of the FIFO
+			dummy = UxRXREG;
+			seen = seen && dummy == 0;
+		}
+	}
+
+	T2CONbits.TON = 0;
+	IFS0bits.T3IF = 0;
+	UxMODEbits.UARTEN = 0;
+	return seen;
+}
+#endif
+
+#ifdef USE_MULTIDROP
+/********************************************************************
+* Function: 	void TransportDriver(BOOL on)
+*
+* Precondition: TransportInit called
+*
+* Input: 		on - TRUE to drive the bus, FALSE to let go of it
+*
+* Output:		None.
+*
+* Side Effects:	Waits for the transmitter to finish when letting go.
+*
+* Overview: 	Drives the RS-485 transceiver's DE pin around a reply.
+*				It is released only after the last stop bit, dropping
+*				it once the bytes are queued would cut the frame off.
+*
+* Note:		 	With DE wired to /RE as well, nothing is received
+*				while the pin is high.
+********************************************************************/
+void TransportDriver(BOOL on)
+{
+	if(on) {
+		RS485_DE = 1;
+	} else {
+		TransportFlush();
+		RS485_DE = 0;
+	}
+}
+#endif
+
+#ifdef USE_AUTOBAUD
+/*********************************************************************
+* Function:     void AutoBaud()
+*
+* PreCondition: UART Setup
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	Resets WDT.
+*
+* Overview:		Sets autobaud mode and waits for completion, then
+*				discards the sync character.
+*
+* Note:			Contains code to handle UART errata issues for
+				PIC24FJ128 family parts, A2 and A3 revs.
+********************************************************************/
+void AutoBaud()
+{
+	UxMODEbits.ABAUD = 1;                                                           //Set autobaud mode
+
+	while(UxMODEbits.ABAUD)	{                                                       //Wait for sync character 0x55
+		asm("clrwdt");                                                              //looping code so clear WDT
+		if(IFS0bits.T3IF == 1) {                                                    //if timer expired, jump to user code
+			#ifdef USE_STATS
+			if(statsClock) {
+				IFS0bits.T3IF = 0;                                                  //Only the counters' clock wrapping
+				continue;
+			}
+			#endif
+			ResetDevice(userReset.Val);
+		}
+		if(UxSTAbits.OERR) {
+			UxSTAbits.OERR = 0;
+			#ifdef USE_STATS
+			stats.overruns++;
+			#endif
+		}
+		if(UxSTAbits.URXDA) (void)UxRXREG;
+	}
+
+	#ifdef USE_WORKAROUNDS                                                          //Workarounds for autobaud errata in some silicon revisions
+		if(UxBRG == 0xD) UxBRG--;                                                   //Workaround for autobaud innaccuracy
+		if(UxBRG == 0x1A) UxBRG--;
+		if(UxBRG == 0x09) UxBRG--;
+
+		#ifdef USE_HI_SPEED_BRG                                                     //Workarounds for ABAUD incompatability w/ BRGH = 1
+			UxBRG = (UxBRG+1)*4 -1;
+			if(UxBRG == 0x13) UxBRG=0x11;
+			if(UxBRG == 0x1B) UxBRG=0x19;
+			if(UxBRG == 0x08) UxBRG=0x22;
+
+			if (UxBRG & 0x0001)	UxBRG++;                                            //Workaround for Odd BRG recieve error when BRGH = 1
+		#endif
+	#endif
+
+	(void)UxRXREG;                                                                  //Dummy read
+
+}
+#endif
+
+#ifdef DEV_HAS_PPS
+/*********************************************************************
+* Function:     void ioMap()
+*
+* PreCondition: None.
+*
+* Input:		None.
+*
+* Output:		None.
+*
+* Side Effects:	Locks IOLOCK bit.
+*
+* Overview:		Maps UART IO for communications on PPS devices.
+*
+* Note:			None.
+********************************************************************/
+void ioMap()
+{
+	__builtin_write_OSCCONL(OSCCON & 0xFFBF);                                       //Clear the IOLOCK bit
+	PPS_URX_REG = PPS_URX_PIN;                                                      //UxRX = RP19
+	PPS_UTX_PIN = UxTX_IO;                                                          //RP25 = UxTX
+	__builtin_write_OSCCONL(OSCCON | 0x0040);                                       //Lock the IOLOCK bit so that the IO is not accedentally changed.
+}
+#endif
+
+#endif //ifndef USE_USB_CDC
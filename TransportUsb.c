@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Transport.h"
+
+#ifdef USE_USB_CDC
+
+//Microchip Application Library USB device stack. usb_config.h and
+//usb_descriptors.c come from its CDC basic demo, see README.md.
+#include "USB/usb.h"
+#include "USB/usb_function_cdc.h"
+
+#if defined(USB_INTERRUPT)
+	#error "TransportUsb.c services the USB stack by polling, define USB_POLLING in usb_config.h"
+#endif
+
+#if (TRANSPORT_BLOCK_SIZE < CDC_DATA_OUT_EP_SIZE)
+	#error "getsUSBUSART drops what does not fit, TRANSPORT_BLOCK_SIZE must hold a whole OUT packet"
+#endif
+
+/********************************************************************
+* Function: 	BOOL TransportService()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		TRUE once the host has configured the device.
+*
+* Side Effects:	Clears WDT.
+*
+* Overview: 	Runs the USB device state machine and moves queued IN
+*				data to the endpoint.
+*
+* Note:		 	Must run every few ms during enumeration. Once
+*				configured the SIE NAKs the host on its own, so NVM
+*				stalls only slow the transfer down.
+********************************************************************/
+static BOOL TransportService(void)
+{
+	asm("clrwdt");
+	USBDeviceTasks();
+	if(USBGetDeviceState() < CONFIGURED_STATE || USBIsDeviceSuspended()) {
+		return FALSE;
+	}
+	CDCTxService();
+	return TRUE;
+}
+
+/********************************************************************
+* Function: 	void TransportInit()
+*
+* Precondition: USB clock running (96 MHz PLL, see main.c)
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Attaches to the bus.
+*
+* Overview: 	Starts the USB device stack. Enumeration completes
+*				while GetChar polls TransportRead.
+*
+* Note:		 	None.
+********************************************************************/
+void TransportInit(void)
+{
+	USBDeviceInit();
+}
+
+/********************************************************************
+* Function: 	WORD TransportRead(BYTE * data, WORD length)
+*
+* Precondition: TransportInit called
+*
+* Input: 		data - where to put the characters
+*				length - room in data, at least one OUT packet
+*
+* Output:		Number of characters read, 0 if none are waiting.
+*
+* Side Effects:	Services the USB stack.
+*
+* Overview: 	Non-blocking read of the last OUT packet from the host.
+*
+* Note:		 	None.
+********************************************************************/
+WORD TransportRead(BYTE * data, WORD length)
+{
+	if(!TransportService()) {
+		return 0;
+	}
+	return getsUSBUSART((char *)data, (BYTE)length);
+}
+
+/********************************************************************
+* Function: 	void TransportWrite(BYTE * data, WORD length)
+*
+* Precondition: TransportInit called
+*
+* Input: 		data - characters to transmit
+*				length - number of characters
+*
+* Output:		None.
+*
+* Side Effects:	Services the USB stack.
+*
+* Overview: 	Sends the characters as bulk IN packets.
+*
+* Note:		 	putUSBUSART keeps a pointer to data, so each packet
+*				is moved to the endpoint buffer before returning.
+*				Characters are dropped if the host deconfigures the
+*				device meanwhile, the host resends the command.
+********************************************************************/
+void TransportWrite(BYTE * data, WORD length)
+{
+	BYTE count;
+
+	while(length != 0) {
+		while(!USBUSARTIsTxTrfReady()) {                                            //Previous packet still in the endpoint
+			if(!TransportService()) {
+				return;
+			}
+		}
+		count = (length > CDC_DATA_IN_EP_SIZE) ? CDC_DATA_IN_EP_SIZE : (BYTE)length;
+		putUSBUSART((char *)data, count);
+		CDCTxService();                                                             //Copies the packet out of data
+		data += count;
+		length -= count;
+	}
+}
+
+/********************************************************************
+* Function: 	void TransportFlush()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Services the USB stack.
+*
+* Overview: 	Waits until the host has taken the last IN packet.
+*
+* Note:		 	None.
+********************************************************************/
+void TransportFlush(void)
+{
+	while(!USBUSARTIsTxTrfReady()) {
+		if(!TransportService()) {
+			return;
+		}
+	}
+}
+
+/********************************************************************
+* Function: 	void TransportClose()
+*
+* Precondition: TransportInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Detaches from the bus.
+*
+* Overview: 	Finishes sending and drops off the bus, the
+*				application enumerates again with its own stack.
+*
+* Note:		 	None.
+********************************************************************/
+void TransportClose(void)
+{
+	TransportFlush();
+	USBSoftDetach();
+}
+
+/********************************************************************
+* Function: 	WORD TransportErrors()
+*
+* Precondition: None.
+*
+* Input: 		None.
+*
+* Output:		Always 0.
+*
+* Side Effects:	None.
+*
+* Overview: 	USB retries damaged packets itself, nothing reaches
+*				GetCommand with a byte missing.
+*
+* Note:		 	None.
+********************************************************************/
+WORD TransportErrors(void)
+{
+	return 0;
+}
+
+#ifdef USE_FAST_BOOT
+/********************************************************************
+* Function: 	BOOL TransportBreak(DWORD cycles)
+*
+* Precondition: None.
+*
+* Input: 		cycles - how long the UART would watch the line
+*
+* Output:		Always FALSE.
+*
+* Side Effects:	None.
+*
+* Overview: 	USB has no break condition to look for.
+*
+* Note:		 	None.
+********************************************************************/
+BOOL TransportBreak(DWORD cycles)
+{
+	return FALSE;
+}
+#endif
+
+/********************************************************************
+* Function: 	BOOL USER_USB_CALLBACK_EVENT_HANDLER(int event,
+*					void * pdata, WORD size)
+*
+* Precondition: None.
+*
+* Input: 		event - USB stack event
+*				pdata, size - event data
+*
+* Output:		TRUE.
+*
+* Side Effects:	None.
+*
+* Overview: 	Opens the CDC endpoints once configured and answers
+*				the CDC class requests (line coding and so on, which
+*				mean nothing to a virtual port).
+*
+* Note:		 	Called by the USB stack.
+********************************************************************/
+BOOL USER_USB_CALLBACK_EVENT_HANDLER(int event, void * pdata, WORD size)
+{
+	switch(event) {
+		case EVENT_CONFIGURED:
+			CDCInitEP();
+			break;
+		case EVENT_EP0_REQUEST:
+			USBCheckCDCRequest();
+			break;
+		default:
+			break;
+	}
+	return TRUE;
+}
+
+#endif //ifdef USE_USB_CDC
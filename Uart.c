@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <GenericTypeDefs.h>
+#include "BootLoader.h"
+#include "Uart.h"
+
+#ifdef USE_UART_ISR
+
+//Globals ********************************
+static BYTE rxBuffer[UART_RX_BUF_SIZE];                                             //Receive ring, filled by UxRXInterrupt
+static BYTE txBuffer[UART_TX_BUF_SIZE];                                             //Transmit ring, drained by UxTXInterrupt
+static volatile WORD rxHead;                                                        //Next free slot, written only by the ISR
+static volatile WORD rxTail;                                                        //Next byte to read, written only by UartRead
+static volatile WORD txHead;                                                        //Next free slot, written only by UartWrite
+static volatile WORD txTail;                                                        //Next byte to send, written only by the ISR
+static BYTE rxGap[UART_RX_BUF_SIZE/8];                                              //One bit per ring slot, set if characters were lost before it
+static BYTE gapPending;                                                             //Mark the next stored character, written only by the ISR
+volatile WORD uartErrors;                                                           //Count of OERR/FERR/PERR events and ring overflows
+
+#ifdef USE_STATS
+extern BL_STATS stats;                                                              //Error counters below, read with RD_STATS
+#endif
+
+/********************************************************************
+* Function: 	void UartInit()
+*
+* Precondition: UART enabled and baud rate set
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Switches the CPU to the alternate interrupt vector table.
+*
+* Overview: 	Empties both ring buffers and enables the UART receive
+*				interrupt. The transmit interrupt is enabled on demand
+*				by UartWrite.
+*
+* Note:		 	The bootloader handlers live in the AIVT so that the
+*				application can own the primary IVT.
+********************************************************************/
+void UartInit(void)
+{
+	rxHead = 0;
+	rxTail = 0;
+	txHead = 0;
+	txTail = 0;
+	uartErrors = 0;
+
+	UxRXIE = 0;
+	UxTXIE = 0;
+	UxRXIP = UART_INT_PRIORITY;
+	UxTXIP = UART_INT_PRIORITY;
+	INTCON2bits.ALTIVT = 1;                                                         //Vector through the bootloader owned AIVT
+	SRbits.IPL = 0;                                                                 //Allow the UART interrupts to run
+
+	UxRXIF = 0;
+	UxRXIE = 1;                                                                     //Interrupt on every received character
+}
+
+/********************************************************************
+* Function: 	WORD UartRead(BYTE * data, WORD length)
+*
+* Precondition: UartInit called
+*
+* Input: 		data - where to put the characters
+*				length - room in data
+*
+* Output:		Number of characters taken from the receive ring.
+*
+* Side Effects:	None.
+*
+* Overview: 	Non-blocking read from the receive ring buffer.
+*
+* Note:		 	uartErrors is incremented when a character follows
+*				a receive error or lost characters. The read stops
+*				in front of such a character so the count changes
+*				only once everything before it has been parsed, and
+*				a frame can tell whether its own bytes were damaged.
+********************************************************************/
+WORD UartRead(BYTE * data, WORD length)
+{
+	WORD tail = rxTail;
+	WORD head = rxHead;
+	WORD count = 0;
+
+	while(tail != head && count < length) {
+		if(rxGap[tail >> 3] & (1 << (tail & 7))) {                                  //Count the error where it happened in the stream
+			if(count != 0) {
+				break;
+			}
+			uartErrors++;
+		}
+		data[count++] = rxBuffer[tail];
+		tail = (tail + 1) & (UART_RX_BUF_SIZE - 1);
+	}
+	rxTail = tail;
+	return count;
+}
+
+/********************************************************************
+* Function: 	void UartWrite(BYTE * data, WORD length)
+*
+* Precondition: UartInit called
+*
+* Input: 		data - characters to transmit
+*				length - number of characters
+*
+* Output:		None.
+*
+* Side Effects:	Clears WDT while waiting for space.
+*
+* Overview: 	Queues characters for transmission. Only blocks while
+*				the transmit ring is full.
+*
+* Note:		 	None.
+********************************************************************/
+void UartWrite(BYTE * data, WORD length)
+{
+	WORD head = txHead;
+	WORD next;
+
+	while(length--) {
+		next = (head + 1) & (UART_TX_BUF_SIZE - 1);
+		if(next == txTail) {                                                        //Ring full, wait for the ISR to make room
+			txHead = head;
+			UxTXIE = 1;
+			UxTXIF = 1;
+			while(next == txTail) {
+				asm("clrwdt");
+			}
+		}
+		txBuffer[head] = *data++;
+		head = next;
+	}
+	txHead = head;
+
+	UxTXIE = 1;                                                                     //Kick the transmitter, the ISR returns
+	UxTXIF = 1;                                                                     //immediately if the FIFO is already full
+}
+
+/********************************************************************
+* Function: 	void UartFlush()
+*
+* Precondition: UartInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Clears WDT.
+*
+* Overview: 	Waits until every queued character has left the
+*				transmit shift register.
+*
+* Note:		 	None.
+********************************************************************/
+void UartFlush(void)
+{
+	while(txHead != txTail || !UxSTAbits.TRMT) {
+		asm("clrwdt");
+	}
+}
+
+/********************************************************************
+* Function: 	void UartClose()
+*
+* Precondition: UartInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Restores the primary interrupt vector table.
+*
+* Overview: 	Drains the transmitter and disables the UART interrupts
+*				before control is handed to the application.
+*
+* Note:		 	None.
+********************************************************************/
+void UartClose(void)
+{
+	UartFlush();
+
+	UxRXIE = 0;
+	UxTXIE = 0;
+	UxRXIF = 0;
+	UxTXIF = 0;
+	INTCON2bits.ALTIVT = 0;                                                         //Hand the IVT back to the application
+}
+
+/********************************************************************
+* Function: 	void UxRXInterrupt()
+*
+* Precondition: UartInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Clears OERR.
+*
+* Overview: 	Empties the UART RX FIFO with UartPollRx.
+*
+* Note:		 	None.
+********************************************************************/
+void BL_ISR UxRXInterrupt(void)
+{
+	UxRXIF = 0;
+	UartPollRx();
+}
+
+/********************************************************************
+* Function: 	void UartPollRx()
+*
+* Precondition: UartInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Clears OERR.
+*
+* Overview: 	Moves every character in the UART RX FIFO into the
+*				receive ring. Receive errors and ring overflows mark
+*				the next stored character instead of being dropped
+*				silently.
+*
+* Note:		 	The FIFO is drained before OERR is cleared since
+*				clearing OERR resets the FIFO. Called outside the
+*				ISR only while the UART interrupts are held off.
+********************************************************************/
+void UartPollRx(void)
+{
+	BYTE rxChar;
+	WORD head;
+	WORD next;
+
+	head = rxHead;
+	while(UxSTAbits.URXDA) {
+		if((UxSTA & 0x000C) != 0x0000) {                                            //FERR/PERR apply to the character at the top of the FIFO
+			gapPending = 1;
+			#ifdef USE_STATS
+			stats.framingErrors++;
+			#endif
+		}
+		rxChar = UxRXREG;
+
+		next = (head + 1) & (UART_RX_BUF_SIZE - 1);
+		if(next != rxTail) {
+			rxBuffer[head] = rxChar;
+			if(gapPending) {
+				rxGap[head >> 3] |= 1 << (head & 7);
+				gapPending = 0;
+			} else {
+				rxGap[head >> 3] &= ~(1 << (head & 7));
+			}
+			head = next;
+		} else {
+			gapPending = 1;                                                         //Ring full, character lost
+			#ifdef USE_STATS
+			stats.ringOverflows++;
+			#endif
+		}
+	}
+	rxHead = head;
+
+	if(UxSTAbits.OERR) {
+		UxSTAbits.OERR = 0;                                                         //Clear OERR to keep receiving
+		gapPending = 1;
+		#ifdef USE_STATS
+		stats.overruns++;
+		#endif
+	}
+}
+
+/********************************************************************
+* Function: 	void UxTXInterrupt()
+*
+* Precondition: UartInit called
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview: 	Refills the UART TX FIFO from the transmit ring and
+*				disables itself once the ring is empty.
+*
+* Note:		 	None.
+********************************************************************/
+void BL_ISR UxTXInterrupt(void)
+{
+	WORD tail;
+
+	UxTXIF = 0;
+
+	tail = txTail;
+	while(!UxSTAbits.UTXBF) {
+		if(tail == txHead) {
+			UxTXIE = 0;                                                             //Nothing left to send
+			break;
+		}
+		UxTXREG = txBuffer[tail];
+		tail = (tail + 1) & (UART_TX_BUF_SIZE - 1);
+	}
+	txTail = tail;
+}
+
+#endif //ifdef USE_UART_ISR
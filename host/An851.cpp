@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "An851.h"
+
+namespace an851 {
+
+static size_t Stuff(uint8_t data, Bytes &out)
+{
+    if(data == STX || data == ETX || data == DLE) {
+        out.push_back(DLE);
+        out.push_back(data);
+        return 2;
+    }
+    out.push_back(data);
+    return 1;
+}
+
+size_t Encode(const uint8_t *payload, size_t length, Bytes &out, unsigned check)
+{
+    uint8_t checksum = 0;
+    uint32_t crc;
+    size_t n = 3;
+    size_t i;
+
+    out.reserve(out.size() + 2 * (length + check) + 3);
+    out.push_back(STX);
+    out.push_back(STX);
+    for(i = 0; i < length; i++) {
+        checksum += payload[i];
+        n += Stuff(payload[i], out);
+    }
+    if(check > 1) {
+        crc = FrameCrc(payload, length, check);
+        for(i = check; i-- > 0;) {                                  //High byte first
+            n += Stuff((uint8_t)(crc >> (8 * i)), out);
+        }
+    } else {
+        n += Stuff((uint8_t)(~checksum + 1), out);
+    }
+    out.push_back(ETX);
+    return n;
+}
+
+size_t EncodeCobs(const uint8_t *payload, size_t length, Bytes &out, unsigned check)
+{
+    Bytes frame(payload, payload + length);
+    uint8_t checksum = 0;
+    uint32_t crc;
+    size_t start = out.size();
+    size_t k = 0;
+    size_t j;
+    size_t i;
+    uint8_t code;
+
+    if(check > 1) {
+        crc = FrameCrc(payload, length, check);
+        for(i = check; i-- > 0;) {                                  //High byte first
+            frame.push_back((uint8_t)(crc >> (8 * i)));
+        }
+    } else {
+        for(i = 0; i < length; i++) {
+            checksum += payload[i];
+        }
+        frame.push_back((uint8_t)(~checksum + 1));
+    }
+    out.reserve(out.size() + frame.size() + frame.size() / 254 + 3);
+    out.push_back(STX);
+    while(true) {
+        for(j = k; j < frame.size() && j - k < 254 && frame[j] != STX; j++) {
+        }
+        code = (uint8_t)(j - k + 1);
+        out.push_back(code ^ STX);
+        out.insert(out.end(), frame.begin() + k, frame.begin() + j);
+        k = j;
+        if(k == frame.size()) {
+            break;
+        }
+        if(code != 0xFF) {
+            k++;                                                    //The STX the block stands for
+        }
+    }
+    out.push_back(STX);
+    return out.size() - start;
+}
+
+Decoder::Decoder() : badFrames(0), check(1), cobs(false), addressed(false)
+{
+    Reset();
+}
+
+void Decoder::Reset()
+{
+    state = IDLE;
+    checksum = 0;
+    payload.clear();
+}
+
+bool Decoder::Put(uint8_t data)
+{
+    switch(state) {
+    case IDLE:
+        if(data == STX) {
+            state = FIRST_STX;
+        }
+        return false;
+    case FIRST_STX:
+        if(data == STX) {
+            state = BODY;
+            checksum = 0;
+            payload.clear();
+        } else if(cobs) {
+            state = COBS;
+            checksum = 0;
+            payload.clear();
+            cobsLeft = (uint8_t)(data ^ STX) - 1;
+            cobsImplied = cobsLeft != 254;
+        } else {
+            state = IDLE;
+        }
+        return false;
+    case COBS:
+        if(data == STX) {                                           //End of the frame, start of the next
+            state = FIRST_STX;
+            if(cobsLeft != 0) {
+                badFrames++;
+                return false;
+            }
+            return Finish();
+        }
+        if(cobsLeft == 0) {                                         //Code byte
+            cobsLeft = (uint8_t)(data ^ STX) - 1;
+            if(!cobsImplied) {
+                cobsImplied = cobsLeft != 254;
+                return false;
+            }
+            cobsImplied = cobsLeft != 254;
+            data = STX;
+        } else {
+            cobsLeft--;
+        }
+        break;
+    case ESCAPE:
+        state = BODY;
+        break;                                                      //Data, whatever its value
+    case BODY:
+        if(data == STX) {                                           //Start over, as GetCommand() does
+            checksum = 0;
+            payload.clear();
+            return false;
+        }
+        if(data == DLE) {
+            state = ESCAPE;
+            return false;
+        }
+        if(data == ETX) {
+            state = IDLE;
+            return Finish();
+        }
+        break;
+    }
+    checksum += data;
+    payload.push_back(data);
+    return false;
+}
+
+bool Decoder::Finish()
+{
+    size_t at = addressed ? 1 : 0;
+    unsigned bytes = (check > 1 && payload.size() > at && payload[at] != SESSION) ? check : 1;
+
+    if(payload.size() < bytes ||
+       (bytes > 1 ? FrameCrc(payload.data(), payload.size(), bytes) != 0 : checksum != 0)) {
+        badFrames++;
+        return false;
+    }
+    payload.resize(payload.size() - bytes);                         //Checksum or CRC
+    return true;
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static uint32_t table[256];
+    uint32_t c;
+    int i, k;
+
+    if(table[1] == 0) {
+        for(i = 0; i < 256; i++) {
+            c = (uint32_t)i;
+            for(k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while(length--) {
+        crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+uint32_t FrameCrc(const uint8_t *data, size_t length, unsigned bytes)
+{
+    static uint32_t table16[256];
+    static uint32_t table32[256];
+    uint32_t *table = bytes == 2 ? table16 : table32;
+    unsigned shift = bytes * 8 - 8;
+    uint32_t mask = bytes == 2 ? 0xFFFF : 0xFFFFFFFF;
+    uint32_t crc, c;
+    int i, k;
+
+    if(table[1] == 0) {
+        for(i = 0; i < 256; i++) {
+            c = (uint32_t)i << shift;
+            for(k = 0; k < 8; k++) {
+                c = (c >> (shift + 7)) & 1 ? (c << 1) ^ (bytes == 2 ? 0x1021 : 0x04C11DB7UL) : c << 1;
+            }
+            table[i] = c & mask;
+        }
+    }
+    crc = mask;
+    while(length--) {
+        crc = ((crc << 8) ^ table[((crc >> shift) ^ *data++) & 0xFF]) & mask;
+    }
+    return crc;
+}
+
+} //namespace an851
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * AN851 framing and commands as BootLoader.c speaks them, for host tools.
+ * A frame is STX STX, the payload with STX/ETX/DLE escaped by a DLE, the
+ * two's complement of the payload sum (escaped the same way), then ETX.
+ * After a SESSION that agreed on one, a CRC-16 or CRC-32 takes the place
+ * of the checksum, high byte first; SESSION frames keep the checksum.
+ * One that agreed on COBS lets other frames go as STX, the payload and
+ * trailer in blocks of at most 254 bytes each led by a code byte (its
+ * length plus one, XORed with STX) and ending where the payload had an STX,
+ * then STX. Only the two STX and the code bytes are added, and the
+ * opening STX is left out when the last byte on the line was an STX.
+ * On a USE_MULTIDROP bus a node address leads the payload of every frame.
+ */
+
+#ifndef AN851_H
+#define AN851_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace an851 {
+
+//Commands, see BootLoader.h
+const uint8_t RD_VER        = 0x00;                                 //Length 0 is RESET
+const uint8_t RD_FLASH      = 0x01;
+const uint8_t WT_FLASH      = 0x02;
+const uint8_t ER_FLASH      = 0x03;
+const uint8_t VERIFY_OK     = 0x08;
+const uint8_t SESSION       = 0x09;
+const uint8_t RD_CRC_MAP    = 0x0A;
+const uint8_t VERIFY_RANGE  = 0x0B;
+const uint8_t RD_STATS      = 0x0E;                                 //Only with USE_STATS
+const uint8_t RD_SLOT       = 0x0F;                                 //Only with USE_DUAL_SLOT
+const uint8_t JOURNAL       = 0x10;                                 //Only with USE_JOURNAL
+const uint8_t RD_STREAM     = 0x11;                                 //Only with USE_STREAM
+const uint8_t BATCH         = 0x12;                                 //Only with USE_BATCH
+const uint8_t SET_NONCE     = 0x13;                                 //Only with USE_AES
+const uint8_t SIGNATURE     = 0x14;                                 //Only with USE_SIGN
+const uint8_t SEQ_NAK       = 0xFF;
+
+const uint8_t SESSION_LARGE = 0x01;
+const uint8_t SESSION_CRC16 = 0x02;
+const uint8_t SESSION_CRC32 = 0x04;
+const uint8_t SESSION_COBS  = 0x08;
+const uint8_t SESSION_AUTO_ERASE = 0x10;                            //WT_FLASH erases a page before its first row
+const uint8_t SESSION_BATCH = 0x20;                                 //Reply only: BATCH is built in
+const uint8_t SESSION_AES   = 0x40;                                 //Reply only: rows are decrypted, see Crypt.h
+const uint8_t SESSION_SIGN  = 0x80;                                 //Reply only: VERIFY_OK needs a signature, see Sign.h
+const uint8_t STATS_CLEAR   = 0x01;
+const uint8_t SLOT_NONE     = 0xFF;                                 //RD_SLOT: no valid slot yet
+const uint8_t JOURNAL_BEGIN = 0x01;                                 //JOURNAL: start a new journal
+const unsigned JOURNAL_ERASE = 0;                                   //Journal entry types
+const unsigned JOURNAL_WRITE = 1;
+const unsigned JOURNAL_VERIFY = 2;
+const unsigned BATCH_MAX_OPS = 32;                                  //Sub-commands per BATCH, as BootLoader.h sets it
+const unsigned BATCH_RESULT_SIZE = 5;                               //Per sub-command in the reply: status, then 4 bytes
+const uint8_t BATCH_OK      = 0x00;                                 //BATCH status per sub-command
+const uint8_t BATCH_MISMATCH = 0x02;                                //VERIFY_RANGE CRC differs
+const uint8_t BATCH_SKIPPED = 0x04;                                 //Not run, an earlier one failed
+const uint8_t STREAM_BLANK  = 0x80;                                 //RD_STREAM token: (token & 0x7F) + 1 erased instructions
+const uint8_t NODE_BROADCAST = 0x7F;                                //Every node takes the frame, none replies
+const uint8_t NODE_REPLY    = 0x80;                                 //Set in the address of a reply
+
+const uint8_t STX           = 0x55;
+const uint8_t ETX           = 0x04;
+const uint8_t DLE           = 0x05;
+
+typedef std::vector<uint8_t> Bytes;
+
+//Appends the framed payload to out, returns the bytes added. check is
+//the trailer size: 1 for the checksum, 2 or 4 for a frame CRC.
+size_t Encode(const uint8_t *payload, size_t length, Bytes &out, unsigned check = 1);
+
+inline size_t Encode(const Bytes &payload, Bytes &out, unsigned check = 1)
+{
+    return Encode(payload.data(), payload.size(), out, check);
+}
+
+//The same COBS framed, see GetCobsFrame()
+size_t EncodeCobs(const uint8_t *payload, size_t length, Bytes &out, unsigned check = 1);
+
+inline size_t EncodeCobs(const Bytes &payload, Bytes &out, unsigned check = 1)
+{
+    return EncodeCobs(payload.data(), payload.size(), out, check);
+}
+
+//Byte at a time frame parser, the same state machine as GetCommand(),
+//COBS frames are taken as well once SetCobs() allows them
+class Decoder {
+public:
+    Decoder();
+    //Returns true when data completes a frame with a good checksum, the
+    //payload (checksum removed) is then in Payload() until the next call
+    bool Put(uint8_t data);
+    const Bytes &Payload() const { return payload; }
+    unsigned BadFrames() const { return badFrames; }
+    void Reset();
+    void SetCheck(unsigned bytes) { check = bytes; }                //As for Encode(), SESSION replies keep the checksum
+    void SetCobs(bool on) { cobs = on; }
+    void SetAddressed(bool on) { addressed = on; }                  //A node address comes before the command
+
+private:
+    enum State { IDLE, FIRST_STX, BODY, ESCAPE, COBS };
+    bool Finish();                                                  //Checks and strips the trailer
+    State state;
+    uint8_t checksum;
+    Bytes payload;
+    unsigned badFrames;
+    unsigned check;
+    bool cobs;
+    bool addressed;
+    unsigned cobsLeft;                                              //Data bytes still to come in the block
+    bool cobsImplied;                                               //STX due before the next block
+};
+
+//CRC-32 as Crc32Update() and zlib, crc starts at 0
+uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+//Frame CRC of bytes 2 or 4 bytes wide: CRC-16/CCITT (0x1021) or
+//CRC-32/MPEG-2 (0x04C11DB7), MSB first from all ones, no final inversion
+uint32_t FrameCrc(const uint8_t *data, size_t length, unsigned bytes);
+
+} //namespace an851
+
+#endif /*AN851_H*/
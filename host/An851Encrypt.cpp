@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * an851encrypt: encrypts an Intel HEX file for a USE_AES bootloader.
+ *
+ * usage: an851encrypt [options] IN.hex OUT.hex
+ *
+ *   --key K             AES-128 key, 32 hex digits, the bytes AES_KEY
+ *                       holds low byte first in each word; default
+ *                       000102030405060708090a0b0c0d0e0f, as shipped
+ *   --nonce N           16 hex digits; default random. A key must never
+ *                       see the same nonce for two different images
+ *   --delay S           bootloader entry delay written at DELAY_TIME_ADDR
+ *                       before encrypting, an851flash cannot change it after
+ *   --config            keep the config page, dropped by default
+ *   --row N, --page N   instructions per flash row and page (64, 512)
+ *   --boot FIRST-LAST   PC addresses the bootloader protects (0x400-0x13FF;
+ *                       LAST 0x23FF with the optional protocol features,
+ *                       0x27FF with USE_AES, 0x2FFF with USE_SIGN, 0x33FF
+ *                       with both, see BootConfig.h)
+ *   --flash-end ADDR    first PC address past flash (0x2AC00)
+ *
+ * The rows are those an851flash would send with the same options:
+ * bootloader rows and those past the end of flash are dropped and page 0
+ * is filled out to whole rows. Each is encrypted as Crypt.h describes
+ * and the manifest, the nonce and the plain CRC of each range an851flash
+ * verifies, goes into the rows from FIRST. Those are bootloader rows, so
+ * an851flash reads the manifest and then drops them unsent. The output
+ * holds nothing else readable but the addresses in use, and the
+ * signature an851sign put in the last bootloader row, which is carried
+ * over as it is; --delay is refused for a signed image.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "Crypt.h"
+#include "HexImage.h"
+#include "Programmer.h"
+#include "Sign.h"
+
+using namespace an851;
+
+#define DELAY_TIME_ADDR     0x102                                   //As in BootLoader.h
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: an851encrypt [--key K] [--nonce N] [--delay S] [--config] [--row N] [--page N] [--boot FIRST-LAST]\n"
+            "                    [--flash-end ADDR] IN.hex OUT.hex\n");
+    exit(2);
+}
+
+//false unless text is exactly 2 * length hex digits
+static bool ParseHex(const char *text, uint8_t *out, size_t length)
+{
+    char pair[3] = {0};
+    char *end;
+
+    if(strlen(text) != 2 * length) {
+        return false;
+    }
+    for(size_t i = 0; i < length; i++) {
+        memcpy(pair, text + 2 * i, 2);
+        out[i] = (uint8_t)strtoul(pair, &end, 16);
+        if(*end != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t key[AES_BLOCK_SIZE] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                   0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+    bool nonceSet = false;
+    bool keepConfig = false;
+    long delay = -1;
+    const char *in = NULL;
+    const char *out = NULL;
+    Geometry geometry;
+    Manifest manifest;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if(arg == "--config") {
+            keepConfig = true;
+        } else if(arg.compare(0, 2, "--") == 0 && value == NULL) {
+            Usage();
+        } else if(arg == "--key") {
+            if(!ParseHex(argv[++i], key, sizeof(key))) {
+                Usage();
+            }
+        } else if(arg == "--nonce") {
+            if(!ParseHex(argv[++i], manifest.nonce, sizeof(manifest.nonce))) {
+                Usage();
+            }
+            nonceSet = true;
+        } else if(arg == "--delay") {
+            delay = strtol(argv[++i], NULL, 0);
+        } else if(arg == "--row") {
+            geometry.rowInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--page") {
+            geometry.pageInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--flash-end") {
+            geometry.flashEnd = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--boot") {
+            char *dash;
+            geometry.bootFirst = strtoul(argv[++i], &dash, 0);
+            if(*dash != '-') {
+                Usage();
+            }
+            geometry.bootLast = strtoul(dash + 1, NULL, 0);
+        } else if(arg.compare(0, 2, "--") == 0) {
+            Usage();
+        } else if(in == NULL) {
+            in = argv[i];
+        } else if(out == NULL) {
+            out = argv[i];
+        } else {
+            Usage();
+        }
+    }
+    if(out == NULL || geometry.rowInstructions == 0 || geometry.pageInstructions % geometry.rowInstructions != 0 ||
+       geometry.rowInstructions * 3 % AES_BLOCK_SIZE != 0 || delay > 255) {
+        Usage();
+    }
+    if(!nonceSet) {
+        std::random_device random;
+
+        for(uint8_t &b : manifest.nonce) {
+            b = (uint8_t)random();
+        }
+    }
+
+    try {
+        HexImage image(geometry.rowInstructions);
+        Aes128 aes(key);
+        uint32_t pageSpan = geometry.pageInstructions * 2;
+        uint32_t crc = 0;
+        unsigned dropped;
+        unsigned manifestRows;
+        unsigned signRows = (unsigned)SignatureRows(geometry.rowInstructions);
+        uint32_t signAt = geometry.bootLast + 1 - signRows * geometry.rowInstructions * 2;
+        uint8_t sig[SIGN_SIZE];
+        bool signedImage;
+
+        image.Load(in);
+        signedImage = ReadSignature(image, signAt, sig);            //Before the drop takes its rows
+        if(signedImage && delay >= 0) {
+            throw std::runtime_error(std::string(in) + ": signed, --delay would change a signed row");
+        }
+        dropped = image.Drop(geometry.bootFirst, geometry.bootLast);
+        dropped += image.Drop(keepConfig ? geometry.flashEnd : geometry.flashEnd - pageSpan, 0xFFFFFFFF);
+        if(delay >= 0) {
+            image.SetWord(DELAY_TIME_ADDR, (uint32_t)delay);
+        }
+        if(!image.Rows().empty() && image.Rows().begin()->first < pageSpan) {
+            for(uint32_t a = 0; a < pageSpan; a += image.RowSpan()) {
+                image.Row(a);                                       //As an851flash fills it, but before encrypting
+            }
+        }
+        if(image.Rows().empty()) {
+            throw std::runtime_error(std::string(in) + ": nothing to encrypt");
+        }
+
+        for(const auto &row : image.Rows()) {                       //The ranges Programmer::Verify() sends
+            Manifest::Range *last = manifest.ranges.empty() ? NULL : &manifest.ranges.back();
+
+            if(row.first < pageSpan) {
+                continue;                                           //Page 0 is not verified
+            }
+            if(last == NULL || last->end != row.first) {
+                if(last != NULL) {
+                    last->crc = crc;
+                }
+                manifest.ranges.push_back(Manifest::Range{row.first, row.first, 0});
+                last = &manifest.ranges.back();
+                crc = 0;
+            }
+            crc = Crc32(crc, row.second.data(), row.second.size());
+            last->end += image.RowSpan();
+        }
+        if(!manifest.ranges.empty()) {
+            manifest.ranges.back().crc = crc;
+        }
+
+        for(const auto &row : image.Rows()) {
+            CtrRow(aes, manifest.nonce, row.first, image.Row(row.first));
+        }
+        manifestRows = (unsigned)ManifestRows(manifest, image.RowInstructions());
+        if(geometry.bootFirst + manifestRows * image.RowSpan() > (signedImage ? signAt : geometry.bootLast + 1)) {
+            throw std::runtime_error(std::string(in) + ": too many ranges for a manifest in the bootloader rows");
+        }
+        WriteManifest(image, geometry.bootFirst, manifest);
+        if(signedImage) {
+            WriteSignature(image, signAt, sig);                     //Not encrypted, an851flash sends it as it is
+        }
+        image.Save(out);
+
+        printf("an851encrypt: %s -> %s, AES-128 CTR, nonce ", in, out);
+        for(uint8_t b : manifest.nonce) {
+            printf("%02x", b);
+        }
+        printf("\n  image      %u rows, %u dropped, %u ranges, manifest in %u rows at 0x%06X\n",
+               (unsigned)image.Rows().size() - manifestRows - (signedImage ? signRows : 0),
+               dropped - (signedImage ? signRows : 0),
+               (unsigned)manifest.ranges.size(), manifestRows, geometry.bootFirst);
+        if(signedImage) {
+            printf("  signed     signature at 0x%06X carried over\n", signAt);
+        }
+        return 0;
+    } catch(const std::exception &e) {
+        fprintf(stderr, "an851encrypt: %s\n", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,598 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * an851flash: programs an Intel HEX file through the bootloader.
+ *
+ * usage: an851flash [options] PORT FILE.hex
+ *        an851flash [options] --dump FILE.hex PORT
+ *
+ *   PORT                serial port or pty (/dev/...), or the Unix
+ *                       socket of sim/bootpty --socket
+ *   --baud B            line rate, default 115200
+ *   --window N          frames in flight, default 8; 1 is AN851
+ *                       stop-and-wait, 0 skips SESSION altogether
+ *   --small             no large packets, one row per WT_FLASH
+ *   --crc N             frame CRC bits asked for in the SESSION, 32
+ *                       (default), 16, or 0 to keep the checksum
+ *   --no-cobs           keep DLE stuffing, COBS framing is asked for
+ *                       in the SESSION by default
+ *   --no-auto-erase     send ER_FLASH first; by default the SESSION
+ *                       asks the device to erase each page as the
+ *                       first rows for it arrive (USE_AUTO_ERASE)
+ *   --no-batch          send each VERIFY_RANGE and the VERIFY_OK on its
+ *                       own; by default a device that reports BATCH in
+ *                       the SESSION gets them packed into BATCH frames
+ *   --readback          also read the image back with RD_FLASH
+ *   --delay S           bootloader entry delay written at DELAY_TIME_ADDR;
+ *                       without it, or one in the image, the device
+ *                       commits DEFAULT_DELAY, 2 s
+ *   --config            keep the config page, dropped by default
+ *   --no-reset          stay in the bootloader when done
+ *   --stats             clear the RD_STATS counters after connecting and
+ *                       print them before the reset (USE_STATS firmware)
+ *   --slot-b FILE       USE_DUAL_SLOT firmware: FILE.hex is linked for
+ *                       slot A, this one for slot B; the slot RD_SLOT
+ *                       names as the target decides which is sent
+ *   --dump FILE         read all of flash, config page included, into
+ *                       FILE as Intel HEX instead of programming; with
+ *                       RD_STREAM (USE_STREAM firmware and a frame CRC)
+ *                       or else RD_FLASH a frame at a time
+ *   --restart           USE_JOURNAL firmware: erase and write everything
+ *                       even if the journal shows this image was partly
+ *                       written already
+ *   --timeout MS        reply timeout before a resend, default 500
+ *   --row N, --page N   instructions per flash row and page (64, 512)
+ *   --boot FIRST-LAST   PC addresses the bootloader protects (0x400-0x13FF;
+ *                       LAST 0x23FF with the optional protocol features,
+ *                       0x27FF with USE_AES, 0x2FFF with USE_SIGN, 0x33FF
+ *                       with both, see BootConfig.h)
+ *   --flash-end ADDR    first PC address past flash (0x2AC00)
+ *   --node N            USE_MULTIDROP firmware: the address of the node
+ *                       to program on an RS-485 bus
+ *   --nodes N,N,...     program several nodes at once: each is opened in
+ *                       turn, the erase and the rows are broadcast once,
+ *                       then each is verified and committed on its own;
+ *                       one that fails is erased and written again
+ *                       alone. Both make the window default 1
+ *
+ * Rows inside the bootloader or past the end of flash are dropped, the
+ * bootloader would refuse them anyway. Each phase is timed.
+ *
+ * With dual slot firmware everything below the target slot belongs to
+ * the bootloader and is dropped as well. Any other row outside the
+ * slot means the image was linked for the other one, which is an error.
+ * Gaps are filled with blank rows so a single VERIFY_RANGE from the
+ * slot base covers the image; that range is what the slot record keeps.
+ *
+ * With journal firmware the journal is read first. If it was begun for
+ * this image (the tag is the CRC-32 of the rows past page 0) and is not
+ * full, the update carries on from it: page 0, the pages the last entry
+ * touched and any page not known to be erased are erased again, and only
+ * rows the journal does not show as written are sent. Otherwise a new
+ * journal is begun. Verify always covers the whole image. A device
+ * with a journal left open does not grant auto erase, so a resume
+ * always erases what it needs itself.
+ *
+ * An image an851encrypt made is recognised by its manifest, see Crypt.h.
+ * Its nonce goes to each node with SET_NONCE before the first row and
+ * VERIFY_RANGE sends the manifest's CRCs, so nothing here needs the key.
+ * Rows are sent as they are: --delay, which changes one, is refused, as
+ * are --readback and --dump, which USE_AES firmware does not answer, and
+ * dual slot firmware, whose slot fill would not decrypt. A plain image
+ * is refused by a bootloader that reports USE_AES in its SESSION.
+ *
+ * An image an851sign made carries its signature in the last bootloader
+ * row, see Sign.h. It goes to each node with SIGNATURE before the first
+ * erase or row, and the device hashes the rows as they are written and
+ * checks the signature at VERIFY_OK, which commits nothing if it fails.
+ * The signature covers every row in the order sent, so a signed image
+ * is always written whole, never resumed from a journal, and --delay and
+ * dual slot firmware are refused as for an encrypted one. The device
+ * also wants every page below the config page erased after SIGNATURE,
+ * so the pages no row reaches are erased too, blank ones cheaply with
+ * USE_BLANK_CHECK. A node written again on its own after a broadcast
+ * gets the signature again first. An unsigned image is refused by a
+ * bootloader that reports USE_SIGN.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "Crypt.h"
+#include "HexImage.h"
+#include "Link.h"
+#include "Programmer.h"
+#include "Session.h"
+#include "Sign.h"
+
+using namespace an851;
+
+#define DELAY_TIME_ADDR     0x102                                   //As in BootLoader.h
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: an851flash [--baud B] [--window N] [--small] [--crc N] [--no-cobs] [--no-auto-erase] [--no-batch]\n"
+            "                  [--readback] [--delay S] [--config] [--no-reset] [--stats] [--slot-b FILE] [--restart] [--timeout MS]\n"
+            "                  [--row N] [--page N] [--boot FIRST-LAST] [--flash-end ADDR]\n"
+            "                  [--node N | --nodes N,N,...] PORT FILE.hex\n"
+            "       an851flash [options] --dump FILE.hex PORT\n");
+    exit(2);
+}
+
+static void Report(const Phase &p)
+{
+    printf("  %-10s %8.3f s  %4u frames  %7llu bytes out  %6llu in", p.name.c_str(), p.seconds, p.frames,
+           (unsigned long long)p.bytesOut, (unsigned long long)p.bytesIn);
+    if(p.dataBytes && p.seconds > 0) {
+        printf("  %7.2f KiB/s", p.dataBytes / 1024.0 / p.seconds);
+    }
+    printf("\n");
+}
+
+//Counters as the device kept them, in BL_STATS order after FCY
+static void ReportStats(const std::vector<uint32_t> &s)
+{
+    if(s.size() < 13 || s[0] == 0) {
+        printf("  stats      not built into the bootloader\n");
+        return;
+    }
+    printf("  stats      %u bytes in, %u out, %u/%u escapes, %u bad checksums, %u commands\n",
+           s[1], s[2], s[3], s[4], s[5], s[12]);
+    printf("             %.3f s waiting for bytes, %.3f s in %u NVM operations, %u OERR, %u FERR/PERR, "
+           "%u ring overflows\n", (double)s[6] / s[0], (double)s[7] / s[0], s[8], s[9], s[10], s[11]);
+    if(s.size() >= 16) {                                            //USE_AES counters
+        printf("             %u AES blocks in %.3f s, %.3f s of it holding up WritePM\n", s[13], (double)s[14] / s[0],
+               (double)s[15] / s[0]);
+    }
+    if(s.size() == 15 || s.size() == 18) {                          //USE_SIGN counters, after any AES ones
+        printf("             %.3f s hashing rows that no row write hid, %.3f s checking the signature\n",
+               (double)s[s.size() - 2] / s[0], (double)s[s.size() - 1] / s[0]);
+    }
+}
+
+//Pages to erase after SIGNATURE: all below the config page, or with
+//auto erase those no row of the image reaches
+static std::vector<uint32_t> SignedPages(const HexImage &image, const Geometry &geometry, bool autoErase)
+{
+    std::vector<uint32_t> pages;
+    uint32_t pageSpan = geometry.pageInstructions * 2;
+
+    for(uint32_t page = 0; page + 1 < geometry.flashEnd / pageSpan; page++) {
+        auto it = image.Rows().lower_bound(page * pageSpan);
+
+        if(!autoErase || it == image.Rows().end() || it->first >= (page + 1) * pageSpan) {
+            pages.push_back(page);
+        }
+    }
+    return pages;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long baud = 115200;
+    unsigned window = 8;
+    bool large = true;
+    unsigned crc = 32;
+    bool cobs = true;
+    bool autoErase = true;
+    bool batch = true;
+    bool readBack = false;
+    bool keepConfig = false;
+    bool reset = true;
+    bool stats = false;
+    bool restart = false;
+    bool windowSet = false;
+    std::vector<int> nodes;
+    long delay = -1;
+    int timeoutMs = 500;
+    const char *port = NULL;
+    const char *hex = NULL;
+    const char *hexB = NULL;
+    const char *dump = NULL;
+    Geometry geometry;
+    unsigned dropped;
+    char *end;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if(arg == "--small") {
+            large = false;
+        } else if(arg == "--no-cobs") {
+            cobs = false;
+        } else if(arg == "--no-auto-erase") {
+            autoErase = false;
+        } else if(arg == "--no-batch") {
+            batch = false;
+        } else if(arg == "--readback") {
+            readBack = true;
+        } else if(arg == "--config") {
+            keepConfig = true;
+        } else if(arg == "--no-reset") {
+            reset = false;
+        } else if(arg == "--stats") {
+            stats = true;
+        } else if(arg == "--restart") {
+            restart = true;
+        } else if(arg.compare(0, 2, "--") == 0 && value == NULL) {
+            Usage();
+        } else if(arg == "--baud") {
+            baud = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--window") {
+            window = strtoul(argv[++i], NULL, 0);
+            windowSet = true;
+        } else if(arg == "--node" || arg == "--nodes") {
+            end = argv[++i];
+            do {
+                nodes.push_back((int)strtol(end + (*end == ','), &end, 0));
+                if(nodes.back() < 0 || nodes.back() >= NODE_BROADCAST) {
+                    Usage();
+                }
+            } while(*end == ',');
+            if(*end != 0 || (arg == "--node" && nodes.size() != 1)) {
+                Usage();
+            }
+        } else if(arg == "--crc") {
+            crc = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--delay") {
+            delay = strtol(argv[++i], NULL, 0);
+        } else if(arg == "--slot-b") {
+            hexB = argv[++i];
+        } else if(arg == "--dump") {
+            dump = argv[++i];
+        } else if(arg == "--timeout") {
+            timeoutMs = atoi(argv[++i]);
+        } else if(arg == "--row") {
+            geometry.rowInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--page") {
+            geometry.pageInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--flash-end") {
+            geometry.flashEnd = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--boot") {
+            char *dash;
+            geometry.bootFirst = strtoul(argv[++i], &dash, 0);
+            if(*dash != '-') {
+                Usage();
+            }
+            geometry.bootLast = strtoul(dash + 1, NULL, 0);
+        } else if(arg.compare(0, 2, "--") == 0) {
+            Usage();
+        } else if(port == NULL) {
+            port = argv[i];
+        } else if(hex == NULL) {
+            hex = argv[i];
+        } else {
+            Usage();
+        }
+    }
+    if((dump ? port == NULL || hex != NULL || nodes.size() > 1 : hex == NULL) || window > 255 || (crc != 0 && crc != 16 && crc != 32) || geometry.rowInstructions == 0 ||
+       geometry.pageInstructions % geometry.rowInstructions != 0 || delay > 255) {
+        Usage();
+    }
+
+    if(nodes.size() > 0 && !windowSet) {
+        window = 1;                                                 //Two-wire bus, one talker at a time
+    }
+    if(nodes.empty()) {
+        nodes.push_back(-1);                                        //Point to point, no address byte
+    }
+
+    try {
+        HexImage image(geometry.rowInstructions);
+        uint32_t pageSpan = geometry.pageInstructions * 2;
+        Link link;
+        std::vector<std::unique_ptr<Session>> sessions;
+        std::vector<std::unique_ptr<Programmer>> programmers;
+        std::vector<std::vector<uint32_t>> counters(nodes.size());
+        std::vector<bool> repaired(nodes.size());
+        std::vector<bool> passed(nodes.size());
+        Session bus(link, baud, timeoutMs, 5);
+        Programmer broadcast(link, bus, geometry);
+        Slots slots;
+        Slots other;
+        Journal journal;
+        HexImage rest(geometry.rowInstructions);
+        Manifest manifest;
+        bool encrypted;
+        uint8_t signature[SIGN_SIZE];
+        uint8_t digest[SHA256_SIZE];
+        bool signedImage;
+        std::vector<uint32_t> redo;
+        uint32_t tag;
+        bool journaled;
+        bool resumed = false;
+        bool dual = false;
+        bool multi = nodes.size() > 1;
+        unsigned resends = 0;
+        unsigned naks = 0;
+        auto start = std::chrono::steady_clock::now();
+        auto loaded = start;
+        double loadMs;
+        size_t k;
+
+        for(int node : nodes) {
+            sessions.emplace_back(new Session(link, baud, timeoutMs, 5));
+            sessions.back()->SetNode(node);
+            programmers.emplace_back(new Programmer(link, *sessions.back(), geometry));
+        }
+        Session &session = *sessions[0];
+        Programmer &programmer = *programmers[0];
+
+        link.Open(port, baud);
+        for(k = 0; k < nodes.size(); k++) {
+            Session &s = *sessions[k];
+            char what[96];
+
+            programmers[k]->Connect(window, large, crc, cobs, autoErase);
+            dual = programmers[k]->Slot(k ? other : slots);
+            if(k && (s.Large() != session.Large() || s.Crc() != session.Crc() || s.Cobs() != session.Cobs() ||
+                     s.AutoErase() != session.AutoErase() || s.MaxData() != session.MaxData() ||
+                     (dual && (other.target != slots.target || other.base != slots.base)))) {
+                snprintf(what, sizeof(what), "node %d and node %d differ in frame options or target slot", nodes[k], nodes[0]);
+                throw std::runtime_error(what);                     //A broadcast has to suit them all
+            }
+        }
+        bus.SetNode(NODE_BROADCAST);
+        bus.Adopt(session);
+
+        if(dump != NULL && session.Aes()) {
+            throw std::runtime_error("--dump: a USE_AES bootloader does not read flash back");
+        }
+        if(dump != NULL) {
+            HexImage flash(geometry.rowInstructions);
+
+            programmer.Dump(0, geometry.flashEnd, flash);
+            flash.Save(dump);
+            printf("an851flash: %s, bootloader %u.%u, %u data bytes per frame, %s, %s\n", port, programmer.Major(),
+                   programmer.Minor(), (unsigned)session.MaxData(),
+                   session.Crc() == 32 ? "CRC-32" : session.Crc() == 16 ? "CRC-16" : "checksum",
+                   session.Cobs() ? "COBS" : "DLE stuffed");
+            for(const Phase &p : programmer.Phases()) {
+                Report(p);
+            }
+            printf("  dump       %s, 0x000000-0x%06X, %u rows not erased, %u resends, %u NAKs\n", dump,
+                   geometry.flashEnd - 1, (unsigned)flash.Rows().size(), session.Resends(), session.Naks());
+            if(reset) {
+                programmer.Reset();
+            }
+            return 0;
+        }
+        if(hexB != NULL && !dual) {
+            throw std::runtime_error("--slot-b needs a bootloader built with USE_DUAL_SLOT");
+        }
+        if(hexB != NULL && slots.target == 1) {
+            hex = hexB;
+        }
+
+        loaded = std::chrono::steady_clock::now();
+        image.Load(hex);
+        loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loaded).count();
+        encrypted = ReadManifest(image, geometry.bootFirst, manifest); //Before the drop takes its rows
+        if(encrypted && (dual || readBack || delay >= 0)) {
+            throw std::runtime_error(std::string(hex) + ": encrypted, " +
+                                     (dual ? "dual slot firmware" : readBack ? "--readback" : "--delay") +
+                                     " cannot be used with it");
+        }
+        if(!encrypted && session.Aes()) {
+            throw std::runtime_error(std::string(hex) + ": the bootloader decrypts every row (USE_AES), "
+                                     "encrypt the image with an851encrypt first");
+        }
+        signedImage = ReadSignature(image, geometry.bootLast + 1 - (uint32_t)SignatureRows(geometry.rowInstructions) *
+                                    image.RowSpan(), signature);
+        if(signedImage && (dual || delay >= 0)) {
+            throw std::runtime_error(std::string(hex) + ": signed, " + (dual ? "dual slot firmware" : "--delay") +
+                                     " cannot be used with it");
+        }
+        if(!signedImage && session.Sign()) {
+            throw std::runtime_error(std::string(hex) + ": the bootloader commits only signed images (USE_SIGN), "
+                                     "sign the image with an851sign first");
+        }
+        dropped = image.Drop(geometry.bootFirst, geometry.bootLast);
+        dropped += image.Drop(keepConfig ? geometry.flashEnd : geometry.flashEnd - pageSpan, 0xFFFFFFFF);
+        if(dual) {
+            dropped += image.Drop(0, slots.base - 1);               //Page 0, vector and record pages
+            if(image.Rows().empty()) {
+                throw std::runtime_error(std::string(hex) + ": nothing to program in slot " + (slots.target ? "B" : "A"));
+            }
+            if((--image.Rows().end())->first >= slots.base + slots.size) {
+                throw std::runtime_error(std::string(hex) + ": rows outside slot " + (slots.target ? "B" : "A") +
+                                         ", linked for the other slot?");
+            }
+            for(uint32_t a = slots.base; a < (--image.Rows().end())->first; a += image.RowSpan()) {
+                image.Row(a);                                       //Blank fill, one range from the slot base
+            }
+        }
+        if(delay >= 0) {                                            //With slots only a carrier, the record keeps the delay
+            image.SetWord(DELAY_TIME_ADDR, (uint32_t)delay);
+        }
+        if(!dual && !image.Rows().empty() && image.Rows().begin()->first < pageSpan) {
+            for(uint32_t a = 0; a < pageSpan; a += image.RowSpan()) {
+                image.Row(a);                                       //Page 0 is erased, so write all of it
+            }
+        }
+        if(image.Rows().empty()) {
+            throw std::runtime_error(std::string(hex) + ": nothing to program");
+        }
+
+        tag = programmer.Tag(image);
+        journaled = programmer.ReadJournal(journal);
+        if(journaled && !multi && !restart && !signedImage && journal.capacity && journal.entries.size() < journal.capacity &&
+           journal.tag == tag) {
+            rest = image;
+            redo = programmer.Resume(journal, rest);
+            resumed = true;
+        } else if(journaled) {
+            for(auto &p : programmers) {
+                p->BeginJournal(tag);
+            }
+        }
+
+        if(stats) {
+            for(auto &p : programmers) {
+                p->Stats(true);                                     //Count this run only
+            }
+        }
+        if(encrypted) {
+            for(auto &p : programmers) {
+                p->Encrypted(manifest);                             //Every node, the broadcast rows decrypt at each
+            }
+        }
+        if(signedImage) {
+            for(auto &p : programmers) {
+                p->Signed(signature);                               //Every node hashes the broadcast rows
+            }
+            ImageDigest(image, digest);
+        }
+        printf("an851flash: %s, bootloader %u.%u, window %u, %u data bytes per frame, %s, %s%s%s\n", port,
+               programmer.Major(), programmer.Minor(), session.Window(), (unsigned)session.MaxData(),
+               session.Crc() == 32 ? "CRC-32" : session.Crc() == 16 ? "CRC-16" : "checksum",
+               session.Cobs() ? "COBS" : "DLE stuffed", session.AutoErase() ? ", auto erase" : "",
+               batch && !readBack && session.Batch() ? ", batched commit" : "");
+        printf("  image      %s, %u rows, %.1f KiB, parsed in %.1f ms", hex, (unsigned)image.Rows().size(),
+               image.DataBytes() / 1024.0, loadMs);
+        if(dropped) {
+            printf(", %u rows dropped", dropped);
+        }
+        printf("\n");
+        if(encrypted) {
+            printf("  encrypted  AES-128 CTR, nonce ");
+            for(uint8_t b : manifest.nonce) {
+                printf("%02x", b);
+            }
+            printf(", %u ranges in the manifest\n", (unsigned)manifest.ranges.size());
+        }
+        if(signedImage) {
+            printf("  signed     ECDSA P-256, digest ");
+            for(uint8_t b : digest) {
+                printf("%02x", b);
+            }
+            printf("\n");
+        }
+        if(dual) {
+            printf("  slots      %s active, writing %s at 0x%06X\n",
+                   slots.active == SLOT_NONE ? "none" : slots.active ? "B" : "A", slots.target ? "B" : "A", slots.base);
+        }
+        if(multi) {
+            printf("  bus        %u nodes, erase and write broadcast once\n", (unsigned)nodes.size());
+        }
+        if(resumed) {
+            printf("  journal    %u entries, resuming: %u pages to erase again, %u of %u rows to send\n",
+                   (unsigned)journal.entries.size(), (unsigned)redo.size(), (unsigned)rest.Rows().size(),
+                   (unsigned)image.Rows().size());
+        } else if(journaled) {
+            printf("  journal    %u entries, %s, starting over\n", (unsigned)journal.entries.size(),
+                   journal.capacity == 0 ? "none open" : journal.entries.size() >= journal.capacity ? "full" :
+                   journal.tag != tag ? "begun for another image" : signedImage ? "signed image" : "--restart");
+        }
+
+        if(resumed) {
+            programmer.Erase(redo);
+            programmer.Write(rest);
+        } else {
+            if(signedImage) {
+                (multi ? broadcast : programmer).Erase(SignedPages(image, geometry, session.AutoErase()));
+            } else if(!session.AutoErase()) {
+                (multi ? broadcast : programmer).Erase(image);
+            }
+            (multi ? broadcast : programmer).Write(image);
+        }
+        for(k = 0; k < nodes.size(); k++) {
+            Programmer &p = *programmers[k];
+            bool batched = batch && !readBack && sessions[k]->Batch();   //Commit() reads nothing back
+
+            passed[k] = batched ? p.Commit(image) : p.Verify(image, readBack);
+            if(!passed[k] && multi) {                               //Missed part of the broadcast, this node on its own
+                repaired[k] = true;
+                if(signedImage) {
+                    p.Signed(signature);                            //Starts the hash over, before the erase
+                    p.Erase(SignedPages(image, geometry, false));
+                } else {
+                    p.Erase(image);
+                }
+                p.Write(image);
+                passed[k] = batched ? p.Commit(image) : p.Verify(image, readBack);
+            }
+            if(stats) {
+                counters[k] = p.Stats(false);
+            }
+            if(passed[k] && !batched) {
+                p.Finish(reset);
+            } else if(passed[k] && reset) {
+                p.Reset();                                          //VERIFY_OK went with the ranges
+            }
+        }
+
+        for(const Phase &p : broadcast.Phases()) {
+            Report(p);
+        }
+        for(k = 0; k < nodes.size(); k++) {
+            Programmer &p = *programmers[k];
+
+            if(multi) {
+                printf("  node %d%s\n", nodes[k], repaired[k] ? ", rewritten on its own after the broadcast" : "");
+            } else if(nodes[k] >= 0) {
+                printf("  node %d\n", nodes[k]);
+            }
+            for(const Phase &phase : p.Phases()) {
+                Report(phase);
+            }
+            for(const std::string &m : p.Mismatches()) {
+                printf("  %s\n", m.c_str());
+            }
+            if(stats) {
+                ReportStats(counters[k]);
+            }
+            printf("  verify     %s (%u ranges)\n", passed[k] ? "OK" : "FAILED, entry delay not committed", p.Ranges());
+            resends += sessions[k]->Resends();
+            naks += sessions[k]->Naks();
+        }
+        printf("  total      %8.3f s, %u pages erased, %u skipped as blank, %u resends, %u NAKs\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+               programmer.PagesErased(), programmer.PagesSkipped(), resends, naks);
+        for(k = 0; k < nodes.size() && passed[k]; k++) {
+        }
+        return k == nodes.size() ? 0 : 1;
+    } catch(const std::exception &e) {
+        fprintf(stderr, "an851flash: %s\n", e.what());
+        return 2;
+    }
+}
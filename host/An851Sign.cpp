@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * an851sign: signs an Intel HEX file for a USE_SIGN bootloader.
+ *
+ * usage: an851sign [options] IN.hex OUT.hex
+ *        an851sign [--key K] --public
+ *
+ *   --key K             P-256 private key, 64 hex digits, big endian;
+ *                       default the RFC 6979 A.2.5 example key, whose
+ *                       public key is the SIGN_PUBLIC_KEY BootLoader.h
+ *                       ships. It is published, anyone can sign with it
+ *   --public            print the public key of K as the SIGN_PUBLIC_KEY
+ *                       initializer a bootloader build takes, and exit
+ *   --delay S           bootloader entry delay written at DELAY_TIME_ADDR
+ *                       before signing, an851flash cannot change it after
+ *   --config            keep the config page, dropped by default
+ *   --row N, --page N   instructions per flash row and page (64, 512)
+ *   --boot FIRST-LAST   PC addresses the bootloader protects (0x400-0x13FF;
+ *                       LAST 0x23FF with the optional protocol features,
+ *                       0x27FF with USE_AES, 0x2FFF with USE_SIGN, 0x33FF
+ *                       with both, see BootConfig.h)
+ *   --flash-end ADDR    first PC address past flash (0x2AC00)
+ *
+ * The rows are those an851flash would send with the same options:
+ * bootloader rows and those past the end of flash are dropped and page 0
+ * is filled out to whole rows. Their digest, as Sign.h describes, is
+ * signed and the signature goes into the last bootloader row, which
+ * an851flash reads and then drops unsent. The device hashes rows once
+ * decrypted, so an image for a bootloader with both USE_AES and USE_SIGN
+ * is signed first and encrypted after; an851encrypt carries the
+ * signature over. An image that already has a manifest is refused.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "Crypt.h"
+#include "HexImage.h"
+#include "Programmer.h"
+#include "Sign.h"
+
+using namespace an851;
+
+#define DELAY_TIME_ADDR     0x102                                   //As in BootLoader.h
+
+static void Usage()
+{
+    fprintf(stderr,
+            "usage: an851sign [--key K] [--delay S] [--config] [--row N] [--page N] [--boot FIRST-LAST]\n"
+            "                 [--flash-end ADDR] IN.hex OUT.hex\n"
+            "       an851sign [--key K] --public\n");
+    exit(2);
+}
+
+//false unless text is exactly 2 * length hex digits
+static bool ParseHex(const char *text, uint8_t *out, size_t length)
+{
+    char pair[3] = {0};
+    char *end;
+
+    if(strlen(text) != 2 * length) {
+        return false;
+    }
+    for(size_t i = 0; i < length; i++) {
+        memcpy(pair, text + 2 * i, 2);
+        out[i] = (uint8_t)strtoul(pair, &end, 16);
+        if(*end != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t key[SIGN_KEY_SIZE] = {0xC9, 0xAF, 0xA9, 0xD8, 0x45, 0xBA, 0x75, 0x16, 0x6B, 0x5C, 0x21, 0x57, 0x67, 0xB1, 0xD6, 0x93,
+                                  0x4E, 0x50, 0xC3, 0xDB, 0x36, 0xE8, 0x9B, 0x12, 0x7B, 0x8A, 0x62, 0x2B, 0x12, 0x0F, 0x67, 0x21};
+    bool keepConfig = false;
+    bool publicOnly = false;
+    long delay = -1;
+    const char *in = NULL;
+    const char *out = NULL;
+    Geometry geometry;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if(arg == "--config") {
+            keepConfig = true;
+        } else if(arg == "--public") {
+            publicOnly = true;
+        } else if(arg.compare(0, 2, "--") == 0 && value == NULL) {
+            Usage();
+        } else if(arg == "--key") {
+            if(!ParseHex(argv[++i], key, sizeof(key))) {
+                Usage();
+            }
+        } else if(arg == "--delay") {
+            delay = strtol(argv[++i], NULL, 0);
+        } else if(arg == "--row") {
+            geometry.rowInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--page") {
+            geometry.pageInstructions = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--flash-end") {
+            geometry.flashEnd = strtoul(argv[++i], NULL, 0);
+        } else if(arg == "--boot") {
+            char *dash;
+            geometry.bootFirst = strtoul(argv[++i], &dash, 0);
+            if(*dash != '-') {
+                Usage();
+            }
+            geometry.bootLast = strtoul(dash + 1, NULL, 0);
+        } else if(arg.compare(0, 2, "--") == 0) {
+            Usage();
+        } else if(in == NULL) {
+            in = argv[i];
+        } else if(out == NULL) {
+            out = argv[i];
+        } else {
+            Usage();
+        }
+    }
+    if((publicOnly ? in != NULL : out == NULL) || geometry.rowInstructions == 0 ||
+       geometry.pageInstructions % geometry.rowInstructions != 0 || delay > 255) {
+        Usage();
+    }
+
+    try {
+        HexImage image(geometry.rowInstructions);
+        uint32_t pageSpan = geometry.pageInstructions * 2;
+        uint8_t pub[SIGN_PUBLIC_SIZE];
+        uint8_t hash[SHA256_SIZE];
+        uint8_t sig[SIGN_SIZE];
+        Manifest manifest;
+        unsigned dropped;
+        unsigned signRows = (unsigned)SignatureRows(geometry.rowInstructions);
+        uint32_t signAt = geometry.bootLast + 1 - signRows * geometry.rowInstructions * 2;
+        auto start = std::chrono::steady_clock::now();
+        double signMs;
+
+        EcdsaPublic(key, pub);
+        if(publicOnly) {
+            for(i = 0; i < (int)SIGN_PUBLIC_SIZE; i++) {
+                printf("%s0x%02X", i ? "," : "{", pub[i]);
+            }
+            printf("}\n");
+            return 0;
+        }
+
+        image.Load(in);
+        if(ReadManifest(image, geometry.bootFirst, manifest)) {
+            throw std::runtime_error(std::string(in) + ": encrypted already, the device checks the plain rows, "
+                                     "sign before encrypting");
+        }
+        dropped = image.Drop(geometry.bootFirst, geometry.bootLast);
+        dropped += image.Drop(keepConfig ? geometry.flashEnd : geometry.flashEnd - pageSpan, 0xFFFFFFFF);
+        if(delay >= 0) {
+            image.SetWord(DELAY_TIME_ADDR, (uint32_t)delay);
+        }
+        if(!image.Rows().empty() && image.Rows().begin()->first < pageSpan) {
+            for(uint32_t a = 0; a < pageSpan; a += image.RowSpan()) {
+                image.Row(a);                                       //As an851flash fills it, the device hashes all of it
+            }
+        }
+        if(image.Rows().empty()) {
+            throw std::runtime_error(std::string(in) + ": nothing to sign");
+        }
+
+        start = std::chrono::steady_clock::now();
+        ImageDigest(image, hash);
+        EcdsaSign(key, hash, sig);
+        if(!EcdsaVerify(pub, hash, sig)) {
+            throw std::runtime_error("the signature does not check against the public key");
+        }
+        signMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        WriteSignature(image, signAt, sig);
+        image.Save(out);
+
+        printf("an851sign: %s -> %s, ECDSA P-256, signed in %.0f ms\n", in, out, signMs);
+        printf("  image      %u rows, %u dropped, signature in %u row%s at 0x%06X\n",
+               (unsigned)image.Rows().size() - signRows, dropped, signRows, signRows > 1 ? "s" : "", signAt);
+        printf("  digest     ");
+        for(uint8_t b : hash) {
+            printf("%02x", b);
+        }
+        printf("\n  public key ");
+        for(uint8_t b : pub) {
+            printf("%02x", b);
+        }
+        printf("\n");
+        return 0;
+    } catch(const std::exception &e) {
+        fprintf(stderr, "an851sign: %s\n", e.what());
+        return 2;
+    }
+}
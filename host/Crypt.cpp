@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include "Crypt.h"
+
+namespace an851 {
+
+#define MANIFEST_HEAD       14                                      //Magic, nonce, range count
+#define MANIFEST_RANGE      10                                      //First and end 3 bytes each, CRC 4
+
+static uint8_t sbox[256];
+
+static uint8_t XTime(uint8_t x)
+{
+    return (uint8_t)(x << 1 ^ (x >> 7) * 0x1B);
+}
+
+//The S-box worked out from its definition rather than copied, so this
+//is no copy of Aes.c's table: the inverse in GF(2^8) through powers of 3,
+//then the affine map
+static void MakeSbox()
+{
+    uint8_t exp[256];
+    uint8_t log[256];
+    uint8_t x = 1;
+    uint8_t inv;
+    int i;
+
+    for(i = 0; i < 255; i++) {
+        exp[i] = x;
+        log[x] = (uint8_t)i;
+        x ^= XTime(x);
+    }
+    for(i = 0; i < 256; i++) {
+        inv = i ? exp[(255 - log[i]) % 255] : 0;
+        sbox[i] = (uint8_t)(inv ^ (inv << 1 | inv >> 7) ^ (inv << 2 | inv >> 6) ^ (inv << 3 | inv >> 5) ^
+                            (inv << 4 | inv >> 4) ^ 0x63);
+    }
+}
+
+Aes128::Aes128(const uint8_t key[AES_BLOCK_SIZE])
+{
+    uint8_t rcon = 1;
+    uint8_t *w;
+
+    if(sbox[0] == 0) {
+        MakeSbox();                                                 //sbox[0] is 0x63 once made
+    }
+    memcpy(roundKeys, key, AES_BLOCK_SIZE);
+    for(w = roundKeys + AES_BLOCK_SIZE; w < roundKeys + sizeof(roundKeys); w += 4) {
+        if((w - roundKeys) % AES_BLOCK_SIZE == 0) {
+            w[0] = (uint8_t)(w[-16] ^ sbox[w[-3]] ^ rcon);
+            w[1] = (uint8_t)(w[-15] ^ sbox[w[-2]]);
+            w[2] = (uint8_t)(w[-14] ^ sbox[w[-1]]);
+            w[3] = (uint8_t)(w[-13] ^ sbox[w[-4]]);
+            rcon = XTime(rcon);
+        } else {
+            for(int i = 0; i < 4; i++) {
+                w[i] = (uint8_t)(w[i - 16] ^ w[i - 4]);
+            }
+        }
+    }
+}
+
+void Aes128::Encrypt(uint8_t block[AES_BLOCK_SIZE]) const
+{
+    uint8_t s[AES_BLOCK_SIZE];
+    uint8_t a[4];
+    int round;
+    int c;
+    int i;
+
+    for(i = 0; i < (int)AES_BLOCK_SIZE; i++) {
+        block[i] ^= roundKeys[i];
+    }
+    for(round = 1; round <= 10; round++) {
+        for(i = 0; i < (int)AES_BLOCK_SIZE; i++) {                  //SubBytes, ShiftRows: row r moves left by r
+            s[i] = sbox[block[(i + 4 * (i % 4)) % AES_BLOCK_SIZE]];
+        }
+        for(c = 0; c < 4; c++) {
+            memcpy(a, s + 4 * c, 4);
+            if(round < 10) {                                        //MixColumns, all but the last round
+                uint8_t t = (uint8_t)(a[0] ^ a[1] ^ a[2] ^ a[3]);
+
+                s[4 * c] = (uint8_t)(a[0] ^ t ^ XTime((uint8_t)(a[0] ^ a[1])));
+                s[4 * c + 1] = (uint8_t)(a[1] ^ t ^ XTime((uint8_t)(a[1] ^ a[2])));
+                s[4 * c + 2] = (uint8_t)(a[2] ^ t ^ XTime((uint8_t)(a[2] ^ a[3])));
+                s[4 * c + 3] = (uint8_t)(a[3] ^ t ^ XTime((uint8_t)(a[3] ^ a[0])));
+            }
+        }
+        for(i = 0; i < (int)AES_BLOCK_SIZE; i++) {
+            block[i] = (uint8_t)(s[i] ^ roundKeys[round * AES_BLOCK_SIZE + i]);
+        }
+    }
+}
+
+void CtrRow(const Aes128 &aes, const uint8_t nonce[AES_NONCE_SIZE], uint32_t addr, Bytes &row)
+{
+    uint8_t block[AES_BLOCK_SIZE];
+    uint32_t packed = addr / 2 * 3;
+    uint32_t n = 0xFFFFFFFF;
+
+    for(size_t i = 0; i < row.size(); i++) {
+        if(i % 4 == 3) {
+            continue;                                               //Phantom byte, not in the stream
+        }
+        if(packed / AES_BLOCK_SIZE != n) {
+            n = packed / AES_BLOCK_SIZE;
+            memcpy(block, nonce, AES_NONCE_SIZE);
+            memset(block + AES_NONCE_SIZE, 0, AES_BLOCK_SIZE - AES_NONCE_SIZE);
+            for(int k = 0; k < 4; k++) {
+                block[AES_BLOCK_SIZE - 1 - k] = (uint8_t)(n >> 8 * k);
+            }
+            aes.Encrypt(block);
+        }
+        row[i] ^= block[packed % AES_BLOCK_SIZE];
+        packed++;
+    }
+}
+
+const Manifest::Range *Manifest::Find(uint32_t first, uint32_t end) const
+{
+    for(const Range &r : ranges) {
+        if(r.first == first && r.end == end) {
+            return &r;
+        }
+    }
+    return NULL;
+}
+
+uint8_t *Packed(HexImage &image, uint32_t at, size_t i)
+{
+    uint32_t instr = (uint32_t)(i / 3);
+    Bytes &row = image.Row(at + instr / image.RowInstructions() * image.RowSpan());
+
+    return &row[instr % image.RowInstructions() * 4 + i % 3];
+}
+
+size_t ManifestRows(const Manifest &manifest, unsigned rowInstructions)
+{
+    return (MANIFEST_HEAD + manifest.ranges.size() * MANIFEST_RANGE + rowInstructions * 3 - 1) / (rowInstructions * 3);
+}
+
+void WriteManifest(HexImage &image, uint32_t at, const Manifest &manifest)
+{
+    Bytes out;
+    size_t i;
+
+    for(i = 0; i < 4; i++) {
+        out.push_back((uint8_t)(MANIFEST_MAGIC >> 8 * i));
+    }
+    out.insert(out.end(), manifest.nonce, manifest.nonce + AES_NONCE_SIZE);
+    out.push_back((uint8_t)manifest.ranges.size());
+    out.push_back((uint8_t)(manifest.ranges.size() >> 8));
+    for(const Manifest::Range &r : manifest.ranges) {
+        for(uint32_t v : {r.first, r.first >> 8, r.first >> 16, r.end, r.end >> 8, r.end >> 16,
+                          r.crc, r.crc >> 8, r.crc >> 16, r.crc >> 24}) {
+            out.push_back((uint8_t)v);
+        }
+    }
+    for(i = 0; i < out.size() || i % (image.RowInstructions() * 3); i++) {
+        *Packed(image, at, i) = i < out.size() ? out[i] : 0;        //The rest of the last row 0
+        if(i % 3 == 2) {
+            Packed(image, at, i)[1] = 0;                            //Phantom byte, as a linker writes it
+        }
+    }
+}
+
+bool ReadManifest(const HexImage &image, uint32_t at, Manifest &manifest)
+{
+    HexImage copy(image.RowInstructions());                         //Packed() adds rows, keep them out of image
+    Bytes in;
+    size_t count;
+    size_t i;
+
+    for(uint32_t a = at; image.Rows().count(a); a += image.RowSpan()) {
+        copy.Row(a) = image.Rows().at(a);
+    }
+    if(copy.Rows().empty()) {
+        return false;
+    }
+    for(i = 0; i < MANIFEST_HEAD; i++) {
+        in.push_back(*Packed(copy, at, i));
+    }
+    if((uint32_t)(in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24) != MANIFEST_MAGIC) {
+        return false;
+    }
+    memcpy(manifest.nonce, &in[4], AES_NONCE_SIZE);
+    count = in[12] | in[13] << 8;
+    if(MANIFEST_HEAD + count * MANIFEST_RANGE > copy.Rows().size() * image.RowInstructions() * 3) {
+        return false;                                               //Cut short
+    }
+    manifest.ranges.clear();
+    for(size_t k = 0; k < count; k++) {
+        uint8_t b[MANIFEST_RANGE];
+
+        for(i = 0; i < MANIFEST_RANGE; i++) {
+            b[i] = *Packed(copy, at, MANIFEST_HEAD + k * MANIFEST_RANGE + i);
+        }
+        manifest.ranges.push_back(Manifest::Range{b[0] | b[1] << 8 | (uint32_t)b[2] << 16,
+                                                  b[3] | b[4] << 8 | (uint32_t)b[5] << 16,
+                                                  b[6] | b[7] << 8 | b[8] << 16 | (uint32_t)b[9] << 24});
+    }
+    return true;
+}
+
+} //namespace an851
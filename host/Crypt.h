@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * AES-128 CTR for images going to a USE_AES bootloader, the same stream
+ * as Aes.c takes off: counter block n is the 8 byte nonce, four zero
+ * bytes and n big endian, and covers bytes 16n to 16n+15 of program
+ * memory packed 3 bytes per instruction, phantom bytes left out. The
+ * counter is the address, so any row decrypts on its own and an update
+ * may send rows in any order or resume part way.
+ *
+ * The device checks VERIFY_RANGE against the CRC of what it wrote, the
+ * plain rows, which the holder of an encrypted image cannot work out. A
+ * manifest carries them: the nonce and, for each run of rows VERIFY_RANGE
+ * covers, its first address, end and plain CRC-32. It is written packed
+ * into rows from BOOT_ADDR_LOW up, rows a flash tool drops unsent.
+ */
+
+#ifndef CRYPT_H
+#define CRYPT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "HexImage.h"
+
+namespace an851 {
+
+const unsigned AES_BLOCK_SIZE = 16;
+const unsigned AES_NONCE_SIZE = 8;
+const uint32_t MANIFEST_MAGIC = 0x4D534541;                         //"AESM", the first packed bytes
+
+class Aes128 {
+public:
+    explicit Aes128(const uint8_t key[AES_BLOCK_SIZE]);
+    void Encrypt(uint8_t block[AES_BLOCK_SIZE]) const;
+
+private:
+    uint8_t roundKeys[11 * AES_BLOCK_SIZE];
+};
+
+//XORs the keystream into row, HEX layout, the row at PC address addr;
+//run twice it gives the row back
+void CtrRow(const Aes128 &aes, const uint8_t nonce[AES_NONCE_SIZE], uint32_t addr, Bytes &row);
+
+struct Manifest {
+    struct Range {
+        uint32_t first;                                             //PC address of the first row
+        uint32_t end;                                               //Past the last row, as VERIFY_RANGE sends it
+        uint32_t crc;                                               //CRC-32 of the plain rows, HEX layout
+    };
+    uint8_t nonce[AES_NONCE_SIZE];
+    std::vector<Range> ranges;
+
+    const Range *Find(uint32_t first, uint32_t end) const;         //NULL if no such range
+};
+
+//Byte i of the packed stream, 3 per instruction, in the rows from at up;
+//adds the row it falls in if image lacks it
+uint8_t *Packed(HexImage &image, uint32_t at, size_t i);
+
+size_t ManifestRows(const Manifest &manifest, unsigned rowInstructions);
+void WriteManifest(HexImage &image, uint32_t at, const Manifest &manifest);
+bool ReadManifest(const HexImage &image, uint32_t at, Manifest &manifest); //false if no manifest at at
+
+} //namespace an851
+
+#endif /*CRYPT_H*/
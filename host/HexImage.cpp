@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "HexImage.h"
+
+namespace an851 {
+
+HexImage::HexImage(unsigned rowInstructions) : rowInstructions(rowInstructions), lastRow(NULL)
+{
+}
+
+Bytes &HexImage::Row(uint32_t addr)
+{
+    uint32_t base = addr - addr % RowSpan();
+    std::map<uint32_t, Bytes>::iterator it = rows.find(base);
+    size_t i;
+
+    if(it == rows.end()) {
+        it = rows.insert(std::make_pair(base, Bytes(RowBytes()))).first;
+        for(i = 0; i < RowBytes(); i++) {
+            it->second[i] = (i % 4 == 3) ? 0x00 : 0xFF;             //Erased flash, phantom byte sent as 0
+        }
+    }
+    return it->second;
+}
+
+void HexImage::Put(uint32_t byteAddr, uint8_t data)
+{
+    uint32_t base = byteAddr - byteAddr % RowBytes();
+
+    if(lastRow == NULL || base != lastBase) {                       //Records run in address order, look up once a row
+        lastRow = &Row(byteAddr / 2);
+        lastBase = base;
+    }
+    (*lastRow)[byteAddr - base] = data;
+}
+
+void HexImage::SetWord(uint32_t addr, uint32_t word)
+{
+    Bytes &row = Row(addr);
+    size_t at = (addr % RowSpan()) * 2;
+
+    row[at + 0] = (uint8_t)word;
+    row[at + 1] = (uint8_t)(word >> 8);
+    row[at + 2] = (uint8_t)(word >> 16);
+    row[at + 3] = 0;
+}
+
+unsigned HexImage::Drop(uint32_t first, uint32_t last)
+{
+    std::map<uint32_t, Bytes>::iterator it = rows.lower_bound(first - first % RowSpan());
+    unsigned n = 0;
+
+    lastRow = NULL;
+    while(it != rows.end() && it->first <= last) {
+        it = rows.erase(it);
+        n++;
+    }
+    return n;
+}
+
+static int HexDigit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+void HexImage::Load(const std::string &path)
+{
+    struct stat st;
+    const char *map;
+    const char *p;
+    const char *end;
+    uint8_t record[256 + 5];
+    uint32_t base = 0;
+    unsigned line = 1;
+    unsigned length;
+    unsigned i;
+    uint8_t sum;
+    int hi, lo;
+    int fd;
+    bool done = false;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    map = st.st_size ? (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(map == MAP_FAILED) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    if(map) {
+        madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    p = map;
+    end = map + st.st_size;
+    while(p < end && !done) {
+        while(p < end && *p != ':') {                               //Skip to the next record
+            if(*p++ == '\n') {
+                line++;
+            }
+        }
+        if(p == end) {
+            break;
+        }
+        p++;
+        for(length = 0, sum = 0; length < sizeof(record) && p + 1 < end; length++, p += 2) {
+            hi = HexDigit(p[0]);
+            lo = HexDigit(p[1]);
+            if(hi < 0 || lo < 0) {
+                break;
+            }
+            record[length] = (uint8_t)(hi << 4 | lo);
+            sum += record[length];
+        }
+        if(length < 5 || length != record[0] + 5u || sum != 0) {
+            munmap((void *)map, st.st_size);
+            throw std::runtime_error(path + ":" + std::to_string(line) + ": bad record");
+        }
+
+        switch(record[3]) {
+        case 0x00:                                                  //Data
+            for(i = 0; i < record[0]; i++) {
+                Put(base + ((uint32_t)record[1] << 8 | record[2]) + i, record[4 + i]);
+            }
+            break;
+        case 0x01:                                                  //End of file
+            done = true;
+            break;
+        case 0x02:                                                  //Extended segment address
+            base = ((uint32_t)record[4] << 8 | record[5]) << 4;
+            break;
+        case 0x04:                                                  //Extended linear address
+            base = ((uint32_t)record[4] << 8 | record[5]) << 16;
+            break;
+        default:                                                    //Start addresses mean nothing here
+            break;
+        }
+    }
+    if(map) {
+        munmap((void *)map, st.st_size);
+    }
+}
+
+static void HexRecord(FILE *fp, uint8_t type, uint16_t addr, const uint8_t *data, unsigned length)
+{
+    uint8_t sum = (uint8_t)(length + (addr >> 8) + addr + type);
+    unsigned i;
+
+    fprintf(fp, ":%02X%04X%02X", length, addr, type);
+    for(i = 0; i < length; i++) {
+        fprintf(fp, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(fp, "%02X\n", (uint8_t)(0 - sum));
+}
+
+void HexImage::Save(const std::string &path) const
+{
+    static const uint8_t blank[4] = {0xFF, 0xFF, 0xFF, 0x00};
+    FILE *fp = fopen(path.c_str(), "w");
+    uint32_t upper = 0;
+    uint32_t byteAddr;
+    uint8_t ela[2];
+    size_t at;
+
+    if(fp == NULL) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    for(const auto &row : rows) {
+        for(at = 0; at < row.second.size(); at += 16) {             //4 instructions a record
+            bool erased = true;
+
+            for(size_t i = at; i < at + 16 && erased; i += 4) {
+                erased = memcmp(&row.second[i], blank, 4) == 0;
+            }
+            if(erased) {
+                continue;
+            }
+            byteAddr = row.first * 2 + (uint32_t)at;
+            if(byteAddr >> 16 != upper) {
+                upper = byteAddr >> 16;
+                ela[0] = (uint8_t)(upper >> 8);
+                ela[1] = (uint8_t)upper;
+                HexRecord(fp, 0x04, 0, ela, 2);
+            }
+            HexRecord(fp, 0x00, (uint16_t)byteAddr, &row.second[at], 16);
+        }
+    }
+    HexRecord(fp, 0x01, 0, NULL, 0);
+    if(fclose(fp) != 0) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+}
+
+} //namespace an851
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Intel HEX image of PIC24 program memory, cut into flash rows. HEX
+ * addresses are twice the PC address and carry 4 bytes per instruction,
+ * the last one the phantom byte; rows keep that layout, which is what
+ * WT_FLASH expects. Files are memory mapped and parsed in place.
+ */
+
+#ifndef HEX_IMAGE_H
+#define HEX_IMAGE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "An851.h"
+
+namespace an851 {
+
+class HexImage {
+public:
+    explicit HexImage(unsigned rowInstructions);
+
+    void Load(const std::string &path);                             //Throws std::runtime_error
+    void Save(const std::string &path) const;                       //Intel HEX, erased instructions left out
+    Bytes &Row(uint32_t addr);                                      //Row holding PC address addr, blank if new
+    void SetWord(uint32_t addr, uint32_t word);
+    unsigned Drop(uint32_t first, uint32_t last);                   //Removes rows in [first, last], returns how many
+
+    unsigned RowInstructions() const { return rowInstructions; }
+    size_t RowBytes() const { return rowInstructions * 4; }
+    uint32_t RowSpan() const { return rowInstructions * 2; }       //PC addresses per row
+    const std::map<uint32_t, Bytes> &Rows() const { return rows; }  //By PC address of the row
+    size_t DataBytes() const { return rows.size() * RowBytes(); }
+
+private:
+    void Put(uint32_t byteAddr, uint8_t data);
+
+    unsigned rowInstructions;
+    std::map<uint32_t, Bytes> rows;
+    uint32_t lastBase;                                              //Row Put() wrote last
+    Bytes *lastRow;
+};
+
+} //namespace an851
+
+#endif /*HEX_IMAGE_H*/
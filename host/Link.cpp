@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Link.h"
+
+namespace an851 {
+
+static speed_t BaudCode(unsigned long baud)
+{
+    switch(baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 1000000: return B1000000;
+#endif
+    default: return 0;
+    }
+}
+
+Link::Link() : fd(-1), bytesOut(0), bytesIn(0)
+{
+}
+
+Link::~Link()
+{
+    Close();
+}
+
+void Link::Open(const std::string &path, unsigned long baud)
+{
+    struct sockaddr_un addr;
+    struct termios tio;
+    speed_t speed;
+
+    name = path;
+    if(path.compare(0, 5, "/dev/") != 0) {                          //bootpty --socket
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            throw std::runtime_error(path + ": " + strerror(errno));
+        }
+        return;
+    }
+
+    fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if(fd < 0 || tcgetattr(fd, &tio) < 0) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    speed = BaudCode(baud);
+    if(speed == 0) {
+        throw std::runtime_error(path + ": unsupported baud rate " + std::to_string(baud));
+    }
+    cfmakeraw(&tio);                                                //8N1, no flow control
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if(tcsetattr(fd, TCSANOW, &tio) < 0) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    tcflush(fd, TCIOFLUSH);
+}
+
+void Link::Close()
+{
+    if(fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void Link::Write(const uint8_t *data, size_t length)
+{
+    ssize_t n;
+
+    while(length != 0) {
+        n = write(fd, data, length);
+        if(n < 0) {
+            if(errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            throw std::runtime_error(name + ": " + strerror(errno));
+        }
+        bytesOut += n;
+        data += n;
+        length -= n;
+    }
+}
+
+size_t Link::Read(uint8_t *data, size_t length, int timeoutMs)
+{
+    struct pollfd p;
+    ssize_t n;
+
+    p.fd = fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    if(poll(&p, 1, timeoutMs) <= 0) {
+        return 0;
+    }
+    n = read(fd, data, length);
+    if(n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return 0;
+    }
+    if(n <= 0) {
+        throw std::runtime_error(name + ": " + (n == 0 ? "device went away" : strerror(errno)));
+    }
+    bytesIn += n;
+    return n;
+}
+
+} //namespace an851
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Byte link to the device: a serial port or pty (anything under /dev),
+ * or the Unix socket sim/bootpty --socket listens on.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace an851 {
+
+class Link {
+public:
+    Link();
+    ~Link();
+
+    void Open(const std::string &path, unsigned long baud);         //Throws std::runtime_error
+    void Close();
+    void Write(const uint8_t *data, size_t length);
+    size_t Read(uint8_t *data, size_t length, int timeoutMs);       //0 on timeout
+
+    uint64_t BytesOut() const { return bytesOut; }
+    uint64_t BytesIn() const { return bytesIn; }
+
+private:
+    int fd;
+    std::string name;
+    uint64_t bytesOut;
+    uint64_t bytesIn;
+};
+
+} //namespace an851
+
+#endif /*LINK_H*/
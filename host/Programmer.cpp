@@ -0,0 +1,675 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <stdexcept>
+#include "Programmer.h"
+
+namespace an851 {
+
+#define ERASE_PAGE_MS       50                                      //Timeout allowances on top of the link's
+#define WRITE_ROW_MS        10
+#define CRC_INSTR_PER_MS    64
+#define ERASE_PAGE_HOLD_MS  25                                      //Broadcast, no reply: wait out the stall at every node
+#define WRITE_ROW_HOLD_MS   3
+#define SIGN_CHECK_MS       5000                                    //VERIFY_OK checking a signature, 4.5 s at 16 MIPS
+                                                                    //with the slowest multiply README.md budgets
+#define ERASE_MAX_PAGES     64                                      //Pages per ER_FLASH
+#define STREAM_RETRIES      5                                       //RD_STREAM requests that bring nothing new
+
+static uint64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Programmer::Programmer(Link &link, Session &session, const Geometry &geometry) :
+    link(link), session(session), geometry(geometry), startUs(0), major(0), minor(0), pagesErased(0),
+    pagesSkipped(0), ranges(0), manifest(NULL), commitMs(0)
+{
+}
+
+void Programmer::Begin(const char *name)
+{
+    Phase p;
+
+    p.name = name;
+    p.seconds = 0;
+    p.dataBytes = 0;
+    p.frames = session.Frames();
+    p.bytesOut = link.BytesOut();
+    p.bytesIn = link.BytesIn();
+    phases.push_back(p);
+    startUs = NowUs();
+}
+
+void Programmer::End(size_t dataBytes)
+{
+    Phase &p = phases.back();
+
+    p.seconds = (NowUs() - startUs) / 1e6;
+    p.dataBytes = dataBytes;
+    p.frames = session.Frames() - p.frames;
+    p.bytesOut = link.BytesOut() - p.bytesOut;
+    p.bytesIn = link.BytesIn() - p.bytesIn;
+}
+
+std::vector<Programmer::Run> Programmer::Runs(const HexImage &image, bool skipPage0) const
+{
+    std::vector<Run> runs;
+    uint32_t page0End = geometry.pageInstructions * 2;
+
+    for(const auto &row : image.Rows()) {
+        if(skipPage0 && row.first < page0End) {
+            continue;
+        }
+        if(!runs.empty() && runs.back().addr + runs.back().rows * image.RowSpan() == row.first) {
+            runs.back().rows++;
+        } else {
+            runs.push_back(Run{row.first, 1});
+        }
+    }
+    return runs;
+}
+
+void Programmer::Connect(unsigned window, bool large, unsigned crc, bool cobs, bool autoErase)
+{
+    Bytes reply;
+
+    Begin("connect");
+    reply = session.Transact(session.Command(RD_VER, 2, 0));
+    if(reply.size() < 4 || reply[0] != RD_VER) {
+        throw std::runtime_error("no version reply, is the bootloader running?");
+    }
+    minor = reply[2];
+    major = reply[3];
+    if(window != 0 && (window > 1 || large || crc || cobs || autoErase)) { //Window 0: firmware without SESSION
+        session.Open(window, large, crc, cobs, autoErase);
+    }
+    End(0);
+}
+
+void Programmer::Encrypted(const Manifest &m)
+{
+    Bytes payload = session.Command(SET_NONCE, AES_NONCE_SIZE, 0);
+    Bytes reply;
+
+    payload.insert(payload.end(), m.nonce, m.nonce + AES_NONCE_SIZE);
+    reply = session.Transact(payload);
+    if(reply.size() != 5 || reply[0] != SET_NONCE || (session.Opened() && !session.Aes())) { //Unknown commands get a stale length
+        throw std::runtime_error("encrypted image, but the bootloader was built without USE_AES");
+    }
+    manifest = &m;
+}
+
+void Programmer::Signed(const uint8_t sig[SIGN_SIZE])
+{
+    Bytes payload = session.Command(SIGNATURE, SIGN_SIZE, 0);
+    Bytes reply;
+
+    payload.insert(payload.end(), sig, sig + SIGN_SIZE);
+    reply = session.Transact(payload);
+    if(reply.size() != 5 || reply[0] != SIGNATURE || (session.Opened() && !session.Sign())) {
+        throw std::runtime_error("signed image, but the bootloader was built without USE_SIGN");
+    }
+    commitMs = SIGN_CHECK_MS;
+}
+
+void Programmer::Erase(const HexImage &image)
+{
+    std::vector<uint32_t> pages;
+    uint32_t pageSpan = geometry.pageInstructions * 2;
+
+    for(const auto &row : image.Rows()) {
+        if(pages.empty() || pages.back() != row.first / pageSpan) {
+            pages.push_back(row.first / pageSpan);
+        }
+    }
+    Erase(pages);
+}
+
+void Programmer::Erase(const std::vector<uint32_t> &pages)
+{
+    uint32_t pageSpan = geometry.pageInstructions * 2;
+    uint32_t first;
+    unsigned count;
+    unsigned perPage = session.Node() == NODE_BROADCAST ? ERASE_PAGE_HOLD_MS : ERASE_PAGE_MS;
+    size_t i;
+
+    Begin("erase");
+    for(i = 0; i < pages.size(); i += count) {
+        first = pages[i];
+        for(count = 1; i + count < pages.size() && pages[i + count] == first + count && count < ERASE_MAX_PAGES; count++) {
+        }
+        session.Queue(session.Command(ER_FLASH, count, first * pageSpan), count * perPage,
+                      [this](const Bytes &reply) {
+                          if(reply.size() >= 9) {                   //USE_BLANK_CHECK counts
+                              pagesErased += reply[5] | reply[6] << 8;
+                              pagesSkipped += reply[7] | reply[8] << 8;
+                          }
+                      });
+    }
+    session.Drain();
+    End(0);
+}
+
+void Programmer::Write(const HexImage &image)
+{
+    std::map<uint32_t, Bytes>::const_iterator it;
+    unsigned perFrame = session.MaxData() / image.RowBytes();
+    unsigned perRow = session.Node() == NODE_BROADCAST ? WRITE_ROW_HOLD_MS : WRITE_ROW_MS;
+    unsigned perPage = session.Node() == NODE_BROADCAST ? ERASE_PAGE_HOLD_MS : ERASE_PAGE_MS;
+    uint32_t pageSpan = geometry.pageInstructions * 2;
+    uint32_t reached = 0;                                           //Pages below are erased by an earlier frame
+    uint32_t addr;
+    unsigned pages;
+    unsigned rows;
+    Bytes payload;
+
+    if(perFrame == 0) {
+        perFrame = 1;
+    }
+    Begin("write");
+    for(const Run &run : Runs(image, false)) {
+        it = image.Rows().find(run.addr);
+        for(unsigned done = 0; done < run.rows; done += rows) {
+            rows = run.rows - done < perFrame ? run.rows - done : perFrame;
+            addr = it->first;
+            payload = session.Command(WT_FLASH, rows, addr);
+            pages = 0;
+            for(unsigned r = 0; r < rows; r++, ++it) {
+                payload.insert(payload.end(), it->second.begin(), it->second.end());
+                if(session.AutoErase() && it->first / pageSpan + 1 > reached) {
+                    reached = it->first / pageSpan + 1;             //Rows go out in address order
+                    pages++;
+                }
+            }
+            session.Queue(payload, rows * perRow + pages * perPage, [](const Bytes &) {});
+        }
+    }
+    session.Drain();
+    End(image.DataBytes());
+}
+
+bool Programmer::Verify(const HexImage &image, bool readBack)
+{
+    std::map<uint32_t, Bytes>::const_iterator it;
+    uint32_t end;
+    uint32_t crc;
+    size_t covered = 0;
+    size_t instr;
+    size_t chunk;
+    size_t n;
+    Bytes payload;
+    Bytes data;
+    Bytes reply;
+    char what[96];
+    size_t before = mismatches.size();
+
+    Begin("verify");
+    for(const Run &run : Runs(image, true)) {
+        end = run.addr + run.rows * image.RowSpan();
+        instr = (size_t)run.rows * image.RowInstructions();
+        payload = session.Command(VERIFY_RANGE, 1, run.addr);
+        data = RangePayload(image, run, crc);
+        payload.insert(payload.end(), data.begin(), data.end());
+        reply = session.Transact(payload, (int)(instr / CRC_INSTR_PER_MS));
+        ranges++;
+        covered += run.rows * image.RowBytes();
+        if(reply.size() < 9 || (uint32_t)(reply[5] | reply[6] << 8 | reply[7] << 16 | (uint32_t)reply[8] << 24) != crc) {
+            snprintf(what, sizeof(what), "range 0x%06X-0x%06X: CRC differs", run.addr, end - 1);
+            mismatches.push_back(what);
+        }
+    }
+
+    chunk = session.MaxData() / 4;                                  //Instructions per RD_FLASH
+    for(const Run &run : Runs(image, true)) {
+        if(!readBack) {
+            break;
+        }
+        Bytes expect;
+
+        it = image.Rows().find(run.addr);
+        for(unsigned r = 0; r < run.rows; r++, ++it) {
+            expect.insert(expect.end(), it->second.begin(), it->second.end());
+        }
+        instr = expect.size() / 4;
+        for(size_t at = 0; at < instr; at += n) {
+            n = instr - at < chunk ? instr - at : chunk;
+            reply = session.Transact(session.Command(RD_FLASH, (unsigned)n, run.addr + (uint32_t)at * 2));
+            if(reply.size() != 5 + n * 4 || memcmp(reply.data() + 5, expect.data() + at * 4, n * 4) != 0) {
+                snprintf(what, sizeof(what), "read back 0x%06X-0x%06X differs", run.addr + (uint32_t)at * 2,
+                         run.addr + (uint32_t)(at + n) * 2 - 1);
+                mismatches.push_back(what);
+            }
+        }
+    }
+    End(covered);
+    return mismatches.size() == before;
+}
+
+Bytes Programmer::RangePayload(const HexImage &image, const Run &run, uint32_t &crc) const
+{
+    std::map<uint32_t, Bytes>::const_iterator it = image.Rows().find(run.addr);
+    uint32_t end = run.addr + run.rows * image.RowSpan();
+    Bytes data;
+
+    crc = 0;
+    for(unsigned r = 0; r < run.rows && manifest == NULL; r++, ++it) {
+        crc = Crc32(crc, it->second.data(), it->second.size());
+    }
+    if(manifest != NULL) {
+        const Manifest::Range *range = manifest->Find(run.addr, end);
+        char what[96];
+
+        if(range == NULL) {
+            snprintf(what, sizeof(what), "rows 0x%06X-0x%06X are not a range of the manifest", run.addr, end - 1);
+            throw std::runtime_error(what);                         //Dropped or added since an851encrypt
+        }
+        crc = range->crc;
+    }
+    for(uint32_t v : {end, end >> 8, end >> 16, crc, crc >> 8, crc >> 16, crc >> 24}) {
+        data.push_back((uint8_t)v);
+    }
+    return data;
+}
+
+//Each BATCH holds as many VERIFY_RANGE sub-commands as fit, the last one
+//the VERIFY_OK too. The device stops a batch at the first range that
+//differs, and a later VERIFY_OK finds the failure and commits nothing.
+//A BATCH acked again after a lost reply brings no statuses; the ranges
+//are then checked one by one and committed as Verify() and Finish() would.
+bool Programmer::Commit(const HexImage &image)
+{
+    struct Sub {
+        Bytes bytes;                                                //Header and data
+        const Run *run;                                             //NULL for the VERIFY_OK
+        size_t instr;
+    };
+    std::vector<Run> runs = Runs(image, true);
+    std::vector<Sub> subs;
+    size_t room = session.MaxData();
+    size_t covered = 0;
+    size_t before = mismatches.size();
+    bool unknown = false;
+    char what[96];
+    int extraMs;
+    uint32_t crc;
+    size_t i;
+    size_t n;
+
+    for(const Run &run : runs) {
+        Bytes data = RangePayload(image, run, crc);
+        Sub s = {{VERIFY_RANGE, 1, 0, (uint8_t)run.addr, (uint8_t)(run.addr >> 8), (uint8_t)(run.addr >> 16)}, &run,
+                 (size_t)run.rows * image.RowInstructions()};
+
+        s.bytes.insert(s.bytes.end(), data.begin(), data.end());
+        subs.push_back(s);
+        covered += run.rows * image.RowBytes();
+    }
+    subs.push_back(Sub{{VERIFY_OK, 1, 0, 0, 0, 0}, NULL, 0});
+
+    Begin("verify");
+    for(i = 0; i < subs.size(); i += n) {
+        Bytes payload;
+        size_t bytes = 0;
+        size_t instr = 0;
+
+        for(n = 0; i + n < subs.size() && n < BATCH_MAX_OPS && (session.Large() || n < 255) &&
+            bytes + subs[i + n].bytes.size() <= room; n++) {
+            bytes += subs[i + n].bytes.size();
+            instr += subs[i + n].instr;
+        }
+        payload = session.Command(BATCH, (unsigned)n, 0);
+        for(size_t k = i; k < i + n; k++) {
+            payload.insert(payload.end(), subs[k].bytes.begin(), subs[k].bytes.end());
+        }
+        extraMs = (int)(instr / CRC_INSTR_PER_MS) + WRITE_ROW_MS;
+        if(i + n == subs.size()) {
+            extraMs += commitMs;                                    //The VERIFY_OK is in this one
+        }
+        session.Queue(payload, extraMs, [&, i, n](const Bytes &reply) {
+            if(reply.size() < 5 + n * BATCH_RESULT_SIZE) {
+                unknown = true;                                     //Repeated ack, or acked by a later frame
+                return;
+            }
+            for(size_t k = 0; k < n; k++) {
+                const Run *run = subs[i + k].run;
+                const uint8_t *result = &reply[5 + k * BATCH_RESULT_SIZE];
+
+                if(run != NULL && result[0] != BATCH_SKIPPED) {
+                    ranges++;
+                }
+                if(run != NULL && result[0] == BATCH_MISMATCH) {    //The device's CRC follows the status
+                    snprintf(what, sizeof(what), "range 0x%06X-0x%06X: CRC differs, device has 0x%08X", run->addr,
+                             run->addr + run->rows * image.RowSpan() - 1,
+                             result[1] | result[2] << 8 | result[3] << 16 | (uint32_t)result[4] << 24);
+                    mismatches.push_back(what);
+                } else if(run == NULL && result[0] != BATCH_OK && mismatches.size() == before) {
+                    mismatches.push_back("VERIFY_OK: not committed by the device");
+                }
+            }
+        });
+    }
+    session.Drain();
+    End(covered);
+    if(unknown && mismatches.size() == before) {
+        if(!Verify(image, false)) {
+            return false;
+        }
+        session.Transact(session.Command(VERIFY_OK, 1, 0), commitMs);
+    }
+    return mismatches.size() == before;
+}
+
+std::vector<uint32_t> Programmer::Stats(bool clear)
+{
+    std::vector<uint32_t> values;
+    Bytes payload = session.Command(RD_STATS, 1, 0);
+    Bytes reply;
+
+    payload.push_back(clear ? STATS_CLEAR : 0);
+    reply = session.Transact(payload);
+    if(reply.size() < 6 || reply[0] != RD_STATS || reply.size() != 6 + 4 * ((size_t)reply[5] + 1)) {
+        return values;                                              //Firmware without USE_STATS
+    }
+    for(size_t i = 6; i < reply.size(); i += 4) {
+        values.push_back(reply[i] | reply[i+1] << 8 | reply[i+2] << 16 | (uint32_t)reply[i+3] << 24);
+    }
+    return values;
+}
+
+bool Programmer::Slot(Slots &slots)
+{
+    Bytes reply = session.Transact(session.Command(RD_SLOT, 1, 0));
+
+    if(reply.size() < 13 || reply[0] != RD_SLOT) {
+        return false;                                               //Firmware without USE_DUAL_SLOT echoes the command
+    }
+    slots.active = reply[5];
+    slots.target = reply[6];
+    slots.base = reply[7] | reply[8] << 8 | (uint32_t)reply[9] << 16;
+    slots.size = reply[10] | reply[11] << 8 | (uint32_t)reply[12] << 16;
+    return true;
+}
+
+bool Programmer::ReadJournal(Journal &journal)
+{
+    size_t per = (session.MaxData() - 13) / 3;                      //Entries per reply, 3 bytes each after the header
+    unsigned count;
+    Bytes payload;
+    Bytes reply;
+
+    if(!session.Large() && per > 255) {
+        per = 255;
+    }
+    journal.entries.clear();
+    do {
+        payload = session.Command(JOURNAL, (unsigned)per, (uint32_t)journal.entries.size());
+        payload.push_back(0);
+        reply = session.Transact(payload);
+        if(reply.size() < 13 || reply[0] != JOURNAL || (reply.size() - 13) % 3 != 0) {
+            return false;                                           //Firmware without USE_JOURNAL
+        }
+        count = reply[5] | reply[6] << 8;
+        journal.capacity = reply[7] | reply[8] << 8;
+        journal.tag = reply[9] | reply[10] << 8 | reply[11] << 16 | (uint32_t)reply[12] << 24;
+        for(size_t i = 13; i < reply.size(); i += 3) {
+            journal.entries.push_back(reply[i] | reply[i+1] << 8 | (uint32_t)reply[i+2] << 16);
+        }
+    } while(reply.size() > 13 && journal.entries.size() < count);
+    return true;
+}
+
+void Programmer::BeginJournal(uint32_t tag)
+{
+    Bytes payload = session.Command(JOURNAL, 1, 0);                 //Length 0 would be RESET
+
+    for(uint32_t v : {(uint32_t)JOURNAL_BEGIN, tag, tag >> 8, tag >> 16, tag >> 24}) {
+        payload.push_back((uint8_t)v);
+    }
+    session.Transact(payload, 2 * ERASE_PAGE_MS);                   //May erase the journal page twice
+}
+
+uint32_t Programmer::Tag(const HexImage &image) const
+{
+    uint32_t crc = 0;
+
+    for(const auto &row : image.Rows()) {
+        if(row.first >= geometry.pageInstructions * 2) {
+            crc = Crc32(crc, row.second.data(), row.second.size());
+        }
+    }
+    return crc;
+}
+
+//Only the last entry can have been cut short, the pages it covers are
+//erased again. So is page 0, the bootloader's words in it are not in the
+//journal, and any page with rows still to write that no entry erased.
+std::vector<uint32_t> Programmer::Resume(const Journal &journal, HexImage &image) const
+{
+    std::set<uint32_t> erased;
+    std::set<uint32_t> written;
+    std::vector<uint32_t> pages;
+    std::vector<uint32_t> drop;
+    unsigned perPage = geometry.pageInstructions / geometry.rowInstructions;
+    uint32_t type, first, rows, page;
+    size_t k;
+
+    for(k = 0; k < journal.entries.size(); k++) {
+        type = journal.entries[k] >> 22;
+        first = (journal.entries[k] >> 11) & 0x7FF;
+        rows = journal.entries[k] & 0x7FF;
+        for(uint32_t r = first; r < first + rows; r++) {
+            page = r / perPage;
+            if(type == JOURNAL_ERASE || (type == JOURNAL_WRITE && k + 1 == journal.entries.size())) {
+                if(type == JOURNAL_ERASE && k + 1 < journal.entries.size()) {
+                    erased.insert(page);
+                } else {
+                    erased.erase(page);
+                }
+                written.erase(written.lower_bound(page * perPage), written.lower_bound((page + 1) * perPage));
+            } else if(type == JOURNAL_WRITE) {
+                written.insert(r);
+            }
+        }
+    }
+
+    for(const auto &row : image.Rows()) {
+        uint32_t r = row.first / image.RowSpan();
+        bool redo;
+
+        page = r / perPage;
+        if(!pages.empty() && pages.back() == page) {
+            continue;                                               //Erased again, every row of it goes
+        }
+        redo = page == 0;
+        for(auto it = image.Rows().lower_bound(page * perPage * image.RowSpan());
+            it != image.Rows().end() && it->first < (page + 1) * perPage * image.RowSpan(); ++it) {
+            redo = redo || (!erased.count(page) && !written.count(it->first / image.RowSpan()));
+        }
+        if(redo) {
+            pages.push_back(page);
+        } else if(written.count(r)) {
+            drop.push_back(row.first);
+        }
+    }
+    for(uint32_t addr : drop) {
+        image.Drop(addr, addr + image.RowSpan() - 1);
+    }
+    return pages;
+}
+
+void Programmer::Finish(bool reset)
+{
+    Begin("finish");
+    session.Transact(session.Command(VERIFY_OK, 1, 0), commitMs);   //Commits the entry delay
+    if(reset) {
+        Reset();
+    }
+    End(0);
+}
+
+void Programmer::Reset()
+{
+    session.Send(session.Command(RD_VER, 0, 0));                    //Length 0 is RESET, no reply
+}
+
+//Decodes an RD_STREAM frame that starts at next into image and moves next
+//past it; false if it starts elsewhere or does not decode
+bool Programmer::StreamFrame(const Bytes &frame, uint32_t &next, HexImage &image) const
+{
+    std::vector<uint32_t> words;
+    uint32_t addr;
+    size_t i;
+    unsigned n;
+
+    if(frame.size() < 5) {
+        return false;
+    }
+    addr = frame[2] | frame[3] << 8 | (uint32_t)frame[4] << 16;
+    if(addr != next) {
+        return false;                                               //One before it was lost
+    }
+    for(i = 5; i < frame.size(); ) {
+        n = (frame[i] & 0x7F) + 1;
+        if(frame[i++] & STREAM_BLANK) {
+            words.insert(words.end(), n, 0xFFFFFF);
+            continue;
+        }
+        if(i + n * 3 > frame.size()) {
+            return false;
+        }
+        for(; n > 0; n--, i += 3) {
+            words.push_back(frame[i] | frame[i+1] << 8 | (uint32_t)frame[i+2] << 16);
+        }
+    }
+    if(words.empty() || (uint8_t)words.size() != frame[1]) {
+        return false;                                               //The length holds the low bits of the count
+    }
+    for(uint32_t w : words) {
+        if(w != 0xFFFFFF) {
+            image.SetWord(next, w);
+        }
+        next += 2;
+    }
+    return true;
+}
+
+//A frame lost on the way leaves a gap in the addresses, that range is
+//asked for again once the stream is over
+void Programmer::Dump(uint32_t first, uint32_t end, HexImage &image)
+{
+    std::deque<std::pair<uint32_t, uint32_t>> todo = {{first, end}};
+    unsigned room = session.MaxData() < 0xFFFF ? (unsigned)session.MaxData() : 0xFFFF;
+    uint32_t from;
+    uint32_t to;
+    uint32_t next;
+    uint32_t addr;
+    unsigned tries = 0;
+    int wireMs;
+    bool bare = false;
+    Bytes payload;
+
+    if(!session.Large() && room > 255) {
+        room = 255;
+    }
+    wireMs = (int)(room * 2 * 10000ULL / session.Baud());           //A whole frame stuffed, on top of the timeout
+    Begin("dump");
+    while(!todo.empty() && !bare) {
+        from = next = todo.front().first;
+        to = todo.front().second;
+        todo.pop_front();
+        payload = session.Command(RD_STREAM, room, from);           //Data bytes per frame, then where to stop
+        for(uint32_t v : {to, to >> 8, to >> 16}) {
+            payload.push_back((uint8_t)v);
+        }
+        session.Stream(payload, wireMs, [&](const Bytes &frame) {
+            if(frame.size() < 5) {
+                bare = next == from;                                //Not built in, or no frame CRC agreed
+                return false;
+            }
+            addr = frame[2] | frame[3] << 8 | (uint32_t)frame[4] << 16;
+            if(addr > next && addr < to) {
+                todo.push_back({next, addr});
+                next = addr;
+            }
+            StreamFrame(frame, next, image);
+            return next < to;
+        });
+        if(next < to && !bare) {
+            todo.push_front({next, to});                            //Cut off, carry on from there
+        }
+        tries = next == from ? tries + 1 : 0;
+        if(tries > STREAM_RETRIES) {
+            throw std::runtime_error("RD_STREAM brought nothing back");
+        }
+    }
+    if(bare) {
+        DumpFlash(from, to, image);
+        for(const auto &range : todo) {
+            DumpFlash(range.first, range.second, image);
+        }
+    }
+    End((end - first) * 2);
+}
+
+//RD_FLASH a frame at a time, for firmware without USE_STREAM
+void Programmer::DumpFlash(uint32_t first, uint32_t end, HexImage &image)
+{
+    size_t chunk = session.MaxData() / 4;
+    uint32_t n;
+    uint32_t w;
+    Bytes reply;
+
+    for(uint32_t addr = first; addr < end; addr += n * 2) {
+        n = (end - addr) / 2 < chunk ? (end - addr) / 2 : (uint32_t)chunk;
+        reply = session.Transact(session.Command(RD_FLASH, n, addr), (int)(n * 8 * 10000ULL / session.Baud()));
+        if(reply.size() != 5 + n * 4) {
+            throw std::runtime_error("short RD_FLASH reply");
+        }
+        for(uint32_t i = 0; i < n; i++) {
+            w = reply[5 + i*4] | reply[6 + i*4] << 8 | (uint32_t)reply[7 + i*4] << 16;
+            if(w != 0xFFFFFF) {
+                image.SetWord(addr + i * 2, w);
+            }
+        }
+    }
+}
+
+} //namespace an851
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Erase, write and verify of a HexImage, each step timed. Page 0 is the
+ * bootloader's to rearrange (reset vector, user reset, entry delay), so
+ * it is erased and written whole but left out of the verify, as
+ * README.md describes. Erase and Write over a NODE_BROADCAST Session
+ * reach every node on the bus at once. With a progress journal on the
+ * device Resume() works out what an update cut short left to do.
+ * Dump() reads flash back with RD_STREAM, or RD_FLASH without it.
+ * Commit() is Verify() and Finish() in as few BATCH frames as hold the
+ * ranges, for firmware built with USE_BATCH. After Encrypted() the rows
+ * are taken to be AES-128 CTR, see Crypt.h: the nonce goes to the
+ * device and VERIFY_RANGE sends the manifest's CRCs of the plain rows.
+ * Signed() hands the device the signature of the rows that follow, see
+ * Sign.h; VERIFY_OK then waits out the check.
+ */
+
+#ifndef PROGRAMMER_H
+#define PROGRAMMER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Crypt.h"
+#include "HexImage.h"
+#include "Session.h"
+#include "Sign.h"
+
+namespace an851 {
+
+//Device layout, defaults as BootLoader.h sets them for the PIC24FJ256GB206
+struct Geometry {
+    unsigned rowInstructions = 64;
+    unsigned pageInstructions = 512;
+    uint32_t bootFirst = 0x400;                                     //BOOT_ADDR_LOW
+    uint32_t bootLast = 0x13FF;                                     //BOOT_ADDR_HI of BootConfig.h as shipped
+    uint32_t flashEnd = 0x2AC00;                                    //First PC address past flash, config page included
+};
+
+//RD_SLOT reply, the slot a new image goes to
+struct Slots {
+    unsigned active;                                                //0 A, 1 B, SLOT_NONE
+    unsigned target;
+    uint32_t base;                                                  //First PC address of the target slot
+    uint32_t size;                                                  //PC addresses per slot
+};
+
+//JOURNAL reply, what the open journal recorded
+struct Journal {
+    unsigned capacity;                                              //Entries it holds, 0 if none is open
+    uint32_t tag;                                                   //As JOURNAL_BEGIN was given it
+    std::vector<uint32_t> entries;                                  //Type, first row and rows each, oldest first
+};
+
+struct Phase {
+    std::string name;
+    double seconds;
+    size_t dataBytes;                                               //Image bytes the phase covered
+    unsigned frames;
+    uint64_t bytesOut;
+    uint64_t bytesIn;
+};
+
+class Programmer {
+public:
+    Programmer(Link &link, Session &session, const Geometry &geometry);
+
+    void Connect(unsigned window, bool large, unsigned crc, bool cobs, bool autoErase); //RD_VER, then SESSION if asked for
+    void Encrypted(const Manifest &manifest);                       //SET_NONCE; manifest has to outlive the Programmer
+    void Signed(const uint8_t sig[SIGN_SIZE]);                      //SIGNATURE, before the first erase or row
+    void Erase(const HexImage &image);
+    void Erase(const std::vector<uint32_t> &pages);                 //Page numbers, ascending
+    void Write(const HexImage &image);                              //With Session::AutoErase() no Erase() needed first
+    bool Verify(const HexImage &image, bool readBack);              //VERIFY_RANGE per run of rows, RD_FLASH too if readBack;
+                                                                    //false if this call found a mismatch
+    bool Commit(const HexImage &image);                             //VERIFY_RANGEs and VERIFY_OK batched, see Session::Batch();
+                                                                    //false if a range differed, nothing committed then
+    void Finish(bool reset);                                        //VERIFY_OK, then RESET
+    void Reset();                                                   //RESET alone, no reply
+    void Dump(uint32_t first, uint32_t end, HexImage &image);       //Flash [first, end) into image, erased rows left out
+    std::vector<uint32_t> Stats(bool clear);                        //RD_STATS: FCY, then BL_STATS; empty if not built in
+    bool Slot(Slots &slots);                                        //RD_SLOT; false if not built in
+    bool ReadJournal(Journal &journal);                             //JOURNAL queries; false if not built in
+    void BeginJournal(uint32_t tag);                                //JOURNAL_BEGIN, a new journal for this image
+    uint32_t Tag(const HexImage &image) const;                      //CRC-32 of the rows past page 0
+    std::vector<uint32_t> Resume(const Journal &journal, HexImage &image) const; //Drops the rows journal has written, returns
+                                                                    //the pages to erase again
+
+    const std::vector<Phase> &Phases() const { return phases; }
+    unsigned Major() const { return major; }
+    unsigned Minor() const { return minor; }
+    unsigned PagesErased() const { return pagesErased; }
+    unsigned PagesSkipped() const { return pagesSkipped; }
+    unsigned Ranges() const { return ranges; }
+    const std::vector<std::string> &Mismatches() const { return mismatches; }
+
+private:
+    struct Run {                                                    //Consecutive rows
+        uint32_t addr;
+        unsigned rows;
+    };
+    std::vector<Run> Runs(const HexImage &image, bool skipPage0) const;
+    Bytes RangePayload(const HexImage &image, const Run &run, uint32_t &crc) const; //VERIFY_RANGE data: end, CRC
+    bool StreamFrame(const Bytes &frame, uint32_t &next, HexImage &image) const;
+    void DumpFlash(uint32_t first, uint32_t end, HexImage &image);
+    void Begin(const char *name);
+    void End(size_t dataBytes);
+
+    Link &link;
+    Session &session;
+    Geometry geometry;
+    std::vector<Phase> phases;
+    uint64_t startUs;
+    unsigned major;
+    unsigned minor;
+    unsigned pagesErased;
+    unsigned pagesSkipped;
+    unsigned ranges;
+    std::vector<std::string> mismatches;
+    const Manifest *manifest;                                       //NULL for a plain image
+    int commitMs;                                                   //Extra VERIFY_OK allowance, the signature check
+};
+
+} //namespace an851
+
+#endif /*PROGRAMMER_H*/
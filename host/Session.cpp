@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include "Session.h"
+
+namespace an851 {
+
+static uint64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Session::Session(Link &link, unsigned long baud, int timeoutMs, int retries) :
+    link(link), baud(baud), lineFreeUs(0), stxSent(false), timeoutMs(timeoutMs), retries(retries), opened(false), window(1), sequenced(false), large(false),
+    check(1), cobs(false), autoErase(false), batch(false), aes(false), sign(false), maxData(256), node(-1), nextSeq(0), frames(0), resends(0), naks(0), rxPos(0), rxLen(0)
+{
+}
+
+void Session::Open(unsigned requestWindow, bool requestLarge, unsigned requestCrc, bool requestCobs, bool requestAutoErase)
+{
+    uint8_t options = (requestLarge ? SESSION_LARGE : 0) | (requestCobs ? SESSION_COBS : 0) |
+                      (requestCrc == 32 ? SESSION_CRC32 : requestCrc == 16 ? SESSION_CRC16 : 0) |
+                      (requestAutoErase ? SESSION_AUTO_ERASE : 0);
+    Bytes payload = {SESSION, 1, 0, 0, 0, (uint8_t)requestWindow, options};
+    Bytes reply;
+
+    cobs = false;
+    decoder.SetCobs(false);
+    reply = Transact(payload);                                      //Always plain AN851 framing
+    if(reply.size() != 9 || reply[0] != SESSION) {
+        return;                                                     //Built without USE_SESSION
+    }
+    opened = true;
+    window = reply[5] ? reply[5] : 1;
+    large = (reply[6] & SESSION_LARGE) != 0;
+    check = (reply[6] & SESSION_CRC32) ? 4 : (reply[6] & SESSION_CRC16) ? 2 : 1;   //Firmware without USE_FRAME_CRC grants neither
+    decoder.SetCheck(check);
+    cobs = (reply[6] & SESSION_COBS) != 0;                          //Replies mirror the framing of the request
+    decoder.SetCobs(cobs);
+    autoErase = (reply[6] & SESSION_AUTO_ERASE) != 0;               //Not granted with a journal left open
+    batch = (reply[6] & SESSION_BATCH) != 0;                        //Never asked for, the device says if it has it
+    aes = (reply[6] & SESSION_AES) != 0;
+    sign = (reply[6] & SESSION_SIGN) != 0;
+    maxData = reply[7] | (size_t)reply[8] << 8;
+    sequenced = window > 1;
+    nextSeq = 0;
+}
+
+void Session::SetNode(int address)
+{
+    node = address;
+    decoder.SetAddressed(node >= 0);
+}
+
+void Session::Adopt(const Session &other)
+{
+    large = other.large;                                            //Broadcasts are never sequenced
+    check = other.check;
+    decoder.SetCheck(check);
+    cobs = other.cobs;
+    decoder.SetCobs(cobs);
+    autoErase = other.autoErase;
+    batch = other.batch;
+    aes = other.aes;
+    sign = other.sign;
+    maxData = other.maxData;
+}
+
+Bytes Session::Command(uint8_t command, unsigned length, uint32_t addr) const
+{
+    Bytes payload;
+
+    payload.push_back(command);
+    payload.push_back((uint8_t)length);
+    if(large) {
+        payload.push_back((uint8_t)(length >> 8));
+    }
+    payload.push_back((uint8_t)addr);
+    payload.push_back((uint8_t)(addr >> 8));
+    payload.push_back((uint8_t)(addr >> 16));
+    return payload;
+}
+
+Bytes Session::Encode(const Bytes &payload, uint8_t seq) const
+{
+    Bytes wire;
+    Bytes body;
+
+    if(node >= 0) {
+        body.push_back((uint8_t)node);                              //Checked with the rest, before the command
+    }
+    body.insert(body.end(), payload.begin(), payload.end());
+    if(sequenced && payload[0] != SESSION) {
+        body.push_back(seq);                                        //After the data, before the checksum
+    }
+    if(cobs && payload[0] != SESSION) {
+        EncodeCobs(body, wire, check);
+    } else {
+        an851::Encode(body, wire, payload[0] != SESSION ? check : 1);
+    }
+    return wire;
+}
+
+void Session::Write(const Bytes &wire)
+{
+    size_t skip = stxSent && wire.size() > 1 && wire[1] != STX;   //A COBS frame opens on the STX that ended the last one
+
+    link.Write(wire.data() + skip, wire.size() - skip);
+    stxSent = wire.back() == STX;
+}
+
+void Session::Transmit(Pending &p)
+{
+    uint64_t now = NowUs();
+
+    Write(p.wire);
+    if(lineFreeUs < now) {
+        lineFreeUs = now;
+    }
+    lineFreeUs += p.wire.size() * 10000000ULL / baud;               //Behind whatever is still queued
+    p.sentUs = lineFreeUs;
+}
+
+void Session::Pause(uint64_t untilUs)
+{
+    uint64_t now;
+
+    while((now = NowUs()) < untilUs) {
+        link.Read(rxBuf, sizeof(rxBuf), (int)((untilUs - now + 999) / 1000));
+    }
+    rxPos = rxLen = 0;
+}
+
+bool Session::Receive(Bytes &reply, int waitMs)
+{
+    uint64_t until = NowUs() + (uint64_t)waitMs * 1000;
+    uint64_t now;
+
+    while(1) {
+        while(rxPos < rxLen) {
+            if(decoder.Put(rxBuf[rxPos++])) {
+                reply = decoder.Payload();
+                return true;
+            }
+        }
+        now = NowUs();
+        if(now >= until) {
+            return false;
+        }
+        rxLen = link.Read(rxBuf, sizeof(rxBuf), (int)((until - now + 999) / 1000));
+        rxPos = 0;
+    }
+}
+
+bool Session::Unwrap(const Bytes &raw, Bytes &reply, uint8_t &seq) const
+{
+    reply = raw;
+    seq = 0;
+    if(node >= 0) {
+        if(reply.empty() || reply[0] != (uint8_t)(node | NODE_REPLY)) {
+            return false;                                           //Another node's reply
+        }
+        reply.erase(reply.begin());
+    }
+    if(reply.empty()) {
+        return false;
+    }
+    if(large && reply.size() > 3 && reply[0] != SESSION) {
+        reply.erase(reply.begin() + 2);                             //PutResponse() puts it after the low length byte
+    }
+    if(sequenced && reply[0] != SESSION) {
+        if(reply.size() < 2) {
+            return false;
+        }
+        seq = reply.back();
+        reply.pop_back();
+    }
+    return true;
+}
+
+void Session::Acknowledge(const Bytes &raw)
+{
+    Bytes reply;
+    uint8_t seq;
+    size_t i;
+
+    if(!Unwrap(raw, reply, seq)) {
+        return;
+    }
+
+    if(!sequenced) {
+        if(inFlight.empty() || reply[0] != inFlight.front().command) {
+            return;                                                 //Late reply to a frame sent again
+        }
+        Done done = inFlight.front().done;
+        inFlight.pop_front();
+        done(reply);
+        return;
+    }
+
+    if(reply[0] == SEQ_NAK) {                                       //Everything before seq arrived, resend the rest
+        naks++;
+        while(!inFlight.empty() && (uint8_t)(inFlight.front().seq - seq) >= 0x80) {
+            Done done = inFlight.front().done;
+            inFlight.pop_front();
+            done(Bytes());
+        }
+        for(i = 0; i < inFlight.size(); i++) {
+            Transmit(inFlight[i]);
+            resends++;
+        }
+        return;
+    }
+
+    for(i = 0; i < inFlight.size() && inFlight[i].seq != seq; i++) {
+    }
+    if(i == inFlight.size() || inFlight[i].command != reply[0]) {
+        return;                                                     //Already acked
+    }
+    while(i--) {                                                    //Acks are cumulative
+        Done done = inFlight.front().done;
+        inFlight.pop_front();
+        done(Bytes());
+    }
+    Done done = inFlight.front().done;
+    inFlight.pop_front();
+    done(reply);
+}
+
+void Session::Wait()
+{
+    size_t before = inFlight.size();
+    Bytes reply;
+    int64_t left;
+    size_t i;
+
+    while(!inFlight.empty() && inFlight.size() >= before) {
+        Pending &oldest = inFlight.front();
+
+        left = oldest.timeoutMs - ((int64_t)NowUs() - (int64_t)oldest.sentUs) / 1000;
+        if(left > 0 && Receive(reply, (int)left)) {
+            Acknowledge(reply);
+            continue;
+        }
+        if(++oldest.tries > retries) {
+            char what[64];
+
+            snprintf(what, sizeof(what), "no reply to command 0x%02X after %d retries", oldest.command, retries);
+            throw std::runtime_error(what);
+        }
+        for(i = 0; i < inFlight.size(); i++) {                      //Go back to the oldest unanswered frame
+            Transmit(inFlight[i]);
+            resends++;
+        }
+    }
+}
+
+void Session::Queue(const Bytes &payload, int extraMs, Done done)
+{
+    Pending p;
+
+    p.wire = Encode(payload, nextSeq);                              //Encoded while the last frame is answered
+    p.command = payload[0];
+    p.seq = nextSeq;
+    p.timeoutMs = timeoutMs + extraMs;
+    p.tries = 0;
+    p.sentUs = 0;
+    p.done = done;
+    if(sequenced && payload[0] != SESSION) {
+        nextSeq++;
+    }
+
+    if(node == NODE_BROADCAST) {                                    //No reply, the nodes get extraMs to carry it out
+        Drain();
+        Transmit(p);
+        frames++;
+        Pause(p.sentUs + (uint64_t)extraMs * 1000);
+        done(Bytes());
+        return;
+    }
+    while(inFlight.size() >= window) {
+        Wait();
+    }
+    inFlight.push_back(p);
+    Transmit(inFlight.back());
+    frames++;
+}
+
+void Session::Drain()
+{
+    while(!inFlight.empty()) {
+        Wait();
+    }
+}
+
+Bytes Session::Transact(const Bytes &payload, int extraMs)
+{
+    Bytes result;
+
+    Queue(payload, extraMs, [&result](const Bytes &reply) { result = reply; });
+    Drain();
+    return result;
+}
+
+void Session::Send(const Bytes &payload)
+{
+    Bytes wire;
+
+    Drain();
+    wire = Encode(payload, nextSeq);
+    if(sequenced) {
+        nextSeq++;
+    }
+    Write(wire);
+    frames++;
+}
+
+//The sequence number is only used up once a frame came back, so a
+//request that was lost goes again as the same frame
+bool Session::Stream(const Bytes &payload, int extraMs, Take take)
+{
+    Bytes raw;
+    Bytes reply;
+    uint8_t seq;
+    bool any = false;
+
+    Drain();
+    Write(Encode(payload, nextSeq));
+    frames++;
+    while(Receive(raw, timeoutMs + extraMs)) {
+        if(!Unwrap(raw, reply, seq) || reply[0] != payload[0] || (sequenced && seq != nextSeq)) {
+            continue;                                               //Stray reply to something earlier
+        }
+        any = true;
+        if(!take(reply)) {
+            break;
+        }
+    }
+    if(any && sequenced) {
+        nextSeq++;
+    }
+    return any;
+}
+
+} //namespace an851
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Command exchange with the bootloader. Queue() encodes a frame and, once
+ * the window has room, sends it, so the next frame is encoded while the
+ * device works on the last one. With a SESSION window above 1 frames carry
+ * sequence numbers and the device acks cumulatively and NAKs a gap, see
+ * CheckSequence(); without one this is AN851 stop-and-wait. The SESSION
+ * may also swap the checksum for a frame CRC. Replies come back AN851
+ * shaped, sequence number, high length byte and checksum or CRC removed.
+ * On a multi-drop bus each node has its own Session; one for
+ * NODE_BROADCAST gets no replies, Queue() waits out extraMs instead.
+ * Stream() sends one request and takes the run of frames it brings back.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include "An851.h"
+#include "Link.h"
+
+namespace an851 {
+
+class Session {
+public:
+    typedef std::function<void(const Bytes &reply)> Done;          //Empty reply: acked by a later frame
+    typedef std::function<bool(const Bytes &frame)> Take;          //false once no more frames are wanted
+
+    //Timeouts run from when a frame should have left the line at baud
+    Session(Link &link, unsigned long baud, int timeoutMs, int retries);
+
+    //SESSION, stays stop-and-wait if unanswered; crc is 16, 32 or 0 bits
+    void Open(unsigned window, bool large, unsigned crc = 0, bool cobs = false, bool autoErase = false);
+    bool Opened() const { return opened; }                          //The device answered the SESSION
+    unsigned Window() const { return window; }
+    bool Large() const { return large; }
+    unsigned Crc() const { return check > 1 ? check * 8 : 0; }     //Frame CRC bits agreed, 0 for the checksum
+    bool Cobs() const { return cobs; }
+    bool AutoErase() const { return autoErase; }                    //WT_FLASH erases pages itself, no ER_FLASH needed
+    bool Batch() const { return batch; }                            //BATCH built in, as the SESSION reply said
+    bool Aes() const { return aes; }                                //USE_AES, every row written is decrypted first
+    bool Sign() const { return sign; }                              //USE_SIGN, VERIFY_OK commits only a signed image
+    size_t MaxData() const { return maxData; }                      //Data bytes per frame
+    unsigned long Baud() const { return baud; }
+    void SetNode(int node);                                         //Bus address of the device, -1 for a point to point link
+    int Node() const { return node; }
+    void Adopt(const Session &other);                               //Frame options another node agreed, for a broadcast Session
+
+    //Payload of a command, with the 16-bit length if large packets are on
+    Bytes Command(uint8_t command, unsigned length, uint32_t addr) const;
+
+    void Queue(const Bytes &payload, int extraMs, Done done);
+    void Drain();                                                   //Waits for every queued frame
+    Bytes Transact(const Bytes &payload, int extraMs = 0);
+    void Send(const Bytes &payload);                                //No reply expected, RESET
+    bool Stream(const Bytes &payload, int extraMs, Take take);      //Every frame to take until it returns false or
+                                                                    //none comes for the timeout plus extraMs; false
+                                                                    //if none came
+
+    unsigned Frames() const { return frames; }
+    unsigned Resends() const { return resends; }
+    unsigned Naks() const { return naks; }
+
+private:
+    struct Pending {
+        Bytes wire;
+        uint8_t command;
+        uint8_t seq;
+        int timeoutMs;
+        int tries;
+        uint64_t sentUs;                                            //Estimated end of transmission
+        Done done;
+    };
+
+    Bytes Encode(const Bytes &payload, uint8_t seq) const;
+    void Write(const Bytes &wire);
+    void Pause(uint64_t untilUs);                                   //Drops whatever arrives meanwhile
+    void Transmit(Pending &p);
+    bool Receive(Bytes &reply, int timeoutMs);
+    bool Unwrap(const Bytes &raw, Bytes &reply, uint8_t &seq) const; //AN851 shaped; false if another node's
+    void Acknowledge(const Bytes &reply);
+    void Wait();                                                    //Until the oldest frame is answered
+
+    Link &link;
+    unsigned long baud;
+    uint64_t lineFreeUs;                                            //When the last byte written is on its way
+    bool stxSent;                                                   //Last byte written was an STX
+    Decoder decoder;
+    std::deque<Pending> inFlight;
+    int timeoutMs;
+    int retries;
+    bool opened;
+    unsigned window;
+    bool sequenced;
+    bool large;
+    unsigned check;                                                 //Trailer bytes, 1 for the checksum
+    bool cobs;
+    bool autoErase;
+    bool batch;
+    bool aes;
+    bool sign;
+    size_t maxData;
+    int node;
+    uint8_t nextSeq;
+    unsigned frames;
+    unsigned resends;
+    unsigned naks;
+    uint8_t rxBuf[4096];
+    size_t rxPos;
+    size_t rxLen;
+};
+
+} //namespace an851
+
+#endif /*SESSION_H*/
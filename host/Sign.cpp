@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include "Crypt.h"
+#include "Sign.h"
+
+namespace an851 {
+
+#define SIGN_HEAD           4                                       //Magic
+
+//256-bit numbers, least significant word first. Nothing here is quick
+//or constant time: a multiply reduces a bit at a time, which is plenty
+//for signing an image now and then on a build machine
+struct Num {
+    uint32_t w[8];
+};
+
+struct Point {                                                      //Jacobian, z 0 for the point at infinity
+    Num x;
+    Num y;
+    Num z;
+};
+
+static const uint32_t sha256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static const Num curveP = {{0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF}};
+static const Num curveN = {{0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF}};
+static const Num one = {{1, 0, 0, 0, 0, 0, 0, 0}};
+static const Point curveG = {
+    {{0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81, 0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2}},
+    {{0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357, 0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2}},
+    {{1, 0, 0, 0, 0, 0, 0, 0}}
+};
+
+static uint32_t Ror(uint32_t x, int n)
+{
+    return x >> n | x << (32 - n);
+}
+
+Sha256::Sha256() :
+    state{0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19}, bytes(0)
+{
+}
+
+void Sha256::Compress(const uint8_t in[64])
+{
+    uint32_t w[64];
+    uint32_t v[8];
+    uint32_t t1;
+    uint32_t t2;
+    int i;
+
+    for(i = 0; i < 16; i++) {
+        w[i] = (uint32_t)in[4 * i] << 24 | in[4 * i + 1] << 16 | in[4 * i + 2] << 8 | in[4 * i + 3];
+    }
+    for(; i < 64; i++) {
+        w[i] = w[i - 16] + (Ror(w[i - 15], 7) ^ Ror(w[i - 15], 18) ^ w[i - 15] >> 3) + w[i - 7] +
+               (Ror(w[i - 2], 17) ^ Ror(w[i - 2], 19) ^ w[i - 2] >> 10);
+    }
+    memcpy(v, state, sizeof(v));
+    for(i = 0; i < 64; i++) {
+        t1 = v[7] + (Ror(v[4], 6) ^ Ror(v[4], 11) ^ Ror(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256K[i] + w[i];
+        t2 = (Ror(v[0], 2) ^ Ror(v[0], 13) ^ Ror(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for(i = 0; i < 8; i++) {
+        state[i] += v[i];
+    }
+}
+
+void Sha256::Update(const uint8_t *data, size_t size)
+{
+    while(size--) {
+        block[bytes++ % 64] = *data++;
+        if(bytes % 64 == 0) {
+            Compress(block);
+        }
+    }
+}
+
+void Sha256::Final(uint8_t digest[SHA256_SIZE])
+{
+    uint64_t bits = bytes * 8;
+    uint8_t pad = 0x80;
+    int i;
+
+    Update(&pad, 1);
+    pad = 0;
+    while(bytes % 64 != 56) {
+        Update(&pad, 1);
+    }
+    for(i = 0; i < 8; i++) {
+        pad = (uint8_t)(bits >> (56 - 8 * i));
+        Update(&pad, 1);
+    }
+    for(i = 0; i < (int)SHA256_SIZE; i++) {
+        digest[i] = (uint8_t)(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    *this = Sha256();
+}
+
+//HMAC-SHA256 with a 32 byte key; mac may be key
+static void Hmac(const uint8_t key[SHA256_SIZE], const Bytes &message, uint8_t mac[SHA256_SIZE])
+{
+    uint8_t inner[64];
+    uint8_t outer[64];
+    Sha256 sha;
+
+    for(unsigned i = 0; i < 64; i++) {
+        inner[i] = (uint8_t)((i < SHA256_SIZE ? key[i] : 0) ^ 0x36);
+        outer[i] = (uint8_t)((i < SHA256_SIZE ? key[i] : 0) ^ 0x5C);
+    }
+    sha.Update(inner, sizeof(inner));
+    sha.Update(message.data(), message.size());
+    sha.Final(mac);
+    sha.Update(outer, sizeof(outer));
+    sha.Update(mac, SHA256_SIZE);
+    sha.Final(mac);
+}
+
+static Num Load(const uint8_t bytes[32])                            //Big endian
+{
+    Num a;
+
+    for(int i = 0; i < 8; i++) {
+        a.w[7 - i] = (uint32_t)bytes[4 * i] << 24 | bytes[4 * i + 1] << 16 | bytes[4 * i + 2] << 8 | bytes[4 * i + 3];
+    }
+    return a;
+}
+
+static void Store(const Num &a, uint8_t bytes[32])
+{
+    for(int i = 0; i < 32; i++) {
+        bytes[i] = (uint8_t)(a.w[7 - i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static bool IsZero(const Num &a)
+{
+    uint32_t any = 0;
+
+    for(uint32_t w : a.w) {
+        any |= w;
+    }
+    return any == 0;
+}
+
+static int Compare(const Num &a, const Num &b)
+{
+    for(int i = 7; i >= 0; i--) {
+        if(a.w[i] != b.w[i]) {
+            return a.w[i] < b.w[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t AddTo(Num &a, const Num &b)                         //Returns the carry
+{
+    uint64_t t = 0;
+
+    for(int i = 0; i < 8; i++) {
+        t += (uint64_t)a.w[i] + b.w[i];
+        a.w[i] = (uint32_t)t;
+        t >>= 32;
+    }
+    return (uint32_t)t;
+}
+
+static uint32_t SubFrom(Num &a, const Num &b)                       //Returns the borrow
+{
+    uint32_t borrow = 0;
+
+    for(int i = 0; i < 8; i++) {
+        uint64_t t = (uint64_t)a.w[i] - b.w[i] - borrow;
+
+        a.w[i] = (uint32_t)t;
+        borrow = (uint32_t)(t >> 32) & 1;
+    }
+    return borrow;
+}
+
+//The rest take and give numbers below m
+static Num AddMod(Num a, const Num &b, const Num &m)
+{
+    if(AddTo(a, b) || Compare(a, m) >= 0) {
+        SubFrom(a, m);
+    }
+    return a;
+}
+
+static Num SubMod(Num a, const Num &b, const Num &m)
+{
+    if(SubFrom(a, b)) {
+        AddTo(a, m);
+    }
+    return a;
+}
+
+//Any a and b, the product reduced a bit at a time from the top
+static Num MulMod(const Num &a, const Num &b, const Num &m)
+{
+    uint32_t product[16] = {0};
+    Num r = {{0}};
+    uint32_t top;
+    int i;
+    int j;
+
+    for(i = 0; i < 8; i++) {
+        uint64_t carry = 0;
+
+        for(j = 0; j < 8; j++) {
+            carry += (uint64_t)a.w[i] * b.w[j] + product[i + j];
+            product[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        product[i + 8] = (uint32_t)carry;
+    }
+    for(i = 511; i >= 0; i--) {
+        top = r.w[7] >> 31;
+        for(j = 7; j > 0; j--) {
+            r.w[j] = r.w[j] << 1 | r.w[j - 1] >> 31;
+        }
+        r.w[0] = r.w[0] << 1 | (product[i / 32] >> i % 32 & 1);
+        if(top || Compare(r, m) >= 0) {
+            SubFrom(r, m);                                          //Wraps back below 2^256 when top was set
+        }
+    }
+    return r;
+}
+
+static Num Invert(const Num &a, const Num &m)                       //m prime, a^(m-2)
+{
+    Num e = m;
+    Num two = {{2, 0, 0, 0, 0, 0, 0, 0}};
+    Num r = one;
+
+    SubFrom(e, two);
+    for(int i = 255; i >= 0; i--) {
+        r = MulMod(r, r, m);
+        if(e.w[i / 32] >> i % 32 & 1) {
+            r = MulMod(r, a, m);
+        }
+    }
+    return r;
+}
+
+static Point Double(const Point &a)                                 //Curve a = -3
+{
+    const Num &p = curveP;
+    Point r;
+    Num delta;
+    Num gamma;
+    Num beta;
+    Num alpha;
+    Num t;
+
+    if(IsZero(a.z)) {
+        return a;
+    }
+    delta = MulMod(a.z, a.z, p);
+    gamma = MulMod(a.y, a.y, p);
+    beta = MulMod(a.x, gamma, p);
+    alpha = MulMod(SubMod(a.x, delta, p), AddMod(a.x, delta, p), p);
+    alpha = AddMod(alpha, AddMod(alpha, alpha, p), p);
+    t = AddMod(beta, beta, p);
+    t = AddMod(t, t, p);                                            //4 beta
+    r.x = SubMod(MulMod(alpha, alpha, p), AddMod(t, t, p), p);
+    t = AddMod(a.y, a.z, p);
+    r.z = SubMod(SubMod(MulMod(t, t, p), gamma, p), delta, p);
+    gamma = MulMod(gamma, gamma, p);
+    gamma = AddMod(gamma, gamma, p);
+    gamma = AddMod(gamma, gamma, p);
+    gamma = AddMod(gamma, gamma, p);                                //8 gamma^2
+    t = AddMod(beta, beta, p);
+    t = AddMod(t, t, p);
+    r.y = SubMod(MulMod(alpha, SubMod(t, r.x, p), p), gamma, p);
+    return r;
+}
+
+static Point Add(const Point &a, const Point &b)
+{
+    const Num &p = curveP;
+    Point r;
+    Num za2;
+    Num zb2;
+    Num u1;
+    Num s1;
+    Num h;
+    Num rr;
+    Num h2;
+    Num h3;
+
+    if(IsZero(a.z)) {
+        return b;
+    }
+    if(IsZero(b.z)) {
+        return a;
+    }
+    za2 = MulMod(a.z, a.z, p);
+    zb2 = MulMod(b.z, b.z, p);
+    u1 = MulMod(a.x, zb2, p);
+    s1 = MulMod(a.y, MulMod(zb2, b.z, p), p);
+    h = SubMod(MulMod(b.x, za2, p), u1, p);
+    rr = SubMod(MulMod(b.y, MulMod(za2, a.z, p), p), s1, p);
+    if(IsZero(h)) {
+        if(IsZero(rr)) {
+            return Double(a);
+        }
+        r.z = Num{{0}};                                             //b is -a
+        return r;
+    }
+    h2 = MulMod(h, h, p);
+    h3 = MulMod(h2, h, p);
+    u1 = MulMod(u1, h2, p);
+    r.x = SubMod(SubMod(MulMod(rr, rr, p), h3, p), AddMod(u1, u1, p), p);
+    r.y = SubMod(MulMod(rr, SubMod(u1, r.x, p), p), MulMod(s1, h3, p), p);
+    r.z = MulMod(MulMod(h, a.z, p), b.z, p);
+    return r;
+}
+
+static Point Mul(const Num &k, const Point &a)
+{
+    Point r = {{{0}}, {{0}}, {{0}}};
+
+    for(int i = 255; i >= 0; i--) {
+        r = Double(r);
+        if(k.w[i / 32] >> i % 32 & 1) {
+            r = Add(r, a);
+        }
+    }
+    return r;
+}
+
+static void Affine(const Point &a, Num &x, Num &y)
+{
+    Num zi = Invert(a.z, curveP);
+    Num zi2 = MulMod(zi, zi, curveP);
+
+    x = MulMod(a.x, zi2, curveP);
+    y = MulMod(a.y, MulMod(zi2, zi, curveP), curveP);
+}
+
+static Num PrivateKey(const uint8_t key[SIGN_KEY_SIZE])
+{
+    Num d = Load(key);
+
+    if(IsZero(d) || Compare(d, curveN) >= 0) {
+        throw std::runtime_error("private key out of range, it has to be 1 to n-1");
+    }
+    return d;
+}
+
+void EcdsaPublic(const uint8_t key[SIGN_KEY_SIZE], uint8_t pub[SIGN_PUBLIC_SIZE])
+{
+    Num x;
+    Num y;
+
+    Affine(Mul(PrivateKey(key), curveG), x, y);
+    Store(x, pub);
+    Store(y, pub + 32);
+}
+
+//RFC 6979 3.2, the nonce from HMAC-SHA256 keyed with the private key
+//and the hash; a candidate out of range or giving r or s of 0 is
+//followed by the next
+void EcdsaSign(const uint8_t key[SIGN_KEY_SIZE], const uint8_t hash[SHA256_SIZE], uint8_t sig[SIGN_SIZE])
+{
+    Num d = PrivateKey(key);
+    Num e = MulMod(Load(hash), one, curveN);
+    uint8_t seed[64];
+    uint8_t v[SHA256_SIZE];
+    uint8_t k[SHA256_SIZE];
+    Bytes m;
+
+    Store(d, seed);
+    Store(e, seed + 32);
+    memset(v, 0x01, sizeof(v));
+    memset(k, 0x00, sizeof(k));
+    for(uint8_t step = 0; step < 2; step++) {
+        m.assign(v, v + sizeof(v));
+        m.push_back(step);
+        m.insert(m.end(), seed, seed + sizeof(seed));
+        Hmac(k, m, k);
+        Hmac(k, Bytes(v, v + sizeof(v)), v);
+    }
+    for(;;) {
+        Hmac(k, Bytes(v, v + sizeof(v)), v);
+        Num n = Load(v);
+
+        if(!IsZero(n) && Compare(n, curveN) < 0) {
+            Num x;
+            Num y;
+            Num r;
+            Num s;
+
+            Affine(Mul(n, curveG), x, y);
+            r = MulMod(x, one, curveN);
+            s = MulMod(Invert(n, curveN), AddMod(e, MulMod(r, d, curveN), curveN), curveN);
+            if(!IsZero(r) && !IsZero(s)) {
+                Store(r, sig);
+                Store(s, sig + 32);
+                return;
+            }
+        }
+        m.assign(v, v + sizeof(v));
+        m.push_back(0);
+        Hmac(k, m, k);
+        Hmac(k, Bytes(v, v + sizeof(v)), v);
+    }
+}
+
+bool EcdsaVerify(const uint8_t pub[SIGN_PUBLIC_SIZE], const uint8_t hash[SHA256_SIZE], const uint8_t sig[SIGN_SIZE])
+{
+    Num r = Load(sig);
+    Num s = Load(sig + 32);
+    Point q = {Load(pub), Load(pub + 32), one};
+    Num w;
+    Num x;
+    Num y;
+    Point sum;
+
+    if(IsZero(r) || IsZero(s) || Compare(r, curveN) >= 0 || Compare(s, curveN) >= 0 ||
+       Compare(q.x, curveP) >= 0 || Compare(q.y, curveP) >= 0) {
+        return false;
+    }
+    w = Invert(s, curveN);
+    sum = Add(Mul(MulMod(MulMod(Load(hash), one, curveN), w, curveN), curveG), Mul(MulMod(r, w, curveN), q));
+    if(IsZero(sum.z)) {
+        return false;
+    }
+    Affine(sum, x, y);
+    return Compare(MulMod(x, one, curveN), r) == 0;
+}
+
+void ImageDigest(const HexImage &image, uint8_t hash[SHA256_SIZE])
+{
+    Sha256 sha;
+
+    for(const auto &row : image.Rows()) {
+        uint8_t addr[3] = {(uint8_t)row.first, (uint8_t)(row.first >> 8), (uint8_t)(row.first >> 16)};
+
+        sha.Update(addr, sizeof(addr));
+        for(size_t i = 0; i < row.second.size(); i += 4) {
+            sha.Update(&row.second[i], 3);                          //Phantom byte left out
+        }
+    }
+    sha.Final(hash);
+}
+
+size_t SignatureRows(unsigned rowInstructions)
+{
+    return (SIGN_HEAD + SIGN_SIZE + rowInstructions * 3 - 1) / (rowInstructions * 3);
+}
+
+void WriteSignature(HexImage &image, uint32_t at, const uint8_t sig[SIGN_SIZE])
+{
+    Bytes out;
+    size_t i;
+
+    for(i = 0; i < 4; i++) {
+        out.push_back((uint8_t)(SIGNATURE_MAGIC >> 8 * i));
+    }
+    out.insert(out.end(), sig, sig + SIGN_SIZE);
+    for(i = 0; i < out.size() || i % (image.RowInstructions() * 3); i++) {
+        *Packed(image, at, i) = i < out.size() ? out[i] : 0;        //The rest of the last row 0
+        if(i % 3 == 2) {
+            Packed(image, at, i)[1] = 0;                            //Phantom byte, as a linker writes it
+        }
+    }
+}
+
+bool ReadSignature(const HexImage &image, uint32_t at, uint8_t sig[SIGN_SIZE])
+{
+    HexImage copy(image.RowInstructions());                         //Packed() adds rows, keep them out of image
+    Bytes in;
+    size_t i;
+
+    for(i = 0; i < SignatureRows(image.RowInstructions()); i++) {
+        uint32_t a = at + (uint32_t)i * image.RowSpan();
+
+        if(!image.Rows().count(a)) {
+            return false;
+        }
+        copy.Row(a) = image.Rows().at(a);
+    }
+    for(i = 0; i < SIGN_HEAD + SIGN_SIZE; i++) {
+        in.push_back(*Packed(copy, at, i));
+    }
+    if((uint32_t)(in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24) != SIGNATURE_MAGIC) {
+        return false;
+    }
+    memcpy(sig, &in[SIGN_HEAD], SIGN_SIZE);
+    return true;
+}
+
+} //namespace an851
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ECDSA P-256 over SHA-256 for images going to a USE_SIGN bootloader,
+ * the signature Sign.c checks at VERIFY_OK. The message is the rows as
+ * WritePM takes them: for each row, in ascending address order, its PC
+ * address 3 bytes low byte first, then its instructions packed 3 bytes
+ * each, phantom bytes left out. an851flash sends rows in that order once
+ * boot and config rows are dropped and page 0 is filled out, so
+ * ImageDigest() has to see the image after the same steps. Nonces are
+ * RFC 6979's, worked out from the key and the hash, so signing needs no
+ * random source and an image signs the same way every time.
+ *
+ * The signature, r then s big endian, is written packed behind a magic
+ * into the last bootloader row, SignatureRows() of them for short rows,
+ * which a flash tool drops unsent; an AES manifest from BOOT_ADDR_LOW up
+ * fits beside it.
+ */
+
+#ifndef SIGN_H
+#define SIGN_H
+
+#include <cstddef>
+#include <cstdint>
+#include "HexImage.h"
+
+namespace an851 {
+
+const unsigned SHA256_SIZE = 32;
+const unsigned SIGN_KEY_SIZE = 32;                                  //Private key, big endian
+const unsigned SIGN_PUBLIC_SIZE = 64;                               //x then y, big endian, as SIGN_PUBLIC_KEY holds it
+const unsigned SIGN_SIZE = 64;                                      //r then s, big endian
+const uint32_t SIGNATURE_MAGIC = 0x4E474953;                        //"SIGN", the first packed bytes
+
+class Sha256 {
+public:
+    Sha256();
+    void Update(const uint8_t *data, size_t size);
+    void Final(uint8_t digest[SHA256_SIZE]);                        //Starts over afterwards
+
+private:
+    void Compress(const uint8_t block[64]);
+
+    uint32_t state[8];
+    uint64_t bytes;
+    uint8_t block[64];
+};
+
+//Each throws std::runtime_error for a private key of 0 or not below n
+void EcdsaPublic(const uint8_t key[SIGN_KEY_SIZE], uint8_t pub[SIGN_PUBLIC_SIZE]);
+void EcdsaSign(const uint8_t key[SIGN_KEY_SIZE], const uint8_t hash[SHA256_SIZE], uint8_t sig[SIGN_SIZE]);
+bool EcdsaVerify(const uint8_t pub[SIGN_PUBLIC_SIZE], const uint8_t hash[SHA256_SIZE], const uint8_t sig[SIGN_SIZE]);
+
+void ImageDigest(const HexImage &image, uint8_t hash[SHA256_SIZE]); //Every row of image, as WritePM hashes them
+size_t SignatureRows(unsigned rowInstructions);
+void WriteSignature(HexImage &image, uint32_t at, const uint8_t sig[SIGN_SIZE]);
+bool ReadSignature(const HexImage &image, uint32_t at, uint8_t sig[SIGN_SIZE]); //false if no signature at at
+
+} //namespace an851
+
+#endif /*SIGN_H*/
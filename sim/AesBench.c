@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Known answer tests and timing of the firmware's Aes.c, built for the
+ * host with USE_AES and the SP 800-38A key in place of AES_KEY. The
+ * vectors are FIPS-197 appendix B (the cipher), SP 800-38A F.1.1
+ * (ECB-AES128, four blocks) and F.5.1 (CTR-AES128, four blocks, its
+ * counter blocks as given). AesCtrRow is then checked against a CTR made
+ * here from AesEncrypt over the image packed 3 bytes per instruction: a
+ * row on its own, rows in address order with AesPrefetch run part way
+ * between them as PrefetchWriteMem would, a nonce changed after a prefetch,
+ * and a row decrypted back to what it was.
+ *
+ * usage: aesbench
+ *
+ * Times are host ns per block, which tracks changes to the C but is not
+ * the PIC24's cycle count; on the device USE_STATS counts those. The
+ * budget is exact: the cycles per block a row write hides, which is what
+ * AesPrefetch may take with nothing on the write path, and the cycles per
+ * block a row's time on the line leaves at each SET_BAUD rate, all of it
+ * where the CPU runs through the write and what is left after the write
+ * where it stalls. Exits 1 if any check fails.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Sim.h"
+#include "BootLoader.h"
+#include "Aes.h"
+
+#define BENCH_MIN_NS        200000000ULL                            //Time each case for at least this long
+#define BENCH_ROWS          32                                      //Rows in the in order check
+#define BENCH_ROW_ADDR      0x4000
+
+static int failures;
+
+static const BYTE fipsPlain[16] = {                                 //FIPS-197 appendix B
+    0x32, 0x43, 0xF6, 0xA8, 0x88, 0x5A, 0x30, 0x8D, 0x31, 0x31, 0x98, 0xA2, 0xE0, 0x37, 0x07, 0x34
+};
+static const BYTE fipsCipher[16] = {
+    0x39, 0x25, 0x84, 0x1D, 0x02, 0xDC, 0x09, 0xFB, 0xDC, 0x11, 0x85, 0x97, 0x19, 0x6A, 0x0B, 0x32
+};
+static const BYTE spPlain[4][16] = {                                //SP 800-38A F.1 and F.5, the same four blocks
+    {0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A},
+    {0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51},
+    {0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF},
+    {0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10}
+};
+static const BYTE spEcb[4][16] = {                                  //F.1.1 ECB-AES128.Encrypt
+    {0x3A, 0xD7, 0x7B, 0xB4, 0x0D, 0x7A, 0x36, 0x60, 0xA8, 0x9E, 0xCA, 0xF3, 0x24, 0x66, 0xEF, 0x97},
+    {0xF5, 0xD3, 0xD5, 0x85, 0x03, 0xB9, 0x69, 0x9D, 0xE7, 0x85, 0x89, 0x5A, 0x96, 0xFD, 0xBA, 0xAF},
+    {0x43, 0xB1, 0xCD, 0x7F, 0x59, 0x8E, 0xCE, 0x23, 0x88, 0x1B, 0x00, 0xE3, 0xED, 0x03, 0x06, 0x88},
+    {0x7B, 0x0C, 0x78, 0x5E, 0x27, 0xE8, 0xAD, 0x3F, 0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5D, 0xD4}
+};
+static const BYTE spCtr[4][16] = {                                  //F.5.1 CTR-AES128.Encrypt
+    {0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE},
+    {0x98, 0x06, 0xF6, 0x6B, 0x79, 0x70, 0xFD, 0xFF, 0x86, 0x17, 0x18, 0x7B, 0xB9, 0xFF, 0xFD, 0xFF},
+    {0x5A, 0xE4, 0xDF, 0x3E, 0xDB, 0xD5, 0xD3, 0x5E, 0x5B, 0x4F, 0x09, 0x02, 0x0D, 0xB0, 0x3E, 0xAB},
+    {0x1E, 0x03, 0x1D, 0xDA, 0x2F, 0xBE, 0x03, 0xD1, 0x79, 0x21, 0x70, 0xA0, 0xF3, 0x00, 0x9C, 0xEE}
+};
+static const BYTE spCounter[16] = {                                 //F.5.1 initial counter block, incremented by one
+    0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+static void Check(const char *what, int ok, const char *detail)
+{
+    printf("  check   %-28s %s%s\n", what, ok ? "OK" : "FAILED", detail);
+    failures += !ok;
+}
+
+static uint64_t BenchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//The row CTR written out the long way: counter block n is the nonce, then
+//n big endian, and covers packed bytes 16n to 16n+15
+static void RefCtrRow(BYTE *row, DWORD addr, const BYTE *nonce)
+{
+    BYTE block[AES_BLOCK_SIZE];
+    DWORD packed = addr / 2 * 3;
+    DWORD n = 0xFFFFFFFF;
+    int i;
+
+    for(i = 0; i < PM_ROW_SIZE; i++) {
+        if(i % 4 == 3) {
+            continue;
+        }
+        if(packed / AES_BLOCK_SIZE != n) {
+            n = packed / AES_BLOCK_SIZE;
+            memcpy(block, nonce, AES_NONCE_SIZE);
+            memset(block + AES_NONCE_SIZE, 0, AES_BLOCK_SIZE - AES_NONCE_SIZE);
+            block[12] = (BYTE)(n >> 24);
+            block[13] = (BYTE)(n >> 16);
+            block[14] = (BYTE)(n >> 8);
+            block[15] = (BYTE)n;
+            AesEncrypt(block);
+        }
+        row[i] ^= block[packed % AES_BLOCK_SIZE];
+        packed++;
+    }
+}
+
+static void FillRow(BYTE *row, int seed)
+{
+    int i;
+
+    for(i = 0; i < PM_ROW_SIZE; i++) {
+        row[i] = (i % 4 == 3) ? 0x00 : (BYTE)(i * 7 + seed * 31);
+    }
+}
+
+static void KnownAnswers(void)
+{
+    BYTE block[AES_BLOCK_SIZE];
+    BYTE counter[AES_BLOCK_SIZE];
+    int ok;
+    int i;
+    int j;
+
+    memcpy(block, fipsPlain, sizeof(block));
+    AesEncrypt(block);
+    Check("FIPS-197 B", !memcmp(block, fipsCipher, sizeof(block)), "");
+
+    for(ok = 1, i = 0; i < 4; i++) {
+        memcpy(block, spPlain[i], sizeof(block));
+        AesEncrypt(block);
+        ok &= !memcmp(block, spEcb[i], sizeof(block));
+    }
+    Check("SP 800-38A F.1.1 ECB", ok, ", 4 blocks");
+
+    memcpy(counter, spCounter, sizeof(counter));
+    for(ok = 1, i = 0; i < 4; i++) {
+        memcpy(block, counter, sizeof(block));
+        AesEncrypt(block);
+        for(j = 0; j < AES_BLOCK_SIZE; j++) {
+            block[j] ^= spPlain[i][j];
+        }
+        ok &= !memcmp(block, spCtr[i], sizeof(block));
+        for(j = AES_BLOCK_SIZE - 1; j >= 0 && ++counter[j] == 0; j--) {
+        }
+    }
+    Check("SP 800-38A F.5.1 CTR", ok, ", 4 blocks");
+}
+
+static void Rows(void)
+{
+    static BYTE nonce[AES_NONCE_SIZE] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF};
+    static BYTE other[AES_NONCE_SIZE] = {0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10};
+    BYTE row[PM_ROW_SIZE];
+    BYTE ref[PM_ROW_SIZE];
+    int ok;
+    int r;
+    int k;
+
+    AesSetNonce(nonce);
+    FillRow(row, 1);
+    memcpy(ref, row, sizeof(row));
+    AesCtrRow(row, BENCH_ROW_ADDR);
+    RefCtrRow(ref, BENCH_ROW_ADDR, nonce);
+    Check("row on its own", !memcmp(row, ref, sizeof(row)), "");
+
+    for(ok = 1, r = 0; r < BENCH_ROWS; r++) {                       //Follows the row above
+        for(k = 0; k < r % (AES_ROW_BLOCKS + 2); k++) {             //None, some or all of it made ahead
+            AesPrefetch();
+        }
+        FillRow(row, r);
+        memcpy(ref, row, sizeof(row));
+        AesCtrRow(row, BENCH_ROW_ADDR + (DWORD)(r + 1) * (PM_ROW_SIZE/2));
+        RefCtrRow(ref, BENCH_ROW_ADDR + (DWORD)(r + 1) * (PM_ROW_SIZE/2), nonce);
+        ok &= !memcmp(row, ref, sizeof(row));
+    }
+    Check("rows in order, prefetched", ok, "");
+
+    AesPrefetch();
+    AesPrefetch();
+    AesSetNonce(other);
+    FillRow(row, 2);
+    memcpy(ref, row, sizeof(row));
+    AesCtrRow(row, BENCH_ROW_ADDR + (DWORD)(BENCH_ROWS + 1) * (PM_ROW_SIZE/2));
+    RefCtrRow(ref, BENCH_ROW_ADDR + (DWORD)(BENCH_ROWS + 1) * (PM_ROW_SIZE/2), other);
+    Check("nonce set after a prefetch", !memcmp(row, ref, sizeof(row)), "");
+
+    FillRow(ref, 3);
+    memcpy(row, ref, sizeof(row));
+    AesCtrRow(row, 0);
+    ok = memcmp(row, ref, sizeof(row)) != 0;
+    AesCtrRow(row, 0);
+    Check("row there and back", ok && !memcmp(row, ref, sizeof(row)), "");
+}
+
+static void Times(void)
+{
+    BYTE block[AES_BLOCK_SIZE] = {0};
+    BYTE row[PM_ROW_SIZE];
+    uint64_t start = BenchNowNs();
+    uint64_t t;
+    long n;
+    long i;
+
+    for(n = 0; BenchNowNs() - start < BENCH_MIN_NS; n += 1000) {
+        for(i = 0; i < 1000; i++) {
+            AesEncrypt(block);
+        }
+    }
+    t = BenchNowNs() - start;
+    printf("  time    AesEncrypt                   %.1f ns per block on this host\n", (double)t / n);
+
+    FillRow(row, 4);
+    start = BenchNowNs();
+    for(n = 0; BenchNowNs() - start < BENCH_MIN_NS; n += 100) {
+        for(i = 0; i < 100; i++) {
+            AesCtrRow(row, BENCH_ROW_ADDR);                         //The same row, so nothing made ahead counts
+        }
+    }
+    t = BenchNowNs() - start;
+    printf("  time    AesCtrRow                    %.1f ns per row, %.1f ns per block\n", (double)t / n,
+            (double)t / n / AES_ROW_BLOCKS);
+}
+
+static void Budget(void)
+{
+    static const DWORD rates[] = {
+#ifdef USE_BAUD_SWITCH
+        BAUD_SWITCH_1, BAUD_SWITCH_2, BAUD_SWITCH_3, BAUD_SWITCH_4
+#else
+        BAUDRATE
+#endif
+    };
+    double rowUs;
+    double left;
+    size_t i;
+
+    printf("  budget  a row write of %u us hides %.0f cycles per block of the next row's keystream\n",
+            SIM_ROW_WRITE_US, (double)FCY * SIM_ROW_WRITE_US / 1e6 / AES_ROW_BLOCKS);
+    for(i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        rowUs = PM_ROW_SIZE * 10.0 * 1e6 / rates[i];               //Data bytes alone, 8N1
+        left = rowUs > SIM_ROW_WRITE_US ? rowUs - SIM_ROW_WRITE_US : 0;
+        printf("          %7lu baud: a row is %6.0f us on the line, %6.0f cycles per block, %6.0f after the write\n",
+                (unsigned long)rates[i], rowUs, (double)FCY * rowUs / 1e6 / AES_ROW_BLOCKS,
+                (double)FCY * left / 1e6 / AES_ROW_BLOCKS);
+    }
+}
+
+int main(void)
+{
+    printf("aesbench: AES-128 CTR, %d blocks per %d byte row, FCY %lu\n", AES_ROW_BLOCKS, PM_ROW_SIZE,
+            (unsigned long)FCY);
+    AesInit();
+    KnownAnswers();
+    Rows();
+    Times();
+    Budget();
+    if(failures) {
+        printf("aesbench: %d checks FAILED\n", failures);
+        return 1;
+    }
+    return 0;
+}
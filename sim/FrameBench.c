@@ -0,0 +1,638 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmark of the framing hot path: GetCommand() unstuffing and
+ * checksumming a WT_FLASH frame, PutResponse() stuffing an RD_FLASH
+ * reply. Both are the firmware's own code, run over memory buffers in
+ * place of a transport, on synthetic row images from plain code to
+ * frames made only of STX, ETX and DLE. With USE_COBS every case is run
+ * again COBS framed, named IMAGE.cobs, the bytes its code bytes add
+ * counted as escapes. The wr cases time WritePM() on the rows of a
+ * received frame with the NVM stall set to 0: app rows at 0x4000, and
+ * page0 rows from 0 through the reset vector, the AIVT and the
+ * bootloader.
+ *
+ * usage: framebench [--check FILE] [--write FILE] [--tolerance PCT]
+ *
+ * The Makefile builds the firmware sources with -fsanitize-coverage=
+ * trace-pc, so every basic block they enter calls
+ * __sanitizer_cov_trace_pc() below. Blocks per flash data byte are the
+ * same on every run for a given compiler and flags, and move with the
+ * firmware's C as an instruction count would, though they are not the
+ * PIC24's cycles. Host ns per data byte are printed beside them, timing
+ * only. The wire side is exact: bytes per frame, escapes, and the
+ * frames per second a 1 Mbaud line can carry. --write records a
+ * baseline. --check fails if the wire bytes of a case changed, or if
+ * it takes more than PCT (default 2) percent more blocks than the
+ * baseline; the ns are never checked, they vary with the machine and
+ * its load.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Sim.h"
+#include "BootLoader.h"
+#include "Transport.h"
+
+#define BENCH_STREAM_BYTES  (16 * 1024)                            //Frames per pass fill about this much
+#define BENCH_MIN_NS        200000000ULL                            //Time each case for at least this long
+#define BENCH_MIN_PASSES    5
+#define BENCH_LINE_BAUD     1000000UL
+#define BENCH_MAX_CASES     64
+
+extern BYTE buffer[];                                               //BootLoader.c state the benchmark drives
+extern WORD rxBlockPos;
+extern WORD rxBlockLen;
+#ifdef USE_LARGE_PACKETS
+extern BYTE largePackets;
+extern BYTE lengthHi;
+#endif
+#ifdef USE_RUNAWAY_PROTECT
+extern volatile WORD writeKey1;
+extern volatile WORD writeKey2;
+#endif
+#ifdef USE_COBS
+extern BYTE cobsFraming;
+extern BYTE cobsFrame;
+extern BYTE cobsOpen;
+extern BYTE cobsSent;
+#endif
+
+typedef struct {
+    const char *name;
+    BYTE (*fill)(int i);                                            //Byte i of the image
+} BenchImage;
+
+typedef struct {
+    char name[16];
+    char dir[4];
+    int data;
+    int wire;
+    double blocks;                                                  //Firmware basic blocks per data byte
+    double ns;
+} BenchResult;
+
+static const BYTE *rxStream;                                        //Memory transport
+static size_t rxLen;
+static size_t rxPos;
+static uint64_t txBytes;
+static uint64_t benchBlocks;
+
+static BenchResult results[BENCH_MAX_CASES];
+static int resultCount;
+
+//Images ***************************************************************************
+static BYTE FillZero(int i)
+{
+    (void)i;
+    return 0x00;
+}
+
+static BYTE FillErased(int i)
+{
+    return (i % 4 == 3) ? 0x00 : 0xFF;                              //Phantom byte is sent as 0
+}
+
+static BYTE FillRandom(int i)
+{
+    return (i % 4 == 3) ? 0x00 : (BYTE)rand();
+}
+
+static BYTE FillStx(int i)
+{
+    (void)i;
+    return STX;
+}
+
+static BYTE FillEtx(int i)
+{
+    (void)i;
+    return ETX;
+}
+
+static BYTE FillDle(int i)
+{
+    (void)i;
+    return DLE;
+}
+
+static BYTE FillMixed(int i)
+{
+    static const BYTE ctrl[3] = {STX, ETX, DLE};
+
+    return ctrl[i % 3];
+}
+
+static const BenchImage images[] = {
+    {"zero", FillZero},
+    {"erased", FillErased},
+    {"random", FillRandom},
+    {"stx", FillStx},
+    {"etx", FillEtx},
+    {"dle", FillDle},
+    {"mixed", FillMixed},
+};
+
+//Transport ************************************************************************
+void TransportInit(void)
+{
+}
+
+WORD TransportRead(BYTE *data, WORD length)
+{
+    if(length > rxLen - rxPos) {
+        length = (WORD)(rxLen - rxPos);
+    }
+    memcpy(data, rxStream + rxPos, length);
+    rxPos += length;
+    return length;
+}
+
+void TransportWrite(BYTE *data, WORD length)
+{
+    (void)data;
+    txBytes += length;
+}
+
+void TransportFlush(void)
+{
+}
+
+void TransportClose(void)
+{
+}
+
+WORD TransportErrors(void)
+{
+    return 0;
+}
+
+BOOL TransportBreak(DWORD cycles)
+{
+    (void)cycles;
+    return FALSE;
+}
+
+void TransportDriver(BOOL on)
+{
+    (void)on;
+}
+
+//Simulator hooks, the simulated UART is not used ********************************
+void SimHostUpdate(uint64_t now)
+{
+    (void)now;
+}
+
+int SimHostTxByte(uint64_t now)
+{
+    (void)now;
+    return -1;
+}
+
+void SimHostRxByte(BYTE data, uint64_t now)
+{
+    (void)data;
+    (void)now;
+}
+
+void SimHostFinish(WORD addr)
+{
+    fprintf(stderr, "framebench: unexpected reset to 0x%06X\n", addr);
+    exit(2);
+}
+
+//Benchmark ************************************************************************
+//Entered at every basic block of the firmware, see the Makefile; this
+//file is built without the instrumentation
+void __sanitizer_cov_trace_pc(void)
+{
+    benchBlocks++;
+}
+
+static uint64_t BenchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int BenchStuff(BYTE *out, BYTE data)
+{
+    if(data == STX || data == ETX || data == DLE) {
+        out[0] = DLE;
+        out[1] = data;
+        return 2;
+    }
+    out[0] = data;
+    return 1;
+}
+
+//Frames the payload as a host would, returns the wire length
+static int BenchFrame(BYTE *out, const BYTE *payload, int len)
+{
+    BYTE checksum = 0;
+    int n = 0;
+    int i;
+
+    out[n++] = STX;
+    out[n++] = STX;
+    for(i = 0; i < len; i++) {
+        checksum += payload[i];
+        n += BenchStuff(out + n, payload[i]);
+    }
+    n += BenchStuff(out + n, (BYTE)(~checksum + 1));
+    out[n++] = ETX;
+    return n;
+}
+
+#ifdef USE_COBS
+//The same COBS framed, see GetCobsFrame(). Back to back, so without the
+//opening STX: the last frame's closing one stands for it
+static int BenchFrameCobs(BYTE *out, const BYTE *payload, int len)
+{
+    BYTE checksum = 0;
+    int n = 0;
+    int k = 0;
+    int i, j;
+    BYTE code;
+
+    for(i = 0; i < len; i++) {
+        checksum += payload[i];
+    }
+    checksum = ~checksum + 1;
+    while(1) {                                                      //payload then checksum, as one run of len+1
+        for(j = k; j <= len && j - k < 254 && (j < len ? payload[j] : checksum) != STX; j++) {
+        }
+        code = (BYTE)(j - k + 1);
+        out[n++] = code ^ STX;
+        for(; k < j; k++) {
+            out[n++] = k < len ? payload[k] : checksum;
+        }
+        if(k == len + 1) {
+            break;
+        }
+        if(code != 0xFF) {
+            k++;
+        }
+    }
+    out[n++] = STX;
+    return n;
+}
+#endif
+
+//Runs pass() until BENCH_MIN_NS have gone by. Returns the best ns per
+//pass, and in *blocks the firmware basic blocks of one, the same for each.
+static double BenchTime(void (*pass)(int), int frames, uint64_t *blocks)
+{
+    uint64_t start = BenchNowNs();
+    uint64_t best = ~0ULL;
+    uint64_t t;
+    int passes = 0;
+
+    benchBlocks = 0;
+    pass(frames);
+    *blocks = benchBlocks;
+    while(passes < BENCH_MIN_PASSES || BenchNowNs() - start < BENCH_MIN_NS) {
+        t = BenchNowNs();
+        pass(frames);
+        t = BenchNowNs() - t;
+        if(t < best) {
+            best = t;
+        }
+        passes++;
+    }
+    return (double)best;
+}
+
+static void BenchRxPass(int frames)
+{
+    int i;
+
+    rxPos = 0;
+    rxBlockPos = rxBlockLen = 0;
+    #ifdef USE_COBS
+    cobsOpen = cobsFraming;
+    #endif
+    for(i = 0; i < frames; i++) {
+        GetCommand();
+    }
+}
+
+static WORD txLength;
+
+static void BenchTxPass(int frames)
+{
+    int i;
+
+    for(i = 0; i < frames; i++) {
+        PutResponse(txLength);
+    }
+}
+
+static WORD rowLength;
+static DWORD_VAL rowAddr;
+
+static void BenchRowPass(int frames)
+{
+    int i;
+
+    for(i = 0; i < frames; i++) {
+        #ifdef USE_RUNAWAY_PROTECT
+        writeKey1 = ((WORD)(0xFFFF + 10) | (WORD)rowAddr.Val) - rowLength; //As the main loop and WT_FLASH leave them
+        writeKey2 = (WORD)((WORD)(0x5555 + 42) << 1) + WT_FLASH;
+        #endif
+        WritePM(rowLength, rowAddr);
+    }
+}
+
+static void BenchReport(const char *name, const char *dir, int data, int wire, int escapes, double ns,
+                        uint64_t blocks, int frames)
+{
+    double nsPerByte = ns / frames / data;
+    double blocksPerByte = (double)blocks / frames / data;
+    BenchResult *r;
+
+    printf("  %-11s %-2s  %5d %5d %5d  %6.1f%%  %7.3f  %7.2f  %9.0f  %6.0f\n", name, dir, data, wire, escapes,
+            100.0 * (wire - data) / data, blocksPerByte, nsPerByte, 1e9 / (nsPerByte * data),
+            BENCH_LINE_BAUD / 10.0 / wire);
+    if(resultCount < BENCH_MAX_CASES) {
+        r = &results[resultCount++];
+        snprintf(r->name, sizeof(r->name), "%s", name);
+        snprintf(r->dir, sizeof(r->dir), "%s", dir);
+        r->data = data;
+        r->wire = wire;
+        r->blocks = blocksPerByte;
+        r->ns = nsPerByte;
+    }
+}
+
+//Every image at one frame size, data flash bytes behind the command header
+static void BenchSize(int data, int large, int cobs)
+{
+    static BYTE payload[MAX_PACKET_SIZE + 8];
+    char name[16];
+    BYTE *stream;
+    BYTE *frame;
+    int header = large ? 6 : 5;
+    int trailer = cobs ? 2 : 4;                                     //Checksum and an STX, or two STX, checksum and ETX
+    int frames;
+    int wire;
+    int escapes;
+    int img;
+    int i;
+    double ns;
+    uint64_t blocks;
+
+    #ifdef USE_LARGE_PACKETS
+    largePackets = (BYTE)large;
+    #endif
+    #ifdef USE_COBS
+    cobsFraming = (BYTE)cobs;
+    #endif
+    frame = malloc(2 * (data + header) + 4);
+    for(img = 0; img < (int)(sizeof(images) / sizeof(images[0])); img++) {
+        snprintf(name, sizeof(name), cobs ? "%s.cobs" : "%s", images[img].name);
+        srand(1);
+        payload[0] = WT_FLASH;
+        payload[1] = (BYTE)(data / PM_ROW_SIZE);
+        if(large) {
+            payload[2] = (BYTE)((data / PM_ROW_SIZE) >> 8);
+        }
+        payload[header - 3] = 0x00;                                 //Address 0x004000
+        payload[header - 2] = 0x40;
+        payload[header - 1] = 0x00;
+        for(i = 0; i < data; i++) {
+            payload[header + i] = images[img].fill(i);
+        }
+
+        #ifdef USE_COBS
+        if(cobs) {
+            wire = BenchFrameCobs(frame, payload, header + data);
+        } else
+        #endif
+        wire = BenchFrame(frame, payload, header + data);           //Host to device, WT_FLASH
+        escapes = wire - (header + data + trailer);
+        frames = BENCH_STREAM_BYTES / wire + 1;
+        stream = malloc((size_t)frames * wire);
+        for(i = 0; i < frames; i++) {
+            memcpy(stream + (size_t)i * wire, frame, wire);
+        }
+        rxStream = stream;
+        rxLen = (size_t)frames * wire;
+        BenchRxPass(1);
+        if(memcmp(buffer, payload, 2) || memcmp(buffer + 2, payload + header - 3, data + 3)) {
+            fprintf(stderr, "framebench: %s frame was not received intact\n", name);
+            exit(2);
+        }
+        ns = BenchTime(BenchRxPass, frames, &blocks);
+        BenchReport(name, "rx", data, wire, escapes, ns, blocks, frames);
+        free(stream);
+
+        buffer[0] = RD_FLASH;                                       //Device to host, RD_FLASH reply
+        buffer[1] = (BYTE)(data / PM_INSTR_SIZE);
+        #ifdef USE_LARGE_PACKETS
+        lengthHi = (BYTE)((data / PM_INSTR_SIZE) >> 8);
+        #endif
+        memcpy(buffer + 2, payload + header - 3, data + 3);
+        txLength = (WORD)(data + 5);
+        #ifdef USE_COBS
+        cobsFrame = (BYTE)cobs;
+        cobsSent = (BYTE)cobs;                                      //Back to back as on the rx side
+        #endif
+        txBytes = 0;
+        BenchTxPass(1);
+        wire = (int)txBytes;
+        escapes = wire - (header + data + trailer);
+        frames = BENCH_STREAM_BYTES / wire + 1;
+        ns = BenchTime(BenchTxPass, frames, &blocks);
+        BenchReport(name, "tx", data, wire, escapes, ns, blocks, frames);
+    }
+    free(frame);
+}
+
+//WritePM on rows of random code at addr, checked once against a blank flash
+//past the bootloader
+static void BenchRows(const char *name, DWORD addr, int rows)
+{
+    int data = rows * PM_ROW_SIZE;
+    int frames = BENCH_STREAM_BYTES / data + 1;
+    DWORD w;
+    int i;
+    double ns;
+    uint64_t blocks;
+
+    srand(1);
+    for(i = 0; i < data; i++) {
+        buffer[5 + i] = FillRandom(i);
+    }
+    buffer[0] = WT_FLASH;
+    rowLength = (WORD)rows;
+    rowAddr.Val = addr;
+    SimInit();
+    BenchRowPass(1);
+    for(i = 0; i < data / PM_INSTR_SIZE; i++) {
+        w = buffer[5 + i*4] | buffer[6 + i*4] << 8 | (DWORD)buffer[7 + i*4] << 16;
+        if(addr > BOOT_ADDR_HI && simFlash[addr/2 + i] != w) {
+            fprintf(stderr, "framebench: %s rows were not programmed\n", name);
+            exit(2);
+        }
+    }
+    ns = BenchTime(BenchRowPass, frames, &blocks);
+    BenchReport(name, "wr", data, data, 0, ns, blocks, frames);
+}
+
+static void BenchRun(void)
+{
+    BenchSize(PM_ROW_SIZE, 0, 0);
+    #ifdef USE_LARGE_PACKETS
+    BenchSize(MAX_DATA_SIZE, 1, 0);
+    #endif
+    #ifdef USE_COBS
+    BenchSize(PM_ROW_SIZE, 0, 1);
+    #ifdef USE_LARGE_PACKETS
+    BenchSize(MAX_DATA_SIZE, 1, 1);
+    #endif
+    #endif
+    SimSetNvm("0,0,0");
+    BenchRows("app", 0x4000, 1);
+    BenchRows("app", 0x4000, MAX_DATA_SIZE / PM_ROW_SIZE);
+    BenchRows("page0", 0x0, MAX_DATA_SIZE / PM_ROW_SIZE);
+}
+
+//Baseline *************************************************************************
+static void BenchWrite(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if(f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    fprintf(f, "# framebench baseline: image, direction, data bytes, wire bytes, firmware basic blocks per\n");
+    fprintf(f, "# data byte (checked), host ns per data byte (for reference only)\n");
+    for(i = 0; i < resultCount; i++) {
+        fprintf(f, "%s %s %d %d %.3f %.2f\n", results[i].name, results[i].dir, results[i].data, results[i].wire,
+                results[i].blocks, results[i].ns);
+    }
+    fclose(f);
+    printf("baseline written to %s\n", path);
+}
+
+//Compares with the baseline and reports the differences
+static int BenchCheck(const char *path, double tolerance)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    BenchResult b;
+    int failed = 0;
+    int found;
+    int i;
+
+    if(f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    printf("against %s, %.0f%% slack on blocks:\n", path, tolerance);
+    while(fgets(line, sizeof(line), f)) {
+        if(line[0] == '#' || sscanf(line, "%15s %3s %d %d %lf %lf", b.name, b.dir, &b.data, &b.wire, &b.blocks, &b.ns) != 6) {
+            continue;
+        }
+        found = 0;
+        for(i = 0; i < resultCount; i++) {
+            if(strcmp(results[i].name, b.name) || strcmp(results[i].dir, b.dir) || results[i].data != b.data) {
+                continue;
+            }
+            found = 1;
+            if(results[i].wire != b.wire) {
+                printf("  %-11s %-2s  %5d  wire bytes %d, baseline %d\n", b.name, b.dir, b.data, results[i].wire, b.wire);
+                failed = 1;
+            } else if(results[i].blocks > b.blocks * (1.0 + tolerance / 100.0)) {
+                printf("  %-11s %-2s  %5d  %.3f blocks per byte, baseline %.3f (%.2f ns/byte, was %.2f)\n",
+                        b.name, b.dir, b.data, results[i].blocks, b.blocks, results[i].ns, b.ns);
+                failed = 1;
+            }
+        }
+        if(!found) {
+            printf("  %-11s %-2s  %5d  not measured in this configuration\n", b.name, b.dir, b.data);
+        }
+    }
+    fclose(f);
+    printf(failed ? "REGRESSION\n" : "no regressions\n");
+    return failed;
+}
+
+//Main *****************************************************************************
+int main(int argc, char **argv)
+{
+    const char *optCheck = NULL;
+    const char *optWrite = NULL;
+    double optTolerance = 2.0;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(i + 1 < argc && !strcmp(argv[i], "--check")) {
+            optCheck = argv[++i];
+        } else if(i + 1 < argc && !strcmp(argv[i], "--write")) {
+            optWrite = argv[++i];
+        } else if(i + 1 < argc && !strcmp(argv[i], "--tolerance")) {
+            optTolerance = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: framebench [--check FILE] [--write FILE] [--tolerance PCT]\n");
+            return 2;
+        }
+    }
+
+    SimInit();
+    printf("framebench: GetCommand (rx) and PutResponse (tx), firmware basic blocks and host ns per flash data byte\n");
+    printf("at %lu baud a wire byte lasts %.1f us, %llu cycles at FCY\n\n", BENCH_LINE_BAUD,
+            10e6 / BENCH_LINE_BAUD, (unsigned long long)(SIM_FCY * 10 / BENCH_LINE_BAUD));
+    printf("  image       dir  data  wire   esc  overhead   blocks  ns/byte   frames/s  line/s\n");
+    BenchRun();
+    printf("\n");
+
+    if(optWrite) {
+        BenchWrite(optWrite);
+    }
+    if(optCheck) {
+        return BenchCheck(optCheck, optTolerance);
+    }
+    return 0;
+}
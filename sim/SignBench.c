@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Known answer tests and timing of the firmware's Sha256.c and Sign.c,
+ * built for the host with USE_SIGN and SIGN_PUBLIC_KEY as shipped, the
+ * RFC 6979 A.2.5 example key. SHA-256 is checked against the FIPS 180-2
+ * examples ("", "abc" and the 448-bit message), and the same data hashed
+ * in one call and in pieces. EcdsaVerify takes the RFC 6979 A.2.5
+ * SHA-256 signatures of "sample" and "test", and must turn down each with
+ * a bit of r, s or the hash flipped, r or s of 0 or n, and another key.
+ * The row path, SignRow with SignPrefetch run part way as PrefetchWriteMem
+ * would and SignFlush after, is checked against a signature made over
+ * BENCH_ROWS rows by the same signer as host/an851sign, and must fail
+ * when a page below the config page was not erased after SIGNATURE.
+ *
+ * usage: signbench
+ *
+ * Times are host ns, which track changes to the C but are not the
+ * PIC24's cycle counts; on the device USE_STATS counts signWait and
+ * signCycles. The counts are exact: field multiplies per verify, nearly
+ * all of its time, and SHA-256 blocks per row. The budget turns them into
+ * device time for a range of cycles per multiply, and gives the cycles
+ * per block a row write hides and a row's time on the line leaves at each
+ * SET_BAUD rate. Exits 1 if any check fails.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Sim.h"
+#include "BootLoader.h"
+#include "Sha256.h"
+#include "Sign.h"
+
+#define BENCH_MIN_NS        200000000ULL                            //Time each case for at least this long
+#define BENCH_ROWS          8                                       //Rows the row signature covers
+#define BENCH_ROW_ADDR      0x4000
+#define BENCH_ROW_HASH      (3 + PM_ROW_SIZE/PM_INSTR_SIZE*3)       //Bytes a row adds to the message
+
+static int failures;
+
+BYTE erasedPages[(AUTO_ERASE_PAGES + 7)/8];                         //ErasePM's bitmap, BootLoader.c is not linked in
+
+static const BYTE publicKey[SIGN_PUBLIC_SIZE] = SIGN_PUBLIC_KEY;
+static const BYTE otherKey[SIGN_PUBLIC_SIZE] = {                    //The base point, private key 1
+    0x6B, 0x17, 0xD1, 0xF2, 0xE1, 0x2C, 0x42, 0x47, 0xF8, 0xBC, 0xE6, 0xE5, 0x63, 0xA4, 0x40, 0xF2,
+    0x77, 0x03, 0x7D, 0x81, 0x2D, 0xEB, 0x33, 0xA0, 0xF4, 0xA1, 0x39, 0x45, 0xD8, 0x98, 0xC2, 0x96,
+    0x4F, 0xE3, 0x42, 0xE2, 0xFE, 0x1A, 0x7F, 0x9B, 0x8E, 0xE7, 0xEB, 0x4A, 0x7C, 0x0F, 0x9E, 0x16,
+    0x2B, 0xCE, 0x33, 0x57, 0x6B, 0x31, 0x5E, 0xCE, 0xCB, 0xB6, 0x40, 0x68, 0x37, 0xBF, 0x51, 0xF5
+};
+
+static const struct {
+    const char *text;
+    BYTE digest[SHA256_SIZE];
+} shaKnown[] = {                                                    //FIPS 180-2 examples
+    {"", {
+        0xE3, 0xB0, 0xC4, 0x42, 0x98, 0xFC, 0x1C, 0x14, 0x9A, 0xFB, 0xF4, 0xC8, 0x99, 0x6F, 0xB9, 0x24,
+        0x27, 0xAE, 0x41, 0xE4, 0x64, 0x9B, 0x93, 0x4C, 0xA4, 0x95, 0x99, 0x1B, 0x78, 0x52, 0xB8, 0x55
+    }},
+    {"abc", {
+        0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+        0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD
+    }},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", {
+        0x24, 0x8D, 0x6A, 0x61, 0xD2, 0x06, 0x38, 0xB8, 0xE5, 0xC0, 0x26, 0x93, 0x0C, 0x3E, 0x60, 0x39,
+        0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF, 0x21, 0x67, 0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1
+    }}
+};
+
+static const struct {
+    const char *text;
+    BYTE sig[SIGN_SIZE];
+} signKnown[] = {                                                   //RFC 6979 A.2.5, SHA-256
+    {"sample", {
+        0xEF, 0xD4, 0x8B, 0x2A, 0xAC, 0xB6, 0xA8, 0xFD, 0x11, 0x40, 0xDD, 0x9C, 0xD4, 0x5E, 0x81, 0xD6,
+        0x9D, 0x2C, 0x87, 0x7B, 0x56, 0xAA, 0xF9, 0x91, 0xC3, 0x4D, 0x0E, 0xA8, 0x4E, 0xAF, 0x37, 0x16,
+        0xF7, 0xCB, 0x1C, 0x94, 0x2D, 0x65, 0x7C, 0x41, 0xD4, 0x36, 0xC7, 0xA1, 0xB6, 0xE2, 0x9F, 0x65,
+        0xF3, 0xE9, 0x00, 0xDB, 0xB9, 0xAF, 0xF4, 0x06, 0x4D, 0xC4, 0xAB, 0x2F, 0x84, 0x3A, 0xCD, 0xA8
+    }},
+    {"test", {
+        0xF1, 0xAB, 0xB0, 0x23, 0x51, 0x83, 0x51, 0xCD, 0x71, 0xD8, 0x81, 0x56, 0x7B, 0x1E, 0xA6, 0x63,
+        0xED, 0x3E, 0xFC, 0xF6, 0xC5, 0x13, 0x2B, 0x35, 0x4F, 0x28, 0xD3, 0xB0, 0xB7, 0xD3, 0x83, 0x67,
+        0x01, 0x9F, 0x41, 0x13, 0x74, 0x2A, 0x2B, 0x14, 0xBD, 0x25, 0x92, 0x6B, 0x49, 0xC6, 0x49, 0x15,
+        0x5F, 0x26, 0x7E, 0x60, 0xD3, 0x81, 0x4B, 0x4C, 0x0C, 0xC8, 0x42, 0x50, 0xE4, 0x6F, 0x00, 0x83
+    }}
+};
+
+static const BYTE rowSig[SIGN_SIZE] = {                             //Over BENCH_ROWS rows from FillRow
+    0x69, 0xA9, 0x90, 0x01, 0x25, 0x93, 0xBC, 0x6A, 0xF0, 0x6B, 0xDF, 0xE7, 0x50, 0xA3, 0x28, 0x40,
+    0x9E, 0xC2, 0xA9, 0xF1, 0xCB, 0x66, 0xC2, 0x39, 0x44, 0xA4, 0x28, 0xBC, 0xC0, 0x92, 0xC3, 0xA9,
+    0x47, 0x39, 0x98, 0x40, 0x0E, 0x3C, 0x77, 0x9A, 0x18, 0x56, 0x97, 0x27, 0x67, 0x92, 0x2C, 0x49,
+    0x97, 0xE9, 0xC2, 0x5E, 0x25, 0xCC, 0xDC, 0x7A, 0x3D, 0x7A, 0x61, 0xC6, 0x6A, 0xE4, 0xDD, 0xD3
+};
+
+static const BYTE orderN[32] = {                                    //Group order, big endian
+    0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xBC, 0xE6, 0xFA, 0xAD, 0xA7, 0x17, 0x9E, 0x84, 0xF3, 0xB9, 0xCA, 0xC2, 0xFC, 0x63, 0x25, 0x51
+};
+
+static void Check(const char *what, int ok, const char *detail)
+{
+    printf("  check   %-28s %s%s\n", what, ok ? "OK" : "FAILED", detail);
+    failures += !ok;
+}
+
+static uint64_t BenchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void Digest(const char *text, BYTE *digest)
+{
+    SHA256_CTX ctx;
+
+    Sha256Init(&ctx);
+    Sha256Update(&ctx, (BYTE *)text, (WORD)strlen(text));
+    Sha256Final(&ctx, digest);
+}
+
+static void FillRow(BYTE *row, int seed)
+{
+    int i;
+
+    for(i = 0; i < PM_ROW_SIZE; i++) {
+        row[i] = (i % 4 == 3) ? 0x00 : (BYTE)(i * 7 + seed * 31);
+    }
+}
+
+static void Hashes(void)
+{
+    BYTE data[1000];
+    BYTE one[SHA256_SIZE];
+    BYTE split[SHA256_SIZE];
+    SHA256_CTX ctx;
+    static const WORD pieces[] = {1, 3, 7, 55, 56, 64, 65};
+    size_t i;
+    size_t at;
+    size_t n;
+    int ok;
+
+    for(ok = 1, i = 0; i < sizeof(shaKnown) / sizeof(shaKnown[0]); i++) {
+        Digest(shaKnown[i].text, one);
+        ok &= !memcmp(one, shaKnown[i].digest, SHA256_SIZE);
+    }
+    Check("FIPS 180-2 SHA-256", ok, ", 3 messages");
+
+    for(i = 0; i < sizeof(data); i++) {
+        data[i] = (BYTE)(i * 13 + 5);
+    }
+    Sha256Init(&ctx);
+    Sha256Update(&ctx, data, sizeof(data));
+    Sha256Final(&ctx, one);
+    for(ok = 1, i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        Sha256Init(&ctx);
+        for(at = 0; at < sizeof(data); at += n) {
+            n = sizeof(data) - at < pieces[i] ? sizeof(data) - at : pieces[i];
+            Sha256Update(&ctx, data + at, (WORD)n);
+        }
+        Sha256Final(&ctx, split);
+        ok &= !memcmp(one, split, SHA256_SIZE);
+    }
+    Check("hashed in pieces", ok, ", 1 to 65 bytes a call");
+}
+
+static void Signatures(void)
+{
+    BYTE digest[SHA256_SIZE];
+    BYTE sig[SIGN_SIZE];
+    int ok;
+    size_t i;
+
+    for(ok = 1, i = 0; i < sizeof(signKnown) / sizeof(signKnown[0]); i++) {
+        Digest(signKnown[i].text, digest);
+        ok &= EcdsaVerify(digest, (BYTE *)signKnown[i].sig, publicKey) == TRUE;
+    }
+    Check("RFC 6979 A.2.5", ok, ", \"sample\" and \"test\"");
+
+    Digest(signKnown[0].text, digest);
+    memcpy(sig, signKnown[0].sig, SIGN_SIZE);
+    sig[31] ^= 0x01;
+    ok = !EcdsaVerify(digest, sig, publicKey);
+    memcpy(sig, signKnown[0].sig, SIGN_SIZE);
+    sig[32] ^= 0x80;
+    ok &= !EcdsaVerify(digest, sig, publicKey);
+    memcpy(sig, signKnown[0].sig, SIGN_SIZE);
+    digest[7] ^= 0x10;
+    ok &= !EcdsaVerify(digest, sig, publicKey);
+    Check("r, s or hash changed", ok, "");
+
+    Digest(signKnown[0].text, digest);
+    memset(sig, 0, 32);
+    ok = !EcdsaVerify(digest, sig, publicKey);
+    memcpy(sig, signKnown[0].sig, SIGN_SIZE);
+    memset(sig + 32, 0, 32);
+    ok &= !EcdsaVerify(digest, sig, publicKey);
+    memcpy(sig, orderN, 32);
+    ok &= !EcdsaVerify(digest, sig, publicKey);
+    memcpy(sig, signKnown[0].sig, SIGN_SIZE);
+    memcpy(sig + 32, orderN, 32);
+    ok &= !EcdsaVerify(digest, sig, publicKey);
+    Check("r or s out of range", ok, ", 0 and n");
+
+    ok = !EcdsaVerify(digest, (BYTE *)signKnown[0].sig, otherKey);
+    Check("another key", ok, "");
+}
+
+//Every page erased, as ER_FLASH or auto erase would mark them after a
+//SIGNATURE; keep is a page left as it was, -1 for none
+static void EraseAll(int keep)
+{
+    int page;
+
+    for(page = 0; page < AUTO_ERASE_PAGES; page++) {
+        if(page != keep) {
+            erasedPages[page/8] |= 1 << (page % 8);
+        }
+    }
+}
+
+//BENCH_ROWS rows through the row path, SignPrefetch run k times for row k
+//as a row write would let it, then SignFlush; change is a byte of row 3
+//to change first, -1 for none; keep is a page not erased, -1 for none
+static BOOL SignRows(int change, int keep)
+{
+    BYTE row[PM_ROW_SIZE];
+    int r;
+    int k;
+
+    SignBegin((BYTE *)rowSig);
+    EraseAll(keep);
+    for(r = 0; r < BENCH_ROWS; r++) {
+        FillRow(row, r);
+        if(r == 3 && change >= 0) {
+            row[change] ^= 0x01;
+        }
+        SignRow(row, BENCH_ROW_ADDR + (DWORD)r * (PM_ROW_SIZE/2));
+        for(k = 0; k < r * 11; k++) {                               //None, some or all of it hashed ahead
+            SignPrefetch();
+        }
+        SignFlush();
+    }
+    return SignValid();
+}
+
+static void Rows(void)
+{
+    BYTE row[PM_ROW_SIZE];
+    int ok;
+
+    Check("rows in order, prefetched", SignRows(-1, -1) && SignValid(), ", and the result kept");
+    FillRow(row, 0);
+    SignRow(row, BENCH_ROW_ADDR);
+    SignFlush();
+    Check("a row after the check", !SignValid(), "");
+    Check("a byte of a row changed", !SignRows(5, -1), "");
+    Check("a phantom byte changed", SignRows(7, -1), ", not hashed");
+
+    SignBegin((BYTE *)rowSig);
+    SignErase();
+    ok = SignRows(-1, -1);
+    SignBegin((BYTE *)rowSig);
+    FillRow(row, 0);
+    SignRow(row, BENCH_ROW_ADDR);
+    SignFlush();
+    SignErase();
+    Check("ER_FLASH before, after rows", ok && !SignValid(), "");
+
+    EraseAll(-1);
+    SignBegin((BYTE *)rowSig);
+    Check("erased before SIGNATURE", !SignValid(), "");
+    SignBegin((BYTE *)rowSig);
+    EraseAll(PAGE_NUM(BENCH_ROW_ADDR));
+    FillRow(row, 0);
+    SignRow(row, BENCH_ROW_ADDR);
+    SignFlush();
+    EraseAll(-1);
+    Check("a row on a page not erased", !SignValid(), "");
+    SignBegin((BYTE *)rowSig);
+    EraseAll(0);
+    Check("a page left as it was", !SignValid(), "");
+    Check("the config page left", SignRows(-1, AUTO_ERASE_PAGES - 1), ", not covered");
+}
+
+static DWORD Counts(void)
+{
+    BYTE digest[SHA256_SIZE];
+    DWORD muls;
+    uint64_t start;
+    uint64_t t;
+    SHA256_CTX ctx;
+    BYTE row[PM_ROW_SIZE/PM_INSTR_SIZE*3];
+    long n;
+    long i;
+
+    Digest(signKnown[0].text, digest);
+    ecMuls = 0;
+    EcdsaVerify(digest, (BYTE *)signKnown[0].sig, publicKey);
+    muls = ecMuls;
+    printf("  count   EcdsaVerify                  %lu field multiplies, %lu 16x16 products each\n",
+            (unsigned long)muls, 2UL * 16 * 16);
+    printf("  count   a row                        %d bytes hashed, %.2f SHA-256 blocks\n", BENCH_ROW_HASH,
+            BENCH_ROW_HASH / (double)SHA256_BLOCK_SIZE);
+
+    start = BenchNowNs();
+    for(n = 0; BenchNowNs() - start < BENCH_MIN_NS; n++) {
+        EcdsaVerify(digest, (BYTE *)signKnown[0].sig, publicKey);
+    }
+    t = BenchNowNs() - start;
+    printf("  time    EcdsaVerify                  %.0f us on this host, %.0f ns per multiply\n", t / 1e3 / n,
+            (double)t / n / muls);
+
+    memset(row, 0x5A, sizeof(row));
+    Sha256Init(&ctx);
+    start = BenchNowNs();
+    for(n = 0; BenchNowNs() - start < BENCH_MIN_NS; n += 100) {
+        for(i = 0; i < 100; i++) {
+            Sha256Update(&ctx, row, sizeof(row));
+        }
+    }
+    t = BenchNowNs() - start;
+    printf("  time    Sha256Update                 %.1f ns per block on this host\n",
+            (double)t / n / (sizeof(row) / (double)SHA256_BLOCK_SIZE));
+    return muls;
+}
+
+static void Budget(DWORD muls)
+{
+    static const DWORD rates[] = {
+#ifdef USE_BAUD_SWITCH
+        BAUD_SWITCH_1, BAUD_SWITCH_2, BAUD_SWITCH_3, BAUD_SWITCH_4
+#else
+        BAUDRATE
+#endif
+    };
+    static const unsigned perMul[] = {3000, 6000, 12000};          //Cycles per EcMul, from a hand coded loop to plain C
+    double blocks = BENCH_ROW_HASH / (double)SHA256_BLOCK_SIZE;
+    double rowUs;
+    double left;
+    size_t i;
+
+    printf("  budget  a row write of %u us hides %.0f cycles per SHA-256 block of the row\n", SIM_ROW_WRITE_US,
+            (double)FCY * SIM_ROW_WRITE_US / 1e6 / blocks);
+    for(i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        rowUs = PM_ROW_SIZE * 10.0 * 1e6 / rates[i];               //Data bytes alone, 8N1
+        left = rowUs > SIM_ROW_WRITE_US ? rowUs - SIM_ROW_WRITE_US : 0;
+        printf("          %7lu baud: a row is %6.0f us on the line, %6.0f cycles per block, %6.0f after the write\n",
+                (unsigned long)rates[i], rowUs, (double)FCY * rowUs / 1e6 / blocks, (double)FCY * left / 1e6 / blocks);
+    }
+    printf("  budget  VERIFY_OK checks the signature once, %lu multiplies at FCY %lu\n", (unsigned long)muls,
+            (unsigned long)FCY);
+    for(i = 0; i < sizeof(perMul) / sizeof(perMul[0]); i++) {
+        printf("          %5u cycles per multiply: %5.2f s\n", perMul[i], (double)muls * perMul[i] / FCY);
+    }
+}
+
+int main(void)
+{
+    DWORD muls;
+
+    printf("signbench: ECDSA P-256, SHA-256 over %d bytes per %d byte row, FCY %lu\n", BENCH_ROW_HASH, PM_ROW_SIZE,
+            (unsigned long)FCY);
+    Hashes();
+    Signatures();
+    Rows();
+    muls = Counts();
+    Budget(muls);
+    if(failures) {
+        printf("signbench: %d checks FAILED\n", failures);
+        return 1;
+    }
+    return 0;
+}
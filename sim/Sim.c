@@ -0,0 +1,670 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Device side of the host simulator: SFR storage, UART receiver and
+ * transmitter with 4 deep FIFOs and real line timing, Timer1, Timer2/3 in
+ * 32-bit mode, the flash controller with write latches and NVM stalls, and
+ * interrupt dispatch through the AIVT and the CRC generator. Like the real array, programming
+ * only clears bits; a word written twice without an erase in between is
+ * counted in simStats.nvmOverwrites.
+ *
+ * Time only advances when the bootloader touches hardware (SFR reads,
+ * clrwdt loops, NVM operations), which is enough to reproduce the polled
+ * versus interrupt driven behaviour of the receive path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Sim.h"
+#include "BootLoader.h"
+#include "Uart.h"
+
+//Registers ************************************************************************
+WORD TBLPAG;
+WORD NVMCON;
+WORD RCON = 0x0003;                                                 //POR/BOR, bootloader stays active
+WORD OSCCON;
+WORD PR1, TMR1, PR2, PR3, TMR3, TMR3HLD;
+static WORD tmr2;                                                   //Behind the TMR2 accessor
+SIM_TxCONBITS T1CONbits, T2CONbits;
+SIM_IEC0BITS IEC0bits;
+SIM_IEC5BITS IEC5bits;
+SIM_IPC20BITS IPC20bits;
+SIM_INTCON2BITS INTCON2bits;
+SIM_SRBITS SRbits;
+SIM_RPINR17BITS RPINR17bits;
+SIM_RPOR14BITS RPOR14bits;
+WORD U3BRG;
+SIM_UxMODEBITS U3MODEbits;
+SIM_CRCCON2BITS CRCCON2bits;
+WORD CRCXORL, CRCXORH;
+
+//Simulator state ******************************************************************
+uint64_t simCycles;
+uint64_t simBitCycles;
+uint64_t simHostBitCycles;
+SimStats simStats;
+DWORD simFlash[SIM_FLASH_WORDS];
+uint64_t simRowWriteUs = SIM_ROW_WRITE_US;
+uint64_t simPageEraseUs = SIM_PAGE_ERASE_US;
+uint64_t simWordWriteUs = SIM_WORD_WRITE_US;
+int simBootPin;
+int simDriverEnable;
+int simDriverTris = 1;
+int simNodeAddr = 1;
+
+#define SIM_FIFO_DEPTH      4
+#define SIM_TXREG_IDLE      0xFFFF                                  //No pending write to UxTXREG
+#define SIM_ISR_CYCLES      20                                      //Interrupt entry/exit overhead
+#define SIM_TBL_STEP        64                                      //Table reads between interrupt checks, power of 2
+
+static SIM_UxSTA uxSta;
+static WORD uxTxReg = SIM_TXREG_IDLE;
+static BYTE rxFifo[SIM_FIFO_DEPTH];
+static BYTE rxFifoFerr[SIM_FIFO_DEPTH];                             //Character came in with a framing error
+static int rxFifoCount;
+static int rxOverrun;
+static BYTE txFifo[SIM_FIFO_DEPTH];
+static int txFifoCount;
+static int rxLineBusy;                                              //Host to device character in flight
+static int rxLineChar;                                              //Or SIM_BREAK
+static uint64_t rxLineDone;
+static int txLineBusy;                                              //Device to host character in the TSR
+static BYTE txLineChar;
+static int txLineUndriven;                                          //DE was low as the start bit went out
+static uint64_t txLineDone;
+static int lastUtxen;
+
+static SIM_NVMCONBITS nvmconBits;
+static SIM_IFS0BITS ifs0;
+static SIM_IFS5BITS ifs5;
+static uint64_t nvmBusyUntil;
+static DWORD nvmUndo[PM_PAGE_SIZE/4];                               //Words the NVM operation in progress changes, as they were
+static DWORD nvmUndoBase;
+static DWORD nvmUndoCount;
+static DWORD latch[PM_ROW_SIZE/4];
+static DWORD latchAddr;
+
+#define SIM_CRC_FIFO_DEPTH  16                                      //8-bit or narrower data
+
+static SIM_CRCCON1 crcCon1;
+static WORD crcConLast;                                             //CRCCON1 as last seen, to catch CRCEN going low
+static WORD crcDatL;
+static int crcDataPending;                                          //CRCDATL written, not yet in the FIFO
+static WORD crcWdat[2];
+static int crcFifoCount;
+static DWORD tblReads;
+static uint64_t crcShifted;                                         //Cycle the shifter last drained the FIFO up to
+
+static int timerRunning;
+static uint64_t timerStart;
+static int timer1Running;
+static uint64_t timer1Start;
+#ifdef USE_UART_ISR
+static int inIsr;
+#endif
+
+static void SimFatal(const char *msg)
+{
+    fprintf(stderr, "bootsim: %s at cycle %llu\n", msg, (unsigned long long)simCycles);
+    exit(2);
+}
+
+void SimInit(void)
+{
+    DWORD i;
+
+    for(i = 0; i < SIM_FLASH_WORDS; i++) {
+        simFlash[i] = 0xFFFFFF;
+    }
+    for(i = 0; i < PM_ROW_SIZE/4; i++) {
+        latch[i] = 0xFFFFFF;
+    }
+
+    simFlash[0] = 0x040000 | BOOT_ADDR_LOW;                         //goto BOOT_ADDR_LOW
+    simFlash[1] = 0x000000;
+    #ifdef USE_UART_ISR
+        simFlash[UxRX_AIVT_ADDR/2] = SIM_RX_VECTOR;                 //As left by the programmer image
+        simFlash[UxTX_AIVT_ADDR/2] = SIM_TX_VECTOR;
+    #endif
+
+    uxSta.Val = 0x0110;                                             //TRMT, RIDLE
+}
+
+//Parses "ROW,PAGE,WORD" stall times in microseconds, returns 0 if malformed
+int SimSetNvm(const char *arg)
+{
+    unsigned long row, page, word;
+    char end;
+
+    if(sscanf(arg, "%lu,%lu,%lu%c", &row, &page, &word, &end) != 3) {
+        return 0;
+    }
+    simRowWriteUs = row;
+    simPageEraseUs = page;
+    simWordWriteUs = word;
+    return 1;
+}
+
+uint64_t SimByteCycles(void)
+{
+    if(simBitCycles) {
+        return simBitCycles * 10;
+    }
+    return (uint64_t)(U3MODEbits.BRGH ? 4 : 16) * (U3BRG + 1) * 10;
+}
+
+uint64_t SimHostByteCycles(void)
+{
+    if(simBitCycles || !simHostBitCycles) {
+        return SimByteCycles();
+    }
+    return simHostBitCycles * 10;
+}
+
+static BYTE SimLine(BYTE data)
+{
+    uint64_t dev = SimByteCycles();
+    uint64_t host = SimHostByteCycles();
+    uint64_t diff = dev > host ? dev - host : host - dev;
+
+    if(diff * 100 > dev * 4) {                                      //More than ~4% apart, the receiver samples garbage
+        return (BYTE)(data ^ 0xA7);
+    }
+    return data;
+}
+
+//UART *****************************************************************************
+static void SimRxDeliver(int data)
+{
+    if(nvmBusyUntil > rxLineDone) {
+        simStats.rxDuringNvm++;
+    }
+    if(!simDriverTris && simDriverEnable) {                         //Half duplex, the receiver is off while driving
+        simStats.rxWhileDriving++;
+        return;
+    }
+    if(!U3MODEbits.UARTEN || rxOverrun || rxFifoCount == SIM_FIFO_DEPTH) {
+        rxOverrun = U3MODEbits.UARTEN;                              //5th character completes with the FIFO full
+        simStats.rxLost++;
+        return;
+    }
+    rxFifoFerr[rxFifoCount] = data == SIM_BREAK;                    //Nothing but zeros, not even the stop bit
+    rxFifo[rxFifoCount++] = data == SIM_BREAK ? 0 : (BYTE)data;
+    ifs5.U3RXIF = 1;
+}
+
+static void SimUartUpdate(void)
+{
+    uint64_t start;
+    int data;
+
+    if(!uxSta.bits.OERR && rxOverrun) {                             //Software cleared OERR, FIFO is reset
+        rxOverrun = 0;
+        rxFifoCount = 0;
+    }
+
+    if(uxSta.bits.UTXEN && !lastUtxen) {
+        ifs5.U3TXIF = 1;                                            //TXIF is set when the transmitter is enabled
+    }
+    lastUtxen = uxSta.bits.UTXEN;
+
+    if(uxTxReg != SIM_TXREG_IDLE) {                                 //Latch the last write to UxTXREG
+        if(txFifoCount == SIM_FIFO_DEPTH) {
+            SimFatal("write to UxTXREG with the TX FIFO full");
+        }
+        txFifo[txFifoCount++] = (BYTE)uxTxReg;
+        uxTxReg = SIM_TXREG_IDLE;
+    }
+
+    for(;;) {                                                       //Host to device
+        if(rxLineBusy) {
+            if(simCycles < rxLineDone) {
+                break;
+            }
+            SimRxDeliver(rxLineChar == SIM_BREAK ? SIM_BREAK : SimLine((BYTE)rxLineChar));
+            rxLineBusy = 0;
+            start = rxLineDone;
+        } else {
+            start = simCycles;
+        }
+        data = SimHostTxByte(start);
+        if(data < 0) {
+            break;
+        }
+        rxLineBusy = 1;
+        rxLineChar = data;
+        rxLineDone = start + SimHostByteCycles();
+        simStats.rxBytes += data != SIM_BREAK;
+    }
+
+    for(;;) {                                                       //Device to host
+        if(txLineBusy) {
+            if(simCycles < txLineDone) {
+                break;
+            }
+            if(!simDriverTris && (txLineUndriven || !simDriverEnable)) {
+                simStats.txUndriven++;                              //Cut short on the bus, the host never sees it
+            } else {
+                SimHostRxByte(SimLine(txLineChar), txLineDone);
+            }
+            simStats.txBytes++;
+            txLineBusy = 0;
+            start = txLineDone;
+        } else {
+            start = simCycles;
+        }
+        if(txFifoCount == 0 || !uxSta.bits.UTXEN) {
+            break;
+        }
+        txLineChar = txFifo[0];
+        memmove(txFifo, txFifo + 1, --txFifoCount);
+        txLineBusy = 1;
+        txLineUndriven = !simDriverEnable;
+        txLineDone = start + SimByteCycles();
+        ifs5.U3TXIF = 1;                                            //FIFO to TSR transfer
+    }
+
+    uxSta.bits.URXDA = rxFifoCount > 0;
+    uxSta.bits.FERR = rxFifoCount > 0 && rxFifoFerr[0];
+    uxSta.bits.OERR = rxOverrun;
+    uxSta.bits.UTXBF = txFifoCount == SIM_FIFO_DEPTH;
+    uxSta.bits.TRMT = !txLineBusy && txFifoCount == 0;
+}
+
+//Timer ****************************************************************************
+static void SimTimerUpdate(void)
+{
+    uint64_t period;
+
+    if(!T2CONbits.TON) {
+        timerRunning = 0;
+        return;
+    }
+    if(!timerRunning) {
+        timerRunning = 1;
+        timerStart = simCycles - (((uint64_t)TMR3 << 16) | tmr2);
+    }
+    period = (((uint64_t)PR3 << 16) | PR2) + 1;
+    while(simCycles - timerStart >= period) {
+        ifs0.T3IF = 1;
+        timerStart += period;
+    }
+}
+
+static void SimTimer1Update(void)
+{
+    static const uint64_t prescale[4] = { 1, 8, 64, 256 };
+    uint64_t period;
+
+    if(!T1CONbits.TON) {
+        timer1Running = 0;
+        return;
+    }
+    if(!timer1Running) {
+        timer1Running = 1;
+        timer1Start = simCycles - (uint64_t)TMR1 * prescale[T1CONbits.TCKPS];
+    }
+    period = ((uint64_t)PR1 + 1) * prescale[T1CONbits.TCKPS];
+    while(simCycles - timer1Start >= period) {
+        ifs0.T1IF = 1;
+        timer1Start += period;
+    }
+}
+
+//Interrupts ***********************************************************************
+static void SimDispatch(void)
+{
+    #ifdef USE_UART_ISR
+    if(inIsr) {
+        return;
+    }
+
+    if(IEC5bits.U3RXIE && ifs5.U3RXIF && IPC20bits.U3RXIP > SRbits.IPL) {
+        if(!INTCON2bits.ALTIVT) {
+            SimFatal("UART RX interrupt taken through the application IVT");
+        }
+        if(simFlash[UxRX_AIVT_ADDR/2] != SIM_RX_VECTOR) {
+            SimFatal("UART RX interrupt with a corrupt AIVT entry");
+        }
+        inIsr = 1;
+        simCycles += SIM_ISR_CYCLES;
+        simStats.rxIsr++;
+        UxRXInterrupt();
+        inIsr = 0;
+    }
+
+    if(IEC5bits.U3TXIE && ifs5.U3TXIF && IPC20bits.U3TXIP > SRbits.IPL) {
+        if(!INTCON2bits.ALTIVT) {
+            SimFatal("UART TX interrupt taken through the application IVT");
+        }
+        if(simFlash[UxTX_AIVT_ADDR/2] != SIM_TX_VECTOR) {
+            SimFatal("UART TX interrupt with a corrupt AIVT entry");
+        }
+        inIsr = 1;
+        simCycles += SIM_ISR_CYCLES;
+        simStats.txIsr++;
+        UxTXInterrupt();
+        inIsr = 0;
+    }
+    #endif
+}
+
+void SimStep(WORD cycles)
+{
+    simCycles += cycles;
+    SimHostUpdate(simCycles);
+    SimUartUpdate();
+    SimTimerUpdate();
+    SimTimer1Update();
+    SimDispatch();
+}
+
+//SFR accessors ********************************************************************
+SIM_UxSTA *SimUxSTA(void)
+{
+    SimStep(SIM_SFR_CYCLES);
+    return &uxSta;
+}
+
+WORD SimUxRXREG(void)
+{
+    BYTE data;
+
+    SimStep(SIM_SFR_CYCLES);
+    if(rxFifoCount == 0) {
+        return 0;
+    }
+    data = rxFifo[0];
+    memmove(rxFifo, rxFifo + 1, --rxFifoCount);
+    memmove(rxFifoFerr, rxFifoFerr + 1, rxFifoCount);
+    uxSta.bits.URXDA = rxFifoCount > 0;
+    uxSta.bits.FERR = rxFifoCount > 0 && rxFifoFerr[0];
+    return data;
+}
+
+WORD *SimUxTXREG(void)
+{
+    SimStep(SIM_SFR_CYCLES);                                        //Flushes the previous write
+    return &uxTxReg;
+}
+
+SIM_NVMCONBITS *SimNVMCONbits(void)
+{
+    SimStep(SIM_SFR_CYCLES);
+    nvmconBits.WR = simCycles < nvmBusyUntil;
+    return &nvmconBits;
+}
+
+SIM_IFS0BITS *SimIFS0bits(void)
+{
+    SimStep(SIM_SFR_CYCLES);
+    return &ifs0;
+}
+
+SIM_IFS5BITS *SimIFS5bits(void)
+{
+    SimStep(SIM_SFR_CYCLES);
+    return &ifs5;
+}
+
+WORD *SimTMR2(void)
+{
+    uint64_t count;
+
+    SimStep(SIM_SFR_CYCLES);
+    if(timerRunning) {                                              //Stopped, it holds what was last written
+        count = simCycles - timerStart;
+        tmr2 = (WORD)count;
+        TMR3 = (WORD)(count >> 16);
+        TMR3HLD = TMR3;
+    }
+    return &tmr2;
+}
+
+//CRC generator ********************************************************************
+//Direct (non-augmented) LFSR of PLEN+1 bits, one data bit shifted per
+//cycle after CRCGO. The result is worked out as each word is written,
+//the FIFO count only models the CRCFUL/CRCMPT timing the firmware sees.
+static void SimCrcShift(WORD data)
+{
+    DWORD width = CRCCON2bits.PLEN + 1;
+    DWORD mask = width == 32 ? 0xFFFFFFFF : ((DWORD)1 << width) - 1;
+    DWORD poly = (((DWORD)CRCXORH << 16) | CRCXORL | 1) & mask;
+    DWORD crc = ((DWORD)crcWdat[1] << 16 | crcWdat[0]) & mask;
+    int bits = CRCCON2bits.DWIDTH + 1;
+    int i, bit;
+
+    for(i = 0; i < bits; i++) {
+        bit = crcCon1.bits.LENDIAN ? i : bits - 1 - i;
+        if((((crc >> (width - 1)) ^ (data >> bit)) & 1) != 0) {
+            crc = ((crc << 1) ^ poly) & mask;
+        } else {
+            crc = (crc << 1) & mask;
+        }
+    }
+    crcWdat[0] = (WORD)crc;
+    crcWdat[1] = (WORD)(crc >> 16);
+}
+
+static void SimCrcUpdate(void)
+{
+    uint64_t perWord = CRCCON2bits.DWIDTH + 1;
+
+    if(!crcCon1.bits.CRCEN) {                                       //Off, or turned off since: FIFO and GO cleared
+        crcFifoCount = 0;
+        crcDataPending = 0;
+        crcCon1.bits.CRCGO = 0;
+    } else if((crcConLast & 0x0010) == 0 && crcCon1.bits.CRCGO) {
+        crcShifted = simCycles;                                     //Started shifting now
+    }
+    if(crcDataPending) {
+        crcDataPending = 0;
+        if(crcFifoCount == 0 && crcShifted < simCycles) {
+            crcShifted = simCycles;
+        }
+        if(crcFifoCount < SIM_CRC_FIFO_DEPTH) {                     //Lost if written while CRCFUL, as on the part
+            crcFifoCount++;
+            SimCrcShift(crcDatL);
+        }
+    }
+    if(crcCon1.bits.CRCGO) {
+        while(crcFifoCount > 0 && crcShifted + perWord <= simCycles) {
+            crcShifted += perWord;
+            crcFifoCount--;
+        }
+    }
+    crcCon1.bits.CRCFUL = crcFifoCount == SIM_CRC_FIFO_DEPTH;
+    crcCon1.bits.CRCMPT = crcFifoCount == 0;
+    crcCon1.bits.VWORD = crcFifoCount;
+    crcConLast = crcCon1.Val;
+}
+
+SIM_CRCCON1 *SimCRCCON1(void)
+{
+    SimStep(SIM_SFR_CYCLES);                                        //Picks up the previous write
+    SimCrcUpdate();
+    return &crcCon1;
+}
+
+WORD *SimCRCDATL(void)
+{
+    SimStep(SIM_SFR_CYCLES);
+    SimCrcUpdate();
+    crcDataPending = 1;                                             //Only ever written, taken at the next access
+    return &crcDatL;
+}
+
+WORD *SimCRCWDAT(BYTE high)
+{
+    SimStep(SIM_SFR_CYCLES);
+    SimCrcUpdate();
+    return &crcWdat[high];
+}
+
+//Flash controller *****************************************************************
+WORD SimTblRead(WORD addrLo, BYTE high)
+{
+    DWORD addr = ((DWORD)TBLPAG << 16) | addrLo;
+    DWORD word;
+
+    if((++tblReads & (SIM_TBL_STEP - 1)) == 0) {
+        SimStep(2);                                                 //A blank check or CRC loop is interruptible on the part
+    } else {
+        simCycles += 2;
+    }
+    if((addr >> 1) >= SIM_FLASH_WORDS) {
+        return 0;
+    }
+    word = simFlash[addr >> 1];
+    return high ? (WORD)(word >> 16) : (WORD)word;
+}
+
+void SimTblWrite(WORD addrLo, WORD data, BYTE high)
+{
+    DWORD addr = ((DWORD)TBLPAG << 16) | addrLo;
+    DWORD *slot = &latch[(addr >> 1) & (PM_ROW_SIZE/4 - 1)];
+
+    simCycles += 2;
+    if(high) {
+        *slot = (*slot & 0x00FFFF) | ((DWORD)(data & 0xFF) << 16);
+    } else {
+        *slot = (*slot & 0xFF0000) | data;
+    }
+    latchAddr = addr;
+}
+
+//Keeps the words an NVM operation is about to change, for SimPowerCut
+static void SimUndo(DWORD base, DWORD count)
+{
+    if(base + count > SIM_FLASH_WORDS) {
+        count = base < SIM_FLASH_WORDS ? SIM_FLASH_WORDS - base : 0;
+    }
+    memcpy(nvmUndo, simFlash + base, count * sizeof(DWORD));
+    nvmUndoBase = base;
+    nvmUndoCount = count;
+}
+
+static void SimProgram(DWORD word, DWORD data)
+{
+    if((simFlash[word] & data) != data) {                           //Needs a 0 to become 1, only an erase does that
+        simStats.nvmOverwrites++;
+    }
+    simFlash[word] &= data;
+}
+
+void SimWriteNVM(void)
+{
+    DWORD base;
+    DWORD i;
+    uint64_t stall;
+
+    if(simCycles < nvmBusyUntil) {
+        SimFatal("NVM operation started while busy");
+    }
+
+    switch(NVMCON) {
+        case PM_PAGE_ERASE:
+            base = (latchAddr & ~(DWORD)(PM_PAGE_SIZE/2 - 1)) >> 1;
+            SimUndo(base, PM_PAGE_SIZE/4);
+            for(i = 0; i < PM_PAGE_SIZE/4 && base + i < SIM_FLASH_WORDS; i++) {
+                simFlash[base + i] = 0xFFFFFF;
+            }
+            stall = SIM_US(simPageEraseUs);
+            break;
+        case PM_ROW_WRITE:
+            base = (latchAddr & ~(DWORD)(PM_ROW_SIZE/2 - 1)) >> 1;
+            SimUndo(base, PM_ROW_SIZE/4);
+            for(i = 0; i < PM_ROW_SIZE/4 && base + i < SIM_FLASH_WORDS; i++) {
+                SimProgram(base + i, latch[i]);
+                latch[i] = 0xFFFFFF;
+            }
+            stall = SIM_US(simRowWriteUs);
+            break;
+        #ifdef DEV_HAS_WORD_WRITE
+        case PM_WORD_WRITE:
+            i = (latchAddr >> 1) & (PM_ROW_SIZE/4 - 1);
+            SimUndo(latchAddr >> 1, 1);
+            if((latchAddr >> 1) < SIM_FLASH_WORDS) {
+                SimProgram(latchAddr >> 1, latch[i]);
+            }
+            latch[i] = 0xFFFFFF;
+            stall = SIM_US(simWordWriteUs);
+            break;
+        #endif
+        default:
+            SimFatal("unsupported NVMCON operation");
+            return;
+    }
+
+    nvmBusyUntil = simCycles + stall;
+    simStats.nvmCycles += stall;
+    simStats.nvmOps++;
+}
+
+DWORD SimTblAddress(void (*handler)(void))
+{
+    #ifdef USE_UART_ISR
+        if(handler == UxRXInterrupt) {
+            return SIM_RX_VECTOR;
+        }
+        if(handler == UxTXInterrupt) {
+            return SIM_TX_VECTOR;
+        }
+    #endif
+    (void)handler;
+    return BOOT_ADDR_LOW;
+}
+
+//Power lost: an NVM operation still running gets halfway, the words past that keep their old contents
+void SimPowerCut(void)
+{
+    DWORD i;
+
+    if(simCycles >= nvmBusyUntil) {
+        return;
+    }
+    for(i = nvmUndoCount / 2; i < nvmUndoCount; i++) {
+        simFlash[nvmUndoBase + i] = nvmUndo[i];
+    }
+    nvmBusyUntil = simCycles;
+}
+
+void SimResetDevice(WORD addr)
+{
+    SimHostFinish(addr);
+    exit(0);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include "p24fxxxx.h"
+
+#define SIM_FCY                 16000000ULL                         //Must match FCY in BootLoader.h
+#define SIM_US(us)              ((uint64_t)(us) * (SIM_FCY / 1000000ULL))
+#define SIM_FLASH_WORDS         (0x2AC00 / 2)                       //PIC24FJ256GB206 user flash incl. config page
+
+#define SIM_ROW_WRITE_US        2000                                //Default NVM stall per operation, datasheet typical
+#define SIM_PAGE_ERASE_US       20000
+#define SIM_WORD_WRITE_US       45
+
+#define SIM_BREAK               0x100                               //SimHostTxByte: a character time of break, NUL with FERR
+#define SIM_RX_VECTOR           0x000600                            //Fake handler addresses, see SimTblAddress
+#define SIM_TX_VECTOR           0x000640
+
+typedef struct {
+    uint64_t rxBytes;                                               //Bytes the host put on the wire
+    uint64_t rxLost;                                                //Bytes dropped by a full RX FIFO (OERR)
+    uint64_t rxDuringNvm;                                           //Bytes that arrived while an NVM operation ran
+    uint64_t txBytes;                                               //Bytes the device put on the wire
+    uint64_t txUndriven;                                            //Bytes sent with the RS-485 driver off for part of them
+    uint64_t rxWhileDriving;                                        //Bytes missed with the receiver off, DE high
+    uint64_t nvmCycles;                                             //Cycles spent with NVMCONbits.WR set
+    uint64_t nvmOps;
+    uint64_t nvmOverwrites;                                         //Words programmed over a 0 bit without an erase
+    uint64_t rxIsr;                                                 //Interrupt dispatch counts
+    uint64_t txIsr;
+} SimStats;
+
+extern uint64_t simCycles;                                          //Virtual instruction clock
+extern uint64_t simBitCycles;                                       //0 = follow UxBRG/BRGH, otherwise forced
+extern uint64_t simHostBitCycles;                                   //Host's own rate, 0 = always the device's
+extern SimStats simStats;
+extern DWORD simFlash[SIM_FLASH_WORDS];
+extern uint64_t simRowWriteUs;                                      //NVM stalls in use, see SimSetNvm
+extern uint64_t simPageEraseUs;
+extern uint64_t simWordWriteUs;
+extern int simBootPin;                                              //BOOT_PIN_ACTIVE() strap
+extern int simDriverEnable;                                         //RS485_DE, wired to /RE too
+extern int simDriverTris;                                           //RS485_DE_TRIS, an input means a point to point link
+extern int simNodeAddr;                                             //NODE_ADDRESS_PINS()
+
+void SimInit(void);
+uint64_t SimByteCycles(void);
+uint64_t SimHostByteCycles(void);
+int SimSetNvm(const char *arg);
+void SimPowerCut(void);
+
+//Provided by the host model (SimHost.c, or TransportHost.c in bootpty)
+void SimHostUpdate(uint64_t now);
+int SimHostTxByte(uint64_t now);                                    //Next byte, SIM_BREAK or -1 for an idle line
+void SimHostRxByte(BYTE data, uint64_t now);
+void SimHostFinish(WORD addr);
+
+#endif /*SIM_H*/
@@ -0,0 +1,2650 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host side of the simulator: an AN851 programmer that erases, writes
+ * and verifies a random application image through the simulated UART,
+ * then reports how long the update took and what happened on the line.
+ *
+ * usage: bootsim [--rows N] [--baud B] [--ahead N] [--window N] [--large]
+ *                [--latency US] [--timeout MS] [--seed S] [--patch P]
+ *                [--lz] [--image random|app] [--hex FILE]
+ *                [--switch RATE] [--switch-host RATE] [--nvm ROW,PAGE,WORD]
+ *                [--save-hex FILE] [--crc 16|32] [--swap N] [--cobs]
+ *                [--slot none|a|fallback] [--cut N]
+ *                [--boot blank|app|damaged|magic|break|pin] [--node N] [--nodes K]
+ *                [--flash FILE] [--auto-erase] [--batch] [--no-delay] [--partial]
+ *        bootsim --pty [--baud B] [--nvm ROW,PAGE,WORD] [--slot none|a|fallback]
+ *
+ * --ahead keeps N unsequenced AN851 frames in flight; 1 is classic
+ * stop-and-wait. --window opens a SESSION and sends sequenced frames,
+ * using whatever window the device grants. --large asks the SESSION for
+ * 16-bit length packets and writes as many rows per frame as fit.
+ * --latency delays every response seen by the host, like a USB-serial
+ * adapter does. --patch starts from a device that already holds the
+ * image but for P pages, reads the page CRC map and rewrites only the
+ * pages that differ. --lz sends the rows as WT_FLASH_LZ streams, as
+ * many rows per frame as compress into one packet. --image app replaces
+ * the random image, which does not compress, with one shaped like an
+ * application: code drawn from a skewed set of instruction words,
+ * constant tables, then blank flash. --hex loads an Intel HEX file from
+ * the PIC24 toolchain instead; only what lies past BOOT_ADDR_HI is used.
+ * --switch starts at BAUDRATE and sends SET_BAUD for RATE after RD_VER;
+ * --switch-host makes the host move to a different rate than it asked
+ * for, so the confirmation fails and both ends fall back. --nvm sets the
+ * row write, page erase and word write stalls in microseconds.
+ * --crc asks the SESSION for CRC-16 or CRC-32 frames in place of the
+ * checksum. --swap N swaps two adjacent data bytes in the first sending
+ * of every Nth write frame, an error the checksum cannot see. --cobs
+ * asks for COBS framing and sends every frame after the SESSION so.
+ * --auto-erase asks the SESSION to erase each page on its first write
+ * and leaves out the ER_FLASH, the write frames wait for the erase too.
+ * --batch sends the closing VERIFY_RANGE and VERIFY_OK as one BATCH
+ * frame, and with --patch the erases of the pages a CRC map reply
+ * shows differ as one BATCH ahead of their rows; with --large as well
+ * each page's erase, rows and a range over them, and page 0's erase and
+ * rows in the closing BATCH. --no-delay leaves the
+ * DELAY_TIME_ADDR word of page 0 blank, as an image that carries no
+ * delay does, so VERIFY_OK must commit DEFAULT_DELAY. The device is then
+ * powered up again with no host on the line, and must wait in the
+ * bootloader for that long before it runs the application. --partial
+ * sends the closing VERIFY_RANGE over the first half of the image only,
+ * with the digest of that half, so it matches; the rows past it were
+ * written but never checked, and VERIFY_OK must commit nothing. Not with
+ * --patch, whose ranges over each page cover the rows anyway.
+ *
+ * With USE_DUAL_SLOT (bootsim-dual) the image goes to the slot RD_SLOT
+ * names. --slot sets what the device holds beforehand: nothing, a
+ * verified image in slot A, or images in both slots with the newer one
+ * in A damaged, so the device has fallen back to B. --cut N stops the
+ * update after N frames and resets the device. The run ends with the
+ * slot the next power-up would pick, which must be the new image after
+ * a full update and the old one after a cut.
+ *
+ * With USE_FAST_BOOT alone (bootsim-fast) --boot sets what the device holds
+ * at power-up: nothing, or a verified application with its header. With
+ * "app" the device must run it at once, without a frame exchanged;
+ * "damaged" spoils a word after the header was written, "magic" leaves
+ * BOOT_MAGIC in RAM, "break" holds RX low through the reset and "pin"
+ * sets the strap, and in each of those the update must go ahead. An
+ * update ends with the header checked and the time the next power-up
+ * takes to reach the application.
+ *
+ * With USE_MULTIDROP (bootsim-bus) the device is node --node on an RS-485
+ * bus of --nodes, the others stood in for by their frames on the line.
+ * Each node is opened in turn, the erase and the rows are broadcast once
+ * with a pause for the NVM stall in place of an ack, then every node is
+ * verified, committed and reset, this one last. If its VERIFY_RANGE does
+ * not match, as --swap makes happen, the pages that differ are rewritten
+ * to it alone from the CRC map before it is committed.
+ *
+ * With USE_JOURNAL (bootsim-journal) the update starts a new journal
+ * with JOURNAL_BEGIN. --cut N then cuts the power while the device is
+ * halfway into the NVM stall of frame N, leaving that row or page half
+ * done, and saves the flash to the --flash FILE. If FILE exists the
+ * device powers up with that flash instead of a blank one, the host reads
+ * the journal and, if the tag names this image and the journal is not
+ * full, sends only the pages and rows not recorded as finished, then
+ * page 0 and the rest of a normal update. Otherwise it starts over.
+ * With --pty and --flash the power goes when the host closes the pty
+ * without a RESET, so a tool cut short can be resumed the same way.
+ *
+ * With USE_AES (bootsim-aes) every row goes out encrypted, AES-128 CTR
+ * over the image packed 3 bytes per instruction, the counter blocks
+ * made here from AesEncrypt and the nonce sent with SET_NONCE after
+ * RD_VER. The device must decrypt each row to the plain image for the
+ * verify to pass.
+ *
+ * With USE_SIGN (bootsim-sign) the rows are hashed here as WritePM hashes
+ * them, signed with the private key of the example SIGN_PUBLIC_KEY, and
+ * SIGNATURE goes after RD_VER, then ER_FLASH for every page below the
+ * config page that the rows do not erase themselves. --sign bad sends a
+ * signature with a bit of s flipped and none sends no SIGNATURE. The
+ * other two write a row ahead of SIGNATURE and leave its page out of
+ * the erase: and clears a bit of every instruction of the first row,
+ * which the signed row then goes over, so flash holds the two ANDed;
+ * inject puts a row on the page past the image. In all four the verify
+ * ranges match, as a host that knows what it left behind would make
+ * them, but VERIFY_OK must commit nothing. Not with --patch, which only
+ * learns what rows to send from the CRC map, nor and with --auto-erase,
+ * whose erase takes the row out again.
+ *
+ * --pty replaces the scripted programmer with a pty (SimPty.c) that any
+ * AN851 host tool can open; the device side is simulated as above.
+ * --save-hex FILE writes the image a session would send as Intel HEX and
+ * exits, to feed such a tool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Sim.h"
+#include "SimLz.h"
+#include "SimPty.h"
+#include "BootLoader.h"
+#include "Lz.h"
+#include "Aes.h"
+#include "Sha256.h"
+#include "Sign.h"
+
+#ifndef USE_LZ                                                      //Buffer sizes for options the checks in main() refuse
+#define LZ_MAX_ROWS             1
+#endif
+#ifndef USE_BATCH
+#define BATCH_MAX_OPS           1
+#endif
+#ifndef USE_BAUD_SWITCH
+#define BAUD_CONFIRM_MS         0
+#endif
+
+#define HOST_MAX_FRAMES     4096
+#define HOST_MAX_WIRE       (2 * (MAX_PACKET_SIZE + MAX_CHECK_SIZE) + 8)
+#define HOST_APP_BASE       (BOOT_ADDR_HI + 1)                      //First application row after the bootloader
+#define PAGE0_ROWS          (PM_PAGE_SIZE / PM_ROW_SIZE)
+#define HOST_DELAY          0x000005                                //Bootloader entry delay written at DELAY_TIME_ADDR
+#define HOST_MAX_EVENTS     256
+#define HOST_MAX_PAGES      (SIM_FLASH_WORDS / (PM_PAGE_SIZE/4))
+#define HOST_BOOT_ROWS      64                                      //--boot: size of the application already there
+
+#if defined(USE_FAST_BOOT) && !defined(USE_DUAL_SLOT)
+#define HOST_FAST_BOOT                                              //With dual slots the slot records are the header, see --slot
+#endif
+
+#ifdef USE_MULTIDROP
+#define HOST_ADDR_BYTES     1                                       //Node address before the command
+#define HOST_PEER_TURN_US   100                                     //Another node's reply after the request, driver enable included
+#define HOST_PEER_CRC_US    48                                      //Per row of its VERIFY_RANGE, as this device takes
+#define HOST_PEER_COMMIT_US 2000                                    //Its VERIFY_OK, a row write's worth
+#define HOST_BUS_MARGIN_US  1000                                    //After a broadcast's NVM stall, before the next frame
+#else
+#define HOST_ADDR_BYTES     0
+#endif
+
+typedef struct {
+    BYTE wire[HOST_MAX_WIRE];                                       //Encoded frame as sent
+    WORD wireLen;
+    BYTE cmd;
+    WORD length;
+    int seq;                                                        //-1 when the frame is not sequenced
+    BYTE barrier;                                                   //Nothing follows until this one is acknowledged
+    BYTE raw;                                                       //Baud confirmation bytes, not a frame
+    BYTE cobs;                                                      //wire[0] is left out after an STX, see GetCobsFrame()
+    uint64_t timeout;
+    uint64_t sentAt;                                                //Time the last byte left the host
+    WORD swapAt;                                                    //--swap: wire[swapAt] and the next are exchanged, 0 for none
+    uint64_t hold;                                                  //No reply, counts as acknowledged this long after sending
+    BYTE subs[BATCH_MAX_OPS];                                       //BATCH: the command of each sub-command, for its result
+} HostFrame;
+
+typedef struct {
+    uint64_t at;                                                    //Time the host sees the response
+    BYTE ok;
+    BYTE cmd;
+    BYTE seq;
+    BYTE arg;                                                       //buffer[5] of the response
+    BYTE arg2;                                                      //buffer[6] of the response
+    BYTE status;                                                    //buffer[1] of the response
+    BYTE confirm;                                                   //Baud confirmation echo, not a frame
+    WORD dataLen;                                                   //RD_CRC_MAP payload
+    BYTE data[MAX_DATA_SIZE];
+} HostEvent;
+
+static HostFrame frames[HOST_MAX_FRAMES];
+static int frameCount;
+static int sendIdx;                                                 //Frame currently or next being sent
+static int sendPos;                                                 //Byte position within frames[sendIdx]
+static int ackIdx;                                                  //Frames acknowledged so far
+static uint64_t lastProgress;                                       //Time of the last acknowledgement
+static int goBack = -1;                                             //Resend from here at the next frame boundary
+static int ahead;                                                   //Frames allowed in flight
+static int sequenced;                                               //Responses carry a sequence number
+static int retries;
+static int naks;
+static int staleAcks;
+static int badResponses;
+
+static HostEvent events[HOST_MAX_EVENTS];
+static int eventHead;
+static int eventTail;
+
+static int rxState;                                                 //Response parser
+static int rxEscape;
+static int rxCobsLeft;                                              //Data bytes left in the COBS block
+static int rxCobsImplied;                                           //STX due before the next block
+static int txStx;                                                   //Last byte sent was an STX
+static BYTE rxFrame[MAX_PACKET_SIZE + MAX_CHECK_SIZE + 1];
+static int rxLen;
+
+static int optRows = 256;
+static long optBaud;
+static int optAhead = 1;
+static int optWindow;
+static int optLarge;
+static long optLatencyUs;
+static long optTimeoutMs = 250;
+static unsigned optSeed = 1;
+static int optPatch = -1;
+static int optLz;
+static int optImageApp;
+static const char *optHex;
+static const char *optSaveHex;
+static int optCrc;                                                  //Frame CRC bits, 0 for the checksum
+static int optCobs;
+static int optSwap;
+static int optAutoErase;
+static BYTE autoErased[HOST_MAX_PAGES];                              //Pages a write frame has reached, so erased by the device
+static long autoErasePages;
+static int optBatch;
+static int batchRange = -1;                                         //Frame of the BATCH whose first sub-command is the VERIFY_RANGE
+static int batchFrames;
+static int batchOps;
+static int batchFailed;                                             //Statuses other than BATCH_OK and BATCH_SKIPPED
+static int batchSkipped;
+static int swapWrites;                                              //Write frames counted for --swap
+static DWORD appBase = HOST_APP_BASE;                               //Where the image goes
+#if (defined(USE_DUAL_SLOT) || defined(USE_JOURNAL))
+static int optCut;
+#endif
+#ifdef USE_DUAL_SLOT
+static const char *optSlot = "none";
+static int slotRecords;                                             //Records --slot wrote
+static DWORD slotExpect;                                            //Reset address once the run is over
+static int slotReply = -1;                                          //RD_SLOT: active slot, -1 before the reply
+static DWORD slotReplyBase;
+#endif
+#ifdef HOST_FAST_BOOT
+static const char *optBoot = "blank";
+static int bootBreak;                                               //Hold RX low until the device has looked
+#endif
+#ifdef USE_MULTIDROP
+static int optNodes = 1;
+static int busDest = -1;                                            //Address byte of the frames HostAddFrame makes
+static int busRepair;                                               //VERIFY_RANGE failed after the broadcast, pages rewritten
+static int busBroadcasts;
+static int busPeerFrames;                                           //Requests to and replies from the other nodes
+#endif
+#ifdef USE_JOURNAL
+static const char *optFlash;
+static int journalResume;                                           //Powered up from --flash, the journal decides what to send
+static DWORD journalTag;                                            //CRC-32 of the image
+static DWORD journal[JOURNAL_WORDS];                                //Entries read back so far
+static int journalCount = -1;                                       //As the device reported it, -1 before the reply
+static int journalCapacity;
+static DWORD journalDeviceTag;
+static int journalRead;
+static int journalQuery;                                            //A JOURNAL read is out, HostJournal takes the reply
+static int journalStartOver;                                        //Unusable journal, a full update instead
+static int journalPagesErased;                                      //Pages erased again on resume
+static int journalRowsSent;
+#endif
+static int swapFrames;
+static int optNoDelay;
+static int optPartial;                                              //Closing range over half the image, VERIFY_OK must not commit
+static DWORD expectDelay = HOST_DELAY;                              //What VERIFY_OK must commit
+static uint64_t powerUpAt;                                          //--no-delay: the second power-up, 0 before it
+static WORD powerUpEntry;                                           //Where the update left for, and so must the power-up
+
+static BYTE rows[(PAGE0_ROWS + SIM_FLASH_WORDS / (PM_ROW_SIZE/4)) * PM_ROW_SIZE];
+#ifdef USE_AES
+static BYTE sealed[sizeof(rows)];                                   //rows encrypted, what goes on the line
+static BYTE nonce[AES_NONCE_SIZE] = {'b', 'o', 'o', 't', 's', 'i', 'm', 0};
+#endif
+#ifdef USE_SIGN
+static const char *optSign = "good";
+static SHA256_CTX signHash;                                         //Rows in the order they go out
+static BYTE signature[SIGN_SIZE];
+static const DWORD signKey[8] = {                                   //RFC 6979 A.2.5 private key, least significant word first
+    0x120F6721, 0x7B8A622B, 0x36E89B12, 0x4E50C3DB,
+    0x67B1D693, 0x6B5C2157, 0x45BA7516, 0xC9AFA9D8
+};
+static const DWORD signOrder[8] = {                                 //Group order n
+    0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+    0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF
+};
+static int signRefused;                                             //Any --sign but good, VERIFY_OK must not commit
+static BYTE signAttack[PM_ROW_SIZE];                                //--sign and or inject, the row sent ahead of SIGNATURE
+static DWORD signAttackAddr;
+static const DWORD signGx[8] = {                                    //Base point x, below n
+    0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81,
+    0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2
+};
+#endif
+static DWORD imageEnd;                                              //First address past the application
+static DWORD rangeCrc;                                              //VERIFY_RANGE digest the host expects
+static int rangeMismatch = -1;                                      //-1 until the digest arrives
+static DWORD mapPage;                                               //Next page the CRC map reports
+static DWORD mapEnd;
+static int pagesWritten;
+static long lzFrames;
+static long lzRows;
+static long lzBytes;                                                //Compressed stream bytes sent, before framing
+static int lzRejected;
+static long pagesErased;                                            //From the ER_FLASH replies
+static long pagesSkipped;
+static long optSwitch;
+static long optSwitchHost;
+static int optPty;
+static uint64_t switchFromBitCycles;                                //Host rate to fall back to
+static int switchResult = -1;                                       //-1 not tried, 0 fell back, 1 switched, 2 refused
+static const BYTE switchConfirm[] = BAUD_CONFIRM_BYTES;
+static int switchMatch;                                             //Confirmation bytes echoed so far
+#ifdef USE_STATS
+static DWORD devStats[STATS_COUNT + 1];                             //RD_STATS reply, FCY first
+static int devStatsRead;
+#endif
+
+static DWORD image[SIM_FLASH_WORDS];                                //Expected flash contents
+
+#if (defined(USE_DUAL_SLOT) || defined(USE_FAST_BOOT))              //Firmware state SimHostFinish looks at
+extern DWORD_VAL userReset;
+#endif
+#ifdef HOST_FAST_BOOT
+extern DWORD bootMagic;
+#endif
+#ifdef USE_STATS
+extern BYTE statsClock;
+#endif
+#ifdef USE_DUAL_SLOT
+extern BYTE activeSlot;
+extern volatile WORD writeKey1;
+extern volatile WORD writeKey2;
+#endif
+static BYTE imageUsed[SIM_FLASH_WORDS];
+
+//Frame encoding *******************************************************************
+static void HostPutEscaped(HostFrame *f, BYTE data)
+{
+    if(data == STX || data == ETX || data == DLE) {
+        f->wire[f->wireLen++] = DLE;
+    }
+    f->wire[f->wireLen++] = data;
+}
+
+//CRC-16/CCITT or CRC-32/MPEG-2, MSB first from all ones, bitwise
+static DWORD HostFrameCrc(const BYTE *data, int n, int bits)
+{
+    DWORD top = 1UL << (bits - 1);
+    DWORD mask = bits == 32 ? 0xFFFFFFFF : (1UL << bits) - 1;
+    DWORD poly = bits == 32 ? 0x04C11DB7 : 0x1021;
+    DWORD crc = mask;
+    int i, b;
+
+    for(i = 0; i < n; i++) {
+        crc ^= (DWORD)data[i] << (bits - 8);
+        for(b = 0; b < 8; b++) {
+            crc = ((crc & top) ? (crc << 1) ^ poly : crc << 1) & mask;
+        }
+    }
+    return crc;
+}
+
+//STX, COBS blocks with STX as the value removed, STX: see GetCobsFrame()
+//The opening STX is skipped when the line already carries one
+static void HostPutCobs(HostFrame *f, const BYTE *payload, int n, WORD *wirePos)
+{
+    int k = 0;
+    int j;
+    int code;
+
+    f->wire[f->wireLen++] = STX;
+    while(1) {
+        for(j = k; j < n && j - k < 254 && payload[j] != STX; j++) {
+        }
+        code = j - k + 1;
+        f->wire[f->wireLen++] = (BYTE)code ^ STX;
+        for(; k < j; k++) {
+            wirePos[k] = f->wireLen;
+            f->wire[f->wireLen++] = payload[k];
+        }
+        if(k == n) {
+            break;
+        }
+        if(code != 0xFF) {
+            wirePos[k++] = 0;                                       //Implied by the code byte
+        }
+    }
+    f->wire[f->wireLen++] = STX;
+}
+
+static HostFrame *HostAddFrame(BYTE cmd, WORD length, DWORD addr, const BYTE *data, int dataLen)
+{
+    static int nextSeq;
+    HostFrame *f;
+    BYTE payload[MAX_PACKET_SIZE + MAX_CHECK_SIZE];
+    WORD wirePos[MAX_PACKET_SIZE + MAX_CHECK_SIZE];
+    BYTE checksum = 0;
+    DWORD crc;
+    int n = 0;
+    int body;
+    int i;
+
+    if(frameCount == HOST_MAX_FRAMES) {
+        fprintf(stderr, "bootsim: too many frames\n");
+        exit(2);
+    }
+    f = &frames[frameCount++];
+    memset(f, 0, sizeof(*f));
+    f->cmd = cmd;
+    f->length = length;
+    f->seq = -1;
+    f->timeout = SIM_US(optTimeoutMs * 1000);
+
+#ifdef USE_MULTIDROP
+    payload[n++] = (BYTE)busDest;
+#endif
+    payload[n++] = cmd;
+    payload[n++] = (BYTE)length;
+    if(optLarge && cmd != SESSION) {
+        payload[n++] = (BYTE)(length >> 8);
+    }
+    if(length != 0) {
+        payload[n++] = (BYTE)addr;
+        payload[n++] = (BYTE)(addr >> 8);
+        payload[n++] = (BYTE)(addr >> 16);
+    }
+    memcpy(payload + n, data, dataLen);
+    n += dataLen;
+    if(optWindow && cmd != SESSION) {
+        f->seq = nextSeq++ & 0xFF;
+        payload[n++] = (BYTE)f->seq;
+    }
+
+    body = n;
+    if(optCrc && cmd != SESSION) {
+        crc = HostFrameCrc(payload, n, optCrc);
+        for(i = optCrc - 8; i >= 0; i -= 8) {                       //High byte first
+            payload[n++] = (BYTE)(crc >> i);
+        }
+    } else {
+        for(i = 0; i < n; i++) {
+            checksum += payload[i];
+        }
+        payload[n++] = (BYTE)(~checksum + 1);
+    }
+
+    if(optCobs && cmd != SESSION) {
+        HostPutCobs(f, payload, n, wirePos);
+        f->cobs = 1;
+    } else {
+        f->wire[f->wireLen++] = STX;
+        f->wire[f->wireLen++] = STX;
+        for(i = 0; i < n; i++) {
+            HostPutEscaped(f, payload[i]);
+            wirePos[i] = f->wireLen - 1;
+        }
+        f->wire[f->wireLen++] = ETX;
+    }
+
+    if(optSwap && (cmd == WT_FLASH || cmd == WT_FLASH_LZ) && ++swapWrites % optSwap == 0) {
+        for(i = body - dataLen + dataLen / 2; i + 1 < body; i++) {  //From the middle of the data
+            if(payload[i] != payload[i+1] && wirePos[i+1] == wirePos[i] + 1 &&
+               payload[i] != STX && payload[i] != ETX && payload[i] != DLE &&
+               payload[i+1] != STX && payload[i+1] != ETX && payload[i+1] != DLE) {
+                f->swapAt = wirePos[i];                             //Neither byte escaped, same length on the wire
+                swapFrames++;
+                break;
+            }
+        }
+    }
+    return f;
+}
+
+//Broadcasts are not acknowledged, the host waits out the NVM stall instead
+static void HostBusHold(HostFrame *f, uint64_t nvmUs)
+{
+#ifdef USE_MULTIDROP
+    if(busDest == NODE_BROADCAST) {
+        f->hold = SIM_US(nvmUs + HOST_BUS_MARGIN_US);
+        busBroadcasts++;
+    }
+#else
+    (void)f;
+    (void)nvmUs;
+#endif
+}
+
+//Pages the device erases before writing count rows from addr, with --auto-erase
+static uint64_t HostAutoErase(DWORD addr, int count)
+{
+    DWORD last = (addr + (DWORD)(count - 1) * (PM_ROW_SIZE/2)) / (PM_PAGE_SIZE/2);
+    DWORD p;
+    uint64_t n = 0;
+
+    for(p = addr / (PM_PAGE_SIZE/2); optAutoErase && p <= last && p < HOST_MAX_PAGES; p++) {
+        if(!autoErased[p]) {
+            autoErased[p] = 1;
+            autoErasePages++;
+            n++;
+        }
+    }
+    return n;
+}
+
+static long HostLzPack(const BYTE *rows, int count, BYTE *packed, long capacity)
+{
+    static BYTE raw[LZ_MAX_ROWS * (PM_ROW_SIZE/4) * 3];
+    long n = 0;
+    int i;
+
+    for(i = 0; i < count * PM_ROW_SIZE; i++) {                      //3 bytes per instruction, no phantom byte
+        if(i % 4 != 3) {
+            raw[n++] = rows[i];
+        }
+    }
+    return SimLzCompress(raw, n, packed, capacity);
+}
+
+static void HostAddLzRows(DWORD addr, const BYTE *rows, int count)
+{
+    static BYTE packed[MAX_DATA_SIZE];
+    long capacity = optLarge ? MAX_DATA_SIZE : 256;                 //AN851 sized packets unless the SESSION said otherwise
+    HostFrame *f;
+    int lo;
+    int hi;
+    int mid;
+    int n;
+    long size;
+    uint64_t e;
+
+    while(count > 0) {
+        lo = 1;                                                     //One row always fits, it is at most 3/4 of a packet
+        hi = count < LZ_MAX_ROWS ? count : LZ_MAX_ROWS;
+        while(lo < hi) {                                            //Most rows whose stream fits a packet
+            mid = (lo + hi + 1) / 2;
+            if(HostLzPack(rows, mid, packed, capacity) <= capacity) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        n = lo;
+        size = HostLzPack(rows, n, packed, capacity);
+
+        e = HostAutoErase(addr, n);
+        f = HostAddFrame(WT_FLASH_LZ, (WORD)n, addr, packed, (int)size);
+        f->timeout += SIM_US(((uint64_t)n * simRowWriteUs + e * simPageEraseUs) * 2);
+        HostBusHold(f, (uint64_t)n * simRowWriteUs + e * simPageEraseUs);
+        lzFrames++;
+        lzRows += n;
+        lzBytes += size;
+        addr += (DWORD)n * (PM_ROW_SIZE/2);
+        rows += n * PM_ROW_SIZE;
+        count -= n;
+    }
+}
+
+#ifdef USE_AES
+//CTR over the image packed 3 bytes per instruction: counter block n is the
+//nonce, then n big endian, and covers packed bytes 16n to 16n+15
+static void HostSeal(BYTE *out, DWORD addr, const BYTE *row)
+{
+    BYTE block[AES_BLOCK_SIZE];
+    DWORD packed = addr / 2 * 3;                                    //Packed image offset of the row
+    DWORD n = 0xFFFFFFFF;
+    int i;
+
+    for(i = 0; i < PM_ROW_SIZE; i++) {
+        out[i] = row[i];
+        if(i % 4 == 3) {
+            continue;                                               //Phantom byte, not encrypted
+        }
+        if(packed / AES_BLOCK_SIZE != n) {
+            n = packed / AES_BLOCK_SIZE;
+            memcpy(block, nonce, AES_NONCE_SIZE);
+            memset(block + AES_NONCE_SIZE, 0, AES_BLOCK_SIZE - AES_NONCE_SIZE);
+            block[12] = (BYTE)(n >> 24);
+            block[13] = (BYTE)(n >> 16);
+            block[14] = (BYTE)(n >> 8);
+            block[15] = (BYTE)n;
+            AesEncrypt(block);
+        }
+        out[i] ^= block[packed % AES_BLOCK_SIZE];
+        packed++;
+    }
+}
+
+//The encrypted copy of rows that plain points into
+static BYTE *HostSealed(const BYTE *plain)
+{
+    return sealed + (plain - rows);
+}
+#endif
+
+#ifdef USE_SIGN
+//r*d + e mod n, for 256-bit numbers least significant word first: the
+//product, then reduced a bit at a time from the top
+static void HostMulAddModN(DWORD *out, const DWORD *r, const DWORD *d, const DWORD *e)
+{
+    DWORD t[16] = {0};
+    DWORD acc[9] = {0};                                             //Below 2n, one word over
+    DWORD sub[9];
+    uint64_t c;
+    int borrow;
+    int bit;
+    int i;
+    int j;
+
+    for(i = 0; i < 8; i++) {
+        for(c = 0, j = 0; j < 8; j++) {
+            c += (uint64_t)r[i] * d[j] + t[i + j];
+            t[i + j] = (DWORD)c;
+            c >>= 32;
+        }
+        t[i + 8] = (DWORD)c;
+    }
+    for(c = 0, i = 0; i < 16; i++) {
+        c += (uint64_t)t[i] + (i < 8 ? e[i] : 0);
+        t[i] = (DWORD)c;
+        c >>= 32;
+    }
+    for(bit = 511; bit >= 0; bit--) {                               //acc = 2 acc + bit, less n if that reaches n
+        for(i = 8; i > 0; i--) {
+            acc[i] = acc[i] << 1 | acc[i - 1] >> 31;
+        }
+        acc[0] = acc[0] << 1 | ((t[bit / 32] >> (bit % 32)) & 1);
+        for(borrow = 0, i = 0; i < 9; i++) {
+            c = (uint64_t)acc[i] - (i < 8 ? signOrder[i] : 0) - borrow;
+            sub[i] = (DWORD)c;
+            borrow = (int)((c >> 32) & 1);
+        }
+        if(!borrow) {
+            memcpy(acc, sub, sizeof(acc));
+        }
+    }
+    memcpy(out, acc, 8 * sizeof(DWORD));
+}
+
+//The signature of the rows hashed into signHash, with nonce k = 1: R is
+//then the base point, r its x and s = e + r d mod n. That gives the key
+//away, which only does here because this one is published
+static void HostSign(void)
+{
+    BYTE digest[SHA256_SIZE];
+    DWORD e[8];
+    DWORD s[8];
+    int i;
+
+    Sha256Final(&signHash, digest);
+    for(i = 0; i < 8; i++) {
+        e[i] = (DWORD)digest[31 - 4*i] | (DWORD)digest[30 - 4*i] << 8 | (DWORD)digest[29 - 4*i] << 16 |
+               (DWORD)digest[28 - 4*i] << 24;
+    }
+    HostMulAddModN(s, signGx, signKey, e);
+    for(i = 0; i < 32; i++) {
+        signature[i] = (BYTE)(signGx[7 - i/4] >> (24 - 8*(i % 4)));
+        signature[32 + i] = (BYTE)(s[7 - i/4] >> (24 - 8*(i % 4)));
+    }
+    if(!strcmp(optSign, "bad")) {
+        signature[SIGN_SIZE - 1] ^= 0x01;
+    }
+}
+
+//The row --sign and or inject leaves ahead of SIGNATURE; image follows
+//it, so the verify ranges and the final compare expect it in flash
+static void HostSignAttack(DWORD end)
+{
+    DWORD w;
+    int i;
+
+    signAttackAddr = !strcmp(optSign, "and") ? appBase : (end + PM_PAGE_SIZE/2 - 1) & ~(DWORD)(PM_PAGE_SIZE/2 - 1);
+    for(i = 0; i < PM_ROW_SIZE/4; i++) {
+        w = signAttackAddr/2 + i;
+        if(!strcmp(optSign, "and")) {
+            signAttack[i*4 + 0] = 0xFF;
+            signAttack[i*4 + 1] = 0xFE;                             //Bit 8 of each instruction cleared
+            signAttack[i*4 + 2] = 0xFF;
+            image[w] &= 0xFFFEFF;
+        } else {
+            image[w] = (i == 0) ? (0x040000 | (appBase & 0xFFFF)) : 0x000000;
+            imageUsed[w] = 1;                                       //A goto, kept past the image
+            signAttack[i*4 + 0] = (BYTE)image[w];
+            signAttack[i*4 + 1] = (BYTE)(image[w] >> 8);
+            signAttack[i*4 + 2] = (BYTE)(image[w] >> 16);
+        }
+        signAttack[i*4 + 3] = 0;
+    }
+}
+
+//ER_FLASH for every page below the config page the rows will not erase
+//themselves, but the attack row's: a signature counts only once each of
+//them was erased after it
+static void HostAddSignErase(DWORD end)
+{
+    DWORD first = 0;
+    DWORD page;
+    int keep;
+    HostFrame *f;
+
+    for(page = 0; page < AUTO_ERASE_PAGES; page++) {
+        keep = page == AUTO_ERASE_PAGES - 1 || (signAttackAddr && page == signAttackAddr / (PM_PAGE_SIZE/2)) ||
+               (optAutoErase && (page == 0 || (page >= appBase / (PM_PAGE_SIZE/2) && page < (end + PM_PAGE_SIZE/2 - 1) / (PM_PAGE_SIZE/2))));
+        if(!keep) {
+            continue;
+        }
+        if(page > first) {
+            f = HostAddFrame(ER_FLASH, (BYTE)(page - first), first * (PM_PAGE_SIZE/2), NULL, 0);
+            f->timeout += SIM_US((uint64_t)f->length * simPageEraseUs * 2);
+            HostBusHold(f, (uint64_t)f->length * simPageEraseUs);
+        }
+        first = page + 1;
+    }
+}
+#endif
+
+static void HostAddRows(DWORD addr, const BYTE *rows, int count)
+{
+    HostFrame *f;
+    int n;
+    uint64_t e;
+
+#ifdef USE_AES
+    rows = HostSealed(rows);
+#endif
+    if(optLz) {
+        HostAddLzRows(addr, rows, count);
+        return;
+    }
+    while(count > 0) {
+        n = optLarge ? MAX_DATA_SIZE / PM_ROW_SIZE : 1;
+        if(n > count) {
+            n = count;
+        }
+        e = HostAutoErase(addr, n);
+        f = HostAddFrame(WT_FLASH, (WORD)n, addr, rows, n * PM_ROW_SIZE);
+        f->timeout += SIM_US(((uint64_t)n * simRowWriteUs + e * simPageEraseUs) * 2);
+        HostBusHold(f, (uint64_t)n * simRowWriteUs + e * simPageEraseUs);
+        addr += (DWORD)n * (PM_ROW_SIZE/2);
+        rows += n * PM_ROW_SIZE;
+        count -= n;
+    }
+}
+
+static DWORD HostCrc32(DWORD addr, DWORD bytes)
+{
+    DWORD crc = 0xFFFFFFFF;
+    DWORD w;
+    DWORD i;
+    int b;
+
+    for(i = 0; i < bytes; i++) {                                    //Bitwise, independent of the device's table
+        w = image[addr/2 + i/4];
+        crc ^= (i % 4 == 3) ? 0 : (BYTE)(w >> (8 * (i % 4)));
+        for(b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+    }
+    return ~crc;
+}
+
+//A BATCH sub-command at p, returns its size
+static int HostPutSub(BYTE *p, BYTE cmd, WORD length, DWORD addr, const BYTE *data, int dataLen)
+{
+    p[0] = cmd;
+    p[1] = (BYTE)length;
+    p[2] = (BYTE)(length >> 8);
+    p[3] = (BYTE)addr;
+    p[4] = (BYTE)(addr >> 8);
+    p[5] = (BYTE)(addr >> 16);
+    if(dataLen > 0) {
+        memcpy(p + BATCH_HEADER_SIZE, data, dataLen);
+    }
+    return BATCH_HEADER_SIZE + dataLen;
+}
+
+static void HostAddPage(DWORD addr, int erase)
+{
+    HostFrame *f;
+
+    if(erase) {
+        f = HostAddFrame(ER_FLASH, 1, addr, NULL, 0);
+        f->timeout += SIM_US(simPageEraseUs * 2);
+        HostBusHold(f, simPageEraseUs);
+    }
+    HostAddRows(addr, rows + (PAGE0_ROWS + (addr - appBase) / (PM_ROW_SIZE/2)) * PM_ROW_SIZE, PAGE0_ROWS);
+    pagesWritten++;
+}
+
+//A BATCH of count sub-commands, n bytes at subs
+static HostFrame *HostAddBatch(const BYTE *subs, int n, int count)
+{
+    HostFrame *f = HostAddFrame(BATCH, (WORD)count, 0, subs, n);
+    int k = 0;
+    int i;
+
+    for(i = 0; i < count; i++) {
+        f->subs[i] = subs[k];
+        k += BATCH_HEADER_SIZE + (subs[k] == WT_FLASH ? (subs[k+1] | subs[k+2] << 8) * PM_ROW_SIZE :
+                                  subs[k] == VERIFY_RANGE ? 7 : 0);
+    }
+    batchFrames++;
+    batchOps += count;
+    return f;
+}
+
+//--batch --large: erases and rows go in BATCH frames too. A small packet
+//holds one row and no more, LZ rows are a command of their own, and auto
+//erase needs no ER_FLASH.
+static int HostBatchRows(void)
+{
+    return optBatch && optLarge && !optLz && !optAutoErase;
+}
+
+//--batch: with HostBatchRows() each page goes as its ER_FLASH, its rows
+//and a VERIFY_RANGE over them, as many pages to a BATCH as its data
+//holds. Otherwise the erases go as one BATCH ahead of the rows.
+static void HostAddPages(const DWORD *pages, int count)
+{
+    static BYTE subs[MAX_DATA_SIZE];
+    const BYTE *data;
+    HostFrame *f;
+    DWORD crc;
+    BYTE range[7];
+    int n = 0;
+    int ops;
+    int i;
+
+    if(count <= 0) {
+        return;
+    }
+    if(!HostBatchRows()) {
+        for(i = 0; i < count; i++) {
+            n += HostPutSub(subs + n, ER_FLASH, 1, pages[i], NULL, 0);
+        }
+        f = HostAddBatch(subs, n, count);
+        f->timeout += SIM_US((uint64_t)count * simPageEraseUs * 2);
+        for(i = 0; i < count; i++) {
+            HostAddPage(pages[i], 0);
+        }
+        return;
+    }
+    for(i = 0; i < count; ) {
+        for(n = 0, ops = 0; i < count && ops + 3 <= BATCH_MAX_OPS &&
+            n + 3 * BATCH_HEADER_SIZE + PM_PAGE_SIZE + 7 <= MAX_DATA_SIZE; i++, ops += 3) {
+            data = rows + (PAGE0_ROWS + (pages[i] - appBase) / (PM_ROW_SIZE/2)) * PM_ROW_SIZE;
+#ifdef USE_AES
+            data = HostSealed(data);
+#endif
+            crc = HostCrc32(pages[i], PM_PAGE_SIZE);
+            range[0] = (BYTE)(pages[i] + PM_PAGE_SIZE/2);
+            range[1] = (BYTE)((pages[i] + PM_PAGE_SIZE/2) >> 8);
+            range[2] = (BYTE)((pages[i] + PM_PAGE_SIZE/2) >> 16);
+            range[3] = (BYTE)crc;
+            range[4] = (BYTE)(crc >> 8);
+            range[5] = (BYTE)(crc >> 16);
+            range[6] = (BYTE)(crc >> 24);
+            n += HostPutSub(subs + n, ER_FLASH, 1, pages[i], NULL, 0);
+            n += HostPutSub(subs + n, WT_FLASH, PAGE0_ROWS, pages[i], data, PM_PAGE_SIZE);
+            n += HostPutSub(subs + n, VERIFY_RANGE, 1, pages[i], range, 7);
+            pagesWritten++;
+        }
+        f = HostAddBatch(subs, n, ops);
+        f->timeout += SIM_US((uint64_t)(ops / 3) * (simPageEraseUs + PAGE0_ROWS * simRowWriteUs) * 2);
+    }
+}
+
+static void HostAddCrcMap(void)
+{
+    DWORD n = mapEnd - mapPage;
+
+    if(n > MAX_DATA_SIZE/4) {
+        n = MAX_DATA_SIZE/4;
+    }
+    HostAddFrame(RD_CRC_MAP, (WORD)n, mapPage * (PM_PAGE_SIZE/2), NULL, 0);
+}
+
+//The counters, then RESET
+static void HostAddReset(void)
+{
+#ifdef USE_STATS
+    BYTE options = 0;                                               //Read without clearing
+
+    HostAddFrame(RD_STATS, 1, 0, &options, 1);
+#endif
+    HostAddFrame(RD_VER, 0, 0, NULL, 0);                            //Length 0 is RESET
+}
+
+static void HostAddCommit(void)
+{
+    HostAddFrame(VERIFY_OK, 1, 0, NULL, 0);
+    HostAddReset();
+}
+
+//On the bus HostRange commits once the digest is in, or repairs first
+static void HostAddFinish(void)
+{
+    HostFrame *f;
+    BYTE range[7];
+    DWORD end = imageEnd;
+    int page0 = 0;
+#ifndef USE_MULTIDROP
+    static BYTE subs[4 * BATCH_HEADER_SIZE + PM_PAGE_SIZE + 7];
+    const BYTE *data = rows;
+    int ops = 2;
+    int n = 0;
+#endif
+
+#ifdef USE_MULTIDROP
+    if(busRepair) {
+#elif defined(USE_JOURNAL)
+    if(optPatch >= 0 || journalResume) {                            //The reset vector and delay went with the power, send them again
+#else
+    if(optPatch >= 0) {
+#endif
+        page0 = 1;                                                  //Page 0 holds the bootloader's own words, always rewrite
+    }
+#ifndef USE_MULTIDROP
+    if(page0 && HostBatchRows()) {                                  //Into the closing BATCH below
+#ifdef USE_AES
+        data = HostSealed(rows);
+#endif
+        n = HostPutSub(subs, ER_FLASH, 1, 0, NULL, 0);
+        n += HostPutSub(subs + n, WT_FLASH, PAGE0_ROWS, 0, data, PM_PAGE_SIZE);
+        ops = 4;
+        page0 = 0;
+    }
+#endif
+    if(page0) {
+        f = HostAddFrame(ER_FLASH, 1, 0, NULL, 0);
+        f->timeout += SIM_US(simPageEraseUs * 2);
+        HostAddRows(0, rows, PAGE0_ROWS);
+    }
+
+    if(optPartial) {                                                //Whole rows, the first half of them
+        end = appBase + (imageEnd - appBase) / PM_ROW_SIZE * (PM_ROW_SIZE/2);
+    }
+    rangeCrc = HostCrc32(appBase, (end - appBase) * 2);
+    range[0] = (BYTE)end;                                           //Page 0 is the bootloader's to change, check the rest
+    range[1] = (BYTE)(end >> 8);
+    range[2] = (BYTE)(end >> 16);
+    range[3] = (BYTE)rangeCrc;
+    range[4] = (BYTE)(rangeCrc >> 8);
+    range[5] = (BYTE)(rangeCrc >> 16);
+    range[6] = (BYTE)(rangeCrc >> 24);
+#ifndef USE_MULTIDROP
+    if(optBatch) {                                                  //The commit rides along, run only if the range matches
+        n += HostPutSub(subs + n, VERIFY_RANGE, 1, appBase, range, 7);
+        n += HostPutSub(subs + n, VERIFY_OK, 1, 0, NULL, 0);
+        batchRange = frameCount;
+        f = HostAddBatch(subs, n, ops);
+        if(ops > 2) {
+            f->timeout += SIM_US((simPageEraseUs + PAGE0_ROWS * simRowWriteUs) * 2);
+        }
+        HostAddReset();
+        return;
+    }
+#endif
+    HostAddFrame(VERIFY_RANGE, 1, appBase, range, 7);
+#ifndef USE_MULTIDROP
+    HostAddCommit();
+#endif
+}
+
+#ifdef USE_MULTIDROP
+//A unicast exchange with another node: the request, then its reply of replyLen bytes after turnUs
+static void HostAddPeer(BYTE node, BYTE cmd, WORD length, DWORD addr, const BYTE *data, int dataLen,
+                        int replyLen, uint64_t turnUs)
+{
+    HostFrame *f;
+    BYTE payload[16];
+    BYTE checksum = 0;
+    DWORD crc;
+    int n = 0;
+    int i;
+
+    busDest = node;
+    f = HostAddFrame(cmd, length, addr, data, dataLen);
+    f->hold = SIM_US(turnUs);
+    busDest = simNodeAddr;
+    busPeerFrames++;
+    if(replyLen == 0) {                                             //RESET, the node just leaves
+        return;
+    }
+
+    if(frameCount == HOST_MAX_FRAMES) {
+        fprintf(stderr, "bootsim: too many frames\n");
+        exit(2);
+    }
+    f = &frames[frameCount++];
+    memset(f, 0, sizeof(*f));
+    f->cmd = cmd;
+    f->seq = -1;
+    f->hold = 1;                                                    //Done once it is on the line
+
+    payload[n++] = node | NODE_REPLY;
+    payload[n++] = cmd;
+    while(n < 1 + replyLen) {                                       //Contents do not matter, only the time on the line
+        payload[n++] = 0;
+    }
+    if(optCrc && cmd != SESSION) {
+        crc = HostFrameCrc(payload, n, optCrc);
+        for(i = optCrc - 8; i >= 0; i -= 8) {
+            payload[n++] = (BYTE)(crc >> i);
+        }
+    } else {
+        for(i = 0; i < n; i++) {
+            checksum += payload[i];
+        }
+        payload[n++] = (BYTE)(~checksum + 1);
+    }
+    f->wire[f->wireLen++] = STX;
+    f->wire[f->wireLen++] = STX;
+    for(i = 0; i < n; i++) {
+        HostPutEscaped(f, payload[i]);
+    }
+    f->wire[f->wireLen++] = ETX;
+    busPeerFrames++;
+}
+
+static BYTE HostPeer(int k)
+{
+    return (BYTE)((simNodeAddr + k) % NODE_BROADCAST);
+}
+
+//SESSION and RD_VER to every other node, after this one
+static void HostBusOpen(const BYTE *options)
+{
+    int k;
+
+    for(k = 1; k < optNodes; k++) {
+        if(options) {
+            HostAddPeer(HostPeer(k), SESSION, 1, 0, options, 2, 9, HOST_PEER_TURN_US);
+        }
+        HostAddPeer(HostPeer(k), RD_VER, 2, 0, NULL, 0, 4, HOST_PEER_TURN_US);
+    }
+}
+
+//VERIFY_RANGE, VERIFY_OK and RESET to every other node, then this one is verified
+static void HostBusFinish(void)
+{
+    BYTE range[7] = {0};
+    int k;
+
+    for(k = 1; k < optNodes; k++) {
+        HostAddPeer(HostPeer(k), VERIFY_RANGE, 1, appBase, range, 7, 9,
+                    HOST_PEER_TURN_US + (uint64_t)optRows * HOST_PEER_CRC_US);
+        HostAddPeer(HostPeer(k), VERIFY_OK, 1, 0, NULL, 0, 1, HOST_PEER_TURN_US + HOST_PEER_COMMIT_US);
+        HostAddPeer(HostPeer(k), RD_VER, 0, 0, NULL, 0, 0, HOST_PEER_TURN_US);
+    }
+    HostAddFinish();
+}
+#endif
+
+#ifdef USE_JOURNAL
+static void HostAddJournal(BYTE options)
+{
+    BYTE data[5];
+    WORD n = (WORD)((MAX_DATA_SIZE - 13) / 3);
+
+    if(!optLarge && n > 255) {
+        n = 255;
+    }
+    journalQuery = !(options & JOURNAL_BEGIN);
+    data[0] = options;
+    data[1] = (BYTE)journalTag;
+    data[2] = (BYTE)(journalTag >> 8);
+    data[3] = (BYTE)(journalTag >> 16);
+    data[4] = (BYTE)(journalTag >> 24);
+    HostAddFrame(JOURNAL, n, (DWORD)journalRead, data, options & JOURNAL_BEGIN ? 5 : 1);
+}
+
+//Replays the journal: only the last entry may not have finished, its pages are erased again
+static void HostResume(void)
+{
+    static BYTE erased[HOST_MAX_PAGES];
+    static BYTE redo[HOST_MAX_PAGES];
+    static BYTE done[HOST_MAX_PAGES * PAGE0_ROWS];
+    HostFrame *f;
+    DWORD first = appBase / (PM_ROW_SIZE/2);
+    DWORD end = imageEnd / (PM_ROW_SIZE/2);
+    DWORD type, row, n, r, p, q;
+    int k;
+
+    journalStartOver = journalCapacity == 0 || journalCount >= journalCapacity || journalDeviceTag != journalTag;
+    if(journalStartOver) {
+        HostAddJournal(JOURNAL_BEGIN);                              //Nothing recorded can be trusted, begin again
+    }
+    for(k = 0; k < journalCount && !journalStartOver; k++) {
+        type = journal[k] >> 22;
+        row = (journal[k] >> 11) & JOURNAL_MAX_ROWS;
+        n = journal[k] & JOURNAL_MAX_ROWS;
+        for(r = row; r < row + n && r < HOST_MAX_PAGES * PAGE0_ROWS; r++) {
+            p = r / PAGE0_ROWS;
+            if(type == JOURNAL_ERASE || (type == JOURNAL_WRITE && k == journalCount - 1)) {
+                erased[p] = type == JOURNAL_ERASE && k != journalCount - 1;
+                memset(done + p * PAGE0_ROWS, 0, PAGE0_ROWS);
+            } else if(type == JOURNAL_WRITE) {
+                done[r] = 1;
+            }
+        }
+    }
+
+    for(p = first / PAGE0_ROWS; p * PAGE0_ROWS < end; p++) {        //Rows left to send need a page known to be blank
+        for(r = p * PAGE0_ROWS; r < (p + 1) * PAGE0_ROWS && r < end && done[r]; r++) {
+        }
+        redo[p] = !erased[p] && r < (p + 1) * PAGE0_ROWS && r < end;
+        if(redo[p]) {
+            memset(done + p * PAGE0_ROWS, 0, PAGE0_ROWS);           //Erased again, the whole page goes
+        }
+    }
+    for(p = first / PAGE0_ROWS; p * PAGE0_ROWS < end; p = q) {      //Erase in runs
+        for(q = p; q * PAGE0_ROWS < end && redo[q]; q++) {
+        }
+        if(q > p) {
+            f = HostAddFrame(ER_FLASH, (WORD)(q - p), p * (PM_PAGE_SIZE/2), NULL, 0);
+            f->timeout += SIM_US((uint64_t)f->length * simPageEraseUs * 2);
+            journalPagesErased += q - p;
+        } else {
+            q = p + 1;
+        }
+    }
+    for(r = first; r < end; r = q) {                                //Then the rows not finished, in runs
+        for(q = r; q < end && !done[q]; q++) {
+        }
+        if(q > r) {
+            HostAddRows(r * (PM_ROW_SIZE/2), rows + (PAGE0_ROWS + r - first) * PM_ROW_SIZE, (int)(q - r));
+            journalRowsSent += q - r;
+        } else {
+            q = r + 1;
+        }
+    }
+    HostAddFinish();
+}
+
+static void HostJournal(const HostEvent *e)
+{
+    int n;
+    int k;
+
+    if(!journalQuery) {
+        return;                                                     //JOURNAL_BEGIN, nothing to do with the reply
+    }
+    if(e->dataLen < 8) {
+        badResponses++;
+        return;
+    }
+    journalQuery = 0;
+    journalCount = e->data[0] | e->data[1] << 8;
+    journalCapacity = e->data[2] | e->data[3] << 8;
+    journalDeviceTag = (e->data[4] | (DWORD)e->data[5] << 8) | (e->data[6] | (DWORD)e->data[7] << 8) << 16;
+    n = (e->dataLen - 8) / 3;
+    for(k = 0; k < n && journalRead < JOURNAL_WORDS; k++) {
+        journal[journalRead++] = e->data[8+3*k] | (DWORD)e->data[9+3*k] << 8 | (DWORD)e->data[10+3*k] << 16;
+    }
+    if(journalRead < journalCount && n > 0) {
+        HostAddJournal(0);
+    } else {
+        HostResume();
+    }
+}
+
+//Power lost halfway into the NVM stall of frame optCut, or when the --pty host goes away, the
+//flash as it was left goes to optFlash
+static void HostPowerCut(uint64_t now)
+{
+    FILE *fp = fopen(optFlash, "wb");
+    DWORD w;
+    int entries = 0;
+
+    SimPowerCut();
+    if(fp == NULL || fwrite(simFlash, sizeof(simFlash), 1, fp) != 1) {
+        perror(optFlash);
+        exit(2);
+    }
+    fclose(fp);
+    for(w = JOURNAL_ADDR/2 + 2; w < JOURNAL_ADDR/2 + JOURNAL_WORDS && simFlash[w] != 0xFFFFFF; w++) {
+        entries++;
+    }
+    if(optPty) {
+        printf("bootsim: host went away, power cut at %.3f s, flash saved to %s\n", (double)now / SIM_FCY, optFlash);
+    } else {
+        printf("bootsim: %d rows, power cut in frame %d of %d at %.3f s, flash saved to %s\n", optRows, optCut, frameCount,
+                (double)now / SIM_FCY, optFlash);
+        printf("  frames          %d acknowledged, %d retries\n", ackIdx, retries);
+    }
+    printf("  journal         %d entries\n", entries);
+    fflush(stdout);
+    exit(0);
+}
+#endif
+
+static void HostCrcMap(const HostEvent *e)
+{
+    DWORD pages[BATCH_MAX_OPS];
+    DWORD crc;
+    WORD i;
+    int count = 0;
+
+    for(i = 0; i + 4 <= e->dataLen && mapPage < mapEnd; i += 4, mapPage++) {
+        crc = e->data[i] | (DWORD)e->data[i+1] << 8 | (DWORD)e->data[i+2] << 16 | (DWORD)e->data[i+3] << 24;
+        if(crc == HostCrc32(mapPage * (PM_PAGE_SIZE/2), PM_PAGE_SIZE)) {
+            continue;
+        }
+        if(!optBatch) {
+            HostAddPage(mapPage * (PM_PAGE_SIZE/2), 1);
+            continue;
+        }
+        pages[count++] = mapPage * (PM_PAGE_SIZE/2);
+        if(count == BATCH_MAX_OPS) {
+            HostAddPages(pages, count);
+            count = 0;
+        }
+    }
+    HostAddPages(pages, count);
+    if(mapPage < mapEnd) {
+        HostAddCrcMap();
+    } else {
+        HostAddFinish();
+    }
+}
+
+static DWORD HostAppWord(int r, int i)
+{
+    static DWORD code[256];
+    static DWORD table[32];
+    int k;
+
+    if(code[0] == 0) {                                              //Instruction words an application keeps reusing
+        for(k = 0; k < 256; k++) {
+            code[k] = (((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0xFFFF00) | 0x000001;
+        }
+        for(k = 0; k < 32; k++) {
+            table[k] = ((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0x00FFFF;
+        }
+    }
+
+    if(r < optRows * 55 / 100) {                                    //Code, operands vary, opcodes repeat
+        if(rand() % 8 == 0) {
+            return ((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0xFFFFFF;
+        }
+        k = rand() % 256;
+        return (code[rand() % (k + 1)] & 0xFFFF00) | (rand() % 16);
+    }
+    if(r < optRows * 70 / 100) {                                    //Constant tables, one entry per word
+        return table[(r * (PM_ROW_SIZE/4) + i) % 32] + (DWORD)(r % 4);
+    }
+    return 0xFFFFFF;                                                //Unused flash
+}
+
+static void HostLoadHex(void)
+{
+    FILE *fp = fopen(optHex, "r");
+    char line[600];
+    DWORD ext = 0;
+    DWORD byteAddr;
+    DWORD last = 0;
+    unsigned count, offset, type, data;
+    unsigned k;
+
+    if(fp == NULL) {
+        perror(optHex);
+        exit(2);
+    }
+    for(k = 0; k < SIM_FLASH_WORDS; k++) {
+        image[k] = 0xFFFFFF;
+    }
+    while(fgets(line, sizeof(line), fp)) {
+        if(line[0] != ':' || sscanf(line + 1, "%2x%4x%2x", &count, &offset, &type) != 3) {
+            continue;
+        }
+        if(type == 4 && sscanf(line + 9, "%4x", &data) == 1) {      //Extended linear address
+            ext = (DWORD)data << 16;
+        }
+        if(type != 0) {
+            continue;
+        }
+        for(k = 0; k < count && sscanf(line + 9 + 2*k, "%2x", &data) == 1; k++) {
+            byteAddr = ext + offset + k;                            //HEX addresses are 2x the PC, 4 bytes per instruction
+            if(byteAddr % 4 == 3 || byteAddr / 4 >= SIM_FLASH_WORDS - PM_PAGE_SIZE/4 || byteAddr / 2 < appBase) {
+                continue;                                           //Phantom byte, config page, page 0 and the bootloader
+            }
+            image[byteAddr / 4] &= ~(0xFFUL << (8 * (byteAddr % 4)));
+            image[byteAddr / 4] |= (DWORD)data << (8 * (byteAddr % 4));
+            if(byteAddr / 4 > last) {
+                last = byteAddr / 4;
+            }
+        }
+    }
+    fclose(fp);
+
+    if(last == 0) {
+        fprintf(stderr, "bootsim: %s has nothing above 0x%X\n", optHex, appBase);
+        exit(2);
+    }
+    optRows = (int)((last + 1 - appBase/2 + PM_ROW_SIZE/4 - 1) / (PM_ROW_SIZE/4));
+}
+
+static void HostAddSwitch(void)
+{
+    BYTE rate[4];
+    HostFrame *f;
+
+    rate[0] = (BYTE)optSwitch;
+    rate[1] = (BYTE)(optSwitch >> 8);
+    rate[2] = (BYTE)(optSwitch >> 16);
+    rate[3] = (BYTE)(optSwitch >> 24);
+    f = HostAddFrame(SET_BAUD, 1, 0, rate, 4);
+    f->barrier = 1;                                                 //The confirmation goes out alone, after the reply
+
+    f = &frames[frameCount++];
+    memset(f, 0, sizeof(*f));
+    f->cmd = SET_BAUD;
+    f->seq = -1;
+    f->raw = 1;
+    f->barrier = 1;
+    f->timeout = SIM_US(BAUD_CONFIRM_MS * 2000ULL);
+    memcpy(f->wire, switchConfirm, sizeof(switchConfirm));
+    f->wireLen = sizeof(switchConfirm);
+}
+
+static void HostHexRecord(FILE *fp, BYTE type, WORD offset, const BYTE *data, int count)
+{
+    BYTE sum = (BYTE)(count + (offset >> 8) + offset + type);
+    int k;
+
+    fprintf(fp, ":%02X%04X%02X", count, offset, type);
+    for(k = 0; k < count; k++) {
+        fprintf(fp, "%02X", data[k]);
+        sum += data[k];
+    }
+    fprintf(fp, "%02X\n", (BYTE)-sum);
+}
+
+//Writes the rows HostBuildSession made, blank words left out
+static void HostSaveHex(void)
+{
+    FILE *fp = fopen(optSaveHex, "w");
+    DWORD ext = 0xFFFFFFFF;
+    DWORD byteAddr;
+    BYTE upper[2];
+    BYTE *row;
+    int r, k;
+
+    if(fp == NULL) {
+        perror(optSaveHex);
+        exit(2);
+    }
+    for(r = -PAGE0_ROWS; r < optRows; r++) {
+        row = rows + (r + PAGE0_ROWS) * PM_ROW_SIZE;
+        byteAddr = 2 * ((r < 0) ? (DWORD)(r + PAGE0_ROWS) * (PM_ROW_SIZE/2) : appBase + (DWORD)r * (PM_ROW_SIZE/2));
+        for(k = 0; k < PM_ROW_SIZE; k += 16, byteAddr += 16) {
+            if(!memcmp(row + k, "\xFF\xFF\xFF\x00\xFF\xFF\xFF\x00\xFF\xFF\xFF\x00\xFF\xFF\xFF\x00", 16)) {
+                continue;
+            }
+            if(byteAddr >> 16 != ext) {
+                ext = byteAddr >> 16;
+                upper[0] = (BYTE)(ext >> 8);
+                upper[1] = (BYTE)ext;
+                HostHexRecord(fp, 0x04, 0, upper, 2);
+            }
+            HostHexRecord(fp, 0x00, (WORD)byteAddr, row + k, 16);
+        }
+    }
+    HostHexRecord(fp, 0x01, 0, NULL, 0);
+    fclose(fp);
+}
+
+static void HostBuildSession(void)
+{
+    BYTE *row;
+    BYTE options[2];
+    DWORD addr;
+    DWORD end;
+    DWORD w;
+    int r;
+    int i;
+    HostFrame *f;
+#ifdef USE_SIGN
+    BYTE hashAddr[3];
+#endif
+
+    srand(optSeed);
+    end = appBase + (DWORD)optRows * (PM_ROW_SIZE/2);
+    imageEnd = end;
+#ifdef USE_AES
+    AesInit();                                                      //The device's key, it runs this again when it starts
+    nonce[AES_NONCE_SIZE - 1] = (BYTE)optSeed;
+#endif
+#ifdef USE_SIGN
+    Sha256Init(&signHash);
+#endif
+
+    for(r = -PAGE0_ROWS; r < optRows; r++) {                        //Negative rows are page 0, blank but for the reset vector
+        addr = (r < 0) ? (DWORD)(r + PAGE0_ROWS) * (PM_ROW_SIZE/2) : appBase + (DWORD)r * (PM_ROW_SIZE/2);
+        row = rows + (r + PAGE0_ROWS) * PM_ROW_SIZE;
+        for(i = 0; i < PM_ROW_SIZE/4; i++) {
+            if(r < 0) {
+                w = (addr == 0 && i == 0) ? (0x040000 | appBase) : (addr == 0 && i == 1) ? 0x000000 :
+                    (addr + i*2 == DELAY_TIME_ADDR && !optNoDelay) ? HOST_DELAY : 0xFFFFFF;
+            } else {
+                if(optHex) {
+                    w = image[addr/2 + i];
+                } else if(optImageApp) {
+                    w = HostAppWord(r, i);
+                } else {
+                    w = ((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0xFFFFFF;
+                }
+                image[addr/2 + i] = w;
+                imageUsed[addr/2 + i] = 1;
+            }
+            row[i*4 + 0] = (BYTE)w;
+            row[i*4 + 1] = (BYTE)(w >> 8);
+            row[i*4 + 2] = (BYTE)(w >> 16);
+            row[i*4 + 3] = 0;
+        }
+#ifdef USE_AES
+        HostSeal(HostSealed(row), addr, row);
+#endif
+#ifdef USE_SIGN
+        hashAddr[0] = (BYTE)addr;                                   //Address low byte first, then the instructions
+        hashAddr[1] = (BYTE)(addr >> 8);
+        hashAddr[2] = (BYTE)(addr >> 16);
+        Sha256Update(&signHash, hashAddr, 3);
+        for(i = 0; i < PM_ROW_SIZE/4; i++) {
+            Sha256Update(&signHash, row + i*4, 3);
+        }
+#endif
+    }
+#ifdef USE_SIGN
+    HostSign();
+    if(!strcmp(optSign, "and") || !strcmp(optSign, "inject")) {
+        HostSignAttack(end);
+    }
+#endif
+#ifdef USE_JOURNAL
+    journalTag = HostCrc32(appBase, (end - appBase) * 2);
+#endif
+
+    if(optWindow || optLarge || optCrc || optCobs || optAutoErase) {
+        options[0] = (BYTE)(optWindow ? optWindow : 1);
+        options[1] = optLarge ? SESSION_LARGE : 0;
+        options[1] |= optCrc == 32 ? SESSION_CRC32 : optCrc == 16 ? SESSION_CRC16 : 0;
+        options[1] |= optCobs ? SESSION_COBS : 0;
+        options[1] |= optAutoErase ? SESSION_AUTO_ERASE : 0;
+        HostAddFrame(SESSION, 1, 0, options, 2);
+    }
+
+    HostAddFrame(RD_VER, 2, 0, NULL, 0);
+#ifdef USE_AES
+    HostAddFrame(SET_NONCE, AES_NONCE_SIZE, 0, nonce, AES_NONCE_SIZE);
+#endif
+#ifdef USE_SIGN
+    if(signAttackAddr) {                                            //Not hashed, no signature is open yet
+        f = HostAddFrame(WT_FLASH, 1, signAttackAddr, signAttack, PM_ROW_SIZE);
+        f->timeout += SIM_US((simRowWriteUs + HostAutoErase(signAttackAddr, 1) * simPageEraseUs) * 2);
+    }
+    if(strcmp(optSign, "none")) {
+        HostAddFrame(SIGNATURE, SIGN_SIZE, 0, signature, SIGN_SIZE);
+        memset(autoErased, 0, sizeof(autoErased));                  //So is the device's erased page bitmap
+    }
+#endif
+#ifdef USE_DUAL_SLOT
+    HostAddFrame(RD_SLOT, 1, 0, NULL, 0);
+#endif
+#ifdef USE_JOURNAL
+    if(journalResume) {                                             //The rest once the journal is in, see HostResume
+        HostAddJournal(0);
+        return;
+    }
+    HostAddJournal(JOURNAL_BEGIN);
+#endif
+#ifdef USE_MULTIDROP
+    HostBusOpen(optLarge || optCrc || optAutoErase ? options : NULL);
+    busDest = optNodes > 1 ? NODE_BROADCAST : simNodeAddr;          //Erase and rows once for every node, acked when alone
+#endif
+
+    if(optSwitch) {
+        HostAddSwitch();
+    }
+
+#ifdef USE_DUAL_SLOT
+    if(optPatch < 0 && !optAutoErase) {                             //Page 0 is the bootloader's, only the slot is erased
+        f = HostAddFrame(ER_FLASH, (BYTE)((end - appBase + PM_PAGE_SIZE/2 - 1) / (PM_PAGE_SIZE/2)), appBase, NULL, 0);
+        f->timeout += SIM_US((uint64_t)f->length * simPageEraseUs * 2);
+    }
+#elif defined(USE_SIGN)
+    HostAddSignErase(end);                                          //Pages past the image too, see Sign.c
+#else
+    if(optPatch < 0 && !optAutoErase) {                             //Or each page as the rows reach it
+        f = HostAddFrame(ER_FLASH, (BYTE)((end + PM_PAGE_SIZE/2 - 1) / (PM_PAGE_SIZE/2)), 0, NULL, 0);
+        f->timeout += SIM_US((uint64_t)f->length * simPageEraseUs * 2);
+        HostBusHold(f, (uint64_t)f->length * simPageEraseUs);
+    }
+#endif
+
+    if(optPatch < 0) {
+        HostAddRows(0, rows, PAGE0_ROWS);
+        HostAddRows(appBase, rows + PAGE0_ROWS * PM_ROW_SIZE, optRows);
+#ifdef USE_MULTIDROP
+        busDest = simNodeAddr;
+        HostBusFinish();
+#else
+        HostAddFinish();
+#endif
+#ifdef USE_DUAL_SLOT
+        if(optCut > 0 && optCut < frameCount) {                     //Link lost, the device is reset
+            frameCount = optCut;
+            HostAddFrame(RD_VER, 0, 0, NULL, 0);
+            for(w = appBase/2; w < (appBase + SLOT_SIZE)/2; w++) {
+                imageUsed[w] = 0;                                   //Half written, nothing to compare
+            }
+        } else {
+            slotExpect = appBase;
+        }
+#endif
+        return;
+    }
+
+    for(w = appBase/2; w < end/2; w++) {                            //The device already runs this image...
+        simFlash[w] = image[w];
+    }
+    for(i = 0; i < optPatch; i++) {                                 //...but for optPatch pages of the old release
+        w = appBase/2 + (DWORD)(rand() % ((optRows + PAGE0_ROWS - 1) / PAGE0_ROWS)) * (PM_PAGE_SIZE/4);
+        simFlash[w + rand() % (PM_PAGE_SIZE/4)] ^= 0x000100;
+    }
+#ifdef USE_DUAL_SLOT
+    slotExpect = appBase;
+#endif
+    mapPage = appBase / (PM_PAGE_SIZE/2);
+    mapEnd = (end + PM_PAGE_SIZE/2 - 1) / (PM_PAGE_SIZE/2);
+    HostAddCrcMap();
+}
+
+//Responses ************************************************************************
+static void HostRange(const HostEvent *e)
+{
+    DWORD crc;
+
+    if(e->dataLen < 4) {
+        badResponses++;
+        return;
+    }
+    crc = e->data[0] | (DWORD)e->data[1] << 8 | (DWORD)e->data[2] << 16 | (DWORD)e->data[3] << 24;
+    rangeMismatch = crc != rangeCrc;
+#ifdef USE_MULTIDROP
+    if(rangeMismatch && !busRepair) {                               //Missed part of the broadcast, rewrite what differs
+        busRepair = 1;
+        mapPage = appBase / (PM_PAGE_SIZE/2);
+        mapEnd = (imageEnd + PM_PAGE_SIZE/2 - 1) / (PM_PAGE_SIZE/2);
+        HostAddCrcMap();
+    } else {
+        HostAddCommit();
+    }
+#endif
+}
+
+//Results of a BATCH frame, the one at index i; a repeated ack has none
+static void HostBatch(const HostEvent *e, int i)
+{
+    const BYTE *r;
+    WORD k;
+
+    for(k = 0; (k + 1) * BATCH_RESULT_SIZE <= e->dataLen && k < frames[i].length; k++) {
+        r = e->data + k * BATCH_RESULT_SIZE;
+        if(r[0] == BATCH_SKIPPED) {
+            batchSkipped++;
+        } else if(r[0] != BATCH_OK) {
+            batchFailed++;
+        }
+        if(frames[i].subs[k] == ER_FLASH) {                         //The counts its own reply would carry
+            pagesErased += r[1] | r[2] << 8;
+            pagesSkipped += r[3] | r[4] << 8;
+        }
+    }
+    if(batchRange >= 0 && i == batchRange && e->dataLen >= frames[i].length * BATCH_RESULT_SIZE) {   //The range is next to last
+        rangeMismatch = e->data[(frames[i].length - 2) * BATCH_RESULT_SIZE] != BATCH_OK;
+    }
+}
+
+static void HostSwitch(const HostEvent *e)
+{
+    if(e->dataLen < 1 || e->data[0] != BAUD_SWITCHING) {
+        switchResult = 2;                                           //Refused, skip the confirmation
+        sendIdx = ++ackIdx;
+        return;
+    }
+    switchFromBitCycles = simHostBitCycles;
+    simHostBitCycles = SIM_FCY / (optSwitchHost ? optSwitchHost : optSwitch);
+}
+
+#ifdef USE_STATS
+static void HostStats(const HostEvent *e)
+{
+    int i;
+
+    if(e->dataLen < 1 + 4 * (STATS_COUNT + 1) || e->data[0] != STATS_COUNT) {
+        badResponses++;
+        return;
+    }
+    for(i = 0; i <= STATS_COUNT; i++) {
+        devStats[i] = e->data[1+4*i] | (DWORD)e->data[2+4*i] << 8 | (DWORD)e->data[3+4*i] << 16 |
+                      (DWORD)e->data[4+4*i] << 24;
+    }
+    devStatsRead = 1;
+}
+#endif
+
+#ifdef USE_DUAL_SLOT
+static void HostSlot(const HostEvent *e)
+{
+    if(e->dataLen < 8) {
+        badResponses++;
+        return;
+    }
+    slotReply = e->data[0];
+    slotReplyBase = e->data[2] | (DWORD)e->data[3] << 8 | (DWORD)e->data[4] << 16;
+}
+
+//Puts an image of rows rows into slot, with its record and the vector page, as a finished update leaves them
+static void HostSlotInstall(BYTE slot, int count)
+{
+    DWORD base = SLOT_BASE(slot);
+    DWORD end = base + (DWORD)count * (PM_ROW_SIZE/2);
+    DWORD record = SLOT_RECORD_ADDR/2 + (DWORD)slotRecords++ * (SLOT_ENTRY_SIZE/2);
+    DWORD crc;
+    DWORD w;
+    int i;
+
+    for(w = base/2; w < end/2; w++) {
+        image[w] = ((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0xFFFFFF;
+        imageUsed[w] = 1;                                           //Must come through the update untouched
+        simFlash[w] = image[w];
+    }
+    crc = HostCrc32(base, (end - base) * 2);
+    simFlash[record] = end;
+    simFlash[record + 1] = crc & 0xFFFF;
+    simFlash[record + 2] = crc >> 16;
+    simFlash[record + 3] = (DWORD)SLOT_MAGIC << 16 | HOST_DELAY << 8 | slot;
+    for(i = 0; i < SLOT_VECTORS; i++) {
+        simFlash[SLOT_VECTOR_ADDR/2 + 2*i] = 0x040000 | ((base + 4*i) & 0xFFFF);
+        simFlash[SLOT_VECTOR_ADDR/2 + 2*i + 1] = (base + 4*i) >> 16;
+    }
+}
+
+static void HostSlotSetup(void)
+{
+    DWORD w;
+
+    if(!strcmp(optSlot, "a")) {
+        HostSlotInstall(0, 64);
+        slotExpect = SLOT_A_BASE;
+    } else if(!strcmp(optSlot, "fallback")) {
+        HostSlotInstall(1, 64);
+        HostSlotInstall(0, 48);
+        simFlash[SLOT_A_BASE/2 + 100] ^= 0x000100;                  //Newer image damaged, B runs
+        for(w = SLOT_A_BASE/2; w < (SLOT_A_BASE + SLOT_SIZE)/2; w++) {
+            imageUsed[w] = 0;                                       //Overwritten by the update
+        }
+        slotExpect = SLOT_B_BASE;
+    } else {
+        slotExpect = BOOT_ADDR_LOW;                                 //Nothing runs yet
+    }
+}
+#endif
+
+#ifdef HOST_FAST_BOOT
+//An application from an earlier update: page 0 words, the image and its header, as VERIFY_OK leaves them
+static void HostBootSetup(void)
+{
+    DWORD end = appBase + HOST_BOOT_ROWS * (PM_ROW_SIZE/2);
+    DWORD crc;
+    DWORD w;
+
+    if(!strcmp(optBoot, "blank")) {
+        return;
+    }
+    srand(optSeed + 1);                                             //Not the image the update sends
+    for(w = appBase/2; w < end/2; w++) {
+        image[w] = ((DWORD)rand() ^ ((DWORD)rand() << 12)) & 0xFFFFFF;
+        simFlash[w] = image[w];
+    }
+    crc = HostCrc32(appBase, (end - appBase) * 2);
+    simFlash[0] = 0x040000 | BOOT_ADDR_LOW;
+    simFlash[USER_PROG_RESET/2] = appBase;
+    simFlash[DELAY_TIME_ADDR/2] = HOST_DELAY;
+    simFlash[APP_HEADER_ADDR/2] = appBase;
+    simFlash[APP_HEADER_ADDR/2 + 1] = end;
+    simFlash[APP_HEADER_ADDR/2 + 2] = crc & 0xFFFF;
+    simFlash[APP_HEADER_ADDR/2 + 3] = crc >> 16;
+    simFlash[APP_HEADER_ADDR/2 + 4] = APP_VALID;
+
+    if(!strcmp(optBoot, "damaged")) {
+        simFlash[appBase/2 + 100] ^= 0x000100;                      //Flash gone bad since, the header still says valid
+    } else if(!strcmp(optBoot, "magic")) {
+        bootMagic = BOOT_MAGIC;
+    } else if(!strcmp(optBoot, "break")) {
+        bootBreak = 1;
+    } else if(!strcmp(optBoot, "pin")) {
+        simBootPin = 1;
+    }
+}
+#endif
+
+#ifdef USE_JOURNAL
+//Power-up with the flash a cut left, see HostPowerCut; a blank device until there is one
+static void HostFlashLoad(void)
+{
+    FILE *fp = fopen(optFlash, "rb");
+
+    if(fp == NULL) {
+        return;
+    }
+    if(fread(simFlash, sizeof(simFlash), 1, fp) != 1) {
+        perror(optFlash);
+        exit(2);
+    }
+    fclose(fp);
+    journalResume = 1;
+}
+#endif
+
+static int HostFindSeq(BYTE seq)
+{
+    int i;
+
+    for(i = ackIdx; i < sendIdx; i++) {
+        if(frames[i].seq == seq) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void HostHandleEvent(const HostEvent *e)
+{
+    int i;
+
+    if(e->confirm) {
+        if(ackIdx < sendIdx && frames[ackIdx].raw) {
+            switchResult = 1;
+            lastProgress = e->at;
+            ackIdx++;
+        }
+        return;
+    }
+    if(!e->ok) {
+        badResponses++;
+        return;
+    }
+    if(e->cmd == WT_FLASH_LZ && e->status != LZ_OK) {
+        lzRejected++;                                               //Counted, the final verify shows the damage
+    }
+    if(e->cmd == ER_FLASH && e->dataLen >= 4) {                     //Repeated acks carry no counts
+        pagesErased += e->data[0] | e->data[1] << 8;
+        pagesSkipped += e->data[2] | e->data[3] << 8;
+    }
+
+    lastProgress = e->at;
+
+    if(e->cmd == SESSION) {
+        if(ackIdx >= sendIdx || frames[ackIdx].cmd != SESSION) {
+            badResponses++;
+            return;
+        }
+        if(optWindow && e->arg < 2) {
+            fprintf(stderr, "bootsim: device granted a window of %d\n", e->arg);
+            exit(1);
+        }
+        if(optLarge && !(e->arg2 & SESSION_LARGE)) {
+            fprintf(stderr, "bootsim: device refused large packets\n");
+            exit(1);
+        }
+        if(optCrc && !(e->arg2 & (optCrc == 32 ? SESSION_CRC32 : SESSION_CRC16))) {
+            fprintf(stderr, "bootsim: device refused CRC-%d frames\n", optCrc);
+            exit(1);
+        }
+        if(optCobs && !(e->arg2 & SESSION_COBS)) {
+            fprintf(stderr, "bootsim: device refused COBS framing\n");
+            exit(1);
+        }
+#ifdef USE_JOURNAL
+        if(optAutoErase && !(e->arg2 & SESSION_AUTO_ERASE) && !journalResume) {    //A resume erases what it needs itself
+#else
+        if(optAutoErase && !(e->arg2 & SESSION_AUTO_ERASE)) {
+#endif
+            fprintf(stderr, "bootsim: device refused auto erase\n");
+            exit(1);
+        }
+        if(optBatch && !(e->arg2 & SESSION_BATCH)) {
+            fprintf(stderr, "bootsim: device has no BATCH\n");
+            exit(1);
+        }
+#ifdef USE_AES
+        if(!(e->arg2 & SESSION_AES)) {
+            fprintf(stderr, "bootsim: device does not decrypt rows\n");
+            exit(1);
+        }
+#endif
+#ifdef USE_SIGN
+        if(!(e->arg2 & SESSION_SIGN)) {
+            fprintf(stderr, "bootsim: device does not check signatures\n");
+            exit(1);
+        }
+#endif
+        ahead = optWindow ? e->arg : optAhead;
+        sequenced = optWindow != 0;
+        ackIdx++;
+        return;
+    }
+
+    if(!sequenced) {                                                //AN851, answers arrive in order
+        if(ackIdx >= sendIdx || e->cmd != frames[ackIdx].cmd) {
+            badResponses++;
+            return;
+        }
+        ackIdx++;
+        if(e->cmd == SET_BAUD) {
+            HostSwitch(e);
+        }
+        if(e->cmd == RD_CRC_MAP) {
+            HostCrcMap(e);
+        }
+        if(e->cmd == VERIFY_RANGE) {
+            HostRange(e);
+        }
+        if(e->cmd == BATCH) {
+            HostBatch(e, ackIdx - 1);
+        }
+#ifdef USE_STATS
+        if(e->cmd == RD_STATS) {
+            HostStats(e);
+        }
+#endif
+#ifdef USE_DUAL_SLOT
+        if(e->cmd == RD_SLOT) {
+            HostSlot(e);
+        }
+#endif
+#ifdef USE_JOURNAL
+        if(e->cmd == JOURNAL) {
+            HostJournal(e);
+        }
+#endif
+        return;
+    }
+
+    i = HostFindSeq(e->seq);
+    if(i < 0) {
+        staleAcks++;                                                //Repeated ack or NAK for a frame already handled
+        return;
+    }
+    if(e->cmd == SEQ_NAK) {
+        naks++;
+        ackIdx = i;                                                 //Everything before the gap arrived
+        goBack = i;
+        return;
+    }
+    if(e->cmd != frames[i].cmd) {
+        badResponses++;
+        return;
+    }
+    ackIdx = i + 1;                                                 //Cumulative
+    if(e->cmd == SET_BAUD && frames[ackIdx].raw) {
+        HostSwitch(e);
+    }
+    if(e->cmd == RD_CRC_MAP && i == frameCount - 1) {               //A map reply resent after a NAK is only used once
+        HostCrcMap(e);
+    }
+    if(e->cmd == VERIFY_RANGE) {
+        HostRange(e);
+    }
+    if(e->cmd == BATCH) {
+        HostBatch(e, i);
+    }
+#ifdef USE_STATS
+    if(e->cmd == RD_STATS) {
+        HostStats(e);
+    }
+#endif
+#ifdef USE_DUAL_SLOT
+    if(e->cmd == RD_SLOT) {
+        HostSlot(e);
+    }
+#endif
+#ifdef USE_JOURNAL
+    if(e->cmd == JOURNAL && i == frameCount - 1) {                  //As the CRC map, a resent reply is only used once
+        HostJournal(e);
+    }
+#endif
+}
+
+static void HostProcessEvents(uint64_t now)
+{
+    while(eventTail != eventHead && events[eventTail].at <= now) {
+        HostHandleEvent(&events[eventTail]);
+        eventTail = (eventTail + 1) % HOST_MAX_EVENTS;
+    }
+}
+
+static void HostResponse(uint64_t now)
+{
+    HostEvent *e = &events[eventHead];
+    BYTE checksum = 0;
+    int trailer = (optCrc && rxLen > HOST_ADDR_BYTES && rxFrame[HOST_ADDR_BYTES] != SESSION) ? optCrc / 8 : 1;
+    int i;
+
+    for(i = 0; i < rxLen; i++) {
+        checksum += rxFrame[i];
+    }
+    if(trailer > 1) {
+        checksum = rxLen < 1 + trailer || HostFrameCrc(rxFrame, rxLen, optCrc) != 0;
+        rxLen -= trailer - 1;                                       //Parsed below as if it had a checksum
+    }
+#ifdef USE_MULTIDROP
+    if(rxLen < 1 || rxFrame[0] != (BYTE)(simNodeAddr | NODE_REPLY)) {
+        checksum = 1;                                               //Not from this node
+    }
+    if(rxLen > 0) {
+        memmove(rxFrame, rxFrame + 1, --rxLen);
+    }
+#endif
+
+    memset(e, 0, sizeof(*e));
+    e->at = now + SIM_US(optLatencyUs);
+    e->ok = checksum == 0 && rxLen >= 2;
+    e->cmd = rxFrame[0];
+    if(rxLen == 3 + (sequenced ? 1 : 0)) {                          //Command, status, seq, checksum
+        e->status = rxFrame[1];                                     //A repeated ack for a duplicate has no status
+    }
+    e->arg = (rxLen > 6) ? rxFrame[5] : 0;
+    e->arg2 = (rxLen > 7) ? rxFrame[6] : 0;
+    if(rxLen >= 3) {
+        e->seq = rxFrame[rxLen - 2];
+    }
+    if(e->cmd == RD_CRC_MAP || e->cmd == VERIFY_RANGE || e->cmd == ER_FLASH || e->cmd == SET_BAUD || e->cmd == RD_STATS ||
+       e->cmd == RD_SLOT || e->cmd == JOURNAL || e->cmd == BATCH) {
+        i = rxLen - 1 - (sequenced ? 1 : 0) - (optLarge ? 6 : 5);  //Less command, length, address, seq and checksum
+        e->dataLen = (i > 0) ? (WORD)i : 0;
+        memcpy(e->data, rxFrame + (optLarge ? 6 : 5), e->dataLen);
+    }
+
+    eventHead = (eventHead + 1) % HOST_MAX_EVENTS;
+    if(eventHead == eventTail) {
+        fprintf(stderr, "bootsim: response queue overflow\n");
+        exit(2);
+    }
+}
+
+//Line model ***********************************************************************
+void SimHostUpdate(uint64_t now)
+{
+    HostFrame *f;
+
+    if(optPty) {
+        SimPtyUpdate(now);
+#ifdef USE_JOURNAL
+        if(optFlash && SimPtyClosed()) {
+            HostPowerCut(now);                                      //Link dropped, the board goes with it
+        }
+#endif
+        return;
+    }
+
+    HostProcessEvents(now);
+
+#ifdef USE_JOURNAL
+    if(optCut > 0 && sendIdx >= optCut && frames[optCut - 1].sentAt &&
+       now >= frames[optCut - 1].sentAt + SIM_US((frames[optCut - 1].cmd == ER_FLASH ? simPageEraseUs : simRowWriteUs) / 2)) {
+        HostPowerCut(now);
+    }
+#endif
+
+    if(ackIdx < sendIdx && goBack < 0) {                            //RESET is resent until the device leaves
+        f = &frames[ackIdx];
+        if(f->hold) {
+            if(f->sentAt && now >= f->sentAt + f->hold) {
+                lastProgress = now;
+                ackIdx++;
+            }
+            return;
+        }
+        if(f->raw && f->sentAt && now > f->sentAt + f->timeout) {
+            switchResult = 0;                                       //No echo, the device went back to BAUDRATE
+            simHostBitCycles = switchFromBitCycles;
+            lastProgress = now;
+            ackIdx++;
+            return;
+        }
+        if(f->sentAt && now > (f->sentAt > lastProgress ? f->sentAt : lastProgress) + f->timeout + SIM_US(optLatencyUs)) {
+            retries++;
+            if(retries > 100) {
+                fprintf(stderr, "bootsim: giving up after %d retries\n", retries);
+                exit(1);
+            }
+            goBack = ackIdx;                                        //Resend everything not acknowledged
+        }
+    }
+
+    if(now > SIM_US(600ULL * 1000000)) {
+        fprintf(stderr, "bootsim: 10 simulated minutes elapsed, device never reset\n");
+        exit(1);
+    }
+}
+
+int SimHostTxByte(uint64_t now)
+{
+    HostFrame *f;
+    BYTE data;
+
+    if(optPty) {
+        return SimPtyTxByte(now);
+    }
+
+#ifdef HOST_FAST_BOOT
+    if(now < SIM_US(BOOT_BREAK_US + 10000)) {                       //Power-up: silent while the device looks for a break
+        return bootBreak ? SIM_BREAK : -1;
+    }
+#endif
+    HostProcessEvents(now);
+
+    if(sendPos == 0) {
+        if(goBack >= 0) {
+            sendIdx = goBack;
+            goBack = -1;
+        }
+        if(sendIdx >= frameCount || sendIdx - ackIdx >= (ackIdx == 0 && (optWindow || optLarge || optCrc || optCobs || optAutoErase) ? 1 : ahead)) {
+            return -1;
+        }
+        if(sendIdx > ackIdx && (frames[sendIdx - 1].barrier || frames[sendIdx].raw)) {
+            return -1;
+        }
+        if(frames[sendIdx].raw && frames[sendIdx].sentAt) {
+            return -1;                                              //Confirmation is sent once, never retried
+        }
+    }
+
+    f = &frames[sendIdx];
+    if(sendPos == 0 && f->cobs && txStx) {
+        sendPos = 1;                                                //The last frame's closing STX opens this one
+    }
+    data = f->wire[sendPos++];
+    if(f->swapAt && !f->sentAt && (sendPos - 1 == f->swapAt || sendPos - 1 == f->swapAt + 1)) {
+        data = f->wire[sendPos - 1 == f->swapAt ? f->swapAt + 1 : f->swapAt];
+    }
+    txStx = (data == STX);
+    if(sendPos == f->wireLen) {
+        f->sentAt = now + SimHostByteCycles();
+        sendPos = 0;
+        sendIdx++;
+    }
+    return data;
+}
+
+void SimHostRxByte(BYTE data, uint64_t now)
+{
+    HostEvent *e;
+
+    if(optPty) {
+        SimPtyRxByte(data);
+        return;
+    }
+
+    if(ackIdx < sendIdx && frames[ackIdx].raw) {                    //Waiting for the confirmation echo
+        switchMatch = (data == switchConfirm[switchMatch]) ? switchMatch + 1 : (data == switchConfirm[0]);
+        if(switchMatch == sizeof(switchConfirm)) {
+            switchMatch = 0;
+            rxState = 0;                                            //The device starts afresh at the new rate
+            e = &events[eventHead];
+            memset(e, 0, sizeof(*e));
+            e->at = now + SIM_US(optLatencyUs);
+            e->confirm = 1;
+            eventHead = (eventHead + 1) % HOST_MAX_EVENTS;
+        }
+        return;
+    }
+    if(rxState == 0) {                                              //Waiting for the first STX
+        rxState = (data == STX) ? 1 : 0;
+        return;
+    }
+    if(rxState == 1) {                                              //Second STX
+        rxState = (data == STX) ? 2 : 0;
+        rxLen = 0;
+        rxEscape = 0;
+        if(data != STX && optCobs) {                                //A code byte, COBS frame
+            rxState = 3;
+            rxCobsLeft = (data ^ STX) - 1;
+            rxCobsImplied = rxCobsLeft != 254;
+        }
+        return;
+    }
+    if(rxState == 3) {
+        if(data == STX) {                                           //End of the frame, start of the next
+            if(rxCobsLeft != 0) {
+                rxLen = 0;                                          //Cut off, a bad response
+            }
+            HostResponse(now);
+            rxState = 1;
+        } else if(rxCobsLeft == 0) {
+            if(rxCobsImplied && rxLen < (int)sizeof(rxFrame)) {
+                rxFrame[rxLen++] = STX;
+            }
+            rxCobsLeft = (data ^ STX) - 1;
+            rxCobsImplied = rxCobsLeft != 254;
+        } else {
+            rxCobsLeft--;
+            if(rxLen < (int)sizeof(rxFrame)) {
+                rxFrame[rxLen++] = data;
+            }
+        }
+        return;
+    }
+
+    if(!rxEscape) {
+        if(data == STX) {
+            rxLen = 0;
+            return;
+        }
+        if(data == ETX) {
+            HostResponse(now);
+            rxState = 0;
+            return;
+        }
+        if(data == DLE) {
+            rxEscape = 1;
+            return;
+        }
+    }
+    rxEscape = 0;
+    if(rxLen < (int)sizeof(rxFrame)) {
+        rxFrame[rxLen++] = data;
+    }
+}
+
+//Report ***************************************************************************
+void SimHostFinish(WORD addr)
+{
+    double secs = (double)simCycles / SIM_FCY;
+    DWORD i;
+    DWORD bad = 0;
+#ifdef USE_DUAL_SLOT
+    DWORD entry;
+    BYTE nextDelay;
+#endif
+#ifdef HOST_FAST_BOOT
+    int nextFast = 0;
+    uint64_t nextCycles = 0;
+#endif
+    double kbytes = optRows * (PM_ROW_SIZE * 3.0 / 4.0) / 1024.0;
+
+    if(optPty) {
+        SimPtyFinish(addr);
+        exit(0);
+    }
+
+    if(powerUpAt) {                                                 //Nobody on the line, the entry delay ran out
+        secs = (double)(simCycles - powerUpAt) / SIM_FCY;
+#ifdef HOST_FAST_BOOT
+        bad = addr != powerUpEntry || secs >= expectDelay;          //The header it verified skips the delay
+#else
+        bad = addr != powerUpEntry || secs < expectDelay;
+#endif
+        printf("  power-up        bootloader waited %.3f s, then reset to 0x%06X\n", secs, addr);
+        printf("  verify          %s\n", bad ? "FAILED" : "OK");
+        fflush(stdout);
+        exit(bad ? 1 : 0);
+    }
+
+#ifdef HOST_FAST_BOOT
+    if(!strcmp(optBoot, "app")) {                                   //Nothing may have kept the device from the application
+        bad = ackIdx != 0 || addr != appBase;
+        printf("bootsim: valid application at power-up, %s\n", ackIdx ? "bootloader stayed" : "no frames exchanged");
+        printf("  fast boot       application at 0x%06X after %.3f ms\n", addr, secs * 1000);
+        printf("  verify          %s\n", bad ? "FAILED" : "OK");
+        fflush(stdout);
+        exit(bad ? 1 : 0);
+    }
+#endif
+
+    HostProcessEvents(~0ULL);                                       //Replies still on their way when the device left
+
+    for(i = 0; i < SIM_FLASH_WORDS; i++) {
+        if(imageUsed[i] && simFlash[i] != image[i]) {
+            bad++;
+        }
+    }
+#ifdef USE_DUAL_SLOT
+    entry = slotExpect == BOOT_ADDR_LOW ? BOOT_ADDR_LOW : SLOT_VECTOR_ADDR; //Slots are entered through the vector page
+    if(simFlash[0] != (0x040000 | BOOT_ADDR_LOW) || addr != entry || slotReply < 0 || slotReplyBase != appBase) {
+        bad++;                                                      //Bootloader entry lost, wrong slot or a target the host did not expect
+    }
+    if(entry != BOOT_ADDR_LOW && (simFlash[SLOT_VECTOR_ADDR/2] != (0x040000 | (slotExpect & 0xFFFF)) ||
+       simFlash[SLOT_VECTOR_ADDR/2 + 1] != slotExpect >> 16)) {
+        bad++;                                                      //Vector page must lead to the slot expected
+    }
+    writeKey1 = 0xFFFF;                                             //Power cycle, as far as SlotBoot cares
+    writeKey2 = 0x5555;
+    nextDelay = SlotBoot();
+    if(userReset.Val != entry || activeSlot != (entry == BOOT_ADDR_LOW ? SLOT_NONE : slotExpect != SLOT_A_BASE) ||
+       (entry != BOOT_ADDR_LOW && nextDelay != expectDelay)) {
+        bad++;                                                      //The next boot must agree, delay included
+    }
+#else
+    if(simFlash[0] != (0x040000 | BOOT_ADDR_LOW) || simFlash[USER_PROG_RESET/2] != appBase) {
+        bad++;                                                      //Bootloader entry or saved user reset lost
+    }
+#ifdef USE_SIGN
+    if(simFlash[DELAY_TIME_ADDR/2] != (rangeMismatch || optPartial || signRefused ? 0xFFFFFF : expectDelay)) {
+#else
+    if(simFlash[DELAY_TIME_ADDR/2] != (rangeMismatch || optPartial ? 0xFFFFFF : expectDelay)) {
+#endif
+        bad++;                                                      //VERIFY_OK must commit the delay only after a match over every row
+    }
+#ifdef USE_JOURNAL
+    if(!rangeMismatch && !optPartial && simFlash[JOURNAL_ADDR/2] != 0xFFFFFF) {
+        bad++;                                                      //VERIFY_OK must close the journal
+    }
+#endif
+#ifdef HOST_FAST_BOOT
+    if(simFlash[APP_HEADER_ADDR/2 + 4] != (rangeMismatch ? 0xFFFFFF : APP_VALID) || (!rangeMismatch &&
+       (simFlash[APP_HEADER_ADDR/2] != appBase || simFlash[APP_HEADER_ADDR/2 + 1] != imageEnd ||
+        simFlash[APP_HEADER_ADDR/2 + 2] != (rangeCrc & 0xFFFF) || simFlash[APP_HEADER_ADDR/2 + 3] != rangeCrc >> 16))) {
+        bad++;                                                      //Header must name the verified image, and only then
+    }
+    if(bootMagic != 0) {
+        bad++;                                                      //The request is for one boot only
+    }
+    bootBreak = 0;                                                  //Next power-up, nobody asking for the bootloader
+    simBootPin = 0;
+    nextCycles = simCycles;
+    nextFast = !BootRequested() && AppValid();
+    nextCycles = simCycles - nextCycles;
+    if(nextFast == rangeMismatch) {
+        bad++;
+    }
+#endif
+#endif
+
+    printf("bootsim: %d rows, %lu baud, %s %d%s%s%s, %ld us latency, %s UART\n",
+            optRows, (unsigned long)(SIM_FCY / SimByteCycles() * 10),
+            sequenced ? "window" : "ahead", ahead, optLarge ? ", large packets" : "",
+            optCrc == 32 ? ", CRC-32" : optCrc == 16 ? ", CRC-16" : "", optCobs ? ", COBS" : "", optLatencyUs,
+    #ifdef USE_UART_ISR
+            "interrupt driven");
+    #else
+            "polled");
+    #endif
+    printf("  elapsed         %.3f s, %.2f KiB/s of image\n", secs, kbytes / secs);
+    printf("  frames          %d sent, %d acknowledged, %d retries, %d NAKs, %d stale acks, %d bad responses\n",
+            frameCount, ackIdx, retries, naks, staleAcks, badResponses);
+    printf("  host -> device  %llu bytes, %llu lost to overrun, %llu arrived during NVM stalls\n",
+            (unsigned long long)simStats.rxBytes, (unsigned long long)simStats.rxLost,
+            (unsigned long long)simStats.rxDuringNvm);
+    printf("  device -> host  %llu bytes\n", (unsigned long long)simStats.txBytes);
+    printf("  nvm             %llu operations, %.3f s busy, %llu words programmed without an erase\n",
+            (unsigned long long)simStats.nvmOps, (double)simStats.nvmCycles / SIM_FCY,
+            (unsigned long long)simStats.nvmOverwrites);
+    printf("  interrupts      %llu rx, %llu tx\n",
+            (unsigned long long)simStats.rxIsr, (unsigned long long)simStats.txIsr);
+#ifdef USE_STATS
+    if(devStatsRead) {                                              //As the device counted them, up to RD_STATS
+        printf("  device stats    %lu bytes in, %lu out, %lu/%lu escapes, %lu bad checksums, %lu commands\n",
+                (unsigned long)devStats[1], (unsigned long)devStats[2], (unsigned long)devStats[3],
+                (unsigned long)devStats[4], (unsigned long)devStats[5], (unsigned long)devStats[12]);
+        printf("                  %.3f s waiting for bytes, %.3f s in %lu NVM operations, %lu OERR, %lu FERR/PERR, %lu ring overflows\n",
+                (double)devStats[6] / devStats[0], (double)devStats[7] / devStats[0], (unsigned long)devStats[8],
+                (unsigned long)devStats[9], (unsigned long)devStats[10], (unsigned long)devStats[11]);
+#ifdef USE_AES
+        printf("                  %lu AES blocks, %lu rows' worth\n", (unsigned long)devStats[13],
+                (unsigned long)devStats[13] / AES_ROW_BLOCKS);
+#endif
+    }
+#endif
+    if(optSwap) {
+        printf("  swap            %d frames sent with two bytes swapped\n", swapFrames);
+    }
+    if(optSwitch) {
+        printf("  baud switch     %s\n",
+                switchResult < 0 ? "not attempted" : switchResult == 2 ? "rate refused" : switchResult ? "confirmed" : "fell back to BAUDRATE");
+    }
+    printf("  erase           %ld pages erased, %ld blank pages skipped\n", pagesErased, pagesSkipped);
+    if(optAutoErase) {
+        printf("  auto erase      %ld pages reached by a write frame first, no ER_FLASH for them\n", autoErasePages);
+    }
+    if(optBatch) {
+        printf("  batch           %d frames, %d sub-commands, %d failed, %d skipped\n", batchFrames, batchOps,
+                batchFailed, batchSkipped);
+    }
+    if(optLz) {
+        printf("  lz              %ld rows in %ld frames, %ld stream bytes for %ld bytes of rows (%.1f%%), %d rejected\n",
+                lzRows, lzFrames, lzBytes, lzRows * PM_ROW_SIZE, 100.0 * lzBytes / (lzRows * PM_ROW_SIZE), lzRejected);
+    }
+    if(optPatch >= 0) {
+        printf("  patch           %d of %lu pages rewritten after the CRC map\n", pagesWritten,
+                (unsigned long)(mapEnd - appBase / (PM_PAGE_SIZE/2)));
+    }
+    printf("  verify range    %s%s\n", rangeMismatch < 0 ? "no reply" : rangeMismatch ? "digest MISMATCH" : "digest matches",
+            optPartial ? ", half the image only" : "");
+    if(optPartial) {
+        printf("  commit          VERIFY_OK %s\n", simFlash[DELAY_TIME_ADDR/2] == expectDelay ? "committed" : "refused");
+    }
+#ifdef USE_SIGN
+    printf("  signature       %s, VERIFY_OK %s\n", !strcmp(optSign, "none") ? "not sent" : optSign,
+            simFlash[DELAY_TIME_ADDR/2] == expectDelay ? "committed" : "refused");
+#endif
+    printf("  reset to        0x%06X\n", addr);
+#ifdef USE_DUAL_SLOT
+    printf("  slots           %s beforehand, active %s, update to 0x%06lX%s, next boot runs %s\n", optSlot,
+            slotReply == 0 ? "A" : slotReply == 1 ? "B" : "none", (unsigned long)slotReplyBase,
+            optCut ? " cut short" : "", activeSlot == 0 ? "A" : activeSlot == 1 ? "B" : "the bootloader");
+#endif
+#ifdef USE_MULTIDROP
+    printf("  bus             node %d, one of %d, %d broadcast frames, %d frames to or from the others, %s\n", simNodeAddr, optNodes,
+            busBroadcasts, busPeerFrames, busRepair ? "pages rewritten after the broadcast" : "broadcast complete");
+    printf("                  %llu bytes cut off by the driver enable, %llu missed while driving\n",
+            (unsigned long long)simStats.txUndriven, (unsigned long long)simStats.rxWhileDriving);
+#endif
+#ifdef USE_JOURNAL
+    if(journalResume) {
+        printf("  journal         %d of %d entries%s, tag %s, %s: %d pages erased again, %d of %d rows sent again\n",
+                journalRead, journalCount, journalCount == journalCapacity ? " (full)" : "",
+                journalDeviceTag == journalTag ? "matches" : "differs",
+                journalStartOver ? "started over" : "resumed", journalPagesErased, journalRowsSent, optRows);
+    }
+#endif
+#ifdef HOST_FAST_BOOT
+    printf("  fast boot       %s beforehand, next power-up %s after %.3f ms\n", optBoot,
+            nextFast ? "runs the application" : "stays in the bootloader", (double)nextCycles * 1000 / SIM_FCY);
+#endif
+    printf("  verify          %s (%lu words wrong)\n", bad ? "FAILED" : "OK", (unsigned long)bad);
+
+    fflush(stdout);
+    if(optNoDelay && !bad) {
+        powerUpAt = simCycles;                                      //Power-on reset, and no frames from here on
+        powerUpEntry = addr;
+        frameCount = sendIdx = ackIdx = 0;
+        RCON = 0x0003;
+#ifdef USE_STATS
+        statsClock = 0;                                             //Cleared at start-up, as all RAM the entry path reads
+#endif
+        BootLoader();
+    }
+    exit(bad ? 1 : 0);
+}
+
+//Main *****************************************************************************
+static void Usage(void)
+{
+    fprintf(stderr, "usage: bootsim [--rows N] [--baud B] [--ahead N] [--window N] [--large] [--latency US] [--timeout MS] [--seed S] [--patch P]\n"
+                    "              [--lz] [--image random|app] [--hex FILE] [--switch RATE] [--switch-host RATE] [--nvm ROW,PAGE,WORD]\n"
+                    "              [--save-hex FILE] [--crc 16|32] [--swap N] [--cobs] [--auto-erase] [--batch] [--no-delay]\n"
+                    "              [--partial]\n"
+#ifdef HOST_FAST_BOOT
+                    "              [--boot blank|app|damaged|magic|break|pin]\n"
+#endif
+#ifdef USE_MULTIDROP
+                    "              [--node N] [--nodes K]\n"
+#endif
+#ifdef USE_JOURNAL
+                    "              [--cut N] [--flash FILE]\n"
+#endif
+#ifdef USE_SIGN
+                    "              [--sign good|bad|none|and|inject]\n"
+#endif
+#ifdef USE_DUAL_SLOT
+                    "              [--slot none|a|fallback] [--cut N]\n"
+                    "       bootsim --pty [--baud B] [--nvm ROW,PAGE,WORD] [--slot none|a|fallback]\n");
+#else
+                    "       bootsim --pty [--baud B] [--nvm ROW,PAGE,WORD]\n");
+#endif
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(i + 1 >= argc && strcmp(argv[i], "--large") && strcmp(argv[i], "--lz") && strcmp(argv[i], "--pty") &&
+           strcmp(argv[i], "--cobs") && strcmp(argv[i], "--auto-erase") && strcmp(argv[i], "--batch") &&
+           strcmp(argv[i], "--no-delay") && strcmp(argv[i], "--partial")) {
+            Usage();
+        }
+        if(!strcmp(argv[i], "--rows")) {
+            optRows = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--baud")) {
+            optBaud = atol(argv[++i]);
+        } else if(!strcmp(argv[i], "--ahead")) {
+            optAhead = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--large")) {
+            optLarge = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--window")) {
+            optWindow = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--latency")) {
+            optLatencyUs = atol(argv[++i]);
+        } else if(!strcmp(argv[i], "--timeout")) {
+            optTimeoutMs = atol(argv[++i]);
+        } else if(!strcmp(argv[i], "--lz")) {
+            optLz = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--cobs")) {
+            optCobs = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--auto-erase")) {
+            optAutoErase = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--batch")) {
+            optBatch = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--no-delay")) {
+            optNoDelay = 1;
+            expectDelay = DEFAULT_DELAY;
+            continue;
+        } else if(!strcmp(argv[i], "--partial")) {
+            optPartial = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--pty")) {
+            optPty = 1;
+            continue;
+        } else if(!strcmp(argv[i], "--nvm")) {
+            if(!SimSetNvm(argv[++i])) {
+                Usage();
+            }
+        } else if(!strcmp(argv[i], "--image")) {
+            i++;
+            if(strcmp(argv[i], "app") && strcmp(argv[i], "random")) {
+                Usage();
+            }
+            optImageApp = !strcmp(argv[i], "app");
+        } else if(!strcmp(argv[i], "--hex")) {
+            optHex = argv[++i];
+        } else if(!strcmp(argv[i], "--save-hex")) {
+            optSaveHex = argv[++i];
+        } else if(!strcmp(argv[i], "--patch")) {
+            optPatch = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--switch")) {
+            optSwitch = atol(argv[++i]);
+        } else if(!strcmp(argv[i], "--switch-host")) {
+            optSwitchHost = atol(argv[++i]);
+        } else if(!strcmp(argv[i], "--crc")) {
+            optCrc = atoi(argv[++i]);
+            if(optCrc != 16 && optCrc != 32) {
+                Usage();
+            }
+        } else if(!strcmp(argv[i], "--swap")) {
+            optSwap = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--seed")) {
+            optSeed = (unsigned)atol(argv[++i]);
+#ifdef USE_DUAL_SLOT
+        } else if(!strcmp(argv[i], "--slot")) {
+            optSlot = argv[++i];
+            if(strcmp(optSlot, "none") && strcmp(optSlot, "a") && strcmp(optSlot, "fallback")) {
+                Usage();
+            }
+#endif
+#if (defined(USE_DUAL_SLOT) || defined(USE_JOURNAL))
+        } else if(!strcmp(argv[i], "--cut")) {
+            optCut = atoi(argv[++i]);
+#endif
+#ifdef USE_JOURNAL
+        } else if(!strcmp(argv[i], "--flash")) {
+            optFlash = argv[++i];
+#endif
+#ifdef USE_MULTIDROP
+        } else if(!strcmp(argv[i], "--node")) {
+            simNodeAddr = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "--nodes")) {
+            optNodes = atoi(argv[++i]);
+#endif
+#ifdef USE_SIGN
+        } else if(!strcmp(argv[i], "--sign")) {
+            optSign = argv[++i];
+            if(strcmp(optSign, "good") && strcmp(optSign, "bad") && strcmp(optSign, "none") && strcmp(optSign, "and") &&
+               strcmp(optSign, "inject")) {
+                Usage();
+            }
+            signRefused = strcmp(optSign, "good") != 0;
+#endif
+#ifdef HOST_FAST_BOOT
+        } else if(!strcmp(argv[i], "--boot")) {
+            optBoot = argv[++i];
+            if(strcmp(optBoot, "blank") && strcmp(optBoot, "app") && strcmp(optBoot, "damaged") &&
+               strcmp(optBoot, "magic") && strcmp(optBoot, "break") && strcmp(optBoot, "pin")) {
+                Usage();
+            }
+#endif
+        } else {
+            Usage();
+        }
+    }
+#ifdef USE_DUAL_SLOT
+    appBase = SLOT_BASE(!strcmp(optSlot, "a"));                     //The slot not running
+    if(strcmp(optSlot, "none")) {
+        expectDelay = HOST_DELAY;                                   //The slot record keeps the delay it had
+    }
+#endif
+    if(optHex) {
+        HostLoadHex();
+    }
+    if(optRows < 1 || optAhead < 1 || optWindow < 0 || optWindow > 255 ||
+       appBase/2 + (DWORD)optRows * (PM_ROW_SIZE/4) > SIM_FLASH_WORDS - PM_PAGE_SIZE/4 ||
+#ifdef USE_DUAL_SLOT
+       (DWORD)optRows * (PM_ROW_SIZE/2) > SLOT_SIZE || optCut < 0 ||
+#endif
+       optSwitch < 0 || optSwitchHost < 0 || (optSwitch && optBaud) || optSwap < 0) {
+        Usage();
+    }
+#ifndef USE_LARGE_PACKETS
+    if(optLarge) {
+        Usage();
+    }
+#endif
+#ifndef USE_LZ
+    if(optLz) {
+        Usage();
+    }
+#endif
+#ifndef USE_BAUD_SWITCH
+    if(optSwitch) {
+        Usage();
+    }
+#endif
+#ifndef USE_FRAME_CRC
+    if(optCrc) {
+        Usage();
+    }
+#endif
+#ifndef USE_COBS
+    if(optCobs) {
+        Usage();
+    }
+#endif
+#ifndef USE_AUTO_ERASE
+    if(optAutoErase) {
+        Usage();
+    }
+#endif
+#ifndef USE_BATCH
+    if(optBatch) {
+        Usage();
+    }
+#endif
+    if(optPartial && (optPatch >= 0 || optNoDelay)) {
+        Usage();                                                    //Page ranges check every row, and nothing is committed to power up with
+    }
+#if (defined(USE_DUAL_SLOT) || defined(USE_MULTIDROP) || defined(HOST_FAST_BOOT))
+    if(optPartial) {
+        Usage();                                                    //Slot, bus and header checks expect the whole image verified
+    }
+#endif
+#ifdef USE_JOURNAL
+    if((optCut && optFlash == NULL) || optCut < 0 || optPatch >= 0) {
+        Usage();
+    }
+#endif
+#ifdef USE_SIGN
+    if(optPatch >= 0 || (!strcmp(optSign, "and") && optAutoErase) ||
+       (!strcmp(optSign, "inject") && (appBase + (DWORD)optRows * (PM_ROW_SIZE/2) - 1) / (PM_PAGE_SIZE/2) + 1 >= AUTO_ERASE_PAGES - 1)) {
+        Usage();                                                    //The injected row needs a page past the image
+    }
+#endif
+#ifdef USE_MULTIDROP
+    if(simNodeAddr < 0 || simNodeAddr >= NODE_BROADCAST || optNodes < 1 || optNodes > NODE_BROADCAST ||
+       optWindow || optAhead > 1 || optCobs || optSwitch || optPatch >= 0) {
+        Usage();                                                    //Stop and wait, a reply at a time on the bus
+    }
+    busDest = simNodeAddr;
+#endif
+
+    ahead = optAhead;
+    if(optBaud > 0) {
+        simBitCycles = SIM_FCY / optBaud;                           //Both ends run at the forced rate
+    }
+    if(optSwitch) {
+        simHostBitCycles = SIM_FCY / BAUDRATE;                      //The host follows SET_BAUD, the device its BRG
+    }
+
+    SimInit();
+#ifdef USE_DUAL_SLOT
+    HostSlotSetup();
+#endif
+#ifdef USE_JOURNAL
+    if(optFlash) {
+        HostFlashLoad();
+    }
+#endif
+#ifdef HOST_FAST_BOOT
+    HostBootSetup();
+#endif
+    if(optPty) {
+        SimPtyOpen();
+    } else {
+        HostBuildSession();
+    }
+    if(optSaveHex) {
+        HostSaveHex();
+        return 0;
+    }
+    BootLoader();
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Greedy LZ compressor producing the stream Lz.c decodes: sequences of
+ * token, literals, 2 byte offset, with 15 in a token nibble extended by
+ * bytes of 255 up to the first smaller one. Matches are found through a
+ * hash of the next 3 bytes and a chain of earlier positions, limited to
+ * the decoder's LZ_WINDOW_SIZE.
+ */
+
+#include <string.h>
+#include "SimLz.h"
+#include "BootLoader.h"
+
+#ifndef USE_LZ                                                      //SimHost.c refuses --lz without it
+#define LZ_WINDOW_SIZE          1
+#endif
+
+#define LZ_MIN_MATCH        3
+#define LZ_HASH_BITS        12
+#define LZ_MAX_CHAIN        64                                      //Positions tried per match search
+
+typedef struct {
+    uint8_t *dst;
+    long len;
+    long capacity;
+} LzOut;
+
+static void LzPut(LzOut *o, uint8_t data)
+{
+    if(o->len < o->capacity) {
+        o->dst[o->len] = data;
+    }
+    o->len++;                                                       //Keep counting so the caller sees how much was needed
+}
+
+static void LzPutLength(LzOut *o, long length)
+{
+    length -= 15;
+    while(length >= 255) {
+        LzPut(o, 255);
+        length -= 255;
+    }
+    LzPut(o, (uint8_t)length);
+}
+
+static void LzSequence(LzOut *o, const uint8_t *literals, long litLen, long offset, long matchLen)
+{
+    long m = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    long i;
+
+    LzPut(o, (uint8_t)(((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15)));
+    if(litLen >= 15) {
+        LzPutLength(o, litLen);
+    }
+    for(i = 0; i < litLen; i++) {
+        LzPut(o, literals[i]);
+    }
+    if(matchLen) {
+        LzPut(o, (uint8_t)offset);
+        LzPut(o, (uint8_t)(offset >> 8));
+        if(m >= 15) {
+            LzPutLength(o, m);
+        }
+    }
+}
+
+static unsigned LzHash(const uint8_t *p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Compresses length bytes into dst. Returns the compressed size, which is
+ * larger than capacity (and dst incomplete) when it did not fit.
+ */
+long SimLzCompress(const uint8_t *src, long length, uint8_t *dst, long capacity)
+{
+    static long head[1 << LZ_HASH_BITS];
+    static long prev[LZ_WINDOW_SIZE];
+    LzOut o = { dst, 0, capacity };
+    long pos = 0;
+    long anchor = 0;                                                //First literal not yet sent
+    long best;
+    long bestOffset;
+    long cand;
+    long n;
+    int chain;
+    unsigned h;
+
+    memset(head, 0xFF, sizeof(head));                               //-1, no earlier position
+
+    while(pos < length) {
+        best = 0;
+        bestOffset = 0;
+        if(pos + LZ_MIN_MATCH <= length) {
+            h = LzHash(src + pos);
+            cand = head[h];
+            for(chain = 0; cand >= 0 && pos - cand <= LZ_WINDOW_SIZE && chain < LZ_MAX_CHAIN; chain++) {
+                for(n = 0; pos + n < length && src[cand + n] == src[pos + n]; n++)
+                    ;                                               //Overlapping matches are fine, the decoder copies bytewise
+                if(n > best) {
+                    best = n;
+                    bestOffset = pos - cand;
+                }
+                cand = prev[cand & (LZ_WINDOW_SIZE - 1)];
+            }
+        }
+
+        if(best < LZ_MIN_MATCH) {
+            best = 1;                                               //Literal
+        } else {
+            LzSequence(&o, src + anchor, pos - anchor, bestOffset, best);
+        }
+
+        for(n = 0; n < best; n++, pos++) {                          //Every position goes into the chains
+            if(pos + LZ_MIN_MATCH <= length) {
+                h = LzHash(src + pos);
+                prev[pos & (LZ_WINDOW_SIZE - 1)] = head[h];
+                head[h] = pos;
+            }
+        }
+        if(best >= LZ_MIN_MATCH) {
+            anchor = pos;
+        }
+    }
+
+    if(anchor < length) {
+        LzSequence(&o, src + anchor, length - anchor, 0, 0);        //Last sequence is literals only
+    }
+    return o.len;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pty end of the simulated UART for bootsim --pty. Real host tools open
+ * the pty and drive the bootloader through the simulator's line timing,
+ * FIFOs, NVM stalls and flash. The simulated clock is held to the wall
+ * clock, never ahead of it, so a tool measures what it would on a board.
+ * The clock stands still until the pty is first opened.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include "Sim.h"
+#include "SimPty.h"
+
+#define PTY_BUF_SIZE        4096
+#define PTY_GONE_CHECKS     4                                       //2 ms for the device to act on the last bytes
+
+static int ptyFd = -1;
+static BYTE inBuf[PTY_BUF_SIZE];                                    //Written by the host, not yet on the line
+static int inPos;
+static int inLen;
+static BYTE outBuf[PTY_BUF_SIZE];                                   //Off the line, not yet read by the host
+static int outLen;
+static int opened;                                                  //Host has opened the pty
+static int goneChecks;                                              //Checks in a row that found it closed, all read
+static uint64_t wallBase;                                           //Wall clock in ns when simCycles was cyclesBase
+static uint64_t cyclesBase;
+static uint64_t nextCheck;                                          //Next simulated time to compare with the wall clock
+static uint64_t nextRead;
+static uint64_t bytesIn;
+static uint64_t bytesOut;
+
+static uint64_t PtyNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int PtyHostThere(void)
+{
+    struct pollfd p;
+
+    p.fd = ptyFd;
+    p.events = 0;
+    return poll(&p, 1, 0) >= 0 && !(p.revents & POLLHUP);          //HUP while no process has the slave open
+}
+
+static int PtyHostGone(void)
+{
+    struct pollfd p;
+
+    p.fd = ptyFd;
+    p.events = POLLIN;
+    return poll(&p, 1, 0) >= 0 && (p.revents & POLLHUP) && !(p.revents & POLLIN) && inPos == inLen;
+}
+
+static void PtyFlush(void)
+{
+    ssize_t n;
+
+    if(outLen == 0) {
+        return;
+    }
+    n = write(ptyFd, outBuf, outLen);
+    if(n < 0) {
+        if(errno == EAGAIN) {
+            return;
+        }
+        n = outLen;                                                 //Host gone, the bytes are lost as on a line
+    }
+    memmove(outBuf, outBuf + n, outLen - n);
+    outLen -= (int)n;
+}
+
+void SimPtyOpen(void)
+{
+    struct termios tio;
+    int slave;
+
+    ptyFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(ptyFd < 0 || grantpt(ptyFd) < 0 || unlockpt(ptyFd) < 0) {
+        perror("bootsim: pty");
+        exit(2);
+    }
+    slave = open(ptsname(ptyFd), O_RDWR | O_NOCTTY);                //Raw mode is a property of the slave side
+    if(slave < 0 || tcgetattr(slave, &tio) < 0) {
+        perror("bootsim: pty");
+        exit(2);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    close(slave);
+    fcntl(ptyFd, F_SETFL, O_NONBLOCK);
+
+    printf("bootsim: device on %s\n", ptsname(ptyFd));
+    fflush(stdout);
+}
+
+void SimPtyUpdate(uint64_t now)
+{
+    uint64_t due;
+    uint64_t wall;
+    struct timespec ts;
+
+    if(now < nextCheck) {
+        return;
+    }
+    nextCheck = now + SIM_US(500);
+    PtyFlush();
+    goneChecks = opened && PtyHostGone() ? goneChecks + 1 : 0;
+
+    if(!opened) {
+        while(!PtyHostThere()) {                                    //Power up when the host connects
+            usleep(10000);
+        }
+        opened = 1;
+        wallBase = PtyNowNs();
+        cyclesBase = now;
+        return;
+    }
+
+    due = wallBase + (now - cyclesBase) * 1000000000ULL / SIM_FCY;
+    wall = PtyNowNs();
+    if(due > wall) {                                                //Ahead of the wall clock, wait for it
+        ts.tv_sec = (due - wall) / 1000000000ULL;
+        ts.tv_nsec = (due - wall) % 1000000000ULL;
+        nanosleep(&ts, NULL);
+    }
+}
+
+int SimPtyTxByte(uint64_t now)
+{
+    ssize_t n;
+
+    if(inPos == inLen) {
+        if(now < nextRead) {                                        //At most one read per character time
+            return -1;
+        }
+        nextRead = now + SimHostByteCycles();
+        n = read(ptyFd, inBuf, sizeof(inBuf));
+        if(n <= 0) {
+            return -1;
+        }
+        inPos = 0;
+        inLen = (int)n;
+        bytesIn += n;
+    }
+    return inBuf[inPos++];
+}
+
+void SimPtyRxByte(BYTE data)
+{
+    if(outLen == PTY_BUF_SIZE) {
+        PtyFlush();
+        if(outLen == PTY_BUF_SIZE) {
+            return;                                                 //Host not reading, overrun on its side
+        }
+    }
+    outBuf[outLen++] = data;
+    bytesOut++;
+}
+
+int SimPtyClosed(void)
+{
+    return goneChecks > PTY_GONE_CHECKS;
+}
+
+void SimPtyFinish(WORD addr)
+{
+    while(outLen != 0 && PtyHostThere()) {
+        PtyFlush();
+    }
+    printf("bootsim: reset to 0x%06X after %.3f s, %llu bytes in, %llu bytes out\n",
+            addr, (double)(simCycles - cyclesBase) / SIM_FCY, (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+    printf("  host -> device  %llu lost to overrun, %llu arrived during NVM stalls\n",
+            (unsigned long long)simStats.rxLost, (unsigned long long)simStats.rxDuringNvm);
+    printf("  nvm             %llu operations, %.3f s busy, %llu words programmed without an erase\n",
+            (unsigned long long)simStats.nvmOps, (double)simStats.nvmCycles / SIM_FCY,
+            (unsigned long long)simStats.nvmOverwrites);
+    fflush(stdout);
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host transport: linked in place of TransportUart.c to build bootpty,
+ * which runs the protocol core over a pty or a Unix socket instead of the
+ * simulated UART. Flash and timers are still the simulator's, and while
+ * the device waits for input the simulated clock follows the wall clock,
+ * so the entry timeout behaves as on a board. Any AN851 host tool can open
+ * the pty; the process exits when the bootloader resets to the user code.
+ *
+ * usage: bootpty [--socket PATH] [--nvm ROW,PAGE,WORD]
+ *
+ * Without --socket a pty is opened and its name printed. The clock only
+ * runs while the host holds it open, or while it is connected to PATH.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Sim.h"
+#include "BootLoader.h"
+#include "Transport.h"
+
+#define HOST_WAIT_MS        1                                       //Longest TransportRead blocks for
+
+static const char *optSocket;
+static int linkFd = -1;
+static int listenFd = -1;
+static uint64_t bytesIn;
+static uint64_t bytesOut;
+
+static void HostFatal(const char *what)
+{
+    fprintf(stderr, "bootpty: %s: %s\n", what, strerror(errno));
+    exit(2);
+}
+
+static uint64_t HostNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void HostAccept(void)
+{
+    if(linkFd >= 0) {
+        close(linkFd);
+    }
+    linkFd = accept(listenFd, NULL, NULL);                          //Blocks, the clock stops with no host
+    if(linkFd < 0) {
+        HostFatal("accept");
+    }
+    fcntl(linkFd, F_SETFL, O_NONBLOCK);
+}
+
+//Waits for input, returns 0 if no host is there to send any
+static int HostWait(int events)
+{
+    struct pollfd p;
+    uint64_t start = HostNowNs();
+
+    p.fd = linkFd;
+    p.events = events;
+    if(poll(&p, 1, HOST_WAIT_MS) < 0 && errno != EINTR) {
+        HostFatal("poll");
+    }
+    if(p.revents & (POLLHUP | POLLERR)) {
+        if(optSocket) {
+            HostAccept();                                           //Host went away, wait for the next
+        } else {
+            usleep(10000);                                          //Nobody has the pty open
+        }
+        return 0;
+    }
+    simCycles += (HostNowNs() - start) * SIM_FCY / 1000000000ULL;
+    return 1;
+}
+
+//Transport ************************************************************************
+void TransportInit(void)
+{
+    struct sockaddr_un addr;
+    struct termios tio;
+    int slave;
+
+    if(optSocket) {
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listenFd < 0) {
+            HostFatal("socket");
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, optSocket, sizeof(addr.sun_path) - 1);
+        unlink(optSocket);
+        if(bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 1) < 0) {
+            HostFatal(optSocket);
+        }
+        printf("bootpty: listening on %s\n", optSocket);
+        fflush(stdout);
+        HostAccept();
+        return;
+    }
+
+    linkFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(linkFd < 0 || grantpt(linkFd) < 0 || unlockpt(linkFd) < 0) {
+        HostFatal("pty");
+    }
+    slave = open(ptsname(linkFd), O_RDWR | O_NOCTTY);               //Raw mode is a property of the slave side
+    if(slave < 0 || tcgetattr(slave, &tio) < 0) {
+        HostFatal(ptsname(linkFd));
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    close(slave);
+    fcntl(linkFd, F_SETFL, O_NONBLOCK);
+    printf("bootpty: device on %s\n", ptsname(linkFd));
+    fflush(stdout);
+}
+
+WORD TransportRead(BYTE *data, WORD length)
+{
+    ssize_t n;
+
+    n = read(linkFd, data, length);
+    if(n > 0) {
+        bytesIn += n;
+        return (WORD)n;
+    }
+    if(n == 0 && optSocket) {
+        HostAccept();
+        return 0;
+    }
+    HostWait(POLLIN);
+    return 0;
+}
+
+void TransportWrite(BYTE *data, WORD length)
+{
+    ssize_t n;
+
+    while(length != 0) {
+        n = write(linkFd, data, length);
+        if(n > 0) {
+            bytesOut += n;
+            data += n;
+            length -= (WORD)n;
+        } else if(n < 0 && errno != EAGAIN && errno != EIO && errno != EPIPE) {
+            HostFatal("write");
+        } else if(!HostWait(POLLOUT)) {
+            return;                                                 //No host, the response is lost as on a line
+        }
+    }
+}
+
+void TransportFlush(void)
+{
+}
+
+void TransportClose(void)
+{
+}
+
+WORD TransportErrors(void)
+{
+    return 0;
+}
+
+BOOL TransportBreak(DWORD cycles)
+{
+    (void)cycles;
+    return FALSE;
+}
+
+void TransportDriver(BOOL on)
+{
+    (void)on;
+}
+
+//Simulator hooks, the simulated UART is not used ********************************
+void SimHostUpdate(uint64_t now)
+{
+    (void)now;
+}
+
+int SimHostTxByte(uint64_t now)
+{
+    (void)now;
+    return -1;
+}
+
+void SimHostRxByte(BYTE data, uint64_t now)
+{
+    (void)data;
+    (void)now;
+}
+
+void SimHostFinish(WORD addr)
+{
+    printf("bootpty: reset to 0x%06X after %.3f s, %llu bytes in, %llu bytes out, %llu nvm operations\n",
+            addr, (double)simCycles / SIM_FCY, (unsigned long long)bytesIn, (unsigned long long)bytesOut,
+            (unsigned long long)simStats.nvmOps);
+    fflush(stdout);
+}
+
+//Main *****************************************************************************
+int main(int argc, char **argv)
+{
+    int i;
+
+    signal(SIGPIPE, SIG_IGN);
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--socket") && i + 1 < argc) {
+            optSocket = argv[++i];
+        } else if(!strcmp(argv[i], "--nvm") && i + 1 < argc && SimSetNvm(argv[i + 1])) {
+            i++;
+        } else {
+            fprintf(stderr, "usage: bootpty [--socket PATH] [--nvm ROW,PAGE,WORD]\n");
+            return 2;
+        }
+    }
+
+    SimInit();
+    BootLoader();                                                   //Opens the link through TransportInit
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2011 Redslate Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * - Neither the name of the copyright holders nor the names of
+ *   its contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Host stand-in for the XC16 device header. Special function registers
+ * the bootloader touches are plain variables or accessor calls into the
+ * simulator (Sim.c), which advances a virtual instruction clock, models
+ * the UART FIFOs and line timing, Timer2/3 and the flash controller, and
+ * dispatches the bootloader interrupt handlers.
+ */
+
+#ifndef SIM_P24FXXXX_H
+#define SIM_P24FXXXX_H
+
+#include "GenericTypeDefs.h"
+
+#define __PIC24F__              1
+#define __PIC24FJ256GB206__     1
+#define SIM_HOST                1                                   //Building for the host simulator
+
+#define BL_ISR                                                      //Handlers are called by the simulator
+#define BL_PERSISTENT                                               //bootMagic is a plain variable SimHost.c can set
+#define BOOT_PIN_ACTIVE()           (simBootPin != 0)               //The board strap, see --boot pin
+#define RS485_DE                    simDriverEnable                 //Transceiver pins, see SimUartUpdate
+#define RS485_DE_TRIS               simDriverTris
+#define NODE_ADDRESS_PINS()         simNodeAddr                     //--node
+
+//Instruction and builtin stand-ins ************************************************
+#ifndef SIM_BENCH
+#define asm(...)                    SimStep(SIM_LOOP_CYCLES)
+#define Nop()                       SimStep(1)
+#else
+#define asm(...)                    ((void)0)                       //framebench times the firmware's code alone
+#define Nop()                       ((void)0)
+#endif
+#define __builtin_tblrdl(a)         SimTblRead((a), 0)
+#define __builtin_tblrdh(a)         SimTblRead((a), 1)
+#define __builtin_tblwtl(a,d)       SimTblWrite((a), (d), 0)
+#define __builtin_tblwth(a,d)       SimTblWrite((a), (d), 1)
+#define __builtin_write_NVM()       SimWriteNVM()
+#define __builtin_write_OSCCONL(v)  (OSCCON = (v))
+#define __builtin_tbladdress(f)     SimTblAddress((void (*)(void))(f))
+
+#define SIM_LOOP_CYCLES             8                               //Cost of one pass through a clrwdt polling loop
+#define SIM_SFR_CYCLES              2                               //Cost of one polled SFR read
+
+//Register layouts *****************************************************************
+typedef union {
+    WORD Val;
+    struct {
+        WORD URXDA:1;
+        WORD OERR:1;
+        WORD FERR:1;
+        WORD PERR:1;
+        WORD RIDLE:1;
+        WORD ADDEN:1;
+        WORD URXISEL:2;
+        WORD TRMT:1;
+        WORD UTXBF:1;
+        WORD UTXEN:1;
+        WORD UTXBRK:1;
+        WORD :1;
+        WORD UTXISEL0:1;
+        WORD UTXINV:1;
+        WORD UTXISEL1:1;
+    } bits;
+} SIM_UxSTA;
+
+typedef struct {
+    WORD STSEL:1;
+    WORD PDSEL:2;
+    WORD BRGH:1;
+    WORD URXINV:1;
+    WORD ABAUD:1;
+    WORD LPBACK:1;
+    WORD WAKE:1;
+    WORD UEN:2;
+    WORD :1;
+    WORD RTSMD:1;
+    WORD IREN:1;
+    WORD USIDL:1;
+    WORD :1;
+    WORD UARTEN:1;
+} SIM_UxMODEBITS;
+
+typedef struct { WORD WR:1; WORD WREN:1; WORD WRERR:1; } SIM_NVMCONBITS;
+typedef struct { WORD TON:1; WORD T32:1; WORD TCKPS:2; } SIM_TxCONBITS;
+typedef struct { WORD T1IF:1; WORD T2IF:1; WORD T3IF:1; } SIM_IFS0BITS;
+typedef struct { WORD T1IE:1; WORD T2IE:1; WORD T3IE:1; } SIM_IEC0BITS;
+typedef struct { WORD U3ERIF:1; WORD U3RXIF:1; WORD U3TXIF:1; } SIM_IFS5BITS;
+typedef struct { WORD U3ERIE:1; WORD U3RXIE:1; WORD U3TXIE:1; } SIM_IEC5BITS;
+typedef struct { WORD U3ERIP:3; WORD U3RXIP:3; WORD U3TXIP:3; } SIM_IPC20BITS;
+typedef struct { WORD ALTIVT:1; } SIM_INTCON2BITS;
+typedef struct { WORD IPL:3; } SIM_SRBITS;
+typedef struct { WORD U3RXR:6; } SIM_RPINR17BITS;
+typedef struct { WORD RP29R:6; } SIM_RPOR14BITS;
+
+typedef union {
+    WORD Val;
+    struct {
+        WORD :3;
+        WORD LENDIAN:1;
+        WORD CRCGO:1;
+        WORD CRCISEL:1;
+        WORD CRCMPT:1;
+        WORD CRCFUL:1;
+        WORD VWORD:5;
+        WORD CSIDL:1;
+        WORD :1;
+        WORD CRCEN:1;
+    } bits;
+} SIM_CRCCON1;
+
+typedef struct { WORD PLEN:5; WORD :3; WORD DWIDTH:5; } SIM_CRCCON2BITS;
+
+//Registers ************************************************************************
+extern WORD TBLPAG;
+extern WORD NVMCON;
+extern WORD RCON;
+extern int simBootPin;
+extern int simDriverEnable, simDriverTris, simNodeAddr;
+extern WORD OSCCON;
+extern WORD PR1, TMR1, PR2, PR3, TMR3, TMR3HLD;
+extern SIM_TxCONBITS T1CONbits, T2CONbits;
+extern SIM_IEC0BITS IEC0bits;
+extern SIM_IEC5BITS IEC5bits;
+extern SIM_IPC20BITS IPC20bits;
+extern SIM_INTCON2BITS INTCON2bits;
+extern SIM_SRBITS SRbits;
+extern SIM_RPINR17BITS RPINR17bits;
+extern SIM_RPOR14BITS RPOR14bits;
+extern WORD U3BRG;
+extern SIM_UxMODEBITS U3MODEbits;
+extern SIM_CRCCON2BITS CRCCON2bits;
+extern WORD CRCXORL, CRCXORH;
+
+SIM_UxSTA *SimUxSTA(void);
+WORD SimUxRXREG(void);
+WORD *SimUxTXREG(void);
+SIM_NVMCONBITS *SimNVMCONbits(void);
+SIM_IFS0BITS *SimIFS0bits(void);
+SIM_IFS5BITS *SimIFS5bits(void);
+WORD *SimTMR2(void);
+SIM_CRCCON1 *SimCRCCON1(void);
+WORD *SimCRCDATL(void);
+WORD *SimCRCWDAT(BYTE high);
+
+#define U3STA           (SimUxSTA()->Val)
+#define U3STAbits       (SimUxSTA()->bits)
+#define U3RXREG         SimUxRXREG()
+#define U3TXREG         (*SimUxTXREG())
+#define NVMCONbits      (*SimNVMCONbits())
+#define IFS0bits        (*SimIFS0bits())
+#define IFS5bits        (*SimIFS5bits())
+#define TMR2            (*SimTMR2())
+#define CRCCON1         (SimCRCCON1()->Val)
+#define CRCCON1bits     (SimCRCCON1()->bits)
+#define CRCDATL         (*SimCRCDATL())
+#define CRCWDATL        (*SimCRCWDAT(0))
+#define CRCWDATH        (*SimCRCWDAT(1))
+
+//Simulator hooks ******************************************************************
+void SimStep(WORD cycles);
+WORD SimTblRead(WORD addrLo, BYTE high);
+void SimTblWrite(WORD addrLo, WORD data, BYTE high);
+void SimWriteNVM(void);
+DWORD SimTblAddress(void (*handler)(void));
+void SimResetDevice(WORD addr);
+
+#endif /*SIM_P24FXXXX_H*/